@@ -16,15 +16,46 @@ typedef struct array_tree_t {
 	array_iter key;
 	array_data data;
 	short height;
+	int refs;					/* number of trees sharing this node */
 } array_tree;
 
+/*
+ * Packed arrays are stored in a radix trie of ARRAY_VNODE_WIDTH-way nodes.
+ * Interior nodes hold children, leaves hold values.  Nodes are reference
+ * counted so that copies of an array can share all unchanged nodes.
+ */
+#define ARRAY_VNODE_BITS	5
+#define ARRAY_VNODE_WIDTH	(1 << ARRAY_VNODE_BITS)
+#define ARRAY_VNODE_MASK	(ARRAY_VNODE_WIDTH - 1)
+
+typedef struct array_vnode_t {
+	int refs;					/* number of parents sharing this node */
+	short used;					/* children or values in use */
+	short cap;					/* value slots allocated in a leaf */
+	union {
+		struct array_vnode_t *kids[ARRAY_VNODE_WIDTH];
+		array_data vals[1];		/* really cap entries long */
+	} u;
+} array_vnode;
+
+/*
+ * A packed array's valtype is the PROG_ type shared by all its items, so
+ * that array_is_homogenous() and the vector prims needn't check them one
+ * by one.  It is only a hint: once an array has held mixed items, it
+ * stays ARRAY_VALS_MIXED until it is emptied, whatever it holds.
+ */
+#define ARRAY_VALS_NONE		-1	/* no items */
+#define ARRAY_VALS_MIXED	-2	/* items of more than one type, maybe */
+
 typedef struct stk_array_t {
 	int links;					/* number of pointers  to array */
 	int items;					/* number of items in array */
 	short type;					/* type of array */
+	short valtype;				/* type of every packed item, if known */
 	int pinned;				/* if pinned, don't dup array on changes */
+	int shift;					/* bits indexed below the packed root */
 	union {
-		array_data *packed;		/* pointer to packed array */
+		array_vnode *packed;	/* root of packed array trie */
 		array_tree *dict;		/* pointer to dictionary AVL tree */
 	} data;
 } stk_array;
@@ -63,6 +94,7 @@ stk_array *array_demote_only(stk_array * arr, int threshold);
 void array_mash(stk_array * arr_in, stk_array ** mash, int value);
 
 int array_is_homogenous(stk_array * arr, int typ);
+int array_packed_run(stk_array * arr, int idx, array_data ** vals);
 
 int array_set_strkey(stk_array ** harr, const char *key, struct inst *val);
 
@@ -63,6 +63,140 @@
  */
 #define SPAWN_HOST_RESOLVER
 
+/*
+ * Look up hostnames and ident usernames with pools of threads inside the
+ * server itself, instead of with the fb-resolver process.  There are
+ * RESOLVER_DNS_THREADS threads doing reverse DNS lookups and
+ * RESOLVER_IDENT_THREADS threads doing ident queries, each pool with its
+ * own queue, and an ident query gives up after RESOLVER_IDENT_TIMEOUT
+ * seconds.  Hostnames are cached for HOST_CACHE_EXPIRE seconds, for up to
+ * HOST_CACHE_SIZE addresses.  This overrides SPAWN_HOST_RESOLVER.
+ */
+#define ASYNC_HOST_RESOLVER
+#define RESOLVER_DNS_THREADS 4
+#define RESOLVER_IDENT_THREADS 8
+#define RESOLVER_IDENT_TIMEOUT 15
+#define HOST_CACHE_SIZE 8192
+#define HOST_CACHE_EXPIRE 1800
+
+#ifdef ASYNC_HOST_RESOLVER
+#undef SPAWN_HOST_RESOLVER
+#endif
+
+/*
+ * Write the status, command, muf, sanity and gripe logs from a background
+ * thread, instead of opening and closing the logfile on every line.  Lines
+ * are formatted into a LOG_BUFFER_SIZE byte ring buffer, which the writer
+ * thread empties at least every LOG_FLUSH_MSECS milliseconds.  If the
+ * buffer fills up, loggers wait up to LOG_BACKPRESSURE_MSECS for room,
+ * and then drop the line.  Sending the server a SIGHUP makes it reopen
+ * its logfiles, for use with logrotate and the like.
+ */
+#define ASYNC_LOGGING
+#define LOG_BUFFER_SIZE 262144
+#define LOG_FLUSH_MSECS 250
+#define LOG_BACKPRESSURE_MSECS 50
+#define LOG_LINE_MAX 16384
+#define LOG_MAX_FILES 32
+
+/*
+ * Build in the sampling MUF profiler.  When a wizard turns it on with
+ * '@mufprofile on', the server samples the running MUF primitive, its
+ * line and its call stack MUF_PROFILE_HZ times per CPU second.  The
+ * hottest lines are shown by '@mufprofile top', and '@mufprofile dump'
+ * writes the call stacks to MUF_PROFILE_FILE in the folded format used
+ * by flamegraph tools.  Costs nothing while it is turned off.
+ */
+#define MUF_PROFILER
+#define MUF_PROFILE_HZ 100
+
+/*
+ * Keep counters and histograms of how long each pass of the main loop
+ * and each of its phases takes, how often select() wakes up, how many
+ * bytes go in and out, and how long the queues are.  They are served in
+ * the Prometheus text format on the localhost port given by '@tune
+ * metrics_port', and written every metrics_interval seconds to the file
+ * given by '@tune metrics_file'.  MUF can read them with METRICS.  Costs
+ * a few clock reads per pass of the main loop.
+ */
+#define MAIN_LOOP_METRICS
+
+/*
+ * Build in the sampling heap profiler.  While '@tune heap_sample_bytes'
+ * is set, about one in that many bytes allocated is sampled, and each
+ * sampled block is charged to the line that allocated it, to a type tag,
+ * to the MUF program that was running, and to the property tree being set.
+ * '@memory profile' writes the live samples to HEAP_PROFILE_FILE, keeping
+ * the dump before it, and '@memory profile diff' compares the two.  Unlike
+ * MALLOC_PROFILING it adds nothing to each block, and costs a subtraction
+ * per malloc() and a table lookup per free(), so it can be left running.
+ */
+#define HEAP_SAMPLING
+
+/*
+ * Run a wizard's '@sanity' check a slice at a time from the main loop,
+ * instead of freezing the game until the whole database has been checked.
+ * Each pass through the main loop checks up to SANITY_SLICE_OBJECTS
+ * objects.  Violations are written to the sanity log as they are found,
+ * as well as being shown to the wizard.  '@sanity status' shows how far
+ * along it is and how long it expects to take, and '@sanity stop'
+ * abandons it.  The check done at startup is always done in one go.
+ */
+#define INCREMENTAL_SANITY
+#define SANITY_SLICE_OBJECTS 1000
+
+/*
+ * The object counts shown by @stats and returned by STATS are kept up to
+ * date as objects change, instead of being counted up each time.  Whether
+ * an object is old, unused for longer than '@tune aging_time', is worked
+ * out by a sweep that rechecks STATS_SWEEP_OBJECTS objects each pass
+ * through the main loop, so the old count can lag by one trip around the
+ * database.
+ */
+#define STATS_SWEEP_OBJECTS 1000
+
+/*
+ * The CPU time each owner's MUF and MPI use is kept in CPU_WINDOW_BUCKETS
+ * buckets, which together span '@tune cpu_window'.  More buckets make the
+ * window slide more smoothly, at the cost of a little memory per owner.
+ * '@top' shows who's been busiest, and '@tune cpu_budget_percent' holds
+ * back the timequeue entries of owners who use more than their share.
+ */
+#define CPU_WINDOW_BUCKETS 12
+
+/*
+ * How often a running MUF program reads the clock, to see whether it has
+ * run for longer than '@tune slice_msec' or '@tune max_preempt_msec'.
+ * The clock is read every SLICE_CLOCK_INSTRS instructions, with heavy
+ * primitives such as ARRAY_SORT, FINDNEXT and REGEXP counting as many
+ * instructions, so that one big call is noticed straight after.
+ */
+#define SLICE_CLOCK_INSTRS 256
+
+/*
+ * Hand big ARRAY_SORT, ARRAY_SORT_INDEXED and REGEXP calls to a pool of
+ * MUF_WORKER_THREADS threads, instead of doing them in the main loop.
+ * The program sleeps until its worker is done, like it would for SLEEP,
+ * while everyone else's commands and programs carry on.  Lists of at
+ * least MUF_WORKER_MIN_ITEMS items and strings of at least
+ * MUF_WORKER_MIN_TEXT characters are handed off.  PREEMPT programs always
+ * do the work themselves.
+ */
+#define MUF_WORKERS
+#define MUF_WORKER_THREADS 2
+#define MUF_WORKER_MIN_ITEMS 2000
+#define MUF_WORKER_MIN_TEXT 1024
+
+/*
+ * Parse the property lists in the main database file with up to
+ * DB_LOAD_THREADS threads at startup, once all of the object records have
+ * been read in.  This makes a big database load faster on a machine with
+ * several cores, at the cost of briefly holding the text of all of the
+ * properties in memory.  How long each part of the load took is logged.
+ */
+#define PARALLEL_DB_LOAD
+#define DB_LOAD_THREADS 4
+
 /*
  * There's a set of MUF prims that are considered dangerous.
  * Currently these include only:
@@ -160,6 +294,8 @@
 #define COMMAND_LOG "logs/commands"	/* Player commands */
 #define PROGRAM_LOG "logs/programs"	/* text of changed programs */
 #define USER_LOG    "logs/user"		/* log of player/program-init msgs. */
+#define MUF_PROFILE_FILE "logs/muf-profile.folded"	/* MUF profiler stacks */
+#define HEAP_PROFILE_FILE "logs/heap-profile"	/* Heap profiler samples */
 
 #define MACRO_FILE  "muf/macros"
 
@@ -211,6 +347,13 @@
  */
 #ifdef WIN32
 #undef SPAWN_HOST_RESOLVER
+#undef ASYNC_HOST_RESOLVER
+#undef ASYNC_LOGGING
+#undef MUF_PROFILER
+#undef MAIN_LOOP_METRICS
+#undef HEAP_SAMPLING
+#undef PARALLEL_DB_LOAD
+#undef MUF_WORKERS
 #define NO_MEMORY_COMMAND
 #define NO_USAGE_COMMAND
 #define NOCOREDUMP
@@ -224,6 +367,25 @@
 #ifdef SANITY
 #undef MALLOC_PROFILING
 #undef CRT_DEBUG_ALSO
+#undef HEAP_SAMPLING
+#endif
+
+/*
+ * Full malloc profiling already keeps track of every block.
+ */
+#ifdef MALLOC_PROFILING
+#undef HEAP_SAMPLING
+#endif
+
+#if defined(MALLOC_PROFILING) || defined(HEAP_SAMPLING)
+#define CRT_MALLOC_WRAPPERS
+#endif
+
+/*
+ * The parallel loader needs everything in memory, and a thread-safe malloc.
+ */
+#if defined(DISKBASE) || defined(MALLOC_PROFILING)
+#undef PARALLEL_DB_LOAD
 #endif
 
 /*
@@ -310,10 +472,14 @@
 # endif
 #endif
 
+#ifdef MUF_PROFILER
+# include <signal.h>		/* for sig_atomic_t */
+#endif
+
 /*
  * Include some of the useful local headers here.
  */
-#ifdef MALLOC_PROFILING
+#ifdef CRT_MALLOC_WRAPPERS
 # include "crt_malloc.h"
 #endif
 
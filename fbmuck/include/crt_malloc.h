@@ -10,8 +10,10 @@
 # include <stdlib.h>
 #endif
 
+#ifdef MALLOC_PROFILING
 extern void CrT_check(const char *, int);
 extern int CrT_check_everything(const char *, int);
+#endif
 extern void *CrT_malloc(size_t size, const char *whatfile, int whatline);
 extern void *CrT_calloc(size_t num, size_t size, const char *whatfile, int whatline);
 extern void *CrT_realloc(void *p, size_t size, const char *whatfile, int whatline);
@@ -20,6 +22,64 @@ extern char *CrT_string_dup(const char *, const char *, int);
 extern char *CrT_alloc_string(const char *, const char *, int);
 extern struct shared_string *CrT_alloc_prog_string(const char *, const char *, int);
 
+#ifdef HEAP_SAMPLING
+/* Type tags the heap sampler sorts sampled blocks into. */
+#define CRT_TAG_OTHER		0
+#define CRT_TAG_PROPS		1
+#define CRT_TAG_ARRAYS		2
+#define CRT_TAG_STRINGS		3
+#define CRT_TAG_FRAMES		4
+#define CRT_TAG_TEXT		5
+#define CRT_TAG_PROGRAMS	6
+#define CRT_TAGS			7
+
+#define CRT_PROPDIR_LEN		32
+
+/* Estimated live heap charged to one allocating line and tag. */
+struct CrT_sample_site {
+	const char *file;
+	int line;
+	int tag;
+	double bytes;
+	double blocks;
+	long samples;
+	struct CrT_sample_site *next;
+};
+
+/*
+ * Estimated live heap charged to a running MUF program, if propdir is
+ * empty, or else to the top level property directory of an object.
+ */
+struct CrT_sample_owner {
+	int obj;
+	char propdir[CRT_PROPDIR_LEN];
+	double bytes;
+	double blocks;
+	long samples;
+	struct CrT_sample_owner *next;
+};
+
+/* Which property is being set, while it is being set. */
+struct CrT_prop_context {
+	int obj;
+	const char *propname;
+	struct CrT_prop_context *prev;
+};
+
+extern const char *CrT_tag_names[CRT_TAGS];
+extern long CrT_sample_rate;
+extern int CrT_sample_program;
+
+extern void *CrT_malloc_tagged(size_t size, const char *whatfile, int whatline, int tag);
+extern void CrT_set_sample_rate(long rate);
+extern void CrT_reset_samples(void);
+extern void CrT_enter_prop_context(struct CrT_prop_context *ctx, int obj, const char *propname);
+extern void CrT_leave_prop_context(struct CrT_prop_context *ctx);
+extern void CrT_sample_totals(double *bytes, double *blocks, long *samples, double tagbytes[CRT_TAGS]);
+extern int CrT_copy_sample_sites(struct CrT_sample_site **sites);
+extern int CrT_copy_sample_owners(struct CrT_sample_owner **owners);
+#endif
+
 
 #define malloc(x)            CrT_malloc(           x,    __FILE__, __LINE__)
 #define calloc(x,y)          CrT_calloc(           x, y, __FILE__, __LINE__)
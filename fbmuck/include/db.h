@@ -67,11 +67,14 @@ typedef int dbref;				/* offset into db */
 #  define DBDIRTY(x)  {if (!(db[x].flags & OBJECT_CHANGED))  \
 			   log2file("dirty.out", "#%d: %s %d\n", (int)x, \
 			   __FILE__, __LINE__); \
-		       db[x].flags |= OBJECT_CHANGED;}
+		       db[x].flags |= OBJECT_CHANGED; objstats_update(x);}
 #else
-#  define DBDIRTY(x)  {db[x].flags |= OBJECT_CHANGED;}
+#  define DBDIRTY(x)  {db[x].flags |= OBJECT_CHANGED; objstats_update(x);}
 #endif
 
+/* Keeps the @stats counts in step with the object; see objstats.c. */
+extern void objstats_update(dbref obj);
+
 #define DBSTORE(x, y, z)    {DBFETCH(x)->y = z; DBDIRTY(x);}
 
 #define NAME(x)     (db[x].name)
@@ -377,10 +380,14 @@ struct line {
 #define RES_VAR          4		/* no of reserved variables */
 
 #define STACK_SIZE       1024	/* maximum size of stack */
+#define STACK_INITIAL    16		/* stacks start out this big, and double */
+#define STACK_SLACK      16		/* free slots promised to each primitive */
+#define STACK_RETIRED    8		/* old argument stacks awaiting free */
 
 struct shared_string {			/* for sharing strings in programs */
 	int links;					/* number of pointers to this struct */
 	int length;					/* length of string data */
+	int capacity;				/* bytes allocated for data, with the NUL */
 	char data[1];				/* shared string data */
 };
 
@@ -441,19 +448,31 @@ struct tryvars {
 	struct tryvars *next;
 };
 
+/*
+ * The stacks below are allocated at STACK_INITIAL items, and grown as
+ * needed up to STACK_SIZE.  A primitive may still hold pointers to the
+ * items it popped when it grows the argument stack, so the old copies
+ * are kept in retired[] until the primitive returns.  Stacks only ever
+ * double in size while in use, so STACK_RETIRED is plenty.
+ */
 struct stack {
 	int top;
-	struct inst st[STACK_SIZE];
+	int size;					/* items allocated in st */
+	struct inst *st;
+	int nretired;
+	struct inst *retired[STACK_RETIRED];
 };
 
 struct sysstack {
 	int top;
-	struct stack_addr st[STACK_SIZE];
+	int size;
+	struct stack_addr *st;
 };
 
 struct callstack {
 	int top;
-	dbref st[STACK_SIZE];
+	int size;
+	dbref *st;
 };
 
 struct localvars {
@@ -557,7 +576,7 @@ struct frame {
 	struct debuggerdata brkpt;	/* info the debugger needs */
 	struct timeval proftime;    /* profiling timing code */
     struct timeval totaltime;   /* profiling timing code */
-	struct mufevent *events;	/* MUF event list. */
+	struct mufevent_queue *events;	/* MUF event queue. */
 	struct dlogidlist *dlogids;	/* List of dlogids this frame uses. */
 	struct mufwatchpidlist *waiters;
 	struct mufwatchpidlist *waitees;
@@ -764,27 +783,45 @@ union u_hash_data {
 
 /* The actual hash entry for each item */
 struct t_hash_entry {
-	struct t_hash_entry *next;	/* Pointer for conflict resolution */
-	const char *name;			/* The name of the item */
+	const char *name;			/* The name of the item, or NULL if unused */
+	unsigned int hashval;		/* Full hash value of the name */
 	union u_hash_data dat;		/* Data value for item */
 };
 
+/* A hash table.  See hashtab.c. */
+struct t_hash_table {
+	struct t_hash_entry *entries;
+	unsigned int size;			/* Slots in entries, a power of two */
+	unsigned int count;			/* Slots holding an item */
+	unsigned int filled;		/* Slots holding an item or deleted */
+	unsigned int minsize;		/* Slots to start with */
+	int flags;
+};
+
 typedef union u_hash_data hash_data;
 typedef struct t_hash_entry hash_entry;
-typedef hash_entry *hash_tab;
+typedef struct t_hash_table hash_tab;
+
+#define HASH_EXACT         0x1	/* Hash table names are case-sensitive */
 
-#define PLAYER_HASH_SIZE   (1024)	/* Table for player lookups */
-#define COMP_HASH_SIZE     (256)	/* Table for compiler keywords */
-#define DEFHASHSIZE        (256)	/* Table for compiler $defines */
+#define PLAYER_HASH_SIZE   (1024)	/* Initial size of player name table */
+#define COMP_HASH_SIZE     (1024)	/* Initial size of compiler keyword table */
+#define DEFHASHSIZE        (256)	/* Initial size of compiler $define table */
 
 extern struct object *db;
 extern struct macrotable *macrotop;
 extern dbref db_top;
 
-#ifndef MALLOC_PROFILING
+#ifndef CRT_MALLOC_WRAPPERS
 extern char *alloc_string(const char *);
 extern struct shared_string *alloc_prog_string(const char *);
 #endif
+extern struct shared_string *alloc_prog_char(int c);
+extern struct shared_string *new_prog_string(const char *s,
+											  void *(*allocfn) (size_t, const char *, int),
+											  const char *file, int line);
+extern struct shared_string *prog_string_append(struct shared_string *ss,
+												 const char *s, int len);
 
 extern dbref new_object(void);		/* return a new object */
 
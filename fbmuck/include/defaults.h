@@ -78,6 +78,7 @@
 #define DUMP_WARNTIME TIME_MINUTE(2)	/* warning time before a dump */
 #define MONOLITHIC_INTERVAL TIME_DAY(1)	/* max time between full dumps */
 #define CLEAN_INTERVAL TIME_MINUTE(15)	/* time between unused obj purges */
+#define CPU_WINDOW TIME_MINUTE(1)	/* span of the per-owner CPU budget */
 
 
 /* Information needed for SSL */
@@ -155,6 +156,14 @@
  */
 #define INSTR_SLICE 2000
 
+/* SLICE_MSEC is the most milliseconds a FOREGROUND or BACKGROUND program
+ * runs before a context switch, however few instructions it has run.
+ * MAX_PREEMPT_MSEC is the most milliseconds a PREEMPT program may run
+ * before it is aborted.  0 means no limit.
+ */
+#define SLICE_MSEC 10
+#define MAX_PREEMPT_MSEC 0
+
 
 /* Max # of instrs in uninterruptable programs before timeout. */
 #define MPI_MAX_COMMANDS 2048
@@ -338,6 +347,22 @@
 /* Log commands that take longer than this many milliseconds */
 #define CMD_LOG_THRESHOLD_MSEC 1000
 
+/* Localhost port to serve main loop metrics on, or 0 for none. */
+#define METRICS_PORT 0
+
+/* File to rewrite with main loop metrics, or "" for none. */
+#define METRICS_FILE ""
+
+/* Seconds between rewrites of the metrics file. */
+#define METRICS_INTERVAL 60
+
+/* Mean bytes allocated between heap profiler samples, or 0 for none. */
+#define HEAP_SAMPLE_BYTES 0
+
+/* Percent of cpu_window that one owner's MUF and MPI may use before their
+ * queued and sleeping processes are held back, or 0 for no limit. */
+#define CPU_BUDGET_PERCENT 0
+
 /* max. amount of queued output in bytes, before you get <output flushed> */
 #define MAX_OUTPUT 131071
 
@@ -18,9 +18,10 @@ void do_abort_silent(void);
 void do_dequeue(int descr, dbref player, const char *arg1);
 void do_doing(int descr, dbref player, const char *name, const char *mesg);
 void do_edit(int descr, dbref player, const char *name);
+void do_sanity(dbref player, const char *arg);
 void do_flock(int descr, dbref player, const char *name, const char *keyname);
 void do_leave(int descr, dbref player);
-void do_memory(dbref who);
+void do_memory(dbref who, const char *arg);
 void do_move(int descr, dbref player, const char *direction, int lev);
 void do_newpassword(dbref player, const char *name, const char *password);
 void do_oecho(int descr, dbref player, const char *name, const char *message);
@@ -78,6 +79,8 @@ void sane_dump_object(dbref player, const char *arg);
 void sanechange(dbref player, const char *command);
 void sanfix(dbref player);
 void sanity(dbref player);
+void sanity_incremental(void);
+int sanity_running(void);
 int scopedvar_poplevel(struct frame *fr);
 void send_contents(int descr, dbref loc, dbref dest);
 void set_signals(void);
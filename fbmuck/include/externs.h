@@ -36,6 +36,8 @@ extern int add_event(int event_type, int subtyp, int dtime, int descr, dbref pla
 extern void next_timequeue_event(void);
 extern int in_timequeue(int pid);
 extern struct frame* timequeue_pid_frame(int pid);
+extern int add_muf_worker_event(int descr, dbref player, dbref prog, struct frame *fr);
+extern struct frame *timequeue_wake_worker(int pid);
 extern long next_event_time(void);
 extern void list_events(dbref program);
 extern int dequeue_prog_real(dbref, int, const char *, const int);
@@ -102,13 +104,17 @@ extern void dump_deltas(void);
 extern void fork_and_dump(void);
 
 /* From hashtab.c */
+extern unsigned int hash_string(const char *s, int exact);
 extern unsigned int hash(const char *s, unsigned int hash_size);
-extern hash_data *find_hash(const char *s, hash_tab * table, unsigned size);
-extern hash_entry *add_hash(const char *name, hash_data data, hash_tab * table, unsigned size);
-extern int free_hash(const char *name, hash_tab * table, unsigned size);
-extern void kill_hash(hash_tab * table, unsigned size, int freeptrs);
+extern void hash_init(hash_tab * table, unsigned int size, int flags);
+extern hash_data *find_hash(const char *s, hash_tab * table);
+extern hash_entry *add_hash(const char *name, hash_data data, hash_tab * table);
+extern int free_hash(const char *name, hash_tab * table);
+extern hash_entry *next_hash(hash_tab * table, hash_entry * prev);
+extern void kill_hash(hash_tab * table, int freeptrs);
 
 /* From help.c */
+extern void help_index_init(void);
 extern void spit_file(dbref player, const char *filename);
 extern void do_help(dbref player, char *topic, char *seg);
 extern void do_mpihelp(dbref player, char *topic, char *seg);
@@ -117,6 +123,19 @@ extern void do_man(dbref player, char *topic, char *seg);
 extern void do_motd(dbref player, char *text);
 extern void do_info(dbref player, const char *topic, const char *seg);
 
+/* From hostresolv.c */
+#ifdef ASYNC_HOST_RESOLVER
+struct sockaddr;
+extern void start_resolver(void);
+extern void stop_resolver(void);
+extern int resolver_wakeup_fd(void);
+extern const char *resolver_lookup(int descr, struct sockaddr *addr, int lport);
+extern void resolver_forget(int descr);
+extern int resolver_result(int *descr, char *hostname, char *username, int buflen);
+extern void resolver_stats(int *dns_pending, int *ident_pending, int *cached,
+						   unsigned long *hits, unsigned long *misses);
+#endif
+
 /* From look.c */
 extern void look_room(int descr, dbref player, dbref room, int verbose);
 extern long size_object(dbref i, int load);
@@ -152,6 +171,8 @@ extern void recycle(int descr, dbref player, dbref thing);
 
 /* From player.c */
 extern dbref lookup_player(const char *name);
+extern int count_player_prefix(const char *prefix);
+extern dbref match_player_prefix(const char *prefix, int connected);
 extern void do_password(dbref player, const char *old, const char *newobj);
 extern void add_player(dbref who);
 extern void delete_player(dbref who);
@@ -229,7 +250,7 @@ extern char* strcatn(char* buf, size_t bufsize, const char* src);
 extern char* strcpyn(char* buf, size_t bufsize, const char* src);
 
 
-#if !defined(MALLOC_PROFILING)
+#if !defined(CRT_MALLOC_WRAPPERS)
 extern char *string_dup(const char *s);
 #endif
 
@@ -291,13 +312,108 @@ extern struct frame *interp(int descr, dbref player, dbref location, dbref progr
 							dbref source, int nosleeping, int whichperms, int forced_pid);
 extern void purge_for_pool(void);
 extern void purge_try_pool(void);
+extern void init_slice_costs(void);
 
 /* From mufevent.c */
 extern int muf_event_exists(struct frame* fr, const char* eventid);
 extern int muf_event_process_unregister(struct frame *fr);
 
+/* From mufprof.c */
+extern int muf_profile_command(const char *arg, char *buf, int buflen);
+extern void do_mufprofile(dbref player, const char *arg);
+#ifdef MUF_PROFILER
+extern volatile sig_atomic_t muf_prof_pending;
+extern void muf_profile_discard(void);
+extern void muf_profile_sample(dbref program, struct frame *fr, struct inst *pc, int stop);
+#endif
+
+/* From mufworker.c */
+extern int muf_worker_can_offload(struct frame *fr, dbref program);
+extern void muf_worker_hold(struct frame *fr, void (*run) (void *), void (*release) (void *),
+							void *data);
+extern void *muf_worker_answer(struct frame *fr, void (*run) (void *));
+extern void muf_worker_forget(int pid);
+#ifdef MUF_WORKERS
+extern int muf_worker_job_held;
+extern void start_muf_workers(void);
+extern void stop_muf_workers(void);
+extern int muf_worker_wakeup_fd(void);
+extern void muf_worker_submit(struct frame *fr, dbref player, dbref program);
+extern void muf_worker_results(void);
+#endif
+
+/* From objstats.c */
+struct objstats {
+	int rooms;
+	int exits;
+	int things;
+	int players;
+	int programs;
+	int garbage;
+	int altered;				/* OBJECT_CHANGED since the last dump */
+	int old;					/* unused for longer than aging_time */
+	int loaded;					/* DISKBASE proploaded */
+	int changed;				/* DISKBASE propchanged */
+};
+extern void objstats_sweep(void);
+extern void objstats_free(void);
+extern void objstats_rebuild(void);
+extern void objstats_get(dbref owner, struct objstats *stats);
+
+/* From cpuacct.c */
+extern void cpuacct_charge(dbref owner, struct timeval *tv, int mpi);
+extern int cpuacct_throttle_delay(dbref owner);
+extern void cpuacct_free(void);
+extern void do_cpu_top(dbref player, const char *arg);
+
+/* From heapprof.c */
+extern void heap_profile_tick(void);
+extern void do_heap_profile(dbref player, const char *arg);
+
+/* From metrics.c */
+#define METRIC_LOOP		0	/* Histograms */
+#define METRIC_SELECT		1
+#define METRIC_EVENTS		2
+#define METRIC_COMMANDS		3
+#define METRIC_MUFEVENTS	4
+#define METRIC_IO		5
+#define METRIC_HISTS		6
+
+#define METRIC_ITERATIONS	0	/* Counters */
+#define METRIC_WAKEUPS		1
+#define METRIC_TIMEOUTS		2
+#define METRIC_BYTES_IN		3
+#define METRIC_BYTES_OUT	4
+#define METRIC_COMMANDS_RUN	5
+#define METRIC_CONNECTS		6
+#define METRIC_COUNTERS		7
+
+extern stk_array *metrics_array(void);
+#ifdef MAIN_LOOP_METRICS
+extern long metrics_counts[METRIC_COUNTERS];
+extern void metrics_init(void);
+extern void metrics_pass(struct timeval *now);
+extern void metrics_phase(int which, struct timeval *since);
+extern void metrics_select(struct timeval *waited, int ready);
+extern void metrics_queues(int descrs, int inlines, long outbytes);
+extern void metrics_fdset(fd_set * input_set, int *maxd);
+extern void metrics_serve(fd_set * input_set);
+extern void metrics_tick(void);
+extern void metrics_shutdown(void);
+# define METRICS_COUNT(which, n) (metrics_counts[(which)] += (n))
+# define METRICS_MARK(tv) gettimeofday(&(tv), NULL)
+# define METRICS_PHASE(which, tv) metrics_phase((which), &(tv))
+#else
+# define METRICS_COUNT(which, n) ((void) 0)
+# define METRICS_MARK(tv) ((void) 0)
+# define METRICS_PHASE(which, tv) ((void) 0)
+#endif
+
 /* from signal.h */
 extern void set_dumper_signals(void);
+#ifndef WIN32
+extern void our_signal(int signo, void (*sighandler) (int));
+#endif
 #ifdef WIN32
 extern void set_console(void);
 extern void check_cosole(void);
@@ -315,6 +431,12 @@ extern void notify_fmt(dbref player, char *format, ...);
 extern void log_program_text(struct line *first, dbref player, dbref i);
 extern void log_command(char *format, ...);
 extern void log_user(dbref player, dbref program, char *logmessage);
+#ifdef ASYNC_LOGGING
+extern void start_log_writer(void);
+extern void stop_log_writer(void);
+extern void reopen_logs(void);
+extern void log_writer_stats(unsigned long *queued, unsigned long *dropped, unsigned long *pending);
+#endif
 
 /* From timestamp.c */
 extern void ts_newobject(struct object *thing);
@@ -326,6 +448,8 @@ extern void ts_modifyobject(dbref thing);
 extern int equalstr(char *s, char *t);
 
 extern void CrT_summarize(dbref player);
+extern void CrT_summarize_to_file(const char *file, const char *comment);
+extern long CrT_total_allocs(void);
 
 extern int force_level;
 extern dbref force_prog;
@@ -366,6 +490,7 @@ extern short global_dumpdone;
 #ifdef SPAWN_HOST_RESOLVER
 extern void spawn_resolver(void);
 #endif
+extern void make_nonblocking(int s);
 
 
 /* from events.c */
@@ -6,7 +6,7 @@
 #include "array.h"
 #include "autoconf.h"
 #include "config.h"
-#ifdef MALLOC_PROFILING
+#ifdef CRT_MALLOC_WRAPPERS
 # include "crt_malloc.h"
 #endif
 #include "dbsearch.h"
@@ -56,6 +56,15 @@ extern void ignore_add_player(dbref Player, dbref Who);
 extern void ignore_remove_player(dbref Player, dbref Who);
 extern void ignore_remove_from_all_players(dbref Player);
 
+/* the following let the benchmarks run the server without sockets */
+extern void replay_init(void);
+extern int replay_connect(void);
+extern int replay_login(int descr, dbref player);
+extern int replay_input(int descr, const char *line);
+extern void replay_disconnect(int descr);
+extern int replay_queued(int descr);
+extern void replay_slice(void);
+
 /* the following symbols are provided by game.c */
 
 extern void process_command(int descr, dbref player, char *command);
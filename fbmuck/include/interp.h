@@ -68,6 +68,11 @@ extern void interp_err(dbref player, dbref program, struct inst *pc,
 
 extern void push(struct inst *stack, int *top, int type, voidptr res);
 
+extern int argstack_reserve(struct frame *fr, int need);
+extern void argstack_free_retired(struct frame *fr);
+extern int sysstack_reserve(struct frame *fr, int need);
+extern void frame_release_stacks(struct frame *fr, int keep);
+
 extern int valid_player(struct inst *oper);
 
 extern int valid_object(struct inst *oper);
@@ -140,8 +145,11 @@ extern dbref find_uid(dbref player, struct frame *fr, int st, dbref program);
 #define PushNullArray   PushArrayRaw(0)
 #define PushInst(x) copyinst(x, &arg[((*top)++)])
 
-#define CHECKOFLOW(x) if((*top + (x - 1)) >= STACK_SIZE) \
-			  abort_interp("Stack Overflow!");
+#define CHECKOFLOW(x) if ((*top + (x)) > fr->argument.size) { \
+			  if (argstack_reserve(fr, *top + (x)) < 0) \
+				  abort_interp("Stack Overflow!"); \
+			  arg = fr->argument.st; \
+		  }
 
 #define PRIM_PROTOTYPE dbref player, dbref program, int mlev, \
                        struct inst *pc, struct inst *arg, int *top, \
@@ -18,6 +18,9 @@ typedef void *connection_t;
 #define MAX_MCP_MESG_ARGS      30 /* max number of args per mesg. */
 #define MAX_MCP_MESG_SIZE  262144 /* max mesg size in bytes. */
 
+#define MCP_PKG_HASHSIZE       32 /* buckets per package table. Power of 2. */
+#define MCP_ARG_CHUNK_SIZE   2048 /* bytes per message argument chunk. */
+
 /* This is a convenient struct for dealing with MCP versions. */
 typedef struct McpVersion_T {
 	unsigned short vermajor;	/* major version number */
@@ -43,6 +46,15 @@ typedef struct McpArg_T {
 } McpArg;
 
 
+/* Argument names, values and lines of a message are carved out of */
+/* a short list of these chunks, and freed all at once on clear.    */
+typedef struct McpArgChunk_T {
+	struct McpArgChunk_T *next;
+	size_t size;
+	size_t used;
+} McpArgChunk;
+
+
 /* This is an MCP message. */
 typedef struct McpMesg_T {
 	struct McpMesg_T *next;
@@ -50,6 +62,9 @@ typedef struct McpMesg_T {
 	char *mesgname;
 	char *datatag;
 	McpArg *args;
+	McpArg *lastarg;			/* Tail of args, and likeliest append target. */
+	McpArgChunk *chunks;		/* Storage for args and their lines. */
+	int argcount;
 	int incomplete;
 	int bytes;
 } McpMesg;
@@ -73,6 +88,7 @@ typedef struct McpPkg_T {
 	void *context;				/* user defined callback context */
 	ContextCleanup_CB cleanup;  /* callback to use to free context */
 	struct McpPkg_T *next;
+	struct McpPkg_T *hashnext;	/* next package in the same hash bucket */
 } McpPkg;
 
 
@@ -84,6 +100,7 @@ typedef struct McpFrame_T {
 	char *authkey;				/* Authorization key. */
 	McpVer version;				/* Supported MCP version number. */
 	McpPkg *packages;			/* Pkgs supported on this connection. */
+	McpPkg *pkghash[MCP_PKG_HASHSIZE];	/* Same pkgs, hashed by name. */
 	McpMesg *messages;			/* Partial messages, under construction. */
 } McpFrame;
 
@@ -1,12 +1,39 @@
 #ifndef _MUFEVENT_H
 #define _MUFEVENT_H
 
+#define MUFEVENT_HASH_SIZE 16	/* name buckets in each frame's event queue */
+#define MUFEVENT_BATCH 8		/* most events handed over per process wakeup */
+
+struct mufevent_process;
+
 struct mufevent {
-	struct mufevent *next;
+	struct mufevent *next;		/* next event in the order they arrived */
+	struct mufevent *prev;
+	struct mufevent *samenext;	/* next event with the same name */
+	struct mufevent_name *name;
+	unsigned long seq;			/* arrival order, for comparing names */
 	char *event;
 	struct inst data;
 };
 
+/* The pending events with one name, ignoring case, oldest first. */
+struct mufevent_name {
+	struct mufevent_name *next;	/* hash chain */
+	struct mufevent *head;
+	struct mufevent *tail;
+	int count;
+};
+
+/* A frame's event queue, allocated when it first gets or waits for one. */
+struct mufevent_queue {
+	struct mufevent *head;
+	struct mufevent *tail;
+	int count;
+	unsigned long seq;
+	struct mufevent_process *waiter;	/* its EVENT_WAIT, if it is in one */
+	struct mufevent_name *names[MUFEVENT_HASH_SIZE];
+};
+
 #define MUFEVENT_ALL	-1
 #define MUFEVENT_FIRST	-2
 #define MUFEVENT_LAST	-3
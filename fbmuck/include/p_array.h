@@ -59,6 +59,16 @@ extern void prim_array_nested_del(PRIM_PROTOTYPE);
 
 extern void prim_array_filter_flags(PRIM_PROTOTYPE);
 
+extern void prim_array_sum(PRIM_PROTOTYPE);
+extern void prim_array_min(PRIM_PROTOTYPE);
+extern void prim_array_max(PRIM_PROTOTYPE);
+extern void prim_array_dot(PRIM_PROTOTYPE);
+extern void prim_array_vadd(PRIM_PROTOTYPE);
+extern void prim_array_vsub(PRIM_PROTOTYPE);
+extern void prim_array_vmul(PRIM_PROTOTYPE);
+extern void prim_array_vdiv(PRIM_PROTOTYPE);
+extern void prim_array_findrange(PRIM_PROTOTYPE);
+
 #define PRIMS_ARRAY_FUNCS prim_array_make, prim_array_make_dict, \
         prim_array_explode, prim_array_vals, prim_array_keys, \
         prim_array_first, prim_array_last, prim_array_next, prim_array_prev, \
@@ -76,7 +86,10 @@ extern void prim_array_filter_flags(PRIM_PROTOTYPE);
 		prim_array_cut, prim_array_compare, prim_array_sort_indexed, \
 		prim_array_pin, prim_array_unpin, prim_array_get_ignorelist, \
 		prim_array_nested_get, prim_array_nested_set, prim_array_nested_del, \
-		prim_array_filter_flags, prim_array_interpret
+		prim_array_filter_flags, prim_array_interpret, prim_array_sum, \
+		prim_array_min, prim_array_max, prim_array_dot, prim_array_vadd, \
+		prim_array_vsub, prim_array_vmul, prim_array_vdiv, \
+		prim_array_findrange
 
 #define PRIMS_ARRAY_NAMES "ARRAY_MAKE", "ARRAY_MAKE_DICT", \
         "ARRAY_EXPLODE", "ARRAY_VALS", "ARRAY_KEYS", \
@@ -95,8 +108,11 @@ extern void prim_array_filter_flags(PRIM_PROTOTYPE);
 		"ARRAY_CUT", "ARRAY_COMPARE", "ARRAY_SORT_INDEXED", \
 		" ARRAY_PIN", " ARRAY_UNPIN", "ARRAY_GET_IGNORELIST", \
 		"ARRAY_NESTED_GET", "ARRAY_NESTED_SET", "ARRAY_NESTED_DEL", \
-		"ARRAY_FILTER_FLAGS", "ARRAY_INTERPRET"
+		"ARRAY_FILTER_FLAGS", "ARRAY_INTERPRET", "ARRAY_SUM", \
+		"ARRAY_MIN", "ARRAY_MAX", "ARRAY_DOT", "ARRAY_VADD", \
+		"ARRAY_VSUB", "ARRAY_VMUL", "ARRAY_VDIV", \
+		"ARRAY_FINDRANGE"
 
-#define PRIMS_ARRAY_CNT 49
+#define PRIMS_ARRAY_CNT 58
 
 #endif /* _P_ARRAY_H */
@@ -44,6 +44,8 @@ extern void prim_ignore_del(PRIM_PROTOTYPE);
 extern void prim_debug_on(PRIM_PROTOTYPE);
 extern void prim_debug_off(PRIM_PROTOTYPE);
 extern void prim_debug_line(PRIM_PROTOTYPE);
+extern void prim_muf_profile(PRIM_PROTOTYPE);
+extern void prim_metrics(PRIM_PROTOTYPE);
 
 #define PRIMS_MISC_FUNCS prim_time, prim_date, prim_gmtoffset, \
     prim_systime, prim_timesplit, prim_timefmt, prim_userlog, \
@@ -55,7 +57,8 @@ extern void prim_debug_line(PRIM_PROTOTYPE);
     prim_name_okp, prim_ext_name_okp, prim_force_level, prim_watchpid, \
     prim_read_wants_blanks, prim_sysparm_array, prim_debugger_break, \
     prim_ignoringp, prim_ignore_add, prim_ignore_del, prim_debug_on, \
-    prim_debug_off, prim_debug_line, prim_systime_precise
+    prim_debug_off, prim_debug_line, prim_systime_precise, \
+    prim_muf_profile, prim_metrics
 
 #define PRIMS_MISC_NAMES "TIME", "DATE", "GMTOFFSET", \
     "SYSTIME", "TIMESPLIT", "TIMEFMT", "USERLOG", \
@@ -67,8 +70,9 @@ extern void prim_debug_line(PRIM_PROTOTYPE);
     "NAME-OK?", "EXT-NAME-OK?", "FORCE_LEVEL", "WATCHPID", \
     "READ_WANTS_BLANKS", "SYSPARM_ARRAY", "DEBUGGER_BREAK", \
     "IGNORING?", "IGNORE_ADD", "IGNORE_DEL", "DEBUG_ON", \
-    "DEBUG_OFF", "DEBUG_LINE", "SYSTIME_PRECISE"
+    "DEBUG_OFF", "DEBUG_LINE", "SYSTIME_PRECISE", "MUF_PROFILE", \
+    "METRICS"
 
-#define PRIMS_MISC_CNT 43
+#define PRIMS_MISC_CNT 45
 
 #endif /* _P_MISC_H */
@@ -1,6 +1,18 @@
 #ifndef _PROPS_H
 #define _PROPS_H
 
+/* A set of dbrefs, in the order they were added.  See refset.c. */
+struct refset {
+	int count;					/* refs in the set */
+	int used;					/* entries of order[] used, gaps and all */
+	int size;					/* entries allocated in order[] */
+	unsigned int mask;			/* slots in slots[], less one */
+	dbref *order;				/* the refs, in the order added */
+	int *tree;					/* Fenwick tree counting refs in order[] */
+	unsigned int *slots;		/* index into order[] plus one, or 0 */
+	char *text;					/* "#1 #2 #3", as last asked for, or NULL */
+};
+
 union pdata_u {
 	char *str;
 	struct boolexp *lok;
@@ -8,6 +20,7 @@ union pdata_u {
 	double fval;
 	dbref ref;
 	long pos;
+	struct refset *set;
 };
 
 /* data struct for setting data. */
@@ -30,6 +43,27 @@ struct plist {
 /* property node pointer type */
 typedef struct plist *PropPtr;
 
+/*
+ * Propdir iteration cursor.  Remembers the path from the propdir's root
+ * node down to the current node, so stepping to the next property doesn't
+ * have to search the tree from the top again.  If any property tree has
+ * been restructured since the cursor last moved (prop_tree_generation has
+ * changed), the cursor re-finds its place by name.
+ */
+#define PROPCURSOR_MAXDEPTH 64
+struct prop_cursor {
+	dbref obj;
+	unsigned long generation;
+	int depth;
+	PropPtr stack[PROPCURSOR_MAXDEPTH];
+	char dir[BUFFER_LEN];		/* propdir being iterated */
+	char name[BUFFER_LEN];		/* name of the current prop in dir */
+};
+typedef struct prop_cursor PropCursor;
+
+extern unsigned long prop_tree_generation;
+extern int prop_tree_frozen;
+
 /* propload queue types */
 #define PROPS_UNLOADED 0x0
 #define PROPS_LOADED   0x1
@@ -44,6 +78,7 @@ typedef struct plist *PropPtr;
 #define PROP_LOKTYP   0x4
 #define PROP_REFTYP   0x5
 #define PROP_FLTTYP   0x6
+#define PROP_SETTYP   0x7		/* reflist, held as a struct refset */
 #define PROP_TYPMASK  0x7
 
 /* Property flags.  Unimplemented as yet. */
@@ -63,6 +98,13 @@ typedef struct plist *PropPtr;
 /* Blessed props evaluate with wizbit MPI perms. */
 #define PROP_BLESSED     0x1000
 
+/* Only ever stored on disk.  PROP_SETTYP props are written out as str
+   props with this flag, so that servers that don't know about them can
+   still read them as ordinary reflist strings.  Refs that don't fit on
+   that line follow it in lines of type PROP_SETTYP, which those servers
+   skip. */
+#define PROP_REFLIST     0x2000
+
 
 /* Macros */
 #define AVL_LF(x) (x)->left
@@ -77,12 +119,14 @@ typedef struct plist *PropPtr;
 #define SetPDataRef(x,z) {(x)->data.ref = z;}
 #define SetPDataLok(x,z) {(x)->data.lok = z;}
 #define SetPDataFVal(x,z) {(x)->data.fval = z;}
+#define SetPDataSet(x,z) {(x)->data.set = z;}
 
 #define PropDataStr(x) ((x)->data.str)
 #define PropDataVal(x) ((x)->data.val)
 #define PropDataRef(x) ((x)->data.ref)
 #define PropDataLok(x) ((x)->data.lok)
 #define PropDataFVal(x) ((x)->data.fval)
+#define PropDataSet(x) ((x)->data.set)
 
 #define PropName(x) ((x)->key)
 
@@ -129,6 +173,8 @@ extern PropPtr alloc_propnode(const char *name);
 extern void free_propnode(PropPtr node);
 extern PropPtr first_node(PropPtr p);
 extern PropPtr next_node(PropPtr p, char *c);
+extern PropPtr propcursor_seek_node(PropCursor * cur, PropPtr root, const char *name);
+extern PropPtr propcursor_next_node(PropCursor * cur);
 extern void putprop(FILE * f, PropPtr p);
 extern int Prop_Check(const char *name, const char what);
 extern PropPtr locate_prop(PropPtr l, char *path);
@@ -152,6 +198,7 @@ extern double get_property_fvalue(dbref player, const char *type);
 extern int get_property_value(dbref player, const char *type);
 extern struct boolexp *get_property_lock(dbref player, const char *type);
 extern dbref get_property_dbref(dbref player, const char *pname);
+extern struct refset *get_property_refset(dbref player, const char *pname);
 extern const char *envpropstr(dbref * where, const char *propname);
 extern PropPtr get_property(dbref player, const char *type);
 extern PropPtr envprop(dbref * where, const char *propname, int typ);
@@ -166,6 +213,11 @@ extern PropPtr first_prop(dbref player, const char *dir, PropPtr * list, char *n
 extern PropPtr next_prop(PropPtr list, PropPtr prop, char *name, int maxlen);
 extern char *next_prop_name(dbref player, char *outbuf, int outbuflen, char *name);
 
+extern PropPtr propcursor_first(PropCursor * cur, dbref player, const char *dir);
+extern PropPtr propcursor_first_nofetch(PropCursor * cur, dbref player, const char *dir);
+extern PropPtr propcursor_seek(PropCursor * cur, dbref player, const char *dir, const char *after);
+extern PropPtr propcursor_next(PropCursor * cur);
+
 extern int is_propdir(dbref player, const char *dir);
 
 extern void delete_proplist(PropPtr p);
@@ -204,4 +256,16 @@ extern void reflist_add(dbref obj, const char* propname, dbref toadd);
 extern void reflist_del(dbref obj, const char* propname, dbref todel);
 extern int reflist_find(dbref obj, const char* propname, dbref tofind);
 
+extern struct refset *refset_new(void);
+extern void refset_free(struct refset *set);
+extern struct refset *refset_copy(const struct refset *set);
+extern int refset_find(const struct refset *set, dbref ref);
+extern void refset_add(struct refset *set, dbref ref);
+extern int refset_del(struct refset *set, dbref ref);
+extern int refset_walk(const struct refset *set, int *pos, dbref * ref);
+extern const char *refset_text(struct refset *set);
+extern int refset_write(FILE * f, const struct refset *set, int *pos);
+extern struct refset *refset_parse(const char *text);
+extern long refset_size(const struct refset *set);
+
 #endif /* _PROPS_H */
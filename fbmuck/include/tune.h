@@ -40,6 +40,7 @@ extern const char *tp_ssl_cipher_preference_list;
 extern const char *tp_pcreate_flags;
 extern const char *tp_reserved_names;
 extern const char *tp_reserved_player_names;
+extern const char *tp_metrics_file;
 
 
 
@@ -49,8 +50,10 @@ extern int tp_dump_warntime;
 extern int tp_monolithic_interval;
 extern int tp_clean_interval;
 extern int tp_aging_time;
+extern int tp_cpu_window;
 extern int tp_maxidle;
 extern int tp_idle_ping_time;
+extern int tp_metrics_interval;
 
 
 /* integers */
@@ -80,6 +83,8 @@ extern int tp_max_plyr_processes;
 extern int tp_max_instr_count;
 extern int tp_max_ml4_preempt_count;
 extern int tp_instr_slice;
+extern int tp_slice_msec;
+extern int tp_max_preempt_msec;
 extern int tp_mpi_max_commands;
 extern int tp_pause_min;
 extern int tp_free_frames_pool;
@@ -92,6 +97,9 @@ extern int tp_movepennies_muf_mlev;
 extern int tp_addpennies_muf_mlev;
 extern int tp_pennies_muf_mlev;
 extern int tp_userlog_mlev;
+extern int tp_metrics_port;
+extern int tp_heap_sample_bytes;
+extern int tp_cpu_budget_percent;
 extern int tp_max_force_level;
 
 
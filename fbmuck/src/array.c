@@ -7,6 +7,7 @@
 #include <time.h>
 #include <ctype.h>
 #include <float.h>
+#include <stddef.h>
 #include "db.h"
 #include "tune.h"
 #include "inst.h"
@@ -173,6 +174,9 @@ array_tree_compare(array_iter * a, array_iter * b, int case_sens)
 	}
 }
 
+/*@null@*/
+static array_tree *array_tree_own(array_tree ** hnode);
+
 /*@null@*/
 static array_tree * 
 array_tree_find(array_tree * avl, array_iter * key)
@@ -195,6 +199,33 @@ array_tree_find(array_tree * avl, array_iter * key)
 	return avl;
 }
 
+/*
+** Like array_tree_find(), but makes every node on the way down private
+** to this tree, so that the returned node's data may be changed.
+*/
+/*@null@*/
+static array_tree *
+array_tree_find_own(array_tree ** avl, array_iter * key)
+{
+	array_tree *p;
+	int cmpval;
+
+	assert(avl != NULL);
+	assert(key != NULL);
+
+	while ((p = array_tree_own(avl))) {
+		cmpval = AVL_COMPARE(key, AVL_KEY(p));
+		if (cmpval > 0) {
+			avl = &AVL_RT(p);
+		} else if (cmpval < 0) {
+			avl = &AVL_LF(p);
+		} else {
+			break;
+		}
+	}
+	return p;
+}
+
 static short 
 array_tree_height_of(array_tree * node)
 {
@@ -213,6 +244,41 @@ array_tree_height_diff(array_tree * node)
 		return 0;
 }
 
+/*
+ * Tree nodes are shared between copies of a dictionary.  Before changing
+ * a node, make the link to it private, copying the node if another tree
+ * still refers to it.  Its children become shared by both copies.
+ */
+static array_tree *
+array_tree_own(array_tree ** hnode)
+{
+	array_tree *old = *hnode;
+	array_tree *nu;
+
+	if (old == NULL || old->refs < 2)
+		return old;
+
+	nu = (array_tree *) malloc(sizeof(array_tree));
+	if (!nu) {
+		fprintf(stderr, "array_tree_own(): Out of Memory!\n");
+		abort();
+	}
+	AVL_LF(nu) = AVL_LF(old);
+	AVL_RT(nu) = AVL_RT(old);
+	if (AVL_LF(nu))
+		AVL_LF(nu)->refs++;
+	if (AVL_RT(nu))
+		AVL_RT(nu)->refs++;
+	copyinst(AVL_KEY(old), AVL_KEY(nu));
+	copyinst(&old->data, &nu->data);
+	nu->height = old->height;
+	nu->refs = 1;
+
+	old->refs--;
+	*hnode = nu;
+	return nu;
+}
+
 /*\
 |*| Note to self: don't do : max (x++,y)
 |*| Kim
@@ -235,7 +301,7 @@ array_tree_rotate_left_single(array_tree * a)
 {
 	array_tree *b;
 	assert(a != NULL);
-	b = AVL_RT(a);
+	b = array_tree_own(&AVL_RT(a));
 
 	AVL_RT(a) = AVL_LF(b);
 	AVL_LF(b) = a;
@@ -251,8 +317,8 @@ array_tree_rotate_left_double(array_tree * a)
 {
 	array_tree *b, *c;
 	assert(a != NULL);
-	b = AVL_RT(a);
-	c = AVL_LF(b);
+	b = array_tree_own(&AVL_RT(a));
+	c = array_tree_own(&AVL_LF(b));
 
 	assert(b != NULL);
 	assert(c != NULL);
@@ -274,7 +340,7 @@ array_tree_rotate_right_single(array_tree * a)
 {
 	array_tree *b;
 	assert(a != NULL);
-	b = AVL_LF(a);
+	b = array_tree_own(&AVL_LF(a));
 
 	AVL_LF(a) = AVL_RT(b);
 	AVL_RT(b) = a;
@@ -290,8 +356,8 @@ array_tree_rotate_right_double(array_tree * a)
 {
 	array_tree *b, *c;
 	assert(a != NULL);
-	b = AVL_LF(a);
-	c = AVL_RT(b);
+	b = array_tree_own(&AVL_LF(a));
+	c = array_tree_own(&AVL_RT(b));
 
 	assert(b != NULL);
 	assert(c != NULL);
@@ -350,6 +416,7 @@ array_tree_alloc_node(array_iter * key)
 	AVL_LF(new_node) = NULL;
 	AVL_RT(new_node) = NULL;
 	new_node->height = 1;
+	new_node->refs = 1;
 
 	copyinst(key, AVL_KEY(new_node));
 	new_node->data.type = PROG_INTEGER;
@@ -382,6 +449,7 @@ array_tree_insert(array_tree ** avl, array_iter * key)
 	assert(key != NULL);
 
 	if (p) {
+		p = array_tree_own(avl);
 		cmp = AVL_COMPARE(key, AVL_KEY(p));
 		if (cmp > 0) {
 			ret = array_tree_insert(&(AVL_RT(p)), key);
@@ -422,7 +490,7 @@ array_tree_remove_node(array_iter * key, array_tree ** root)
 	assert(root != NULL);
 	assert(*root != NULL);
 	assert(key != NULL);
-	avl = *root;
+	avl = array_tree_own(root);
 
 	save = avl;
 	if (avl) {
@@ -432,9 +500,9 @@ array_tree_remove_node(array_iter * key, array_tree ** root)
 		} else if (cmpval > 0) {
 			save = array_tree_remove_node(key, &AVL_RT(avl));
 		} else if (!(AVL_LF(avl))) {
-			avl = AVL_RT(avl);
+			avl = array_tree_own(&AVL_RT(avl));
 		} else if (!(AVL_RT(avl))) {
-			avl = AVL_LF(avl);
+			avl = array_tree_own(&AVL_LF(avl));
 		} else {
 			tmp = array_tree_remove_node(
 					AVL_KEY(array_tree_getmax(AVL_LF(avl))),
@@ -475,6 +543,8 @@ array_tree_delete_all(array_tree * p)
 {
 	if (p == NULL)
 		return;
+	if (--p->refs > 0)
+		return;
 	array_tree_delete_all(AVL_LF(p));
 	AVL_LF(p) = NULL;
 	array_tree_delete_all(AVL_RT(p));
@@ -569,6 +639,276 @@ array_tree_next_node(array_tree * ptr, array_iter * key)
 
 
 
+/*****************************************************************
+ *  Packed Array Trie Routines
+ *****************************************************************/
+
+/*
+ * Packed arrays live in a radix trie (see array.h).  Item n is found by
+ * taking ARRAY_VNODE_BITS of n at a time, from the top bits down to the
+ * leaf.  Nodes shared with another array are copied before they are
+ * changed, so a write to a shared array copies one node per level
+ * instead of the entire array.
+ */
+
+#define ARRAY_VNODE_MINCAP 4
+
+static array_vnode *
+array_vnode_alloc(int leaf, int cap)
+{
+	array_vnode *node;
+	size_t size;
+
+	if (leaf) {
+		if (cap < 1)
+			cap = 1;
+		size = offsetof(array_vnode, u) + sizeof(array_data) * cap;
+	} else {
+		cap = ARRAY_VNODE_WIDTH;
+		size = sizeof(array_vnode);
+	}
+	node = (array_vnode *) malloc(size);
+	if (!node) {
+		fprintf(stderr, "array_vnode_alloc(): Out of Memory!\n");
+		abort();
+	}
+	node->refs = 1;
+	node->used = 0;
+	node->cap = (short)cap;
+	return node;
+}
+
+
+static void
+array_vnode_release(array_vnode * node, int shift)
+{
+	int i;
+
+	if (node == NULL)
+		return;
+	if (--node->refs > 0)
+		return;
+	if (shift == 0) {
+		for (i = node->used; i-- > 0;) {
+			CLEAR(&node->u.vals[i]);
+		}
+	} else {
+		for (i = node->used; i-- > 0;) {
+			array_vnode_release(node->u.kids[i], shift - ARRAY_VNODE_BITS);
+		}
+	}
+	free(node);
+}
+
+
+/*
+ * Makes the node at *hnode private to its parent, copying it first if
+ * it is shared.  Children of a copied node become shared by both copies.
+ */
+static array_vnode *
+array_vnode_own(array_vnode ** hnode, int shift)
+{
+	array_vnode *old = *hnode;
+	array_vnode *nu;
+	int i;
+
+	if (old->refs < 2)
+		return old;
+
+	nu = array_vnode_alloc(shift == 0, old->cap);
+	nu->used = old->used;
+	if (shift == 0) {
+		for (i = old->used; i-- > 0;) {
+			copyinst(&old->u.vals[i], &nu->u.vals[i]);
+		}
+	} else {
+		for (i = old->used; i-- > 0;) {
+			nu->u.kids[i] = old->u.kids[i];
+			nu->u.kids[i]->refs++;
+		}
+	}
+	old->refs--;
+	*hnode = nu;
+	return nu;
+}
+
+
+static array_data *
+array_vnode_get(array_vnode * node, int shift, int idx)
+{
+	for (; shift > 0; shift -= ARRAY_VNODE_BITS) {
+		node = node->u.kids[(idx >> shift) & ARRAY_VNODE_MASK];
+	}
+	return &node->u.vals[idx & ARRAY_VNODE_MASK];
+}
+
+
+/*
+ * Returns a writable slot for item idx of a packed array, which must be
+ * either an existing item or the one just past the end.  The path to the
+ * slot is copied if shared, and grown if idx is new.  New slots hold an
+ * integer 0, and the caller is responsible for updating arr->items.
+ */
+static array_data *
+array_packed_slot(stk_array * arr, int idx)
+{
+	array_vnode **hnode;
+	array_vnode *node;
+	int shift, slot;
+
+	if (arr->data.packed == NULL) {
+		arr->data.packed = array_vnode_alloc(1, ARRAY_VNODE_MINCAP);
+		arr->shift = 0;
+	} else if ((idx >> arr->shift) >= ARRAY_VNODE_WIDTH) {
+		node = array_vnode_alloc(0, 0);
+		node->u.kids[0] = arr->data.packed;
+		node->used = 1;
+		arr->data.packed = node;
+		arr->shift += ARRAY_VNODE_BITS;
+	}
+
+	hnode = &arr->data.packed;
+	shift = arr->shift;
+	for (;;) {
+		node = array_vnode_own(hnode, shift);
+		slot = (idx >> shift) & ARRAY_VNODE_MASK;
+		if (shift == 0)
+			break;
+		if (slot == node->used) {
+			node->u.kids[slot] = array_vnode_alloc(shift == ARRAY_VNODE_BITS,
+												   ARRAY_VNODE_WIDTH);
+			node->used++;
+		}
+		hnode = &node->u.kids[slot];
+		shift -= ARRAY_VNODE_BITS;
+	}
+
+	if (slot == node->used) {
+		if (node->used == node->cap) {
+			int cap = node->cap * 2;
+
+			if (cap > ARRAY_VNODE_WIDTH)
+				cap = ARRAY_VNODE_WIDTH;
+			node = (array_vnode *) realloc(node, offsetof(array_vnode, u) +
+										   sizeof(array_data) * cap);
+			if (node == NULL) {
+				fprintf(stderr, "array_packed_slot(): Out of Memory!\n");
+				abort();
+			}
+			node->cap = (short)cap;
+			*hnode = node;
+		}
+		node->used++;
+		node->u.vals[slot].type = PROG_INTEGER;
+		node->u.vals[slot].line = 0;
+		node->u.vals[slot].data.number = 0;
+	}
+	return &node->u.vals[slot];
+}
+
+
+/* Updates arr->valtype for an item of the given type being stored.
+   alone is set if that item will be the only one in the array. */
+static void
+array_packed_note(stk_array * arr, int type, int alone)
+{
+	if (alone)
+		arr->valtype = (short)type;
+	else if (arr->valtype != type)
+		arr->valtype = ARRAY_VALS_MIXED;
+}
+
+
+static void
+array_packed_append(stk_array * arr, array_data * item)
+{
+	array_packed_note(arr, item->type, arr->items == 0);
+	copyinst(item, array_packed_slot(arr, arr->items));
+	arr->items++;
+}
+
+
+/*
+ * Shortens a packed array to its first count items.  Nodes entirely
+ * inside the kept part are left alone, so they stay shared.
+ */
+static void
+array_packed_truncate(stk_array * arr, int count)
+{
+	array_vnode **hnode;
+	array_vnode *node;
+	int shift, last, i;
+
+	if (count >= arr->items)
+		return;
+	if (count <= 0) {
+		array_vnode_release(arr->data.packed, arr->shift);
+		arr->data.packed = NULL;
+		arr->shift = 0;
+		arr->items = 0;
+		arr->valtype = ARRAY_VALS_NONE;
+		return;
+	}
+
+	hnode = &arr->data.packed;
+	shift = arr->shift;
+	for (;;) {
+		node = array_vnode_own(hnode, shift);
+		last = ((count - 1) >> shift) & ARRAY_VNODE_MASK;
+		if (shift == 0) {
+			for (i = node->used; i-- > last + 1;) {
+				CLEAR(&node->u.vals[i]);
+			}
+			node->used = (short)(last + 1);
+			break;
+		}
+		for (i = node->used; i-- > last + 1;) {
+			array_vnode_release(node->u.kids[i], shift - ARRAY_VNODE_BITS);
+		}
+		node->used = (short)(last + 1);
+		hnode = &node->u.kids[last];
+		shift -= ARRAY_VNODE_BITS;
+	}
+	arr->items = count;
+
+	/* Drop root levels left with only one child.  They are private now. */
+	while (arr->shift > 0 && arr->data.packed->used == 1) {
+		node = arr->data.packed;
+		arr->data.packed = node->u.kids[0];
+		arr->shift -= ARRAY_VNODE_BITS;
+		free(node);
+	}
+}
+
+
+/*
+ * Cuts a packed array at item idx for an insert or delete.  The items
+ * from idx on are kept in *tail, which shares the old trie, so that
+ * array_packed_rejoin() can append them again after the new items.
+ */
+static void
+array_packed_cut(stk_array * arr, int idx, stk_array * tail)
+{
+	*tail = *arr;
+	if (tail->data.packed)
+		tail->data.packed->refs++;
+	array_packed_truncate(arr, idx);
+}
+
+
+static void
+array_packed_rejoin(stk_array * arr, stk_array * tail, int from)
+{
+	int i;
+
+	for (i = from; i < tail->items; i++) {
+		array_packed_append(arr, array_vnode_get(tail->data.packed, tail->shift, i));
+	}
+	array_vnode_release(tail->data.packed, tail->shift);
+}
+
+
+
 /*****************************************************************
  *  Stack Array Handling Routines
  *****************************************************************/
@@ -586,8 +926,10 @@ new_array(void)
 	}
 	nu->links = 1;
 	nu->type = ARRAY_UNDEFINED;
+	nu->valtype = ARRAY_VALS_NONE;
 	nu->items = 0;
 	nu->pinned = 0;
+	nu->shift = 0;
 	nu->data.packed = NULL;
 
 	return nu;
@@ -606,19 +948,15 @@ new_array_packed(int size)
 
 	nu = new_array();
 	assert(nu != NULL); /* Redundant, but I'm coding defensively */
-	nu->items = size;
 	nu->type = ARRAY_PACKED;
-	if (size < 1)
-		size = 1;
-	nu->data.packed = (array_data *) malloc(sizeof(array_data) * size);
-	if (nu->data.packed == NULL) {
-		fprintf(stderr, "new_array_packed(): Out of Memory!");
-		abort();
+	if (size > 0) {
+		nu->data.packed = array_vnode_alloc(1,
+				(size < ARRAY_VNODE_WIDTH) ? size : ARRAY_VNODE_WIDTH);
+		nu->valtype = PROG_INTEGER;
 	}
-	for (i = size; i-- > 0;) {
-		nu->data.packed[i].type = PROG_INTEGER;
-		nu->data.packed[i].line = 0;
-		nu->data.packed[i].data.number = 0;
+	for (i = 0; i < size; i++) {
+		(void) array_packed_slot(nu, i);
+		nu->items++;
 	}
 	return nu;
 }
@@ -657,38 +995,31 @@ array_decouple(stk_array * arr)
 		return NULL;
 	}
 
+	/*
+	 * The copy shares the whole trie or tree with the original.  Whichever
+	 * one is changed later copies just the nodes on the path it changes.
+	 */
 	nu = new_array();
 	assert(nu != NULL);  /* Redundant, but I'm coding defensively */
 	nu->pinned = arr->pinned;
 	nu->type = arr->type;
 	switch (arr->type) {
 	case ARRAY_PACKED:{
-			int i;
-
 			nu->items = arr->items;
-			nu->data.packed = (array_data *) malloc(sizeof(array_data) * arr->items);
-			if(nu->data.packed == NULL) {
-				fprintf(stderr, "array_decouple(): Out of Memory!");
-				abort();
-			}
-			for (i = arr->items; i-- > 0;) {
-				copyinst(&arr->data.packed[i], &nu->data.packed[i]);
-			}
+			nu->valtype = arr->valtype;
+			nu->shift = arr->shift;
+			nu->data.packed = arr->data.packed;
+			if (nu->data.packed)
+				nu->data.packed->refs++;
 			return nu;
 			break;
 		}
 
 	case ARRAY_DICTIONARY:{
-			array_iter idx;
-			array_data *val;
-
-			if (array_first(arr, &idx)) {
-				do {
-					val = array_getitem(arr, &idx);
-					assert(val != NULL);
-					array_setitem(&nu, &idx, val);
-				} while (array_next(arr, &idx));
-			}
+			nu->items = arr->items;
+			nu->data.dict = arr->data.dict;
+			if (nu->data.dict)
+				nu->data.dict->refs++;
 			return nu;
 			break;
 		}
@@ -740,18 +1071,13 @@ array_free(stk_array * arr)
 	}
 	switch (arr->type) {
 	case ARRAY_PACKED:{
-			int i;
-			
-			for (i = arr->items; i-- > 0;) {
-				CLEAR(&arr->data.packed[i]);
-			}
-			free(arr->data.packed);
+			array_vnode_release(arr->data.packed, arr->shift);
 			break;
 		}
 	case ARRAY_DICTIONARY:
 		array_tree_delete_all(arr->data.dict);
+		break;
 
-	/* FALLTHRU */
 	default:{
 			assert(0); /* should never get here */
 			break;
@@ -836,7 +1162,8 @@ array_contains_value(stk_array * arr, array_data * item)
 			int i;
 
 			for (i = arr->items; i-- > 0;) {
-				if (!array_tree_compare(&arr->data.packed[i], item, 0)) {
+				if (!array_tree_compare(array_vnode_get(arr->data.packed, arr->shift, i),
+										item, 0)) {
 					return 1;
 				}
 			}
@@ -1045,7 +1372,7 @@ array_getitem(stk_array * arr, array_iter * idx)
 		if (idx->data.number < 0 || idx->data.number >= arr->items) {
 			return NULL;
 		}
-		return &arr->data.packed[idx->data.number];
+		return array_vnode_get(arr->data.packed, arr->shift, idx->data.number);
 		break;
 
 	case ARRAY_DICTIONARY:{
@@ -1083,26 +1410,24 @@ array_setitem(stk_array ** harr, array_iter * idx, array_data * item)
 				return -1;
 			}
 			if (idx->data.number >= 0 && idx->data.number < arr->items) {
+				array_data *slot;
+
 				if (arr->links > 1 && !arr->pinned) {
 					arr->links--;
 					arr = *harr = array_decouple(arr);
 				}
-				CLEAR(&arr->data.packed[idx->data.number]);
-				copyinst(item, &arr->data.packed[idx->data.number]);
+				array_packed_note(arr, item->type, arr->items == 1);
+				slot = array_packed_slot(arr, idx->data.number);
+				CLEAR(slot);
+				copyinst(item, slot);
 				return arr->items;
 			} else if (idx->data.number == arr->items) {
 				if (arr->links > 1 && !arr->pinned) {
 					arr->links--;
 					arr = *harr = array_decouple(arr);
 				}
-				arr->data.packed = (array_data*)
-					realloc(arr->data.packed, sizeof(array_data) * (arr->items + 1));
-				if(arr->data.packed == NULL) {
-					fprintf(stderr,"array_setitem(): Out of Memory!");
-					abort();
-				}
-				copyinst(item, &arr->data.packed[arr->items]);
-				return (++arr->items);
+				array_packed_append(arr, item);
+				return arr->items;
 			} else {
 				return -1;
 			}
@@ -1116,7 +1441,7 @@ array_setitem(stk_array ** harr, array_iter * idx, array_data * item)
 				arr->links--;
 				arr = *harr = array_decouple(arr);
 			}
-			p = array_tree_find(arr->data.dict, idx);
+			p = array_tree_find_own(&arr->data.dict, idx);
 			if (p) {
 				CLEAR(&p->data);
 			} else {
@@ -1140,7 +1465,6 @@ int
 array_insertitem(stk_array ** harr, array_iter * idx, array_data * item)
 {
 	stk_array *arr;
-	int i;
 
 	assert(harr != NULL);
 	assert(*harr != NULL);
@@ -1163,17 +1487,15 @@ array_insertitem(stk_array ** harr, array_iter * idx, array_data * item)
 				arr->links--;
 				arr = *harr = array_decouple(arr);
 			}
-			arr->data.packed = (array_data*)
-					realloc(arr->data.packed, sizeof(array_data) * (arr->items + 1));
-			if(arr->data.packed == NULL) {
-				fprintf(stderr,"array_insertitem(): Out of Memory!");
-				abort();
-			}
-			for (i = arr->items++; i > idx->data.number; i--) {
-				copyinst(&arr->data.packed[i - 1], &arr->data.packed[i]);
-				CLEAR(&arr->data.packed[i - 1]);
+			if (idx->data.number == arr->items) {
+				array_packed_append(arr, item);
+			} else {
+				stk_array tail;
+
+				array_packed_cut(arr, idx->data.number, &tail);
+				array_packed_append(arr, item);
+				array_packed_rejoin(arr, &tail, idx->data.number);
 			}
-			copyinst(item, &arr->data.packed[i]);
 			return arr->items;
 			break;
 		}
@@ -1185,7 +1507,7 @@ array_insertitem(stk_array ** harr, array_iter * idx, array_data * item)
 				arr->links--;
 				arr = *harr = array_decouple(arr);
 			}
-			p = array_tree_find(arr->data.dict, idx);
+			p = array_tree_find_own(&arr->data.dict, idx);
 			if (p) {
 				CLEAR(&p->data);
 			} else {
@@ -1391,9 +1713,10 @@ int
 array_insertrange(stk_array ** harr, array_iter * start, stk_array * inarr)
 {
 	stk_array *arr;
+	stk_array tail;
 	array_data *itm;
 	array_iter idx;
-	array_iter didx;
+	int at;
 
 	assert(harr != NULL);
 	assert(*harr != NULL);
@@ -1422,32 +1745,18 @@ array_insertrange(stk_array ** harr, array_iter * start, stk_array * inarr)
 				arr->links--;
 				arr = *harr = array_decouple(arr);
 			}
-			arr->data.packed = (struct inst*)
-					realloc(arr->data.packed, sizeof(array_data) * (arr->items + inarr->items));
-			if(arr->data.packed == NULL) {
-				fprintf(stderr,"array_insertrange: Out of Memory!");
-				abort();
-			}
-
-			copyinst(start, &idx);
-			copyinst(start, &didx);
-			idx.data.number = arr->items - 1;
-			didx.data.number = arr->items + inarr->items - 1;
-			while (idx.data.number >= start->data.number) {
-				itm = array_getitem(arr, &idx);
-				copyinst(itm, &arr->data.packed[didx.data.number]);
-				CLEAR(itm);
-				idx.data.number--;
-				didx.data.number--;
-			}
+			at = start->data.number;
+			array_packed_cut(arr, at, &tail);
+			if (inarr == arr)
+				inarr = &tail;
 			if (array_first(inarr, &idx)) {
 				do {
 					itm = array_getitem(inarr, &idx);
-					copyinst(itm, &arr->data.packed[start->data.number]);
+					array_packed_append(arr, itm);
 					start->data.number++;
 				} while (array_next(inarr, &idx));
 			}
-			arr->items += inarr->items;
+			array_packed_rejoin(arr, &tail, at);
 			return arr->items;
 			break;
 		}
@@ -1477,10 +1786,9 @@ int
 array_delrange(stk_array ** harr, array_iter * start, array_iter * end)
 {
 	stk_array *arr;
-	array_data *itm;
-	int sidx, eidx, totsize;
+	int sidx, eidx;
 	array_iter idx;
-	array_iter didx;
+	array_iter eidxkey;
 
 	assert(harr != NULL);
 	assert(*harr != NULL);
@@ -1523,23 +1831,13 @@ array_delrange(stk_array ** harr, array_iter * start, array_iter * end)
 			}
 			start->data.number = sidx;
 			end->data.number = eidx;
-			copyinst(end, &idx);
-			copyinst(start, &didx);
-			idx.data.number += 1;
-			while (idx.data.number < arr->items) {
-				itm = array_getitem(arr, &idx);
-				copyinst(itm, &arr->data.packed[didx.data.number]);
-				CLEAR(itm);
-				idx.data.number++;
-				didx.data.number++;
-			}
-			arr->items -= (eidx - sidx + 1);
-			totsize = (arr->items)?arr->items:1;
-			arr->data.packed = (array_data*)
-					realloc(arr->data.packed, sizeof(array_data) * totsize);
-			if(arr->data.packed == NULL) {
-				fprintf(stderr,"array_delrange(): Out of Memory!");
-				abort();
+			if (eidx == arr->items - 1) {
+				array_packed_truncate(arr, sidx);
+			} else {
+				stk_array tail;
+
+				array_packed_cut(arr, sidx, &tail);
+				array_packed_rejoin(arr, &tail, eidx + 1);
 			}
 			return arr->items;
 			break;
@@ -1570,13 +1868,16 @@ array_delrange(stk_array ** harr, array_iter * start, array_iter * end)
 				arr->links--;
 				arr = *harr = array_decouple(arr);
 			}
+			/* Deleting a node may free it, so work from copies of the keys. */
 			copyinst(&s->key, &idx);
-			while (s && array_tree_compare(&s->key, &e->key, 0) <= 0) {
+			copyinst(&e->key, &eidxkey);
+			while (s && array_tree_compare(&s->key, &eidxkey, 0) <= 0) {
 				arr->data.dict = array_tree_delete(&s->key, arr->data.dict);
 				arr->items--;
 				s = array_tree_next_node(arr->data.dict, &idx);
 			}
 			CLEAR(&idx);
+			CLEAR(&eidxkey);
 			return arr->items;
 			break;
 		}
@@ -1707,19 +2008,41 @@ array_is_homogenous(stk_array * arr, int typ)
 {
 	array_iter idx;
 	array_data *dat;
-	int failedflag = 0;
 
 	assert(arr != NULL);
 
+	if (arr->type == ARRAY_PACKED && arr->valtype != ARRAY_VALS_MIXED) {
+		return (arr->valtype == typ || arr->valtype == ARRAY_VALS_NONE);
+	}
 	if (array_first(arr, &idx)) {
 		do {
 			dat = array_getitem(arr, &idx);
 			if (dat->type != typ) {
-				failedflag = 1;
+				CLEAR(&idx);
+				return 0;
 			}
 		} while (array_next(arr, &idx));
 	}
-	return (!failedflag);
+	return 1;
+}
+
+
+/*
+ * Finds the run of items of a packed array, starting with item idx, that
+ * are stored next to each other.  Sets *vals to the first of them, and
+ * returns how many there are, or 0 if idx is out of range.
+ */
+int
+array_packed_run(stk_array * arr, int idx, array_data ** vals)
+{
+	int count;
+
+	if (!arr || arr->type != ARRAY_PACKED || idx < 0 || idx >= arr->items) {
+		return 0;
+	}
+	*vals = array_vnode_get(arr->data.packed, arr->shift, idx);
+	count = ARRAY_VNODE_WIDTH - (idx & ARRAY_VNODE_MASK);
+	return (count < arr->items - idx) ? count : arr->items - idx;
 }
 
 
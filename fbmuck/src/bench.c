@@ -0,0 +1,274 @@
+/*
+ * fbmuck-bench: replays a trace recorded with "fbmuck -record" against a
+ * database, with no network connections, and reports how quickly the
+ * server got through it.
+ *
+ * Usage: fbmuck-bench [-gamedir PATH] [-seed N] dbfile tracefile
+ *
+ * Commands are run one at a time, in the order they were recorded, with
+ * command quotas lifted, so that a run does the same work each time on
+ * any machine.  Events that come due on the timequeue run between
+ * commands, as they do in the server.  The database file isn't changed:
+ * if the trace causes a dump, it goes to BENCH_DUMPFILE instead.
+ *
+ * Prints commands per second, per-command latency percentiles, how much
+ * the heap grew, and how much of the time went on MUF and on MPI, going
+ * by the per-program and per-object profiling times.
+ */
+
+#include "config.h"
+#include "db.h"
+#include "interface.h"
+#include "params.h"
+#include "tune.h"
+#include "externs.h"
+
+#if defined(HAVE_MALLINFO) && defined(HAVE_MALLOC_H)
+# include <malloc.h>
+#else
+# undef HAVE_MALLINFO
+#endif
+
+#define BENCH_DUMPFILE "fbmuck-bench.db"
+
+/* How many passes of the main loop to wait for a command to be taken. */
+#define BENCH_MAX_SLICES 1000
+
+/* How many passes to allow for due events, once the trace is done. */
+#define BENCH_DRAIN_SLICES 1000
+
+static double *latencies;
+static int nlatencies, maxlatencies;
+
+static double
+secs_since(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+static void
+add_latency(double secs)
+{
+	if (nlatencies == maxlatencies) {
+		maxlatencies = maxlatencies ? maxlatencies * 2 : 1024;
+		latencies = (double *) realloc(latencies, maxlatencies * sizeof(double));
+		if (!latencies) {
+			fprintf(stderr, "fbmuck-bench: out of memory\n");
+			exit(1);
+		}
+	}
+	latencies[nlatencies++] = secs;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+/* The latency that the given fraction of commands came in under. */
+static double
+percentile(double frac)
+{
+	int idx = (int) (frac * nlatencies + 0.999999) - 1;
+
+	if (idx < 0)
+		idx = 0;
+	return latencies[idx];
+}
+
+static double
+timeval_secs(struct timeval tv)
+{
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Adds up the MUF and MPI profiling times of every object. */
+static void
+profile_times(double *muf, double *mpi)
+{
+	dbref i;
+
+	*muf = *mpi = 0.0;
+	for (i = 0; i < db_top; i++) {
+		if (Typeof(i) == TYPE_PROGRAM && PROGRAM_SP(i))
+			*muf += timeval_secs(PROGRAM_PROFTIME(i));
+		*mpi += timeval_secs(DBFETCH(i)->mpi_proftime);
+	}
+}
+
+static long
+heap_in_use(void)
+{
+#if defined(HAVE_MALLINFO2)
+	struct mallinfo2 mi = mallinfo2();
+
+	return (long) (mi.uordblks + mi.hblkhd);
+#elif defined(HAVE_MALLINFO)
+	struct mallinfo mi = mallinfo();
+
+	return (long) mi.uordblks + mi.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+/* Runs passes of the main loop until descr has taken all its input. */
+static int
+wait_for_input(int descr)
+{
+	int slices;
+
+	for (slices = 0; slices < BENCH_MAX_SLICES; slices++) {
+		replay_slice();
+		if (replay_queued(descr) <= 0)
+			return 1;
+	}
+	return 0;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-gamedir PATH] [-seed N] dbfile tracefile\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	static int descrs[FD_SETSIZE];
+	char line[MAX_COMMAND_LEN + 32];
+	const char *dbfile = NULL, *tracefile = NULL;
+	struct timeval start, cmdstart;
+	double elapsed, muf0, mpi0, muf1, mpi1;
+	long heap0, heap1;
+	int seed = 1;
+	int commands = 0, stalled = 0, skipped = 0;
+	int i, traced, descr, slices;
+	char event, *text, *ptr;
+	FILE *trace;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-gamedir") && i + 1 < argc) {
+			if (chdir(argv[++i])) {
+				perror("cd to gamedir");
+				exit(4);
+			}
+		} else if (!strcmp(argv[i], "-seed") && i + 1 < argc) {
+			seed = atoi(argv[++i]);
+		} else if (argv[i][0] == '-') {
+			usage(argv[0]);
+		} else if (!dbfile) {
+			dbfile = argv[i];
+		} else if (!tracefile) {
+			tracefile = argv[i];
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if (!tracefile)
+		usage(argv[0]);
+	if (!(trace = fopen(tracefile, "rb"))) {
+		perror(tracefile);
+		exit(1);
+	}
+
+	replay_init();
+	if (init_game(dbfile, BENCH_DUMPFILE) < 0) {
+		fprintf(stderr, "Couldn't load %s!\n", dbfile);
+		exit(2);
+	}
+	SRANDOM(seed);
+	for (i = 0; i < FD_SETSIZE; i++)
+		descrs[i] = -1;
+
+	profile_times(&muf0, &mpi0);
+	heap0 = heap_in_use();
+	gettimeofday(&start, NULL);
+
+	while (!shutdown_flag && fgets(line, sizeof(line), trace)) {
+		if ((ptr = index(line, '\n')))
+			*ptr = '\0';
+		traced = strtol(line, &ptr, 10);
+		if (ptr == line || *ptr++ != ' ' || traced < 0 || traced >= FD_SETSIZE) {
+			skipped++;
+			continue;
+		}
+		event = *ptr;
+		text = ptr[0] && ptr[1] == ' ' ? ptr + 2 : NULL;
+
+		switch (event) {
+		case '+':
+			if ((descrs[traced] = replay_connect()) < 0) {
+				fprintf(stderr, "fbmuck-bench: can't open a connection.\n");
+				exit(1);
+			}
+			replay_slice();
+			break;
+		case '-':
+			if (descrs[traced] >= 0)
+				replay_disconnect(descrs[traced]);
+			descrs[traced] = -1;
+			replay_slice();
+			break;
+		case '>':
+			descr = descrs[traced];
+			if (!text || descr < 0 || !replay_input(descr, text)) {
+				skipped++;
+				break;
+			}
+			gettimeofday(&cmdstart, NULL);
+			if (!wait_for_input(descr))
+				stalled++;
+			add_latency(secs_since(&cmdstart));
+			commands++;
+			break;
+		default:
+			skipped++;
+			break;
+		}
+	}
+	for (slices = 0; slices < BENCH_DRAIN_SLICES && next_muckevent_time() == 0; slices++)
+		replay_slice();
+
+	elapsed = secs_since(&start);
+	heap1 = heap_in_use();
+	profile_times(&muf1, &mpi1);
+	fclose(trace);
+
+	if (!commands) {
+		fprintf(stderr, "fbmuck-bench: no commands in %s\n", tracefile);
+		exit(1);
+	}
+	qsort(latencies, nlatencies, sizeof(double), cmp_double);
+
+	printf("commands:      %d", commands);
+	if (stalled)
+		printf(" (%d not taken after %d passes)", stalled, BENCH_MAX_SLICES);
+	if (skipped)
+		printf(" (%d trace lines skipped)", skipped);
+	printf("\n");
+	printf("elapsed:       %.3f s\n", elapsed);
+	printf("commands/sec:  %.1f\n", commands / elapsed);
+	printf("latency p50:   %.1f us\n", percentile(0.50) * 1e6);
+	printf("latency p99:   %.1f us\n", percentile(0.99) * 1e6);
+	printf("latency p999:  %.1f us\n", percentile(0.999) * 1e6);
+	printf("latency max:   %.1f us\n", latencies[nlatencies - 1] * 1e6);
+#ifdef HAVE_MALLINFO
+	printf("heap growth:   %ld bytes\n", heap1 - heap0);
+#endif
+	printf("MUF time:      %.3f s (%.1f%%)\n", muf1 - muf0, (muf1 - muf0) * 100 / elapsed);
+	printf("MPI time:      %.3f s (%.1f%%)\n", mpi1 - mpi0, (mpi1 - mpi0) * 100 / elapsed);
+
+#ifdef MALLOC_PROFILING
+	CrT_summarize_to_file("malloc_log", "fbmuck-bench");
+#endif
+	return 0;
+}
@@ -44,7 +44,7 @@ static int IN_FOR;
 static int IN_TRYPOP;
 
 
-static hash_tab primitive_list[COMP_HASH_SIZE];
+static hash_tab primitive_list;
 
 struct CONTROL_STACK {
 	short type;
@@ -130,7 +130,7 @@ typedef struct COMPILE_STATE_T {
 	int descr;					/* the descriptor that initiated compiling */
 	int force_err_display;		/* If true, always show compiler errors. */
 	struct INTERMEDIATE *nextinst;
-	hash_tab defhash[DEFHASHSIZE];
+	hash_tab defhash;
 } COMPSTATE;
 
 
@@ -386,7 +386,7 @@ size_pubs(struct publics *mypubs)
 char *
 expand_def(COMPSTATE * cstat, const char *defname)
 {
-	hash_data *exp = find_hash(defname, cstat->defhash, DEFHASHSIZE);
+	hash_data *exp = find_hash(defname, &cstat->defhash);
 
 	if (!exp) {
 		if (*defname == BEGINMACRO) {
@@ -402,11 +402,11 @@ expand_def(COMPSTATE * cstat, const char *defname)
 void
 kill_def(COMPSTATE * cstat, const char *defname)
 {
-	hash_data *exp = find_hash(defname, cstat->defhash, DEFHASHSIZE);
+	hash_data *exp = find_hash(defname, &cstat->defhash);
 
 	if (exp) {
 		free(exp->pval);
-		(void) free_hash(defname, cstat->defhash, DEFHASHSIZE);
+		(void) free_hash(defname, &cstat->defhash);
 	}
 }
 
@@ -418,7 +418,7 @@ insert_def(COMPSTATE * cstat, const char *defname, const char *deff)
 
 	(void) kill_def(cstat, defname);
 	hd.pval = (void *) string_dup(deff);
-	(void) add_hash(defname, hd, cstat->defhash, DEFHASHSIZE);
+	(void) add_hash(defname, hd, &cstat->defhash);
 }
 
 
@@ -435,7 +435,7 @@ insert_intdef(COMPSTATE * cstat, const char *defname, int deff)
 void
 purge_defs(COMPSTATE * cstat)
 {
-	kill_hash(cstat->defhash, DEFHASHSIZE, 1);
+	kill_hash(&cstat->defhash, 1);
 }
 
 
@@ -575,11 +575,7 @@ void
 init_defs(COMPSTATE * cstat)
 {
 	/* initialize hash table */
-	int i;
-
-	for (i = 0; i < DEFHASHSIZE; i++) {
-		cstat->defhash[i] = NULL;
-	}
+	hash_init(&cstat->defhash, DEFHASHSIZE, 0);
 
 	/* Create standard server defines */
 	include_internal_defs(cstat);
@@ -996,7 +992,7 @@ OptimizeIntermediate(COMPSTATE * cstat, int force_err_display)
 						if (IntermediateIsPrimitive(curr->next, StrcmpNo)) {
 							if (IntermediateIsInteger(curr->next->next, 0)) {
 								if (IntermediateIsPrimitive(curr->next->next->next, EqualsNo)) {
-									if (curr->in.data.string)
+									if (curr->in.data.string && --curr->in.data.string->links == 0)
 										free((void *) curr->in.data.string);
 									curr->in.type = PROG_PRIMITIVE;
 									curr->in.data.number = NotNo;
@@ -3562,7 +3558,7 @@ get_primitive(const char *token)
 {
 	hash_data *hd;
 
-	if ((hd = find_hash(token, primitive_list, COMP_HASH_SIZE)) == NULL)
+	if ((hd = find_hash(token, &primitive_list)) == NULL)
 		return 0;
 	else {
 		return (hd->ival);
@@ -3616,7 +3612,7 @@ free_intermediate_node(struct INTERMEDIATE *wd)
 	int varcnt, j;
 
 	if (wd->in.type == PROG_STRING) {
-		if (wd->in.data.string)
+		if (wd->in.data.string && --wd->in.data.string->links == 0)
 			free((void *) wd->in.data.string);
 	}
 	if (wd->in.type == PROG_FUNCTION) {
@@ -3931,7 +3927,7 @@ add_primitive(int val)
 	hash_data hd;
 
 	hd.ival = val;
-	if (add_hash(base_inst[val - BASE_MIN], hd, primitive_list, COMP_HASH_SIZE) == NULL)
+	if (add_hash(base_inst[val - BASE_MIN], hd, &primitive_list) == NULL)
 		panic("Out of memory");
 	else
 		return;
@@ -3940,7 +3936,7 @@ add_primitive(int val)
 void
 clear_primitives(void)
 {
-	kill_hash(primitive_list, COMP_HASH_SIZE, 0);
+	kill_hash(&primitive_list, 0);
 	return;
 }
 
@@ -3950,6 +3946,7 @@ init_primitives(void)
 	int i;
 
 	clear_primitives();
+	hash_init(&primitive_list, COMP_HASH_SIZE, 0);
 	for (i = BASE_MIN; i <= BASE_MAX; i++) {
 		add_primitive(i);
 	}
@@ -3958,5 +3955,6 @@ init_primitives(void)
 	IN_FOR = get_primitive(" FOR");
 	IN_FOREACH = get_primitive(" FOREACH");
 	IN_TRYPOP = get_primitive(" TRYPOP");
+	init_slice_costs();
 	log_status("MUF: %d primitives exist.", BASE_MAX);
 }
@@ -0,0 +1,288 @@
+/* Per-owner CPU time accounting and budgets for MUF and MPI */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "db.h"
+#include "tune.h"
+#include "externs.h"
+#include "interface.h"
+
+/*
+ * Every stretch of time a MUF program runs for is already measured by
+ * calc_profile_timing() for @muftops, and every MPI parse by
+ * do_parse_mesg() for @mpitops.  The same measurements are also charged
+ * here to the owner of the program that started the process, or to the
+ * owner of the object the MPI is on.
+ *
+ * Each owner's charges are kept in CPU_WINDOW_BUCKETS buckets, which
+ * together cover the last '@tune cpu_window'.  A bucket is reused as
+ * soon as it falls out of the window, so the sum of the buckets is a
+ * sliding total of recent CPU use.  When '@tune cpu_budget_percent' is
+ * set, and a non-wizard owner's total is over that share of the window,
+ * their timequeue entries are put back instead of run when they come
+ * due.  The further over budget they are, the longer the entries wait,
+ * so a runaway background loop gets a small share of the server while
+ * everyone else's programs carry on.  Commands typed in are never held.
+ */
+
+struct cpu_account {
+	long usecs[CPU_WINDOW_BUCKETS];	/* CPU time charged in each bucket */
+	long bucket[CPU_WINDOW_BUCKETS];	/* Which span of time each holds */
+	double muf_secs;			/* MUF time since startup or reset */
+	double mpi_secs;			/* MPI time since startup or reset */
+	long deferred;				/* Timequeue entries held back */
+};
+
+struct cpu_top_line {
+	dbref owner;
+	long used;
+};
+
+static struct cpu_account **accounts = NULL;
+static dbref accounts_size = 0;
+static int bucket_secs = 0;
+
+
+/*
+ * How many seconds each bucket covers.  If the window has been retuned,
+ * the buckets no longer mean what they did, so they are all emptied.
+ */
+static int
+cpuacct_bucket_secs(void)
+{
+	int secs = tp_cpu_window / CPU_WINDOW_BUCKETS;
+	dbref i;
+
+	if (secs < 1)
+		secs = 1;
+	if (secs != bucket_secs) {
+		for (i = 0; i < accounts_size; i++) {
+			if (accounts[i]) {
+				memset(accounts[i]->usecs, 0, sizeof(accounts[i]->usecs));
+				memset(accounts[i]->bucket, 0, sizeof(accounts[i]->bucket));
+			}
+		}
+		bucket_secs = secs;
+	}
+	return secs;
+}
+
+
+static struct cpu_account *
+cpuacct_get(dbref owner, int create)
+{
+	struct cpu_account **newaccounts;
+	dbref newsize;
+
+	if (owner < 0 || owner >= db_top)
+		return NULL;
+	if (owner >= accounts_size) {
+		if (!create)
+			return NULL;
+		newsize = accounts_size ? accounts_size : 1024;
+		while (newsize <= owner)
+			newsize *= 2;
+		newaccounts = (struct cpu_account **) realloc(accounts, newsize * sizeof(*accounts));
+		if (!newaccounts)
+			return NULL;
+		accounts = newaccounts;
+		memset(accounts + accounts_size, 0, (newsize - accounts_size) * sizeof(*accounts));
+		accounts_size = newsize;
+	}
+	if (!accounts[owner] && create)
+		accounts[owner] = (struct cpu_account *) calloc(1, sizeof(struct cpu_account));
+	return accounts[owner];
+}
+
+
+/* Charges owner for tv of CPU time, spent in MPI if mpi is set. */
+void
+cpuacct_charge(dbref owner, struct timeval *tv, int mpi)
+{
+	struct cpu_account *acct;
+	long now, usecs;
+	int i;
+
+	if (!(acct = cpuacct_get(owner, 1)))
+		return;
+	usecs = tv->tv_sec * 1000000L + tv->tv_usec;
+	now = (long) time(NULL) / cpuacct_bucket_secs();
+	i = now % CPU_WINDOW_BUCKETS;
+	if (acct->bucket[i] != now) {
+		acct->bucket[i] = now;
+		acct->usecs[i] = 0;
+	}
+	acct->usecs[i] += usecs;
+	if (mpi)
+		acct->mpi_secs += usecs / 1000000.0;
+	else
+		acct->muf_secs += usecs / 1000000.0;
+}
+
+
+/* Microseconds of CPU owner has used within the window. */
+static long
+cpuacct_window_usecs(struct cpu_account *acct)
+{
+	long now = (long) time(NULL) / cpuacct_bucket_secs();
+	long used = 0;
+	int i;
+
+	for (i = 0; i < CPU_WINDOW_BUCKETS; i++)
+		if (acct->bucket[i] > now - CPU_WINDOW_BUCKETS)
+			used += acct->usecs[i];
+	return used;
+}
+
+
+/* The share of the window each owner may use, in microseconds. */
+static double
+cpuacct_budget_usecs(void)
+{
+	return (double) tp_cpu_window * 10000.0 * tp_cpu_budget_percent;
+}
+
+
+/*
+ * How many seconds a timequeue entry belonging to owner should be held
+ * back for, or 0 if it can run now.  Each time an entry is held back
+ * it's counted against the owner, for @top.
+ */
+int
+cpuacct_throttle_delay(dbref owner)
+{
+	struct cpu_account *acct;
+	double budget, used, delay;
+
+	if (tp_cpu_budget_percent <= 0 || tp_cpu_window <= 0)
+		return 0;
+	if (!(acct = cpuacct_get(owner, 0)) || Wizard(owner))
+		return 0;
+	budget = cpuacct_budget_usecs();
+	used = cpuacct_window_usecs(acct);
+	if (used <= budget)
+		return 0;
+	delay = bucket_secs * used / budget;
+	if (delay > tp_cpu_window)
+		delay = tp_cpu_window;
+	acct->deferred++;
+	return (int) delay;
+}
+
+
+void
+cpuacct_free(void)
+{
+	dbref i;
+
+	for (i = 0; i < accounts_size; i++)
+		if (accounts[i])
+			free(accounts[i]);
+	free(accounts);
+	accounts = NULL;
+	accounts_size = 0;
+}
+
+
+static int
+cpu_top_compare(const void *a, const void *b)
+{
+	const struct cpu_top_line *la = (const struct cpu_top_line *) a;
+	const struct cpu_top_line *lb = (const struct cpu_top_line *) b;
+
+	if (la->used != lb->used)
+		return (la->used < lb->used) ? 1 : -1;
+	return la->owner - lb->owner;
+}
+
+
+static void
+cpu_top_notify(dbref player, dbref owner, struct cpu_account *acct, long used)
+{
+	char buf[BUFFER_LEN];
+	double budget = cpuacct_budget_usecs();
+
+	snprintf(buf, sizeof(buf), "%-20.20s %8.3f %6.2f %6s %11.3f %11.3f %8ld",
+			 NAME(owner), used / 1000000.0,
+			 tp_cpu_window > 0 ? used / (tp_cpu_window * 10000.0) : 0.0,
+			 budget > 0 ? (used > budget ? (Wizard(owner) ? "over" : "held") : "ok") : "-",
+			 acct->muf_secs, acct->mpi_secs, acct->deferred);
+	notify(player, buf);
+}
+
+
+/*
+ * '@top [count|reset]'.  Shows the owners who've used the most CPU within
+ * the window, busiest first.  Non-wizards only see themselves.
+ */
+void
+do_cpu_top(dbref player, const char *arg)
+{
+	struct cpu_top_line *lines;
+	struct cpu_account *acct;
+	char buf[BUFFER_LEN];
+	int count = atoi(arg);
+	int nlines = 0;
+	int i;
+	dbref owner;
+
+	if (!string_compare(arg, "reset")) {
+		if (!Wizard(OWNER(player))) {
+			notify(player, "Permission denied.");
+			return;
+		}
+		for (owner = 0; owner < accounts_size; owner++) {
+			if ((acct = accounts[owner])) {
+				acct->muf_secs = acct->mpi_secs = 0.0;
+				acct->deferred = 0;
+			}
+		}
+		notify(player, "CPU totals cleared.");
+		return;
+	}
+	if (count < 0) {
+		notify(player, "Count has to be a positive number.");
+		return;
+	} else if (count == 0) {
+		count = 10;
+	}
+
+	if (tp_cpu_budget_percent > 0)
+		snprintf(buf, sizeof(buf), "CPU use over the last %d seconds.  Budget is %d%% per owner.",
+				 tp_cpu_window, tp_cpu_budget_percent);
+	else
+		snprintf(buf, sizeof(buf), "CPU use over the last %d seconds.  No budget is set.",
+				 tp_cpu_window);
+	notify(player, buf);
+	notify(player, "Owner                  Window   %CPU Budget   MUF total   MPI total Deferred");
+
+	if (!Wizard(OWNER(player))) {
+		owner = OWNER(player);
+		if ((acct = cpuacct_get(owner, 0)))
+			cpu_top_notify(player, owner, acct, cpuacct_window_usecs(acct));
+		return;
+	}
+
+	lines = (struct cpu_top_line *) malloc((accounts_size ? accounts_size : 1) * sizeof(*lines));
+	if (!lines) {
+		notify(player, "Out of memory.");
+		return;
+	}
+	for (owner = 0; owner < accounts_size && owner < db_top; owner++) {
+		if ((acct = accounts[owner]) && Typeof(owner) == TYPE_PLAYER) {
+			lines[nlines].owner = owner;
+			lines[nlines].used = cpuacct_window_usecs(acct);
+			nlines++;
+		}
+	}
+	qsort(lines, nlines, sizeof(*lines), cpu_top_compare);
+	for (i = 0; i < nlines && i < count; i++)
+		cpu_top_notify(player, lines[i].owner, accounts[lines[i].owner], lines[i].used);
+	free(lines);
+	snprintf(buf, sizeof(buf), "*Done*  %d owners have used CPU.", nlines);
+	notify(player, buf);
+}
@@ -934,6 +934,9 @@ copy_one_prop(dbref player, dbref source, dbref destination, char *propname)
 			case PROP_REFTYP:
 				newprop.data = currprop->data;
 				break;
+			case PROP_SETTYP:
+				newprop.data.set = refset_copy((currprop->data).set);
+				break;
 			case PROP_LOKTYP:
 				newprop.data.lok = copy_bool((currprop->data).lok);
 			case PROP_DIRTYP:
@@ -565,6 +565,20 @@ CrT_summarize_to_file(const char *file, const char *comment)
 	fclose(summarize_fd);
 }
 
+/* }}} */
+/* {{{ CrT_total_allocs -- Count the allocations made so far.		*/
+
+long
+CrT_total_allocs(void)
+{
+	Block b;
+	long total = 0;
+
+	for (b = block_list; b; b = b->next)
+		total += b->tot_allocs_done;
+	return total;
+}
+
 /* }}} */
 
 #ifdef MALLOC_PROFILING_EXTRA
@@ -770,8 +784,14 @@ CrT_calloc(size_t num, size_t siz, const char *file, int line)
 void *
 CrT_realloc(void *p, size_t size, const char *file, int line)
 {
-	Header m = ((Header) p) - 1;
-	Block b = m->b;
+	Header m;
+	Block b;
+
+	/* As with realloc(), a NULL block gets a new one. */
+	if (!p)
+		return CrT_malloc(size, file, line);
+	m = ((Header) p) - 1;
+	b = m->b;
 
 #ifdef MALLOC_PROFILING_EXTRA
 	/* Look around for trashed ram blocks: */
@@ -839,8 +859,14 @@ CrT_realloc(void *p, size_t size, const char *file, int line)
 void
 CrT_free(void *p, const char *file, int line)
 {
-	Header m = ((Header) p) - 1;
-	Block b = m->b;
+	Header m;
+	Block b;
+
+	/* As with free(), a NULL block is ignored. */
+	if (!p)
+		return;
+	m = ((Header) p) - 1;
+	b = m->b;
 
 #ifdef MALLOC_PROFILING_EXTRA
 	/* Look around for trashed ram blocks: */
@@ -904,21 +930,7 @@ CrT_alloc_string(const char *string, const char *file, int line)
 struct shared_string *
 CrT_alloc_prog_string(const char *s, const char *file, int line)
 {
-	struct shared_string *ss;
-	int length;
-
-	if (s == NULL || *s == '\0')
-		return (NULL);
-
-	length = strlen(s);
-	if ((ss = (struct shared_string *)
-		 CrT_malloc(sizeof(struct shared_string) + length, file, line)) == NULL)
-		abort();
-
-	ss->links = 1;
-	ss->length = length;
-	bcopy(s, ss->data, ss->length + 1);
-	return (ss);
+	return new_prog_string(s, CrT_malloc, file, line);
 }
 
 /* }}} */
@@ -939,6 +951,679 @@ CrT_string_dup(const char *s, const char *file, int line)
 
 #endif							/* MALLOC_PROFILING */
 
+#ifdef HEAP_SAMPLING
+
+/* {{{ Sampling heap profiler						*/
+
+/*
+ * Rather than keeping a header on every block, the sampler has malloc()
+ * count down a byte budget drawn at random, averaging CrT_sample_rate
+ * bytes, and records the block that takes it past zero.  A block of s
+ * bytes is picked with a chance of 1-exp(-s/rate), so each sample is
+ * weighted by the inverse of that, and sums over the samples estimate
+ * the live heap without bias.  Frees are matched against the sampled
+ * blocks through a small counting filter, so that freeing a block that
+ * was never sampled, which is nearly all of them, takes no lock.
+ *
+ * The countdown itself is shared by all threads without a lock.  Losing
+ * an update now and then only shifts where the next sample lands.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+
+#define CRT_FILTER_SIZE		(1 << 18)	/* Slots in the free() filter. */
+#define CRT_SITE_BUCKETS	1024	/* Buckets in the call site hash. */
+#define CRT_SAMPLES_MIN		1024	/* Starting size of the sample table. */
+
+/* One sampled block that hasn't been freed yet. */
+struct CrT_sample {
+	void *ptr;
+	int tag;
+	double bytes;
+	double blocks;
+	struct CrT_sample_site *site;
+	struct CrT_sample_owner *program;
+	struct CrT_sample_owner *proptree;
+};
+
+const char *CrT_tag_names[CRT_TAGS] = {
+	"other", "props", "arrays", "strings", "frames", "text", "programs"
+};
+
+long CrT_sample_rate = 0;
+int CrT_sample_program = NOTHING;
+
+static volatile long sample_countdown = 0;
+static unsigned long sample_rng = 0;
+
+static pthread_mutex_t sample_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t prop_context_once = PTHREAD_ONCE_INIT;
+static pthread_key_t prop_context_key;
+
+static volatile unsigned char sample_filter[CRT_FILTER_SIZE];
+
+/* Open addressed table of live samples, keyed by address. */
+static struct CrT_sample *sample_table = NULL;
+static size_t sample_table_size = 0;
+static volatile size_t sample_count = 0;
+
+static struct CrT_sample_site *site_buckets[CRT_SITE_BUCKETS];
+static int site_count = 0;
+
+static struct CrT_sample_owner **owner_buckets = NULL;
+static size_t owner_buckets_size = 0;
+static size_t owner_count = 0;
+
+static double total_bytes = 0.0;
+static double total_blocks = 0.0;
+static double tag_bytes[CRT_TAGS];
+
+/* Files whose allocations get a tag of their own. */
+static struct {
+	const char *file;
+	int tag;
+} sample_file_tags[] = {
+	{"props.c", CRT_TAG_PROPS},
+	{"property.c", CRT_TAG_PROPS},
+	{"propdirs.c", CRT_TAG_PROPS},
+	{"diskprop.c", CRT_TAG_PROPS},
+	{"array.c", CRT_TAG_ARRAYS},
+	{"p_array.c", CRT_TAG_ARRAYS},
+	{"stringutil.c", CRT_TAG_STRINGS},
+	{"interp.c", CRT_TAG_FRAMES},
+	{"interface.c", CRT_TAG_TEXT},
+	{"compile.c", CRT_TAG_PROGRAMS},
+	{"edit.c", CRT_TAG_PROGRAMS},
+	{NULL, CRT_TAG_OTHER}
+};
+
+/* {{{ sample_hash -- Spread block addresses over the tables.		*/
+
+static unsigned long
+sample_hash(const void *p)
+{
+	unsigned long h = (unsigned long) p >> 4;
+
+	h ^= h >> 16;
+	h *= 0x45d9f3bUL;
+	h ^= h >> 16;
+	return h;
+}
+
+#define FILTER_SLOT(p) (sample_hash(p) & (CRT_FILTER_SIZE - 1))
+
+/* }}} */
+/* {{{ sample_interval -- Draw the number of bytes to the next sample.	*/
+
+static long
+sample_interval(long rate)
+{
+	double u, n;
+
+	/* xorshift, kept to 32 bits so it acts the same everywhere. */
+	sample_rng ^= (sample_rng << 13) & 0xffffffffUL;
+	sample_rng ^= sample_rng >> 17;
+	sample_rng ^= (sample_rng << 5) & 0xffffffffUL;
+	u = ((double) sample_rng + 0.5) / 4294967296.0;
+	n = -log(u) * rate;
+	return n < 1.0 ? 1 : (long) n;
+}
+
+/* }}} */
+/* {{{ sample table -- Find, add and delete live samples.		*/
+
+static struct CrT_sample *
+sample_find(const void *p)
+{
+	size_t mask = sample_table_size - 1;
+	size_t i;
+
+	if (!sample_table)
+		return NULL;
+	for (i = sample_hash(p) & mask; sample_table[i].ptr; i = (i + 1) & mask)
+		if (sample_table[i].ptr == p)
+			return &sample_table[i];
+	return NULL;
+}
+
+static int
+sample_grow(void)
+{
+	struct CrT_sample *old = sample_table;
+	size_t oldsize = sample_table_size;
+	size_t newsize = oldsize ? oldsize * 2 : CRT_SAMPLES_MIN;
+	size_t i, j;
+
+	sample_table = (struct CrT_sample *) calloc(newsize, sizeof(struct CrT_sample));
+	if (!sample_table) {
+		sample_table = old;
+		return 0;
+	}
+	sample_table_size = newsize;
+	for (i = 0; i < oldsize; i++) {
+		if (!old[i].ptr)
+			continue;
+		for (j = sample_hash(old[i].ptr) & (newsize - 1); sample_table[j].ptr;
+			 j = (j + 1) & (newsize - 1)) ;
+		sample_table[j] = old[i];
+	}
+	free(old);
+	return 1;
+}
+
+static struct CrT_sample *
+sample_insert(void *p)
+{
+	size_t mask, i;
+
+	if ((sample_count + 1) * 2 > sample_table_size && !sample_grow())
+		return NULL;
+	mask = sample_table_size - 1;
+	for (i = sample_hash(p) & mask; sample_table[i].ptr; i = (i + 1) & mask) ;
+	memset(&sample_table[i], 0, sizeof(struct CrT_sample));
+	sample_table[i].ptr = p;
+	sample_count++;
+	return &sample_table[i];
+}
+
+static void
+sample_delete(struct CrT_sample *s)
+{
+	size_t mask = sample_table_size - 1;
+	size_t i = s - sample_table;
+	size_t j = i;
+	size_t k;
+
+	/* Shift later entries of the run back, so lookups needn't skip holes. */
+	for (;;) {
+		j = (j + 1) & mask;
+		if (!sample_table[j].ptr)
+			break;
+		k = sample_hash(sample_table[j].ptr) & mask;
+		if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+			sample_table[i] = sample_table[j];
+			i = j;
+		}
+	}
+	sample_table[i].ptr = NULL;
+	sample_count--;
+}
+
+/* }}} */
+/* {{{ sample_site -- Find or add the record for a call site.		*/
+
+static struct CrT_sample_site *
+sample_site(const char *file, int line, int tag)
+{
+	int bucket = (line * 31 + tag) & (CRT_SITE_BUCKETS - 1);
+	struct CrT_sample_site *s;
+
+	for (s = site_buckets[bucket]; s; s = s->next)
+		if (s->line == line && s->tag == tag && (s->file == file || !strcmp(s->file, file)))
+			return s;
+	if (!(s = (struct CrT_sample_site *) calloc(1, sizeof(struct CrT_sample_site))))
+		return NULL;
+	s->file = file;
+	s->line = line;
+	s->tag = tag;
+	s->next = site_buckets[bucket];
+	site_buckets[bucket] = s;
+	site_count++;
+	return s;
+}
+
+/* }}} */
+/* {{{ sample_owner -- Find or add the record for a program or proptree. */
+
+static unsigned long
+owner_hash(int obj, const char *propdir)
+{
+	unsigned long h = (unsigned long) obj * 2654435761UL;
+
+	while (*propdir)
+		h = h * 33 + (unsigned char) *propdir++;
+	return h;
+}
+
+static void
+owner_grow(void)
+{
+	size_t newsize = owner_buckets_size ? owner_buckets_size * 2 : 256;
+	struct CrT_sample_owner **nb, *o, *next;
+	size_t i, h;
+
+	nb = (struct CrT_sample_owner **) calloc(newsize, sizeof(struct CrT_sample_owner *));
+	if (!nb)
+		return;
+	for (i = 0; i < owner_buckets_size; i++) {
+		for (o = owner_buckets[i]; o; o = next) {
+			next = o->next;
+			h = owner_hash(o->obj, o->propdir) & (newsize - 1);
+			o->next = nb[h];
+			nb[h] = o;
+		}
+	}
+	free(owner_buckets);
+	owner_buckets = nb;
+	owner_buckets_size = newsize;
+}
+
+static struct CrT_sample_owner *
+sample_owner(int obj, const char *propdir)
+{
+	struct CrT_sample_owner *o;
+	size_t h;
+
+	if (owner_count >= owner_buckets_size)
+		owner_grow();
+	if (!owner_buckets)
+		return NULL;
+	h = owner_hash(obj, propdir) & (owner_buckets_size - 1);
+	for (o = owner_buckets[h]; o; o = o->next)
+		if (o->obj == obj && !strcmp(o->propdir, propdir))
+			return o;
+	if (!(o = (struct CrT_sample_owner *) calloc(1, sizeof(struct CrT_sample_owner))))
+		return NULL;
+	o->obj = obj;
+	strncpy(o->propdir, propdir, CRT_PROPDIR_LEN - 1);
+	o->next = owner_buckets[h];
+	owner_buckets[h] = o;
+	owner_count++;
+	return o;
+}
+
+/* Owners come and go with their programs and objects, so drop idle ones. */
+static void
+owner_release(struct CrT_sample_owner *o)
+{
+	struct CrT_sample_owner **pp;
+
+	if (o->samples > 0)
+		return;
+	pp = &owner_buckets[owner_hash(o->obj, o->propdir) & (owner_buckets_size - 1)];
+	for (; *pp; pp = &(*pp)->next) {
+		if (*pp == o) {
+			*pp = o->next;
+			free(o);
+			owner_count--;
+			return;
+		}
+	}
+}
+
+/* }}} */
+/* {{{ sample_charge -- Add a sample into the sums, or take it out.	*/
+
+static void
+charge_site(struct CrT_sample_site *site, double bytes, double blocks, int sign)
+{
+	site->samples += sign;
+	if (site->samples > 0) {
+		site->bytes += bytes;
+		site->blocks += blocks;
+	} else {
+		site->bytes = site->blocks = 0.0;
+	}
+}
+
+static void
+charge_owner(struct CrT_sample_owner *o, double bytes, double blocks, int sign)
+{
+	o->samples += sign;
+	if (o->samples > 0) {
+		o->bytes += bytes;
+		o->blocks += blocks;
+	} else {
+		o->bytes = o->blocks = 0.0;
+	}
+}
+
+static void
+sample_charge(struct CrT_sample *s, int sign)
+{
+	double bytes = sign * s->bytes;
+	double blocks = sign * s->blocks;
+
+	total_bytes += bytes;
+	total_blocks += blocks;
+	tag_bytes[s->tag] += bytes;
+	if (s->site)
+		charge_site(s->site, bytes, blocks, sign);
+	if (s->program)
+		charge_owner(s->program, bytes, blocks, sign);
+	if (s->proptree)
+		charge_owner(s->proptree, bytes, blocks, sign);
+}
+
+/* }}} */
+/* {{{ sample_drop -- Forget a sampled block.				*/
+
+static void
+sample_drop(struct CrT_sample *s)
+{
+	unsigned long slot = FILTER_SLOT(s->ptr);
+	int i;
+
+	sample_charge(s, -1);
+	if (s->program)
+		owner_release(s->program);
+	if (s->proptree)
+		owner_release(s->proptree);
+	/* A slot that filled up stays full, rather than risk going to zero early. */
+	if (sample_filter[slot] < 255)
+		sample_filter[slot]--;
+	sample_delete(s);
+	if (!sample_count) {
+		total_bytes = total_blocks = 0.0;
+		for (i = 0; i < CRT_TAGS; i++)
+			tag_bytes[i] = 0.0;
+	}
+}
+
+static void
+sample_forget(void *p)
+{
+	struct CrT_sample *s;
+
+	pthread_mutex_lock(&sample_lock);
+	if ((s = sample_find(p)))
+		sample_drop(s);
+	pthread_mutex_unlock(&sample_lock);
+}
+
+/* }}} */
+/* {{{ sample_take -- Record a block picked by the countdown.		*/
+
+static void
+prop_context_init(void)
+{
+	pthread_key_create(&prop_context_key, NULL);
+}
+
+static int
+sample_tag(const char *file, int tag)
+{
+	const char *base;
+	int i;
+
+	if (tag != CRT_TAG_OTHER)
+		return tag;
+	base = strrchr(file, '/');
+	base = base ? base + 1 : file;
+	for (i = 0; sample_file_tags[i].file; i++)
+		if (!strcmp(base, sample_file_tags[i].file))
+			return sample_file_tags[i].tag;
+	return CRT_TAG_OTHER;
+}
+
+/* Property trees are charged to their top level directory. */
+static void
+prop_topdir(char *buf, const char *propname)
+{
+	int i = 0;
+
+	while (*propname == '/')
+		propname++;
+	while (*propname && *propname != '/' && *propname != ':' && i < CRT_PROPDIR_LEN - 1)
+		buf[i++] = *propname++;
+	buf[i] = '\0';
+	if (!i)
+		strcpy(buf, "/");
+}
+
+static void
+sample_take(void *p, size_t size, const char *file, int line, int tag)
+{
+	struct CrT_prop_context *ctx;
+	struct CrT_sample *s;
+	char propdir[CRT_PROPDIR_LEN];
+	double prob;
+	long rate;
+
+	pthread_once(&prop_context_once, prop_context_init);
+	ctx = (struct CrT_prop_context *) pthread_getspecific(prop_context_key);
+
+	pthread_mutex_lock(&sample_lock);
+	rate = CrT_sample_rate;
+	if (rate <= 0) {
+		pthread_mutex_unlock(&sample_lock);
+		return;
+	}
+	sample_countdown = sample_interval(rate);
+
+	/* An old sample at the same address was freed behind our back. */
+	if ((s = sample_find(p)))
+		sample_drop(s);
+	if (!(s = sample_insert(p))) {
+		pthread_mutex_unlock(&sample_lock);
+		return;
+	}
+
+	prob = 1.0 - exp(-(double) (size ? size : 1) / rate);
+	s->bytes = (size ? size : 1) / prob;
+	s->blocks = 1.0 / prob;
+	s->tag = ctx ? CRT_TAG_PROPS : sample_tag(file, tag);
+	s->site = sample_site(file, line, s->tag);
+	if (CrT_sample_program != NOTHING)
+		s->program = sample_owner(CrT_sample_program, "");
+	if (ctx) {
+		prop_topdir(propdir, ctx->propname);
+		s->proptree = sample_owner(ctx->obj, propdir);
+	}
+	sample_charge(s, 1);
+	if (sample_filter[FILTER_SLOT(p)] < 255)
+		sample_filter[FILTER_SLOT(p)]++;
+
+	pthread_mutex_unlock(&sample_lock);
+}
+
+/* }}} */
+/* {{{ CrT_malloc &Co -- The wrappers themselves.			*/
+
+void *
+CrT_malloc_tagged(size_t size, const char *file, int line, int tag)
+{
+	void *p = malloc(size);
+
+	if (CrT_sample_rate > 0 && p && (sample_countdown -= (long) size) <= 0)
+		sample_take(p, size, file, line, tag);
+	return p;
+}
+
+void *
+CrT_malloc(size_t size, const char *file, int line)
+{
+	return CrT_malloc_tagged(size, file, line, CRT_TAG_OTHER);
+}
+
+void *
+CrT_calloc(size_t num, size_t siz, const char *file, int line)
+{
+	void *p = calloc(num, siz);
+
+	if (CrT_sample_rate > 0 && p && (sample_countdown -= (long) (num * siz)) <= 0)
+		sample_take(p, num * siz, file, line, CRT_TAG_OTHER);
+	return p;
+}
+
+void *
+CrT_realloc(void *p, size_t size, const char *file, int line)
+{
+	void *r;
+
+	/* The new block gets a fresh chance of being sampled at its new size. */
+	if (p && sample_count && sample_filter[FILTER_SLOT(p)])
+		sample_forget(p);
+	r = realloc(p, size);
+	if (CrT_sample_rate > 0 && r && (sample_countdown -= (long) size) <= 0)
+		sample_take(r, size, file, line, CRT_TAG_OTHER);
+	return r;
+}
+
+void
+CrT_free(void *p, const char *file, int line)
+{
+	if (p && sample_count && sample_filter[FILTER_SLOT(p)])
+		sample_forget(p);
+	free(p);
+}
+
+/* }}} */
+/* {{{ Controls and reports						*/
+
+/*
+ * Sets the mean number of bytes between samples, or turns sampling off
+ * for 0.  Blocks already sampled stay in the profile until they're freed.
+ */
+void
+CrT_set_sample_rate(long rate)
+{
+	pthread_mutex_lock(&sample_lock);
+	if (rate < 0)
+		rate = 0;
+	if (rate && !sample_rng)
+		sample_rng = (((unsigned long) time(NULL) ^ ((unsigned long) getpid() << 16))
+					  & 0xffffffffUL) | 1;
+	CrT_sample_rate = rate;
+	sample_countdown = rate ? sample_interval(rate) : 0;
+	pthread_mutex_unlock(&sample_lock);
+}
+
+/* Forgets every sample, without changing the rate. */
+void
+CrT_reset_samples(void)
+{
+	struct CrT_sample_owner *o, *next;
+	struct CrT_sample_site *s;
+	size_t i;
+
+	pthread_mutex_lock(&sample_lock);
+	free(sample_table);
+	sample_table = NULL;
+	sample_table_size = 0;
+	sample_count = 0;
+	for (i = 0; i < owner_buckets_size; i++) {
+		for (o = owner_buckets[i]; o; o = next) {
+			next = o->next;
+			free(o);
+		}
+		owner_buckets[i] = NULL;
+	}
+	owner_count = 0;
+	for (i = 0; i < CRT_SITE_BUCKETS; i++)
+		for (s = site_buckets[i]; s; s = s->next)
+			s->bytes = s->blocks = 0.0, s->samples = 0;
+	for (i = 0; i < CRT_FILTER_SIZE; i++)
+		sample_filter[i] = 0;
+	total_bytes = total_blocks = 0.0;
+	for (i = 0; i < CRT_TAGS; i++)
+		tag_bytes[i] = 0.0;
+	pthread_mutex_unlock(&sample_lock);
+}
+
+/*
+ * Charges whatever this thread allocates to a property of obj until the
+ * matching CrT_leave_prop_context().  These nest.
+ */
+void
+CrT_enter_prop_context(struct CrT_prop_context *ctx, int obj, const char *propname)
+{
+	pthread_once(&prop_context_once, prop_context_init);
+	ctx->obj = obj;
+	ctx->propname = propname;
+	ctx->prev = (struct CrT_prop_context *) pthread_getspecific(prop_context_key);
+	pthread_setspecific(prop_context_key, ctx);
+}
+
+void
+CrT_leave_prop_context(struct CrT_prop_context *ctx)
+{
+	pthread_setspecific(prop_context_key, ctx->prev);
+}
+
+void
+CrT_sample_totals(double *bytes, double *blocks, long *samples, double tags[CRT_TAGS])
+{
+	int i;
+
+	pthread_mutex_lock(&sample_lock);
+	*bytes = total_bytes;
+	*blocks = total_blocks;
+	*samples = (long) sample_count;
+	for (i = 0; i < CRT_TAGS; i++)
+		tags[i] = tag_bytes[i];
+	pthread_mutex_unlock(&sample_lock);
+}
+
+/*
+ * Copy out the sites or owners that have live samples, in no particular
+ * order.  The caller frees the copy.  Returns how many there are, or -1
+ * if the copy couldn't be made.
+ */
+int
+CrT_copy_sample_sites(struct CrT_sample_site **sites)
+{
+	struct CrT_sample_site *s;
+	int i, n = 0;
+
+	pthread_mutex_lock(&sample_lock);
+	*sites = (struct CrT_sample_site *)
+			malloc((site_count ? site_count : 1) * sizeof(struct CrT_sample_site));
+	if (!*sites) {
+		pthread_mutex_unlock(&sample_lock);
+		return -1;
+	}
+	for (i = 0; i < CRT_SITE_BUCKETS; i++) {
+		for (s = site_buckets[i]; s; s = s->next) {
+			if (s->samples > 0) {
+				(*sites)[n] = *s;
+				(*sites)[n++].next = NULL;
+			}
+		}
+	}
+	pthread_mutex_unlock(&sample_lock);
+	return n;
+}
+
+int
+CrT_copy_sample_owners(struct CrT_sample_owner **owners)
+{
+	struct CrT_sample_owner *o;
+	size_t i;
+	int n = 0;
+
+	pthread_mutex_lock(&sample_lock);
+	*owners = (struct CrT_sample_owner *)
+			malloc((owner_count ? owner_count : 1) * sizeof(struct CrT_sample_owner));
+	if (!*owners) {
+		pthread_mutex_unlock(&sample_lock);
+		return -1;
+	}
+	for (i = 0; i < owner_buckets_size; i++) {
+		for (o = owner_buckets[i]; o; o = o->next) {
+			(*owners)[n] = *o;
+			(*owners)[n++].next = NULL;
+		}
+	}
+	pthread_mutex_unlock(&sample_lock);
+	return n;
+}
+
+/* }}} */
+
+/* }}} */
+
+#endif							/* HEAP_SAMPLING */
+
 /* {{{ File variables							*/
 /*
 
@@ -1,6 +1,9 @@
 #include "config.h"
 
 #include <ctype.h>
+#ifdef PARALLEL_DB_LOAD
+# include <pthread.h>
+#endif
 
 #include "db.h"
 #include "db_header.h"
@@ -36,7 +39,7 @@ dbref db_size = DB_INITIAL_SIZE;
 
 struct macrotable *macrotop;
 
-#ifndef MALLOC_PROFILING
+#ifndef CRT_MALLOC_WRAPPERS
 extern char *alloc_string(const char *);
 #endif
 
@@ -238,22 +241,20 @@ putstring(FILE * f, const char *s)
 void
 putproperties_rec(FILE * f, const char *dir, dbref obj)
 {
-	PropPtr pref;
-	PropPtr p, pptr;
+	PropCursor cursor;
+	PropPtr p;
 	char buf[BUFFER_LEN];
-	char name[BUFFER_LEN];
 
-	pref = first_prop_nofetch(obj, dir, &pptr, name, sizeof(name));
-	while (pref) {
-		p = pref;
+	p = propcursor_first_nofetch(&cursor, obj, dir);
+	while (p) {
 		db_putprop(f, dir, p);
 		strcpyn(buf, sizeof(buf), dir);
-		strcatn(buf, sizeof(buf), name);
+		strcatn(buf, sizeof(buf), cursor.name);
 		if (PropDir(p)) {
 			strcatn(buf, sizeof(buf), "/");
 			putproperties_rec(f, buf, obj);
 		}
-		pref = next_prop(pptr, pref, name, sizeof(name));
+		p = propcursor_next(&cursor);
 	}
 }
 
@@ -280,17 +281,17 @@ extern FILE *delta_outfile;
 int
 fetch_propvals(dbref obj, const char *dir)
 {
-	PropPtr p, pptr;
+	PropCursor cursor;
+	PropPtr p;
 	int cnt = 0;
 	char buf[BUFFER_LEN];
-	char name[BUFFER_LEN];
 
-	p = first_prop_nofetch(obj, dir, &pptr, name, sizeof(name));
+	p = propcursor_first_nofetch(&cursor, obj, dir);
 	while (p) {
 		cnt = (cnt || propfetch(obj, p));
 		if (PropDir(p) || (PropFlags(p) & PROP_DIRUNLOADED)) {
 			strcpyn(buf, sizeof(buf), dir);
-			strcatn(buf, sizeof(buf), name);
+			strcatn(buf, sizeof(buf), cursor.name);
 			strcatn(buf, sizeof(buf), "/");
 			if (PropFlags(p) & PROP_DIRUNLOADED) {
 				SetPFlags(p, (PropFlags(p) & ~PROP_DIRUNLOADED));
@@ -302,7 +303,7 @@ fetch_propvals(dbref obj, const char *dir)
 			}
 			fetch_propvals(obj, buf);
 		}
-		p = next_prop(pptr, p, name, sizeof(name));
+		p = propcursor_next(&cursor);
 	}
 	return cnt;
 }
@@ -597,6 +598,7 @@ db_write_list(FILE * f, int mode)
 			}
 #endif
 			FLAGS(i) &= ~OBJECT_CHANGED;	/* clear changed flag */
+			objstats_update(i);
 		}
 	}
 }
@@ -871,6 +873,8 @@ db_free(void)
 		db = 0;
 		db_top = 0;
 	}
+	objstats_free();
+	cpuacct_free();
 	clear_players();
 	clear_primitives();
 	recyclable = NOTHING;
@@ -1168,6 +1172,219 @@ db_read_object_new(FILE * f, struct object *o, dbref objno)
 	}
 }
 
+#ifdef PARALLEL_DB_LOAD
+
+/*
+ * While the main database is being read in, each object's property section
+ * is only copied into propload_text, and the objects whose sections still
+ * need to be parsed are listed in propload_jobs.  Once all of the object
+ * records are in, propload_run() splits the list between DB_LOAD_THREADS
+ * threads, which build the property trees, locks included, at the same time.
+ * Each thread only touches the objects it was given, and every object's
+ * flags are already set by then, so the locks' object numbers can be
+ * checked against the db without racing anything.
+ */
+struct propload_job {
+	dbref obj;
+	size_t offset;				/* start of its section in propload_text */
+};
+
+struct propload_range {
+	int first, last;			/* jobs [first, last) */
+	int started;
+	pthread_t thread;
+};
+
+static char *propload_text = NULL;
+static size_t propload_len = 0;
+static size_t propload_size = 0;
+static struct propload_job *propload_jobs = NULL;
+static int propload_count = 0;
+static int propload_max = 0;
+static int propload_deferring = 0;
+static int propload_threads = 0;
+
+#define PROPLOAD_MIN_JOBS 256	/* don't start a thread for less than this */
+
+/* No more threads than there are processors to run them. */
+static int
+propload_max_threads(void)
+{
+	int nthreads = DB_LOAD_THREADS;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	int ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (ncpus > 0 && ncpus < nthreads)
+		nthreads = ncpus;
+#endif
+	return nthreads;
+}
+
+static void
+propload_append(const char *buf, size_t len)
+{
+	if (propload_len + len > propload_size) {
+		while (propload_len + len > propload_size)
+			propload_size = propload_size ? propload_size * 2 : 1048576;
+		propload_text = (char *) realloc(propload_text, propload_size);
+		if (!propload_text) {
+			fprintf(stderr, "propload_append(): Out of Memory!\n");
+			abort();
+		}
+	}
+	memcpy(propload_text + propload_len, buf, len);
+	propload_len += len;
+}
+
+/*
+ * Copy obj's property section, up to and including its end marker, exactly
+ * as getproperties() would have read it.  A listening prop would make the
+ * parsing thread set the LISTENER flag, so that is done here instead, and
+ * the threads then never need to write an object's flags.
+ */
+static void
+propload_defer(FILE * f, dbref obj)
+{
+	char buf[BUFFER_LEN * 3];
+	const char *name;
+	size_t len;
+	int oldstyle;
+
+	if (propload_count >= propload_max) {
+		propload_max = propload_max ? propload_max * 2 : 4096;
+		propload_jobs = (struct propload_job *)
+				realloc(propload_jobs, propload_max * sizeof(struct propload_job));
+		if (!propload_jobs) {
+			fprintf(stderr, "propload_defer(): Out of Memory!\n");
+			abort();
+		}
+	}
+	propload_jobs[propload_count].obj = obj;
+	propload_jobs[propload_count].offset = propload_len;
+	propload_count++;
+
+	if (!fgets(buf, sizeof(buf), f))
+		*buf = '\0';
+	propload_append(buf, strlen(buf));
+	oldstyle = strcmp(buf, "Props*\n");
+
+	while (fgets(buf, sizeof(buf), f)) {
+		len = strlen(buf);
+		propload_append(buf, len);
+		if (!strcmp(buf, "*End*\n"))
+			return;
+		if (oldstyle && !strcmp(buf, "***Property list end ***\n"))
+			return;
+		for (name = buf; *name == PROPDIR_DELIMITER; name++) ;
+		if (!(FLAGS(obj) & LISTENER) && index(name, PROP_DELIMITER) &&
+			(string_prefix(name, "_listen") ||
+			 string_prefix(name, "~listen") || string_prefix(name, "~olisten"))) {
+			FLAGS(obj) |= LISTENER;
+		}
+	}
+
+	/* Ran off the end of the file.  Terminate it so parsing stops here. */
+	propload_append("*End*\n", 6);
+}
+
+static void
+propload_range_parse(struct propload_range *r)
+{
+	size_t start = propload_jobs[r->first].offset;
+	size_t end = r->last < propload_count ? propload_jobs[r->last].offset : propload_len;
+	FILE *f;
+	int i;
+
+	f = fmemopen(propload_text + start, end - start, "r");
+	if (!f) {
+		fprintf(stderr, "propload_range_parse(): Out of Memory!\n");
+		abort();
+	}
+	for (i = r->first; i < r->last; i++)
+		getproperties(f, propload_jobs[i].obj, NULL);
+	fclose(f);
+}
+
+static void *
+propload_thread(void *arg)
+{
+	propload_range_parse((struct propload_range *) arg);
+	return NULL;
+}
+
+static void
+propload_free(void)
+{
+	free(propload_text);
+	free(propload_jobs);
+	propload_text = NULL;
+	propload_jobs = NULL;
+	propload_len = propload_size = 0;
+	propload_count = propload_max = 0;
+}
+
+/*
+ * Parse all of the deferred property sections, splitting them between the
+ * threads by size.  A range that a thread couldn't be started for is parsed
+ * here once the others are done.
+ */
+static void
+propload_run(void)
+{
+	struct propload_range ranges[DB_LOAD_THREADS];
+	int nthreads = propload_max_threads();
+	int i, j;
+
+	propload_threads = 1;
+	if (!propload_count) {
+		propload_free();
+		return;
+	}
+
+	if (nthreads > propload_count / PROPLOAD_MIN_JOBS)
+		nthreads = propload_count / PROPLOAD_MIN_JOBS;
+	if (nthreads < 1)
+		nthreads = 1;
+
+	for (i = 0, j = 0; i < nthreads; i++) {
+		size_t limit = (size_t) ((double) propload_len * (i + 1) / nthreads);
+
+		ranges[i].first = j;
+		while (j < propload_count && (i == nthreads - 1 || propload_jobs[j].offset < limit))
+			j++;
+		ranges[i].last = j;
+		ranges[i].started = 0;
+	}
+
+	if (nthreads > 1) {
+		propload_threads = 0;
+		prop_tree_frozen = 1;
+		for (i = 0; i < nthreads; i++) {
+			if (ranges[i].first < ranges[i].last &&
+					!pthread_create(&ranges[i].thread, NULL, propload_thread, &ranges[i])) {
+				ranges[i].started = 1;
+				propload_threads++;
+			}
+		}
+		for (i = 0; i < nthreads; i++) {
+			if (ranges[i].started)
+				pthread_join(ranges[i].thread, NULL);
+		}
+		prop_tree_frozen = 0;
+		prop_tree_generation++;
+		if (!propload_threads)
+			propload_threads = 1;
+	}
+	for (i = 0; i < nthreads; i++) {
+		if (!ranges[i].started && ranges[i].first < ranges[i].last)
+			propload_range_parse(&ranges[i]);
+	}
+	propload_free();
+}
+
+#endif							/* PARALLEL_DB_LOAD */
+
 /* Reads in Foxen, Foxen[2-8], WhiteFire, Mage or Lachesis DB Formats */
 void
 db_read_object_foxen(FILE * f, struct object *o, dbref objno, int dtype, int read_before)
@@ -1233,6 +1450,11 @@ db_read_object_foxen(FILE * f, struct object *o, dbref objno, int dtype, int rea
 			skipproperties(f, objno);
 		}
 #else
+# ifdef PARALLEL_DB_LOAD
+		if (propload_deferring && !read_before) {
+			propload_defer(f, objno);
+		} else
+# endif
 		getproperties(f, objno, NULL);
 #endif
 
@@ -1391,6 +1613,44 @@ autostart_progs(void)
 	}
 }
 
+static double
+db_read_secs(struct timeval *since, struct timeval *until)
+{
+	return (until->tv_sec - since->tv_sec) + (until->tv_usec - since->tv_usec) / 1000000.0;
+}
+
+/* Logs how long each part of loading the database took. */
+static void
+db_read_report(struct timeval *start, struct timeval *records, struct timeval *props,
+			   struct timeval *done)
+{
+	char buf[BUFFER_LEN];
+
+#ifdef PARALLEL_DB_LOAD
+	snprintf(buf, sizeof(buf),
+			 "LOADING: %d objects in %.3fs: records %.3fs, properties %.3fs (%d thread%s), finishing %.3fs",
+			 db_top, db_read_secs(start, done), db_read_secs(start, records),
+			 db_read_secs(records, props), propload_threads, propload_threads == 1 ? "" : "s",
+			 db_read_secs(props, done));
+#else
+	snprintf(buf, sizeof(buf),
+			 "LOADING: %d objects in %.3fs: records and properties %.3fs, finishing %.3fs",
+			 db_top, db_read_secs(start, done), db_read_secs(start, props),
+			 db_read_secs(props, done));
+#endif
+	log_status("%s", buf);
+	fprintf(stderr, "%s\n", buf);
+}
+
+static void
+db_read_abandon(void)
+{
+#ifdef PARALLEL_DB_LOAD
+	propload_free();
+	propload_deferring = 0;
+#endif
+}
+
 dbref
 db_read(FILE * f)
 {
@@ -1402,8 +1662,13 @@ db_read(FILE * f)
 	int main_db_format = 0;
 	int parmcnt;
 	int dbflags;
+	int records_timed = 0;
+	struct timeval load_start, records_done, props_done, load_done;
 	char c;
 
+	gettimeofday(&load_start, NULL);
+	records_done = props_done = load_start;
+
 	/* Parse the header */
 	dbflags = db_read_header( f, &version, &db_load_format, &grow, &parmcnt );
 
@@ -1426,6 +1691,10 @@ db_read(FILE * f)
 	} else {
 		main_db_format = db_load_format;
 	}
+#ifdef PARALLEL_DB_LOAD
+	/* Copying the properties out only pays off if they're parsed in parallel. */
+	propload_deferring = !doing_deltas && db_load_format >= 10 && propload_max_threads() > 1;
+#endif
 
 	c = getc(f);			/* get next char */
 	for (i = 0;; i++) {
@@ -1478,9 +1747,20 @@ db_read(FILE * f)
 			special = getstring(f);
 			if (strcmp(special, "**END OF DUMP***")) {
 				free((void *) special);
+				db_read_abandon();
 				return -1;
 			} else {
 				free((void *) special);
+				if (!records_timed) {
+					/* Everything after this could replace what was read so far. */
+					gettimeofday(&records_done, NULL);
+#ifdef PARALLEL_DB_LOAD
+					propload_run();
+					propload_deferring = 0;
+#endif
+					gettimeofday(&props_done, NULL);
+					records_timed = 1;
+				}
 				special = getstring(f);
 				if (special && !strcmp(special, "***Foxen Deltas Dump Extention***")) {
 					free((void *) special);
@@ -1528,11 +1808,14 @@ db_read(FILE * f)
 						}
 					}
 					autostart_progs();
+					gettimeofday(&load_done, NULL);
+					db_read_report(&load_start, &records_done, &props_done, &load_done);
 					return db_top;
 				}
 			}
 			break;
 		default:
+			db_read_abandon();
 			return -1;
 			/* break; */
 		}
@@ -387,7 +387,7 @@ push_arg(dbref player, struct frame *fr, const char *arg)
 	int sflag = 0;
 	double inum;
 
-	if (fr->argument.top >= STACK_SIZE) {
+	if (argstack_reserve(fr, fr->argument.top + 1) < 0) {
 		notify_nolisten(player, "That would overflow the stack.", 1);
 		return;
 	}
@@ -639,7 +639,7 @@ muf_debugger(int descr, dbref player, dbref program, const char *text, struct fr
 			add_muf_read_event(descr, player, program, fr);
 			return 0;
 		}
-		if (fr->system.top >= STACK_SIZE) {
+		if (sysstack_reserve(fr, fr->system.top + 1) < 0) {
 			notify_nolisten(player,
 							"That would exceed the system stack size for this program.", 1);
 			add_muf_read_event(descr, player, program, fr);
@@ -670,7 +670,7 @@ muf_debugger(int descr, dbref player, dbref program, const char *text, struct fr
 			add_muf_read_event(descr, player, program, fr);
 			return 0;
 		}
-		if (fr->system.top >= STACK_SIZE) {
+		if (sysstack_reserve(fr, fr->system.top + 1) < 0) {
 			notify_nolisten(player,
 							"That would exceed the system stack size for this program.", 1);
 			add_muf_read_event(descr, player, program, fr);
@@ -76,6 +76,7 @@ addobject_ringqueue(dbref obj, int mode)
 	removeobj_ringqueue(obj);
 
 	DBFETCH(obj)->propsmode = mode;
+	objstats_update(obj);
 	switch (mode) {
 	case PROPS_UNLOADED:
 		DBFETCH(obj)->nextold = NOTHING;
@@ -309,6 +310,7 @@ unloadprops_with_prejudice(dbref obj)
 	removeobj_ringqueue(obj);
 	DBFETCH(obj)->propsmode = PROPS_UNLOADED;
 	DBFETCH(obj)->propstime = 0;
+	objstats_update(obj);
 }
 
 
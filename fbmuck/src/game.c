@@ -202,6 +202,11 @@ panic(const char *message)
 	log_status("PANIC: %s", message);
 	fprintf(stderr, "PANIC: %s\n", message);
 
+#ifdef ASYNC_LOGGING
+	/* Get everything logged so far out to disk, and log synchronously. */
+	stop_log_writer();
+#endif
+
 	/* shut down interface */
 	if (!forked_dump_process_flag) {
 		emergency_shutdown();
@@ -447,6 +452,8 @@ init_game(const char *infile, const char *outfile)
 	mesg_init();				/* init mpi interpreter */
 	SRANDOM(getpid());			/* init random number generator */
 	tune_load_parmsfile(NOTHING);	/* load @tune parms from file */
+	heap_profile_tick();		/* so the heap sampler sees the load */
+	help_index_init();			/* index the help files */
 
 	/* ok, read the db in */
 	log_status("LOADING: %s", infile);
@@ -455,6 +462,7 @@ init_game(const char *infile, const char *outfile)
 		return -1;
 	log_status("LOADING: %s (done)", infile);
 	fprintf(stderr, "LOADING: %s (done)\n", infile);
+	objstats_rebuild();
 
 	/* set up dumper */
 	if (dumpfile)
@@ -924,7 +932,7 @@ process_command(int descr, dbref player, char *command)
 			case 'm':
 			case 'M':
 				/* @mcpedit, @mcpprogram, @memory, @mpitops,
-				   @muftops */
+				   @mufprofile, @muftops */
 				switch (command[2]) {
 				case 'c':
 				case 'C':
@@ -940,7 +948,7 @@ process_command(int descr, dbref player, char *command)
 				case 'e':
 				case 'E':
 					Matched("@memory");
-					do_memory(player);
+					do_memory(player, full_command);
 					break;
 				case 'p':
 			    case 'P':
@@ -949,8 +957,13 @@ process_command(int descr, dbref player, char *command)
 			        break;
 			    case 'u':
 			    case 'U':
-			        Matched("@muftops");
-			        do_muf_topprofs(player, arg1);
+			        if (strlen(command) > 4 && string_prefix("@mufprofile", command)) {
+			            Matched("@mufprofile");
+			            do_mufprofile(player, full_command);
+			        } else {
+			            Matched("@muftops");
+			            do_muf_topprofs(player, arg1);
+			        }
 			        break;
 				default:
 					goto bad;
@@ -1090,7 +1103,7 @@ process_command(int descr, dbref player, char *command)
 				case 'a':
 				case 'A':
 					if (!strcmp(command, "@sanity")) {
-						sanity(player);
+						do_sanity(player, arg1);
 					} else if (!strcmp(command, "@sanchange")) {
 						sanechange(player, full_command);
 					} else if (!strcmp(command, "@sanfix")) {
@@ -1144,6 +1157,8 @@ process_command(int descr, dbref player, char *command)
 						do_toad(descr, player, arg1, arg2);
 					} else if (!strcmp(command, "@tops")) {
 						do_all_topprofs(player, arg1);
+					} else if (!strcmp(command, "@top")) {
+						do_cpu_top(player, arg1);
 					} else {
 						goto bad;
 					}
@@ -0,0 +1,152 @@
+/*
+ * hashbench: times lookups in the hash tables from hashtab.c as they fill
+ * up, next to a table of 256 fixed buckets with chaining, which is what
+ * the server's name tables used to be.
+ *
+ * Usage: hashbench [maxkeys]
+ *
+ * For each table size from 16 names up to maxkeys (default 262144),
+ * prints the nanoseconds taken per lookup of a name that is in the table,
+ * and of one that isn't.  The fixed table gets fewer lookups as its
+ * chains grow, so that the big sizes finish in reasonable time.
+ */
+
+#include "config.h"
+#include "db.h"
+#include "externs.h"
+
+#define BENCH_LOOKUPS 2000000
+#define FIXED_BUCKETS 256
+
+struct fixed_entry {
+	struct fixed_entry *next;
+	char *name;
+};
+
+static struct fixed_entry *fixed_table[FIXED_BUCKETS];
+
+/* The hash function the fixed tables used. */
+static unsigned int
+fixed_hash(const char *s)
+{
+	unsigned int hashval;
+
+	for (hashval = 0; *s != '\0'; s++)
+		hashval = (*s | 0x20) + 31 * hashval;
+	return hashval % FIXED_BUCKETS;
+}
+
+static int
+fixed_find(const char *s)
+{
+	struct fixed_entry *hp;
+
+	for (hp = fixed_table[fixed_hash(s)]; hp; hp = hp->next) {
+		if (!strcasecmp(s, hp->name))
+			return 1;
+	}
+	return 0;
+}
+
+static void
+fixed_add(char *s)
+{
+	struct fixed_entry *hp = (struct fixed_entry *) malloc(sizeof(struct fixed_entry));
+	unsigned int hashval = fixed_hash(s);
+
+	hp->name = s;
+	hp->next = fixed_table[hashval];
+	fixed_table[hashval] = hp;
+}
+
+static void
+fixed_clear(void)
+{
+	struct fixed_entry *hp, *np;
+	int i;
+
+	for (i = 0; i < FIXED_BUCKETS; i++) {
+		for (hp = fixed_table[i]; hp; hp = np) {
+			np = hp->next;
+			free(hp);
+		}
+		fixed_table[i] = NULL;
+	}
+}
+
+static double
+nsecs_since(struct timeval *start, int count)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return ((now.tv_sec - start->tv_sec) * 1e9 + (now.tv_usec - start->tv_usec) * 1e3) / count;
+}
+
+int
+main(int argc, char **argv)
+{
+	int maxkeys = argc > 1 ? atoi(argv[1]) : 262144;
+	char **names, **misses;
+	char buf[64];
+	hash_tab table;
+	hash_data hd;
+	struct timeval start;
+	double hit, miss, fixhit, fixmiss;
+	int nkeys, i, found, fixlookups;
+
+	if (maxkeys < 16) {
+		fprintf(stderr, "Usage: %s [maxkeys]\n", argv[0]);
+		return 1;
+	}
+	names = (char **) malloc(maxkeys * sizeof(char *));
+	misses = (char **) malloc(maxkeys * sizeof(char *));
+	for (i = 0; i < maxkeys; i++) {
+		snprintf(buf, sizeof(buf), "Player_%d", i);
+		names[i] = strdup(buf);
+		snprintf(buf, sizeof(buf), "Nobody_%d", i);
+		misses[i] = strdup(buf);
+	}
+
+	printf("%8s %8s %10s %10s %10s %10s\n", "names", "slots",
+		   "hit ns", "miss ns", "fixed hit", "fixed miss");
+	for (nkeys = 16; nkeys <= maxkeys; nkeys *= 4) {
+		hash_init(&table, 0, 0);
+		for (i = 0; i < nkeys; i++) {
+			hd.ival = i;
+			add_hash(names[i], hd, &table);
+			fixed_add(names[i]);
+		}
+
+		found = 0;
+		gettimeofday(&start, NULL);
+		for (i = 0; i < BENCH_LOOKUPS; i++)
+			found += find_hash(names[i % nkeys], &table) != NULL;
+		hit = nsecs_since(&start, BENCH_LOOKUPS);
+		gettimeofday(&start, NULL);
+		for (i = 0; i < BENCH_LOOKUPS; i++)
+			found += find_hash(misses[i % nkeys], &table) != NULL;
+		miss = nsecs_since(&start, BENCH_LOOKUPS);
+
+		fixlookups = BENCH_LOOKUPS / (1 + nkeys / FIXED_BUCKETS);
+		gettimeofday(&start, NULL);
+		for (i = 0; i < fixlookups; i++)
+			found += fixed_find(names[i % nkeys]);
+		fixhit = nsecs_since(&start, fixlookups);
+		gettimeofday(&start, NULL);
+		for (i = 0; i < fixlookups; i++)
+			found += fixed_find(misses[i % nkeys]);
+		fixmiss = nsecs_since(&start, fixlookups);
+
+		if (found != BENCH_LOOKUPS + fixlookups) {
+			fprintf(stderr, "Lookups went wrong with %d names.\n", nkeys);
+			return 1;
+		}
+		printf("%8d %8u %10.1f %10.1f %10.1f %10.1f\n", nkeys, table.size,
+			   hit, miss, fixhit, fixmiss);
+		fflush(stdout);
+		kill_hash(&table, 0);
+		fixed_clear();
+	}
+	return 0;
+}
@@ -3,124 +3,253 @@
 #include "props.h"
 #include "externs.h"
 
-/* hash:  compute hash value for a string
+/*
+ * Hash tables mapping names to a hash_data, with open addressing and
+ * linear probing.  A table starts out with the number of slots it was
+ * given by hash_init() (or HASH_MIN_SIZE, if it was just zeroed), and
+ * doubles whenever it gets more than three quarters full, counting
+ * deleted slots, so lookups stay quick however many names it holds.
  *
- * this particular hash function is fairly simple.  Note that it
- * throws away the information from the 0x20 bit in the character.
- * This means that upper and lower case letters will hash to the
- * same value.
+ * Names are matched without regard to case, unless the table was set up
+ * with HASH_EXACT.  Each entry stores its name's full hash value, so most
+ * mismatches are caught without comparing the names at all.
+ *
+ * This file doesn't use anything from the rest of the server, so that
+ * hashbench can be linked with it alone.
+ */
+
+#define HASH_MIN_SIZE 16
+
+/* An entry's name is this once it has been deleted. */
+static char hash_deleted_name[] = "";
+
+#define HASH_EMPTY(hp)   ((hp)->name == NULL)
+#define HASH_DELETED(hp) ((hp)->name == hash_deleted_name)
+#define HASH_INUSE(hp)   (!HASH_EMPTY(hp) && !HASH_DELETED(hp))
+
+/* hash_string:  compute the full hash value for a string
+ *
+ * FNV-1a over the bytes, folded to lower case unless exact is set, then
+ * run through a finalizer so that the low bits, which pick the slot,
+ * depend on every character of the name.
  */
+unsigned int
+hash_string(register const char *s, int exact)
+{
+	register unsigned int hashval = 2166136261U;
 
+	if (exact) {
+		while (*s)
+			hashval = (hashval ^ *(const unsigned char *) s++) * 16777619U;
+	} else {
+		while (*s)
+			hashval = (hashval ^ tolower(*(const unsigned char *) s++)) * 16777619U;
+	}
+	hashval ^= hashval >> 16;
+	hashval *= 0x85ebca6bU;
+	hashval ^= hashval >> 13;
+	hashval *= 0xc2b2ae35U;
+	hashval ^= hashval >> 16;
+	return hashval;
+}
+
+/* hash:  compute a case-insensitive hash value for a string
+ *
+ * For code that keeps its own buckets.  Upper and lower case letters
+ * hash to the same value.
+ */
 unsigned int
 hash(register const char *s, unsigned int hash_size)
 {
-	unsigned int hashval;
+	return hash_string(s, 0) % hash_size;
+}
+
+static int
+hash_names_match(const hash_tab * table, const char *s1, const char *s2)
+{
+	unsigned char c1, c2;
+
+	if (table->flags & HASH_EXACT)
+		return !strcmp(s1, s2);
+	do {
+		c1 = tolower(*(const unsigned char *) s1++);
+		c2 = tolower(*(const unsigned char *) s2++);
+	} while (c1 && c1 == c2);
+	return c1 == c2;
+}
+
+/*
+ * Returns the entry for name, or if it's not there, the slot it should
+ * be added in.  The table must have at least one slot.
+ */
+static hash_entry *
+hash_slot(const hash_tab * table, const char *name, unsigned int hashval)
+{
+	hash_entry *hp, *reuse = NULL;
+	unsigned int i = hashval & (table->size - 1);
 
-	for (hashval = 0; *s != '\0'; s++) {
-		hashval = (*s | 0x20) + 31 * hashval;
+	for (hp = &table->entries[i]; !HASH_EMPTY(hp); hp = &table->entries[i]) {
+		if (HASH_DELETED(hp)) {
+			if (!reuse)
+				reuse = hp;
+		} else if (hp->hashval == hashval && hash_names_match(table, hp->name, name)) {
+			return hp;
+		}
+		i = (i + 1) & (table->size - 1);
 	}
-	return hashval % hash_size;
+	return reuse ? reuse : hp;
+}
+
+/* Makes room for one more entry, dropping any deleted slots. */
+static void
+hash_grow(hash_tab * table)
+{
+	hash_entry *old = table->entries;
+	unsigned int oldsize = table->size;
+	unsigned int size = table->minsize ? table->minsize : HASH_MIN_SIZE;
+	unsigned int i;
+
+	while ((table->count + 1) * 2 > size)
+		size *= 2;
+	table->entries = (hash_entry *) calloc(size, sizeof(hash_entry));
+	if (table->entries == NULL) {
+		perror("hash_grow: out of memory!");
+		abort();
+	}
+	table->size = size;
+	table->filled = table->count;
+	for (i = 0; i < oldsize; i++) {
+		if (HASH_INUSE(&old[i]))
+			*hash_slot(table, old[i].name, old[i].hashval) = old[i];
+	}
+	free((void *) old);
+}
+
+/* hash_init:  set up an empty hash table
+ *
+ * size is how many slots to start with, rounded up to a power of two.
+ * flags can be HASH_EXACT, to match names case-sensitively.  A table
+ * that has simply been zeroed is an empty case-insensitive table.
+ */
+void
+hash_init(hash_tab * table, unsigned int size, int flags)
+{
+	unsigned int minsize = HASH_MIN_SIZE;
+
+	while (minsize < size)
+		minsize *= 2;
+	table->entries = NULL;
+	table->size = table->count = table->filled = 0;
+	table->minsize = minsize;
+	table->flags = flags;
 }
 
 /* find_hash:  lookup a name in a hash table
  *
- * returns NULL if not found, otherwise a pointer to the data union.
+ * returns NULL if not found, otherwise a pointer to the data union,
+ * which stays good until the next add_hash() on the table.
  */
 hash_data *
-find_hash(register const char *s, hash_tab * table, unsigned int size)
+find_hash(register const char *s, hash_tab * table)
 {
-	register hash_entry *hp;
+	hash_entry *hp;
 
-	for (hp = table[hash(s, size)]; hp != NULL; hp = hp->next) {
-		if (string_compare(s, hp->name) == 0) {
-			return &(hp->dat);	/* found */
-		}
-	}
-	return NULL;				/* not found */
+	if (!table->count)
+		return NULL;
+	hp = hash_slot(table, s, hash_string(s, table->flags & HASH_EXACT));
+	return HASH_INUSE(hp) ? &(hp->dat) : NULL;
 }
 
 /* add_hash:  add a string to a hash table
  *
  * will supercede old values in the table, returns pointer to
- * the hash entry, or NULL on failure.
- *
- * NB: These hash routines assume that the names are static entities.
- * The hash entries store only a pointer to the names.  Be sure to
- * make a static copy of the name before adding it to the table.
+ * the hash entry, or NULL on failure.  The table keeps its own
+ * copy of the name.
  */
 hash_entry *
-add_hash(register const char *name, hash_data data, hash_tab * table, unsigned int size)
+add_hash(register const char *name, hash_data data, hash_tab * table)
 {
-	register hash_entry *hp;
-	unsigned int hashval;
+	hash_entry *hp;
+	unsigned int hashval = hash_string(name, table->flags & HASH_EXACT);
+	int len;
 
-	hashval = hash(name, size);
+	if ((table->filled + 1) * 4 > table->size * 3)
+		hash_grow(table);
 
-	/* an inline find_hash */
-	for (hp = table[hashval]; hp != NULL; hp = hp->next) {
-		if (string_compare(name, hp->name) == 0) {
-			break;
-		}
-	}
-
-	/* If not found, set up a new entry */
-	if (hp == NULL) {
-		hp = (hash_entry *) malloc(sizeof(hash_entry));
-		if (hp == NULL) {
-			perror("add_hash: out of memory!");
-			abort();			/* can't allocate new entry -- die */
-		}
-		hp->next = table[hashval];
-		table[hashval] = hp;
-		hp->name = (char *) string_dup(name);	/* This might be wasteful. */
+	hp = hash_slot(table, name, hashval);
+	if (!HASH_INUSE(hp)) {
+		len = strlen(name) + 1;
+		if (HASH_EMPTY(hp))
+			table->filled++;
+		hp->name = (char *) malloc(len);
 		if (hp->name == NULL) {
 			perror("add_hash: out of memory!");
 			abort();			/* can't allocate new entry -- die */
 		}
+		memcpy((void *) hp->name, name, len);
+		hp->hashval = hashval;
+		table->count++;
 	}
-	/* One way or another, the pointer is now valid */
 	hp->dat = data;
 	return hp;
 }
 
 /* free_hash:  free a hash table entry
  *
- * frees the dynamically allocated hash table entry associated with
- * a name.  Returns 0 on success, or -1 if the name cannot be found.
+ * frees the name of the entry for a name, and marks its slot deleted.
+ * Returns 0 on success, or -1 if the name cannot be found.
  */
 int
-free_hash(register const char *name, hash_tab * table, unsigned int size)
+free_hash(register const char *name, hash_tab * table)
 {
-	register hash_entry **lp, *hp;
-
-	lp = &table[hash(name, size)];
-	for (hp = *lp; hp != NULL; lp = &(hp->next), hp = hp->next) {
-		if (string_compare(name, hp->name) == 0) {
-			*lp = hp->next;		/* got it.  fix the pointers */
-			free((void *) hp->name);
-			free((void *) hp);
-			return 0;
-		}
+	hash_entry *hp;
+
+	if (!table->count)
+		return -1;
+	hp = hash_slot(table, name, hash_string(name, table->flags & HASH_EXACT));
+	if (!HASH_INUSE(hp))
+		return -1;				/* not found */
+	free((void *) hp->name);
+	hp->name = hash_deleted_name;
+	table->count--;
+	return 0;
+}
+
+/* next_hash:  step through the entries of a hash table
+ *
+ * returns the entry after prev, or the first entry if prev is NULL,
+ * or NULL if there are no more.  Entries come out in no particular
+ * order.  Entries may be freed while stepping through the table, but
+ * none may be added.
+ */
+hash_entry *
+next_hash(hash_tab * table, hash_entry * prev)
+{
+	hash_entry *hp = prev ? prev + 1 : table->entries;
+	hash_entry *end = table->entries + table->size;
+
+	for (; hp < end; hp++) {
+		if (HASH_INUSE(hp))
+			return hp;
 	}
-	return -1;					/* not found */
+	return NULL;
 }
 
 /* kill_hash:  kill an entire hash table, by freeing every entry */
 void
-kill_hash(hash_tab * table, unsigned int size, int freeptrs)
+kill_hash(hash_tab * table, int freeptrs)
 {
-	register hash_entry *hp, *np;
 	unsigned int i;
 
-	for (i = 0; i < size; i++) {
-		for (hp = table[i]; hp != NULL; hp = np) {
-			np = hp->next;		/* Don't dereference the pointer after */
-			free((void *) hp->name);
+	for (i = 0; i < table->size; i++) {
+		if (HASH_INUSE(&table->entries[i])) {
+			free((void *) table->entries[i].name);
 			if (freeptrs) {
-				free((void *) hp->dat.pval);
+				free((void *) table->entries[i].dat.pval);
 			}
-			free((void *) hp);	/* we've freed it! */
 		}
-		table[i] = NULL;
 	}
+	free((void *) table->entries);
+	table->entries = NULL;
+	table->size = table->count = table->filled = 0;
 }
@@ -0,0 +1,415 @@
+/* Reports from the sampling heap profiler */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <time.h>
+#include <ctype.h>
+#include <math.h>
+#include "db.h"
+#include "tune.h"
+#include "externs.h"
+#include "interface.h"
+#include "params.h"
+#include "fbstrings.h"
+
+#ifdef HEAP_SAMPLING
+
+/*
+ * The sampling itself lives in crt_malloc.c, where every malloc() and
+ * free() goes through.  This is the server side of it: keeping the
+ * sample rate in step with '@tune heap_sample_bytes', and '@memory
+ * profile', which writes the live samples out to HEAP_PROFILE_FILE and
+ * compares them against the dump before.
+ *
+ * The dump is tab separated, one estimate per line, as
+ *
+ *     kind	key	est_bytes	est_blocks	samples	name
+ *
+ * where kind is "tag", "site", "program" or "proptree", preceded by a
+ * few '#' comment lines giving the totals.  Kind and key together name
+ * the same thing from one dump to the next, so dumps can be diffed.
+ */
+
+#define HEAP_PROFILE_TOP 5		/* Lines of each kind in the summary */
+#define HEAP_PROFILE_DIFF_TOP 20	/* Lines shown by a diff */
+
+struct heap_profile_line {
+	char kind[16];
+	char key[64];
+	double bytes;
+	double blocks;
+	long samples;
+	double old_bytes;
+	char name[BUFFER_LEN];
+};
+
+
+/* Applies '@tune heap_sample_bytes', whenever it's been changed. */
+void
+heap_profile_tick(void)
+{
+	if (tp_heap_sample_bytes != CrT_sample_rate) {
+		CrT_set_sample_rate(tp_heap_sample_bytes > 0 ? tp_heap_sample_bytes : 0);
+		if (tp_heap_sample_bytes > 0)
+			log_status("HEAP: Sampling one in every %d bytes allocated.", tp_heap_sample_bytes);
+		else
+			log_status("HEAP: Heap sampling turned off.");
+	}
+}
+
+
+static const char *
+heap_profile_name(dbref obj)
+{
+	if (obj < 0 || obj >= db_top || Typeof(obj) == TYPE_GARBAGE)
+		return "*RECYCLED*";
+	return unparse_object(GOD, obj);
+}
+
+
+static int
+heap_profile_cmp(const void *a, const void *b)
+{
+	double x = ((const struct heap_profile_line *) a)->bytes;
+	double y = ((const struct heap_profile_line *) b)->bytes;
+
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+
+static int
+heap_profile_delta_cmp(const void *a, const void *b)
+{
+	const struct heap_profile_line *x = *(struct heap_profile_line * const *) a;
+	const struct heap_profile_line *y = *(struct heap_profile_line * const *) b;
+	double dx = fabs(x->bytes - x->old_bytes);
+	double dy = fabs(y->bytes - y->old_bytes);
+
+	return dx < dy ? 1 : dx > dy ? -1 : 0;
+}
+
+
+/*
+ * Gathers the live estimates of every kind into one array, each kind
+ * sorted biggest first.  Returns the number of lines, or -1 if out of
+ * memory.
+ */
+static int
+heap_profile_collect(struct heap_profile_line **linesp, double tags[CRT_TAGS])
+{
+	struct CrT_sample_site *sites;
+	struct CrT_sample_owner *owners;
+	struct heap_profile_line *lines, *l;
+	const char *file;
+	int nsites, nowners, i, n = 0, start;
+
+	if ((nsites = CrT_copy_sample_sites(&sites)) < 0)
+		return -1;
+	if ((nowners = CrT_copy_sample_owners(&owners)) < 0) {
+		free(sites);
+		return -1;
+	}
+	lines = (struct heap_profile_line *) calloc(CRT_TAGS + nsites + nowners + 1,
+												 sizeof(struct heap_profile_line));
+	if (!lines) {
+		free(sites);
+		free(owners);
+		return -1;
+	}
+
+	/* Every site has just the one tag, so the tags' counts come from them. */
+	for (i = 0; i < CRT_TAGS; i++) {
+		l = &lines[n++];
+		strcpyn(l->kind, sizeof(l->kind), "tag");
+		strcpyn(l->key, sizeof(l->key), CrT_tag_names[i]);
+		strcpyn(l->name, sizeof(l->name), CrT_tag_names[i]);
+		l->bytes = tags[i];
+	}
+	for (i = 0; i < nsites; i++) {
+		lines[sites[i].tag].blocks += sites[i].blocks;
+		lines[sites[i].tag].samples += sites[i].samples;
+	}
+	qsort(lines, n, sizeof(*lines), heap_profile_cmp);
+
+	start = n;
+	for (i = 0; i < nsites; i++) {
+		l = &lines[n++];
+		file = rindex(sites[i].file, '/');
+		file = file ? file + 1 : sites[i].file;
+		strcpyn(l->kind, sizeof(l->kind), "site");
+		snprintf(l->key, sizeof(l->key), "%s:%d:%s", file, sites[i].line,
+				 CrT_tag_names[sites[i].tag]);
+		snprintf(l->name, sizeof(l->name), "%s line %d", file, sites[i].line);
+		l->bytes = sites[i].bytes;
+		l->blocks = sites[i].blocks;
+		l->samples = sites[i].samples;
+	}
+	qsort(lines + start, n - start, sizeof(*lines), heap_profile_cmp);
+
+	start = n;
+	for (i = 0; i < nowners; i++) {
+		if (owners[i].propdir[0])
+			continue;
+		l = &lines[n++];
+		strcpyn(l->kind, sizeof(l->kind), "program");
+		snprintf(l->key, sizeof(l->key), "#%d", owners[i].obj);
+		strcpyn(l->name, sizeof(l->name), heap_profile_name(owners[i].obj));
+		l->bytes = owners[i].bytes;
+		l->blocks = owners[i].blocks;
+		l->samples = owners[i].samples;
+	}
+	qsort(lines + start, n - start, sizeof(*lines), heap_profile_cmp);
+
+	start = n;
+	for (i = 0; i < nowners; i++) {
+		if (!owners[i].propdir[0])
+			continue;
+		l = &lines[n++];
+		strcpyn(l->kind, sizeof(l->kind), "proptree");
+		snprintf(l->key, sizeof(l->key), "#%d/%s", owners[i].obj,
+				 strcmp(owners[i].propdir, "/") ? owners[i].propdir : "");
+		snprintf(l->name, sizeof(l->name), "%.*s/%.*s",
+				 BUFFER_LEN / 2, heap_profile_name(owners[i].obj),
+				 BUFFER_LEN / 4, strcmp(owners[i].propdir, "/") ? owners[i].propdir : "");
+		l->bytes = owners[i].bytes;
+		l->blocks = owners[i].blocks;
+		l->samples = owners[i].samples;
+	}
+	qsort(lines + start, n - start, sizeof(*lines), heap_profile_cmp);
+
+	free(sites);
+	free(owners);
+	*linesp = lines;
+	return n;
+}
+
+
+static void
+heap_profile_show(dbref player, struct heap_profile_line *lines, int n,
+				  const char *kind, const char *title, double total)
+{
+	char buf[BUFFER_LEN];
+	int i, shown = 0;
+
+	notify(player, title);
+	for (i = 0; i < n && shown < HEAP_PROFILE_TOP; i++) {
+		if (strcmp(lines[i].kind, kind) || lines[i].bytes < 1.0)
+			continue;
+		snprintf(buf, sizeof(buf), "  %9.0fk %5.1f%%  %.*s", lines[i].bytes / 1024,
+				 total > 0 ? 100.0 * lines[i].bytes / total : 0.0,
+				 BUFFER_LEN / 2, lines[i].name);
+		notify(player, buf);
+		shown++;
+	}
+	if (!shown)
+		notify(player, "  (none)");
+}
+
+
+/*
+ * Writes the live samples out to HEAP_PROFILE_FILE, after moving the
+ * last dump out of the way for diffing, then sums it up for the player.
+ */
+static void
+heap_profile_dump(dbref player)
+{
+	struct heap_profile_line *lines;
+	double bytes, blocks, tags[CRT_TAGS];
+	char buf[BUFFER_LEN];
+	time_t now = time(NULL);
+	long samples;
+	FILE *f;
+	int i, n;
+
+	CrT_sample_totals(&bytes, &blocks, &samples, tags);
+	if (!CrT_sample_rate && !samples) {
+		notify(player, "The heap sampler is off.  Set '@tune heap_sample_bytes' to turn it on.");
+		return;
+	}
+	if ((n = heap_profile_collect(&lines, tags)) < 0) {
+		notify(player, "Out of memory.");
+		return;
+	}
+
+	snprintf(buf, sizeof(buf), "%s.old", HEAP_PROFILE_FILE);
+	(void) rename(HEAP_PROFILE_FILE, buf);
+	if ((f = fopen(HEAP_PROFILE_FILE, "wb")) == NULL) {
+		notify_fmt(player, "Could not write %s.", HEAP_PROFILE_FILE);
+		free(lines);
+		return;
+	}
+	fprintf(f, "# heap profile %ld\n", (long) now);
+	fprintf(f, "# sample_bytes %ld\n", CrT_sample_rate);
+	fprintf(f, "# samples %ld\n", samples);
+	fprintf(f, "# est_bytes %.0f\n", bytes);
+	fprintf(f, "# est_blocks %.0f\n", blocks);
+	fprintf(f, "# kind\tkey\test_bytes\test_blocks\tsamples\tname\n");
+	for (i = 0; i < n; i++)
+		fprintf(f, "%s\t%s\t%.0f\t%.0f\t%ld\t%s\n", lines[i].kind, lines[i].key,
+				lines[i].bytes, lines[i].blocks, lines[i].samples, lines[i].name);
+	fclose(f);
+
+	notify_fmt(player, "About %.0fk live in %.0f blocks, from %ld samples of one in %ld bytes.",
+			   bytes / 1024, blocks, samples, CrT_sample_rate);
+	heap_profile_show(player, lines, n, "tag", "By type:", bytes);
+	heap_profile_show(player, lines, n, "site", "Top call sites:", bytes);
+	heap_profile_show(player, lines, n, "program", "Top MUF programs:", bytes);
+	heap_profile_show(player, lines, n, "proptree", "Top property trees:", bytes);
+	notify_fmt(player, "Wrote %d lines to %s.", n, HEAP_PROFILE_FILE);
+	free(lines);
+}
+
+
+/*
+ * Reads a dump into the table, under "kind key".  Lines already there
+ * from the newer dump get their old_bytes filled in.  Returns the time
+ * the dump was written, or -1 if it couldn't be read.
+ */
+static long
+heap_profile_read(const char *file, hash_tab * table, int newer)
+{
+	struct heap_profile_line *l;
+	hash_data *hd;
+	hash_data data;
+	char buf[BUFFER_LEN * 2];
+	char key[BUFFER_LEN];
+	char kind[16], id[64];
+	double bytes;
+	long when = 0;
+	FILE *f;
+	char *name;
+
+	if ((f = fopen(file, "rb")) == NULL)
+		return -1;
+	while (fgets(buf, sizeof(buf), f)) {
+		if (buf[0] == '#') {
+			sscanf(buf, "# heap profile %ld", &when);
+			continue;
+		}
+		if (sscanf(buf, "%15[^\t]\t%63[^\t]\t%lf", kind, id, &bytes) != 3)
+			continue;
+		snprintf(key, sizeof(key), "%s %s", kind, id);
+		if ((hd = find_hash(key, table))) {
+			((struct heap_profile_line *) hd->pval)->old_bytes = bytes;
+			continue;
+		}
+		if (!(l = (struct heap_profile_line *) calloc(1, sizeof(*l))))
+			break;
+		strcpyn(l->kind, sizeof(l->kind), kind);
+		strcpyn(l->key, sizeof(l->key), id);
+		if (newer)
+			l->bytes = bytes;
+		else
+			l->old_bytes = bytes;
+		name = rindex(buf, '\t');
+		strcpyn(l->name, sizeof(l->name), name ? name + 1 : id);
+		if ((name = index(l->name, '\n')))
+			*name = '\0';
+		data.pval = l;
+		add_hash(key, data, table);
+	}
+	fclose(f);
+	return when;
+}
+
+
+/* Shows what has grown and shrunk the most between the last two dumps. */
+static void
+heap_profile_diff(dbref player)
+{
+	struct heap_profile_line **lines;
+	hash_entry *hp;
+	hash_tab table;
+	char buf[BUFFER_LEN];
+	double delta = 0.0;
+	long now, then;
+	int i, n = 0;
+
+	hash_init(&table, 256, HASH_EXACT);
+	snprintf(buf, sizeof(buf), "%s.old", HEAP_PROFILE_FILE);
+	if ((now = heap_profile_read(HEAP_PROFILE_FILE, &table, 1)) < 0 ||
+		(then = heap_profile_read(buf, &table, 0)) < 0) {
+		notify(player, "It takes two '@memory profile' dumps to make a diff.");
+		kill_hash(&table, 1);
+		return;
+	}
+
+	lines = (struct heap_profile_line **) malloc((table.count + 1) * sizeof(*lines));
+	for (hp = next_hash(&table, NULL); hp && lines; hp = next_hash(&table, hp)) {
+		lines[n] = (struct heap_profile_line *) hp->dat.pval;
+		if (!strcmp(lines[n]->kind, "tag"))
+			delta += lines[n]->bytes - lines[n]->old_bytes;
+		n++;
+	}
+	if (!lines) {
+		notify(player, "Out of memory.");
+		kill_hash(&table, 1);
+		return;
+	}
+	qsort(lines, n, sizeof(*lines), heap_profile_delta_cmp);
+
+	notify_fmt(player, "Heap changed by %+.0fk over the %ld seconds between the last two dumps.",
+			   delta / 1024, now - then);
+	notify(player, "     Change         Now  Kind      Name");
+	for (i = 0; i < n && i < HEAP_PROFILE_DIFF_TOP; i++) {
+		if (fabs(lines[i]->bytes - lines[i]->old_bytes) < 1.0)
+			break;
+		snprintf(buf, sizeof(buf), "%+10.0fk %10.0fk  %-8s  %.*s",
+				 (lines[i]->bytes - lines[i]->old_bytes) / 1024, lines[i]->bytes / 1024,
+				 lines[i]->kind, BUFFER_LEN / 2, lines[i]->name);
+		notify(player, buf);
+	}
+	free(lines);
+	kill_hash(&table, 1);
+}
+
+
+/*
+ * '@memory profile [dump|diff|reset|status]'.  A bare '@memory profile'
+ * dumps.
+ */
+void
+do_heap_profile(dbref player, const char *arg)
+{
+	double bytes, blocks, tags[CRT_TAGS];
+	long samples;
+
+	while (isspace(*arg))
+		arg++;
+	if (!*arg || !string_compare(arg, "dump")) {
+		heap_profile_dump(player);
+	} else if (!string_compare(arg, "diff")) {
+		heap_profile_diff(player);
+	} else if (!string_compare(arg, "reset")) {
+		CrT_reset_samples();
+		notify(player, "Heap samples cleared.");
+	} else if (!string_compare(arg, "status")) {
+		CrT_sample_totals(&bytes, &blocks, &samples, tags);
+		if (CrT_sample_rate)
+			notify_fmt(player, "Heap sampler is on, at one in %ld bytes.", CrT_sample_rate);
+		else
+			notify(player, "Heap sampler is off.");
+		notify_fmt(player, "%ld live samples, estimating %.0fk in %.0f blocks.",
+				   samples, bytes / 1024, blocks);
+	} else {
+		notify(player, "Unknown heap profile command.  Use dump, diff, reset or status.");
+	}
+}
+
+#else							/* HEAP_SAMPLING */
+
+void
+heap_profile_tick(void)
+{
+}
+
+
+void
+do_heap_profile(dbref player, const char *arg)
+{
+	notify(player, "This server was compiled without HEAP_SAMPLING.");
+}
+
+#endif							/* HEAP_SAMPLING */
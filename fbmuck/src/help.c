@@ -95,13 +95,359 @@ strcatn(char* buf, size_t bufsize, const char* src)
 
 #endif
 
+/*
+ * Help files are read in once and kept in memory until they change on
+ * disk.  They are copied rather than mapped, so that a file rewritten in
+ * place can't pull the text out from under a lookup.  The ones used with
+ * index_file() also get an index of their ~topic entries, hashed by topic
+ * name for lookups and sorted by topic name for prefix matches, so that
+ * a help request doesn't have to read through the whole file.
+ */
+struct help_topic {
+	size_t name;				/* offset of its name in the names pool */
+	size_t start;				/* offset of the first line of the entry */
+	size_t end;					/* offset of the ~ line after the entry */
+	int next;					/* next topic in the same hash bucket */
+};
+
+struct help_file {
+	struct help_file *next;
+	char *filename;
+	time_t mtime;
+	off_t size;
+	ino_t ino;
+	char *text;
+	size_t len;
+
+	int indexed;
+	int ntopics;
+	struct help_topic *topics;	/* sorted by name, then by place in the file */
+	char *names;
+	int hashsize;
+	int *buckets;
+};
+
+static struct help_file *help_files = NULL;
+
+
+static void
+help_file_unload(struct help_file *hf)
+{
+	if (hf->text)
+		free(hf->text);
+	hf->text = NULL;
+	hf->len = 0;
+
+	if (hf->topics)
+		free(hf->topics);
+	if (hf->names)
+		free(hf->names);
+	if (hf->buckets)
+		free(hf->buckets);
+	hf->topics = NULL;
+	hf->names = NULL;
+	hf->buckets = NULL;
+	hf->ntopics = 0;
+	hf->hashsize = 0;
+	hf->indexed = 0;
+}
+
+
+/* Returns the contents of the given file, reading it in again if it has
+ * changed since it was last read.  Returns NULL if it can't be read. */
+static struct help_file *
+help_file_get(const char *filename)
+{
+	struct help_file *hf;
+	struct stat st;
+	FILE *f;
+
+	for (hf = help_files; hf; hf = hf->next)
+		if (!strcmp(hf->filename, filename))
+			break;
+
+	if (stat(filename, &st)) {
+		if (hf)
+			help_file_unload(hf);
+		return NULL;
+	}
+
+	if (hf) {
+		if (hf->mtime == st.st_mtime && hf->size == st.st_size && hf->ino == st.st_ino &&
+				(hf->text || !hf->size))
+			return hf;
+		help_file_unload(hf);
+	} else {
+		hf = (struct help_file *) calloc(1, sizeof(struct help_file));
+		hf->filename = (char *) malloc(strlen(filename) + 1);
+		strcpy(hf->filename, filename);
+		hf->next = help_files;
+		help_files = hf;
+	}
+
+	hf->mtime = st.st_mtime;
+	hf->size = st.st_size;
+	hf->ino = st.st_ino;
+	hf->len = st.st_size;
+	if (!hf->len)
+		return hf;
+
+	if ((f = fopen(filename, "rb")) == NULL) {
+		hf->len = 0;
+		return NULL;
+	}
+	hf->text = (char *) malloc(hf->len);
+	hf->len = fread(hf->text, 1, hf->len, f);
+	fclose(f);
+	return hf;
+}
+
+
+/* Copies the line at pos into buf, the way fgets() and then cutting it
+ * off at the first newline would.  Returns the offset of the next line. */
+static size_t
+help_file_line(struct help_file *hf, size_t pos, size_t end, char *buf, int buflen)
+{
+	const char *p = hf->text + pos;
+	char *q = buf;
+	char *bufend = buf + buflen - 1;
+
+	while (pos < end && q < bufend) {
+		pos++;
+		if ((*q++ = *p++) == '\n')
+			break;
+	}
+	*q = '\0';
+	for (q = buf; *q; q++) {
+		if (*q == '\n' || *q == '\r') {
+			*q = '\0';
+			break;
+		}
+	}
+	return pos;
+}
+
+
+/* Returns the offset of the next line that starts with a ~, at or after
+ * pos, which has to be at the start of a line. */
+static size_t
+help_file_next_tilde(struct help_file *hf, size_t pos)
+{
+	const char *p;
+
+	while (pos < hf->len && hf->text[pos] != '~') {
+		p = memchr(hf->text + pos, '\n', hf->len - pos);
+		pos = p ? (size_t) (p - hf->text) + 1 : hf->len;
+	}
+	return pos;
+}
+
+
+static size_t
+help_file_eol(struct help_file *hf, size_t pos)
+{
+	const char *p = memchr(hf->text + pos, '\n', hf->len - pos);
+
+	return p ? (size_t) (p - hf->text) + 1 : hf->len;
+}
+
+
+static unsigned int
+help_hash(const char *s, unsigned int size)
+{
+	unsigned int hashval;
+
+	for (hashval = 0; *s; s++)
+		hashval = tolower(*s) + 31 * hashval;
+	return hashval & (size - 1);
+}
+
+
+static struct help_file *help_sorting;
+
+static int
+help_topic_cmp(const void *a, const void *b)
+{
+	const struct help_topic *ta = (const struct help_topic *) a;
+	const struct help_topic *tb = (const struct help_topic *) b;
+	int cmp;
+
+	cmp = string_compare(help_sorting->names + ta->name, help_sorting->names + tb->name);
+	if (cmp)
+		return cmp;
+	return (ta->start < tb->start) ? -1 : (ta->start > tb->start);
+}
+
+
+/* Finds the ~topic entries in a help file.  Each entry starts after one
+ * or more lines beginning with ~, with a line of topic names separated
+ * by |, and runs up to the next line beginning with ~. */
+static void
+help_file_index(struct help_file *hf)
+{
+	size_t pos, line, eol, start, end;
+	size_t namelen = 0, namemax = 0;
+	int topicmax = 0;
+	int i, slot;
+	char *p;
+
+	if (hf->indexed)
+		return;
+	hf->indexed = 1;
+
+	pos = help_file_next_tilde(hf, 0);
+	while (pos < hf->len) {
+		while (pos < hf->len && hf->text[pos] == '~')
+			pos = help_file_eol(hf, pos);
+		if (pos >= hf->len)
+			break;
+		line = pos;
+		eol = start = help_file_eol(hf, line);
+		end = help_file_next_tilde(hf, start);
+
+		while (eol > line && (hf->text[eol - 1] == '\n' || hf->text[eol - 1] == '\r'))
+			eol--;
+		while (line <= eol) {
+			p = memchr(hf->text + line, '|', eol - line);
+			if (!p)
+				p = hf->text + eol;
+			if (p > hf->text + line) {
+				if (hf->ntopics >= topicmax) {
+					topicmax = topicmax ? topicmax * 2 : 256;
+					hf->topics = (struct help_topic *)
+							realloc(hf->topics, topicmax * sizeof(struct help_topic));
+				}
+				if (namelen + (p - (hf->text + line)) + 1 > namemax) {
+					namemax = namemax ? namemax * 2 : 4096;
+					while (namelen + (p - (hf->text + line)) + 1 > namemax)
+						namemax *= 2;
+					hf->names = (char *) realloc(hf->names, namemax);
+				}
+				hf->topics[hf->ntopics].name = namelen;
+				hf->topics[hf->ntopics].start = start;
+				hf->topics[hf->ntopics].end = end;
+				hf->ntopics++;
+				memcpy(hf->names + namelen, hf->text + line, p - (hf->text + line));
+				namelen += p - (hf->text + line);
+				hf->names[namelen++] = '\0';
+			}
+			line = (p - hf->text) + 1;
+		}
+		pos = end;
+	}
+	if (!hf->ntopics)
+		return;
+
+	help_sorting = hf;
+	qsort(hf->topics, hf->ntopics, sizeof(struct help_topic), help_topic_cmp);
+
+	for (hf->hashsize = 16; hf->hashsize < hf->ntopics; hf->hashsize *= 2) ;
+	hf->buckets = (int *) malloc(hf->hashsize * sizeof(int));
+	for (i = 0; i < hf->hashsize; i++)
+		hf->buckets[i] = -1;
+
+	/* Backwards, so the first entry in the file comes first in a bucket. */
+	for (i = hf->ntopics - 1; i >= 0; i--) {
+		slot = help_hash(hf->names + hf->topics[i].name, hf->hashsize);
+		hf->topics[i].next = hf->buckets[slot];
+		hf->buckets[slot] = i;
+	}
+}
+
+
+static struct help_topic *
+help_file_find(struct help_file *hf, const char *topic)
+{
+	int i;
+
+	if (!hf->ntopics)
+		return NULL;
+	for (i = hf->buckets[help_hash(topic, hf->hashsize)]; i >= 0; i = hf->topics[i].next)
+		if (!string_compare(hf->names + hf->topics[i].name, topic))
+			return &hf->topics[i];
+	return NULL;
+}
+
+
+/* Returns how many different topic names start with the given prefix,
+ * and sets *first to the index of the first one. */
+static int
+help_file_prefix(struct help_file *hf, const char *prefix, int *first)
+{
+	int lo = 0, hi = hf->ntopics, mid;
+	int count = 0;
+	int i;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (string_compare(hf->names + hf->topics[mid].name, prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*first = lo;
+	for (i = lo; i < hf->ntopics && string_prefix(hf->names + hf->topics[i].name, prefix); i++)
+		if (i == lo || string_compare(hf->names + hf->topics[i].name,
+									  hf->names + hf->topics[i - 1].name))
+			count++;
+	return count;
+}
+
+
+/* Looks up a topic, or the one topic that starts with what was given.
+ * Returns NULL if there isn't one, and sets *matches to the number of
+ * topics that start with it. */
+static struct help_topic *
+help_file_lookup(struct help_file *hf, const char *onwhat, int *first, int *matches)
+{
+	struct help_topic *entry;
+
+	help_file_index(hf);
+	*matches = 0;
+	*first = 0;
+	if ((entry = help_file_find(hf, onwhat)))
+		return entry;
+	*matches = help_file_prefix(hf, onwhat, first);
+	if (*matches == 1)
+		return &hf->topics[*first];
+	return NULL;
+}
+
+
+/* Lists the topics starting at first that the help_file_lookup() that
+ * found no single match saw. */
+static void
+help_file_list_matches(struct help_file *hf, char *buf, int buflen, int first, int matches)
+{
+	const char *name;
+	const char *last = NULL;
+	int i;
+
+	strcpyn(buf, buflen, "Topics starting with that:");
+	for (i = first; matches > 0; i++) {
+		name = hf->names + hf->topics[i].name;
+		if (last && !string_compare(last, name))
+			continue;
+		if (strlen(buf) + strlen(name) + 6 >= (size_t) buflen) {
+			strcatn(buf, buflen, " ...");
+			break;
+		}
+		strcatn(buf, buflen, " ");
+		strcatn(buf, buflen, name);
+		last = name;
+		matches--;
+	}
+}
+
+
 void
 spit_file_segment(dbref player, const char *filename, const char *seg)
 {
-	FILE *f;
+	struct help_file *hf;
 	char buf[BUFFER_LEN];
 	char segbuf[BUFFER_LEN];
 	char *p;
+	size_t pos;
 	int startline, endline, currline;
 
 	startline = endline = currline = 0;
@@ -119,20 +465,18 @@ spit_file_segment(dbref player, const char *filename, const char *seg)
 			endline = startline = atoi(segbuf);
 		}
 	}
-	if ((f = fopen(filename, "rb")) == NULL) {
+	if ((hf = help_file_get(filename)) == NULL) {
 		snprintf(buf, sizeof(buf), "Sorry, %s is missing.  Management has been notified.", filename);
 		notify(player, buf);
 		fputs("spit_file:", stderr);
 		perror(filename);
 	} else {
-		while (fgets(buf, sizeof buf, f)) {
-			for (p = buf; *p; p++) {
-				if (*p == '\n' || *p == '\r') {
-					*p = '\0';
-					break;
-				}
-			}
+		pos = 0;
+		while (pos < hf->len) {
+			pos = help_file_line(hf, pos, hf->len, buf, sizeof(buf));
 			currline++;
+			if (endline && currline > endline)
+				break;
 			if ((!startline || (currline >= startline)) && (!endline || (currline <= endline))) {
 				if (*buf) {
 					notify(player, buf);
@@ -141,7 +485,6 @@ spit_file_segment(dbref player, const char *filename, const char *seg)
 				}
 			}
 		}
-		fclose(f);
 	}
 }
 
@@ -155,73 +498,44 @@ spit_file(dbref player, const char *filename)
 void
 index_file(dbref player, const char *onwhat, const char *file)
 {
-	FILE *f;
+	struct help_file *hf;
+	struct help_topic *entry;
 	char buf[BUFFER_LEN];
-	char topic[BUFFER_LEN];
-	char *p;
-	int arglen, found;
+	size_t pos, end;
+	int first, matches;
 
-	*topic = '\0';
-	strcpyn(topic, sizeof(topic), onwhat);
-	if (*onwhat) {
-		strcatn(topic, sizeof(topic), "|");
-	}
-
-	if ((f = fopen(file, "rb")) == NULL) {
+	if ((hf = help_file_get(file)) == NULL) {
 		snprintf(buf, sizeof(buf), "Sorry, %s is missing.  Management has been notified.", file);
 		notify(player, buf);
 		fprintf(stderr, "help: No file %s!\n", file);
-	} else {
-		if (*topic) {
-			arglen = strlen(topic);
-			do {
-				do {
-					if (!(fgets(buf, sizeof buf, f))) {
-						snprintf(buf, sizeof(buf), "Sorry, no help available on topic \"%s\"", onwhat);
-						notify(player, buf);
-						fclose(f);
-						return;
-					}
-				} while (*buf != '~');
-				do {
-					if (!(fgets(buf, sizeof buf, f))) {
-						snprintf(buf, sizeof(buf), "Sorry, no help available on topic \"%s\"", onwhat);
-						notify(player, buf);
-						fclose(f);
-						return;
-					}
-				} while (*buf == '~');
-				p = buf;
-				found = 0;
-				buf[strlen(buf) - 1] = '|';
-				while (*p && !found) {
-					if (strncasecmp(p, topic, arglen)) {
-						while (*p && (*p != '|'))
-							p++;
-						if (*p)
-							p++;
-					} else {
-						found = 1;
-					}
-				}
-			} while (!found);
-		}
-		while (fgets(buf, sizeof buf, f)) {
-			if (*buf == '~')
-				break;
-			for (p = buf; *p; p++) {
-				if (*p == '\n' || *p == '\r') {
-					*p = '\0';
-					break;
-				}
-			}
-			if (*buf) {
+		return;
+	}
+
+	if (*onwhat) {
+		entry = help_file_lookup(hf, onwhat, &first, &matches);
+		if (!entry) {
+			snprintf(buf, sizeof(buf), "Sorry, no help available on topic \"%s\"", onwhat);
+			notify(player, buf);
+			if (matches > 1) {
+				help_file_list_matches(hf, buf, sizeof(buf), first, matches);
 				notify(player, buf);
-			} else {
-				notify(player, "  ");
 			}
+			return;
+		}
+		pos = entry->start;
+		end = entry->end;
+	} else {
+		pos = 0;
+		end = help_file_next_tilde(hf, 0);
+	}
+
+	while (pos < end) {
+		pos = help_file_line(hf, pos, end, buf, sizeof(buf));
+		if (*buf) {
+			notify(player, buf);
+		} else {
+			notify(player, "  ");
 		}
-		fclose(f);
 	}
 }
 
@@ -230,12 +544,12 @@ index_file(dbref player, const char *onwhat, const char *file)
 void
 mcppkg_help_request(McpFrame * mfr, McpMesg * msg, McpVer ver, void *context)
 {
-	FILE *f;
+	struct help_file *hf;
+	struct help_topic *entry;
 	const char* file;
 	char buf[BUFFER_LEN];
-	char topic[BUFFER_LEN];
-	char *p;
-	int arglen, found;
+	size_t pos, end;
+	int first, matches;
 	McpVer supp = mcp_frame_package_supported(mfr, "org-fuzzball-help");
 	McpMesg omsg;
 
@@ -251,12 +565,6 @@ mcppkg_help_request(McpFrame * mfr, McpMesg * msg, McpVer ver, void *context)
 		onwhat = mcp_mesg_arg_getline(msg, "topic", 0);
 		valtype = mcp_mesg_arg_getline(msg, "type", 0);
 
-		*topic = '\0';
-		strcpyn(topic, sizeof(topic), onwhat);
-		if (*onwhat) {
-			strcatn(topic, sizeof(topic), "|");
-		}
-
 		if (!string_compare(valtype, "man")) {
 			file = MAN_FILE;
 		} else if (!string_compare(valtype, "mpi")) {
@@ -275,7 +583,7 @@ mcppkg_help_request(McpFrame * mfr, McpMesg * msg, McpVer ver, void *context)
 			return;
 		}
 
-		if ((f = fopen(file, "rb")) == NULL) {
+		if ((hf = help_file_get(file)) == NULL) {
 			snprintf(buf, sizeof(buf), "Sorry, %s is missing.  Management has been notified.", file);
 			fprintf(stderr, "help: No file %s!\n", file);
 			mcp_mesg_init(&omsg, "org-fuzzball-help", "error");
@@ -283,69 +591,42 @@ mcppkg_help_request(McpFrame * mfr, McpMesg * msg, McpVer ver, void *context)
 			mcp_mesg_arg_append(&omsg, "topic", onwhat);
 			mcp_frame_output_mesg(mfr, &omsg);
 			mcp_mesg_clear(&omsg);
-		} else {
-			if (*topic) {
-				arglen = strlen(topic);
-				do {
-					do {
-						if (!(fgets(buf, sizeof buf, f))) {
-							snprintf(buf, sizeof(buf), "Sorry, no help available on topic \"%s\"", onwhat);
-							fclose(f);
-							mcp_mesg_init(&omsg, "org-fuzzball-help", "error");
-							mcp_mesg_arg_append(&omsg, "text", buf);
-							mcp_mesg_arg_append(&omsg, "topic", onwhat);
-							mcp_frame_output_mesg(mfr, &omsg);
-							mcp_mesg_clear(&omsg);
-							return;
-						}
-					} while (*buf != '~');
-					do {
-						if (!(fgets(buf, sizeof buf, f))) {
-							snprintf(buf, sizeof(buf), "Sorry, no help available on topic \"%s\"", onwhat);
-							fclose(f);
-							mcp_mesg_init(&omsg, "org-fuzzball-help", "error");
-							mcp_mesg_arg_append(&omsg, "text", buf);
-							mcp_mesg_arg_append(&omsg, "topic", onwhat);
-							mcp_frame_output_mesg(mfr, &omsg);
-							mcp_mesg_clear(&omsg);
-							return;
-						}
-					} while (*buf == '~');
-					p = buf;
-					found = 0;
-					buf[strlen(buf) - 1] = '|';
-					while (*p && !found) {
-						if (strncasecmp(p, topic, arglen)) {
-							while (*p && (*p != '|'))
-								p++;
-							if (*p)
-								p++;
-						} else {
-							found = 1;
-						}
-					}
-				} while (!found);
-			}
-			mcp_mesg_init(&omsg, "org-fuzzball-help", "entry");
-			mcp_mesg_arg_append(&omsg, "topic", onwhat);
-			while (fgets(buf, sizeof buf, f)) {
-				if (*buf == '~')
-					break;
-				for (p = buf; *p; p++) {
-					if (*p == '\n' || *p == '\r') {
-						*p = '\0';
-						break;
-					}
-				}
-				if (!*buf) {
-					strcpyn(buf, sizeof(buf), "  ");
-				}
+			return;
+		}
+
+		if (*onwhat) {
+			entry = help_file_lookup(hf, onwhat, &first, &matches);
+			if (!entry) {
+				snprintf(buf, sizeof(buf), "Sorry, no help available on topic \"%s\"", onwhat);
+				mcp_mesg_init(&omsg, "org-fuzzball-help", "error");
 				mcp_mesg_arg_append(&omsg, "text", buf);
+				if (matches > 1) {
+					help_file_list_matches(hf, buf, sizeof(buf), first, matches);
+					mcp_mesg_arg_append(&omsg, "text", buf);
+				}
+				mcp_mesg_arg_append(&omsg, "topic", onwhat);
+				mcp_frame_output_mesg(mfr, &omsg);
+				mcp_mesg_clear(&omsg);
+				return;
 			}
-			fclose(f);
-			mcp_frame_output_mesg(mfr, &omsg);
-			mcp_mesg_clear(&omsg);
+			pos = entry->start;
+			end = entry->end;
+		} else {
+			pos = 0;
+			end = help_file_next_tilde(hf, 0);
+		}
+
+		mcp_mesg_init(&omsg, "org-fuzzball-help", "entry");
+		mcp_mesg_arg_append(&omsg, "topic", onwhat);
+		while (pos < end) {
+			pos = help_file_line(hf, pos, end, buf, sizeof(buf));
+			if (!*buf) {
+				strcpyn(buf, sizeof(buf), "  ");
+			}
+			mcp_mesg_arg_append(&omsg, "text", buf);
 		}
+		mcp_frame_output_mesg(mfr, &omsg);
+		mcp_mesg_clear(&omsg);
 	}
 }
 #endif
@@ -438,6 +719,21 @@ show_subfile(dbref player, const char *dir, const char *topic, const char *seg,
 
 
 #if !defined(STANDALONE_HELP)
+/* Reads in and indexes the help files, so the first requests for them
+ * don't have to. */
+void
+help_index_init(void)
+{
+	const char *files[] = { MAN_FILE, MPI_FILE, HELP_FILE, NEWS_FILE };
+	struct help_file *hf;
+	int i;
+
+	for (i = 0; i < (int) (sizeof(files) / sizeof(files[0])); i++)
+		if ((hf = help_file_get(files[i])))
+			help_file_index(hf);
+}
+
+
 void
 do_man(dbref player, char *topic, char *seg)
 {
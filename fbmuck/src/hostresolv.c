@@ -0,0 +1,680 @@
+/*
+ * In-process hostname and ident resolver.
+ */
+
+#include "config.h"
+
+#ifdef ASYNC_HOST_RESOLVER
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "db.h"
+#include "interface.h"
+#include "externs.h"
+
+/*
+ * With ASYNC_HOST_RESOLVER, the server looks up the hostname and ident
+ * username of each new connection itself, with two pools of threads,
+ * instead of writing a line to the fb-resolver process and waiting for a
+ * line back.  Reverse DNS lookups and ident queries are queued separately,
+ * so a pile of identd servers that never answer can't hold up hostnames.
+ *
+ * Hostnames are kept in an LRU cache of HOST_CACHE_SIZE addresses, hashed
+ * by address, for HOST_CACHE_EXPIRE seconds.  Addresses that don't have a
+ * name are cached too, so they aren't looked up again on every connect.
+ * A connection from an address that is already cached gets its hostname
+ * straight away, without going through the queue at all.
+ *
+ * Finished lookups go on a completion queue, and a byte is written to a
+ * pipe so that the main loop's select() wakes up for them.  Each one is
+ * tagged with its descriptor and the serial number the connection was
+ * given when it was accepted, so it is applied straight to the right
+ * descriptor, and dropped if that connection has gone away since.
+ */
+
+#define RESOLVE_DNS		0
+#define RESOLVE_IDENT	1
+
+#define HOST_HASH_SIZE	4096
+
+struct host_addr {
+	int family;
+	unsigned char bytes[16];
+};
+
+struct hostcache {
+	struct host_addr addr;
+	char name[128];				/* empty if the address has no name */
+	time_t time;
+	struct hostcache *next;		/* LRU list, most recently used first */
+	struct hostcache *prev;
+	struct hostcache *hashnext;
+};
+
+struct resolver_job {
+	struct resolver_job *next;
+	int kind;
+	int descr;
+	unsigned long serial;
+	struct host_addr addr;
+	unsigned short rport;
+	unsigned short lport;
+	char result[128];
+};
+
+struct resolver_queue {
+	struct resolver_job *head;
+	struct resolver_job *tail;
+	int count;
+};
+
+static struct hostcache *hostcache_hash[HOST_HASH_SIZE];
+static struct hostcache *hostcache_head = NULL;
+static struct hostcache *hostcache_tail = NULL;
+static int hostcache_count = 0;
+static pthread_mutex_t hostcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct resolver_queue dns_queue;
+static struct resolver_queue ident_queue;
+static struct resolver_queue done_queue;
+static pthread_mutex_t resolver_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dns_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t ident_wakeup = PTHREAD_COND_INITIALIZER;
+
+/* The serial number of the connection on each descriptor, 0 if none. */
+static unsigned long resolver_live[FD_SETSIZE];
+static unsigned long resolver_serial = 0;
+
+static int resolver_pipe[2] = { -1, -1 };
+static int resolver_active = 0;
+static int resolver_shutdown = 0;
+
+static unsigned long resolver_cache_hits = 0;
+static unsigned long resolver_cache_misses = 0;
+
+
+static unsigned int
+hostcache_hashval(const struct host_addr *addr)
+{
+	unsigned int hashval = addr->family;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		hashval = addr->bytes[i] + 31 * hashval;
+	return hashval % HOST_HASH_SIZE;
+}
+
+
+/* Takes an entry off of the LRU list and out of its hash chain.  Needs
+ * hostcache_mutex. */
+static void
+hostcache_unlink(struct hostcache *ptr)
+{
+	struct hostcache **link;
+
+	if (ptr->next) {
+		ptr->next->prev = ptr->prev;
+	} else {
+		hostcache_tail = ptr->prev;
+	}
+	if (ptr->prev) {
+		ptr->prev->next = ptr->next;
+	} else {
+		hostcache_head = ptr->next;
+	}
+	link = &hostcache_hash[hostcache_hashval(&ptr->addr)];
+	while (*link != ptr)
+		link = &(*link)->hashnext;
+	*link = ptr->hashnext;
+	hostcache_count--;
+}
+
+
+static void
+hostcache_push(struct hostcache *ptr)
+{
+	ptr->prev = NULL;
+	ptr->next = hostcache_head;
+	if (hostcache_head) {
+		hostcache_head->prev = ptr;
+	} else {
+		hostcache_tail = ptr;
+	}
+	hostcache_head = ptr;
+}
+
+
+/* Looks up an address in the host cache.  Returns -1 if it isn't there,
+ * 0 if it is known to have no name, or 1 after copying its name to buf. */
+static int
+hostcache_fetch(const struct host_addr *addr, char *buf, size_t buflen)
+{
+	struct hostcache *ptr;
+	int result = -1;
+
+	pthread_mutex_lock(&hostcache_mutex);
+	for (ptr = hostcache_hash[hostcache_hashval(addr)]; ptr; ptr = ptr->hashnext) {
+		if (!memcmp(&ptr->addr, addr, sizeof(struct host_addr)))
+			break;
+	}
+	if (ptr) {
+		if (time(NULL) - ptr->time > HOST_CACHE_EXPIRE) {
+			hostcache_unlink(ptr);
+			free(ptr);
+		} else {
+			if (ptr != hostcache_head) {
+				if (ptr->next) {
+					ptr->next->prev = ptr->prev;
+				} else {
+					hostcache_tail = ptr->prev;
+				}
+				ptr->prev->next = ptr->next;
+				hostcache_push(ptr);
+			}
+			result = (*ptr->name != '\0');
+			if (result)
+				strcpyn(buf, buflen, ptr->name);
+		}
+	}
+	pthread_mutex_unlock(&hostcache_mutex);
+	return result;
+}
+
+
+static void
+hostcache_add(const struct host_addr *addr, const char *name)
+{
+	struct hostcache *ptr;
+	unsigned int hashval = hostcache_hashval(addr);
+
+	pthread_mutex_lock(&hostcache_mutex);
+	for (ptr = hostcache_hash[hashval]; ptr; ptr = ptr->hashnext) {
+		if (!memcmp(&ptr->addr, addr, sizeof(struct host_addr)))
+			break;
+	}
+	if (ptr) {
+		hostcache_unlink(ptr);
+	} else {
+		ptr = (struct hostcache *) malloc(sizeof(struct hostcache));
+		ptr->addr = *addr;
+	}
+	strcpyn(ptr->name, sizeof(ptr->name), name);
+	ptr->time = time(NULL);
+	ptr->hashnext = hostcache_hash[hashval];
+	hostcache_hash[hashval] = ptr;
+	hostcache_push(ptr);
+	hostcache_count++;
+
+	while (hostcache_count > HOST_CACHE_SIZE) {
+		ptr = hostcache_tail;
+		hostcache_unlink(ptr);
+		free(ptr);
+	}
+	pthread_mutex_unlock(&hostcache_mutex);
+}
+
+
+static void
+resolver_enqueue(struct resolver_queue *q, struct resolver_job *job)
+{
+	job->next = NULL;
+	if (q->tail) {
+		q->tail->next = job;
+	} else {
+		q->head = job;
+	}
+	q->tail = job;
+	q->count++;
+}
+
+
+static struct resolver_job *
+resolver_dequeue(struct resolver_queue *q)
+{
+	struct resolver_job *job = q->head;
+
+	if (job) {
+		q->head = job->next;
+		if (!q->head)
+			q->tail = NULL;
+		q->count--;
+		job->next = NULL;
+	}
+	return job;
+}
+
+
+/* Waits for a job on the given queue whose connection is still open.
+ * Returns NULL when the resolver is shutting down. */
+static struct resolver_job *
+resolver_wait(struct resolver_queue *q, pthread_cond_t *cond)
+{
+	struct resolver_job *job;
+
+	pthread_mutex_lock(&resolver_mutex);
+	for (;;) {
+		while (!q->head && !resolver_shutdown)
+			pthread_cond_wait(cond, &resolver_mutex);
+		if (resolver_shutdown) {
+			pthread_mutex_unlock(&resolver_mutex);
+			return NULL;
+		}
+		job = resolver_dequeue(q);
+		if (resolver_live[job->descr] == job->serial)
+			break;
+		free(job);
+	}
+	pthread_mutex_unlock(&resolver_mutex);
+	return job;
+}
+
+
+static void
+resolver_finish(struct resolver_job *job)
+{
+	char c = 0;
+
+	pthread_mutex_lock(&resolver_mutex);
+	resolver_enqueue(&done_queue, job);
+	pthread_mutex_unlock(&resolver_mutex);
+	write(resolver_pipe[1], &c, 1);
+}
+
+
+static socklen_t
+resolver_sockaddr(const struct host_addr *addr, unsigned short port, struct sockaddr_storage *ss)
+{
+	memset(ss, 0, sizeof(*ss));
+#ifdef USE_IPV6
+	if (addr->family == AF_INET6) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) ss;
+
+		sin6->sin6_family = AF_INET6;
+		memcpy(&sin6->sin6_addr, addr->bytes, sizeof(struct in6_addr));
+		sin6->sin6_port = htons(port);
+		return sizeof(struct sockaddr_in6);
+	}
+#endif
+	{
+		struct sockaddr_in *sin = (struct sockaddr_in *) ss;
+
+		sin->sin_family = AF_INET;
+		memcpy(&sin->sin_addr, addr->bytes, sizeof(struct in_addr));
+		sin->sin_port = htons(port);
+		return sizeof(struct sockaddr_in);
+	}
+}
+
+
+static void *
+resolver_dns_thread(void *arg)
+{
+	struct resolver_job *job;
+	struct sockaddr_storage ss;
+	socklen_t sslen;
+	char name[128];
+	int known;
+
+	while ((job = resolver_wait(&dns_queue, &dns_wakeup))) {
+		/* Someone else may have looked it up while this was queued. */
+		known = hostcache_fetch(&job->addr, name, sizeof(name));
+		if (known < 0) {
+			sslen = resolver_sockaddr(&job->addr, 0, &ss);
+			if (getnameinfo((struct sockaddr *) &ss, sslen, name, sizeof(name),
+							NULL, 0, NI_NAMEREQD)) {
+				*name = '\0';
+			}
+			hostcache_add(&job->addr, name);
+		} else if (!known) {
+			*name = '\0';
+		}
+		if (*name) {
+			strcpyn(job->result, sizeof(job->result), name);
+			resolver_finish(job);
+		} else {
+			free(job);
+		}
+	}
+	return NULL;
+}
+
+
+/* Waits until the socket is ready, or the deadline passes. */
+static int
+resolver_poll(int fd, short events, time_t deadline)
+{
+	struct pollfd pfd;
+	time_t now;
+	int result;
+
+	for (;;) {
+		now = time(NULL);
+		if (now >= deadline || resolver_shutdown)
+			return 0;
+		pfd.fd = fd;
+		pfd.events = events;
+		pfd.revents = 0;
+		result = poll(&pfd, 1, (deadline - now > 1) ? 1000 : (int) (deadline - now) * 1000);
+		if (result > 0)
+			return 1;
+		if (result < 0 && errno != EINTR)
+			return 0;
+	}
+}
+
+
+/* Asks the identd on the far end of a connection who is on it.  Returns
+ * 1 and puts the answer in job->result, or returns 0 if there isn't one. */
+static int
+resolver_ident(struct resolver_job *job)
+{
+	struct sockaddr_storage ss;
+	socklen_t sslen;
+	time_t deadline = time(NULL) + RESOLVER_IDENT_TIMEOUT;
+	char buf[1024];
+	char *ptr, *ptr2;
+	int fd, len, got, err;
+
+	sslen = resolver_sockaddr(&job->addr, 113, &ss);
+	if ((fd = socket(job->addr.family, SOCK_STREAM, 0)) < 0)
+		return 0;
+	make_nonblocking(fd);
+
+	if (connect(fd, (struct sockaddr *) &ss, sslen) < 0) {
+		if (errno != EINPROGRESS || !resolver_poll(fd, POLLOUT, deadline))
+			goto bad;
+		len = sizeof(err);
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, (socklen_t *) &len) < 0 || err)
+			goto bad;
+	}
+
+	snprintf(buf, sizeof(buf), "%u,%u\r\n", job->rport, job->lport);
+	if (write(fd, buf, strlen(buf)) < 0)
+		goto bad;
+
+	got = 0;
+	while (got < (int) sizeof(buf) - 1 && !memchr(buf, '\n', got)) {
+		if (!resolver_poll(fd, POLLIN, deadline))
+			goto bad;
+		len = read(fd, buf + got, sizeof(buf) - 1 - got);
+		if (len < 0 && (errno == EAGAIN || errno == EINTR))
+			continue;
+		if (len <= 0)
+			break;
+		got += len;
+	}
+	buf[got] = '\0';
+
+	/* "rport , lport : USERID : OS : username" */
+	ptr = index(buf, ':');
+	if (!ptr)
+		goto bad;
+	ptr++;
+	while (*ptr == ' ')
+		ptr++;
+	if (strncmp(ptr, "USERID", 6))
+		goto bad;
+	ptr = index(ptr, ':');
+	if (!ptr)
+		goto bad;
+	ptr = index(ptr + 1, ':');
+	if (!ptr)
+		goto bad;
+	ptr++;
+	while (*ptr == ' ')
+		ptr++;
+	if ((ptr2 = index(ptr, '\r')) || (ptr2 = index(ptr, '\n')))
+		*ptr2 = '\0';
+	for (ptr2 = ptr + strlen(ptr); ptr2 > ptr && ptr2[-1] == ' '; )
+		*--ptr2 = '\0';
+	if (!*ptr)
+		goto bad;
+
+	shutdown(fd, 2);
+	close(fd);
+	strcpyn(job->result, sizeof(job->result), ptr);
+	return 1;
+
+  bad:
+	close(fd);
+	return 0;
+}
+
+
+static void *
+resolver_ident_thread(void *arg)
+{
+	struct resolver_job *job;
+
+	while ((job = resolver_wait(&ident_queue, &ident_wakeup))) {
+		if (resolver_ident(job)) {
+			resolver_finish(job);
+		} else {
+			free(job);
+		}
+	}
+	return NULL;
+}
+
+
+void
+start_resolver(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	sigset_t mask, oldmask;
+	int i, started = 0;
+
+	if (resolver_active)
+		return;
+
+	if (pipe(resolver_pipe) < 0) {
+		log_status("Unable to start host resolver: %s", strerror(errno));
+		return;
+	}
+	make_nonblocking(resolver_pipe[0]);
+	make_nonblocking(resolver_pipe[1]);
+#ifdef F_SETFD
+	fcntl(resolver_pipe[0], F_SETFD, 1);
+	fcntl(resolver_pipe[1], F_SETFD, 1);
+#endif
+
+	/*
+	 * Signals should always be handled by the main thread.  The workers
+	 * are detached, since one can be stuck in getnameinfo() for a while,
+	 * and there is no reason to hold up a shutdown for it.
+	 */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &oldmask);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	resolver_shutdown = 0;
+	for (i = 0; i < RESOLVER_DNS_THREADS; i++)
+		if (!pthread_create(&thread, &attr, resolver_dns_thread, NULL))
+			started++;
+	for (i = 0; i < RESOLVER_IDENT_THREADS; i++)
+		if (!pthread_create(&thread, &attr, resolver_ident_thread, NULL))
+			started++;
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+
+	if (started < RESOLVER_DNS_THREADS + RESOLVER_IDENT_THREADS)
+		log_status("Host resolver only started %d of %d threads.", started,
+				   RESOLVER_DNS_THREADS + RESOLVER_IDENT_THREADS);
+	resolver_active = (started > 0);
+}
+
+
+void
+stop_resolver(void)
+{
+	if (!resolver_active)
+		return;
+	pthread_mutex_lock(&resolver_mutex);
+	resolver_shutdown = 1;
+	pthread_cond_broadcast(&dns_wakeup);
+	pthread_cond_broadcast(&ident_wakeup);
+	pthread_mutex_unlock(&resolver_mutex);
+	resolver_active = 0;
+}
+
+
+/* The descriptor the main loop should watch for finished lookups, or -1. */
+int
+resolver_wakeup_fd(void)
+{
+	return resolver_active ? resolver_pipe[0] : -1;
+}
+
+
+/* const char *resolver_lookup(int descr, struct sockaddr *addr, int lport)
+ * Starts looking up the hostname and ident username of a new connection,
+ * on the given descriptor, that came in on local port lport.  If the
+ * address is in the host cache, returns its name.  Otherwise returns NULL,
+ * and the name, if there is one, comes back later from resolver_result().
+ */
+const char *
+resolver_lookup(int descr, struct sockaddr *addr, int lport)
+{
+	static char name[128];
+	struct resolver_job *dns = NULL, *ident;
+	struct host_addr ha;
+	unsigned short rport;
+	int known;
+
+	if (!resolver_active || descr < 0 || descr >= FD_SETSIZE)
+		return NULL;
+
+	memset(&ha, 0, sizeof(ha));
+	ha.family = addr->sa_family;
+#ifdef USE_IPV6
+	if (addr->sa_family == AF_INET6) {
+		memcpy(ha.bytes, &((struct sockaddr_in6 *) addr)->sin6_addr, sizeof(struct in6_addr));
+		rport = ntohs(((struct sockaddr_in6 *) addr)->sin6_port);
+	} else
+#endif
+	if (addr->sa_family == AF_INET) {
+		memcpy(ha.bytes, &((struct sockaddr_in *) addr)->sin_addr, sizeof(struct in_addr));
+		rport = ntohs(((struct sockaddr_in *) addr)->sin_port);
+	} else {
+		return NULL;
+	}
+
+	known = hostcache_fetch(&ha, name, sizeof(name));
+
+	if (known < 0) {
+		dns = (struct resolver_job *) malloc(sizeof(struct resolver_job));
+		dns->kind = RESOLVE_DNS;
+		dns->descr = descr;
+		dns->addr = ha;
+		dns->rport = rport;
+		dns->lport = lport;
+		*dns->result = '\0';
+	}
+	ident = (struct resolver_job *) malloc(sizeof(struct resolver_job));
+	ident->kind = RESOLVE_IDENT;
+	ident->descr = descr;
+	ident->addr = ha;
+	ident->rport = rport;
+	ident->lport = lport;
+	*ident->result = '\0';
+
+	pthread_mutex_lock(&resolver_mutex);
+	if (known < 0) {
+		resolver_cache_misses++;
+	} else {
+		resolver_cache_hits++;
+	}
+	resolver_live[descr] = ++resolver_serial;
+	ident->serial = resolver_serial;
+	resolver_enqueue(&ident_queue, ident);
+	pthread_cond_signal(&ident_wakeup);
+	if (dns) {
+		dns->serial = resolver_serial;
+		resolver_enqueue(&dns_queue, dns);
+		pthread_cond_signal(&dns_wakeup);
+	}
+	pthread_mutex_unlock(&resolver_mutex);
+
+	return (known > 0) ? name : NULL;
+}
+
+
+/* Drops any lookups still pending for the connection on a descriptor
+ * that is being closed. */
+void
+resolver_forget(int descr)
+{
+	if (descr < 0 || descr >= FD_SETSIZE)
+		return;
+	pthread_mutex_lock(&resolver_mutex);
+	resolver_live[descr] = 0;
+	pthread_mutex_unlock(&resolver_mutex);
+}
+
+
+/* int resolver_result(int *descr, char *hostname, char *username, int buflen)
+ * Gets the next finished lookup for a connection that is still open.
+ * Sets one of hostname or username, and empties the other.  Returns 0
+ * when there are none left.
+ */
+int
+resolver_result(int *descr, char *hostname, char *username, int buflen)
+{
+	struct resolver_job *job;
+	char buf[64];
+
+	if (!resolver_active)
+		return 0;
+
+	while (read(resolver_pipe[0], buf, sizeof(buf)) > 0) ;
+
+	pthread_mutex_lock(&resolver_mutex);
+	while ((job = resolver_dequeue(&done_queue))) {
+		if (resolver_live[job->descr] == job->serial)
+			break;
+		free(job);
+	}
+	pthread_mutex_unlock(&resolver_mutex);
+
+	if (!job)
+		return 0;
+
+	*descr = job->descr;
+	*hostname = *username = '\0';
+	if (job->kind == RESOLVE_DNS) {
+		strcpyn(hostname, buflen, job->result);
+	} else {
+		strcpyn(username, buflen, job->result);
+	}
+	free(job);
+	return 1;
+}
+
+
+void
+resolver_stats(int *dns_pending, int *ident_pending, int *cached,
+			   unsigned long *hits, unsigned long *misses)
+{
+	pthread_mutex_lock(&resolver_mutex);
+	*dns_pending = dns_queue.count;
+	*ident_pending = ident_queue.count;
+	*hits = resolver_cache_hits;
+	*misses = resolver_cache_misses;
+	pthread_mutex_unlock(&resolver_mutex);
+
+	pthread_mutex_lock(&hostcache_mutex);
+	*cached = hostcache_count;
+	pthread_mutex_unlock(&hostcache_mutex);
+}
+
+#endif							/* ASYNC_HOST_RESOLVER */
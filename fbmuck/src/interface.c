@@ -160,7 +160,9 @@ struct descriptor_data *descriptor_list = NULL;
 /* Yes, both of these should start defaulted to disabled. */
 /* If both are still disabled after arg parsing, we'll enable one or both. */
 static int ipv4_enabled = 0;
+#if !defined(BENCHMARK) || defined(USE_IPV6)
 static int ipv6_enabled = 0;
+#endif
 
 static int numports = 0;
 static int numsocks = 0;
@@ -183,10 +185,16 @@ SSL_CTX *ssl_ctx;
 #endif
 
 static int ndescriptors = 0;
+
+/* Input lines are copied here, if the server was started with -record. */
+static FILE *record_file = NULL;
 extern void fork_and_dump(void);
 
 void process_commands(void);
 void shovechars();
+struct timeval process_slice(struct timeval last_slice, struct timeval current_time);
+int record_start(const char *filename);
+static void record_event(struct descriptor_data *d, char event, const char *line);
 void shutdownsock(struct descriptor_data *d);
 struct descriptor_data *initializesock(int s, const char *hostname, int is_ssl);
 void make_nonblocking(int s);
@@ -313,6 +321,7 @@ show_program_usage(char *prog)
 	fprintf(stderr, "        -wizonly         only allow wizards to login.\n");
 	fprintf(stderr, "        -godpasswd PASS  reset God(#1)'s password to PASS.  Implies -convert\n");
 	fprintf(stderr, "        -ipv6            enable listening on ipv6 sockets.\n");
+	fprintf(stderr, "        -record FILE     record all connections and input to FILE.\n");
 	fprintf(stderr, "        -version         display this server's version.\n");
 	fprintf(stderr, "        -help            display this message.\n");
 #ifdef WIN32
@@ -326,6 +335,7 @@ show_program_usage(char *prog)
 
 extern int sanity_violated;
 
+#ifndef BENCHMARK
 int
 main(int argc, char **argv)
 {
@@ -418,6 +428,15 @@ main(int argc, char **argv)
 				exit(1);
 #endif
 
+			} else if (!strcmp(argv[i], "-record")) {
+				if (i + 1 >= argc) {
+					show_program_usage(*argv);
+				}
+				if (!record_start(argv[++i])) {
+					perror("-record");
+					exit(1);
+				}
+
 			} else if (!strcmp(argv[i], "-godpasswd")) {
 				if (i + 1 >= argc) {
 					show_program_usage(*argv);
@@ -595,6 +614,11 @@ main(int argc, char **argv)
 			setbuf(stdout, NULL);
             }
 #endif
+
+#ifdef ASYNC_LOGGING
+		/* Must come after we've forked into the background. */
+		start_log_writer();
+#endif
 	}
 
 
@@ -623,6 +647,16 @@ main(int argc, char **argv)
 		spawn_resolver();
 	}
 #endif
+#ifdef ASYNC_HOST_RESOLVER
+	if (!db_conversion_flag && !sanity_interactive) {
+		start_resolver();
+	}
+#endif
+#ifdef MUF_WORKERS
+	if (!db_conversion_flag && !sanity_interactive) {
+		start_muf_workers();
+	}
+#endif
 
 
 	/* Initialize MCP and some packages. */
@@ -702,6 +736,12 @@ main(int argc, char **argv)
 #ifdef SPAWN_HOST_RESOLVER
 		kill_resolver();
 #endif
+#ifdef ASYNC_HOST_RESOLVER
+		stop_resolver();
+#endif
+#ifdef MUF_WORKERS
+		stop_muf_workers();
+#endif
 
 #ifdef MALLOC_PROFILING
 		db_free();
@@ -730,6 +770,10 @@ main(int argc, char **argv)
 		CrT_summarize_to_file("malloc_log", "Shutdown");
 #endif
 
+#ifdef ASYNC_LOGGING
+		stop_log_writer();
+#endif
+
 		if (restart_flag) {
 #ifndef WIN32
 			char **argslist;
@@ -779,6 +823,7 @@ main(int argc, char **argv)
 	exit(0);
 	return 0;
 }
+#endif /* !BENCHMARK */
 
 int
 queue_ansi(struct descriptor_data *d, const char *msg)
@@ -1144,6 +1189,11 @@ shovechars()
 	struct timeval sel_in, sel_out;
 	int avail_descriptors;
 	int i;
+#ifdef MAIN_LOOP_METRICS
+	struct timeval phase;
+	int inlines;
+	long outbytes;
+#endif
 
 #ifdef USE_SSL
 	int ssl_status_ok = 1;
@@ -1241,41 +1291,28 @@ shovechars()
 	avail_descriptors = max_open_files() - 5;
 
 	(void) time(&now);
+#ifdef MAIN_LOOP_METRICS
+	metrics_init();
+#endif
 
 /* And here, we do the actual player-interaction loop */
 
 	while (shutdown_flag == 0) {
 		gettimeofday(&current_time, (struct timezone *) 0);
-		last_slice = update_quotas(last_slice, current_time);
-
-		next_muckevent();
-		process_commands();
-		muf_event_process();
+#ifdef MAIN_LOOP_METRICS
+		metrics_pass(&current_time);
+#endif
+		last_slice = process_slice(last_slice, current_time);
+#ifdef MAIN_LOOP_METRICS
+		metrics_tick();
+#endif
+#ifdef HEAP_SAMPLING
+		heap_profile_tick();
+#endif
 #ifdef WIN32
 /*		check_console();*/ /* Handle possible CTRL+C */
 #endif
 
-		for (d = descriptor_list; d; d = dnext) {
-			dnext = d->next;
-			if (d->booted) {
-				process_output(d);
-				if (d->booted == 2) {
-					goodbye_user(d);
-				}
-				d->booted = 0;
-				process_output(d);
-				shutdownsock(d);
-			}
-		}
-		if (global_dumpdone != 0) {
-			if (tp_dumpdone_warning) {
-				wall_and_flush(tp_dumpdone_mesg);
-			}
-			global_dumpdone = 0;
-		}
-		purge_free_frames();
-		untouchprops_incremental(1);
-
 		if (shutdown_flag)
 			break;
 		timeout.tv_sec = 10;
@@ -1306,11 +1343,19 @@ shovechars()
 # endif
 #endif
 		}
+#ifdef MAIN_LOOP_METRICS
+		inlines = 0;
+		outbytes = 0;
+#endif
 		for (d = descriptor_list; d; d = d->next) {
 			if (d->input.lines > 100)
 				timeout = slice_timeout;
 			else
 				FD_SET(d->descriptor, &input_set);
+#ifdef MAIN_LOOP_METRICS
+			inlines += d->input.lines;
+			outbytes += d->output_size;
+#endif
 
 #ifdef USE_SSL
 			if (d->output.head && !d->block_writes) {
@@ -1355,21 +1400,55 @@ shovechars()
 #ifdef SPAWN_HOST_RESOLVER
 		FD_SET(resolver_sock[1], &input_set);
 #endif
+#ifdef ASYNC_HOST_RESOLVER
+		{
+			int resolver_fd = resolver_wakeup_fd();
+
+			if (resolver_fd >= 0) {
+				FD_SET(resolver_fd, &input_set);
+				if (resolver_fd >= maxd)
+					maxd = resolver_fd + 1;
+			}
+		}
+#endif
+#ifdef MUF_WORKERS
+		{
+			int worker_fd = muf_worker_wakeup_fd();
+
+			if (worker_fd >= 0) {
+				FD_SET(worker_fd, &input_set);
+				if (worker_fd >= maxd)
+					maxd = worker_fd + 1;
+			}
+		}
+#endif
+
+#ifdef MAIN_LOOP_METRICS
+		metrics_queues(ndescriptors, inlines, outbytes);
+		metrics_fdset(&input_set, &maxd);
+#endif
 
 		tmptq = next_muckevent_time();
 		if ((tmptq >= 0L) && (timeout.tv_sec > tmptq)) {
 			timeout.tv_sec = tmptq + (tp_pause_min / 1000);
 			timeout.tv_usec = (tp_pause_min % 1000) * 1000L;
 		}
+#ifdef INCREMENTAL_SANITY
+		if (sanity_running()) {
+			/* Just poll, so the next slice isn't held up waiting for input. */
+			timeout.tv_sec = 0;
+			timeout.tv_usec = 0;
+		}
+#endif
 		gettimeofday(&sel_in,NULL);
 #ifndef WIN32
-		if (select(maxd, &input_set, &output_set, (fd_set *) 0, &timeout) < 0) {
+		if ((cnt = select(maxd, &input_set, &output_set, (fd_set *) 0, &timeout)) < 0) {
 			if (errno != EINTR) {
 				perror("select");
 				return;
 			}
 #else
-		if (select(maxd, &input_set, &output_set, (fd_set *) 0, &timeout) == SOCKET_ERROR) {
+		if ((cnt = select(maxd, &input_set, &output_set, (fd_set *) 0, &timeout)) == SOCKET_ERROR) {
 			if (WSAGetLastError() != WSAEINTR) {
 				perror("select");
 				return;
@@ -1390,6 +1469,11 @@ shovechars()
 				sel_prof_idle_sec += 1;
 			}
 			sel_prof_idle_use++;
+#ifdef MAIN_LOOP_METRICS
+			metrics_select(&sel_out, cnt);
+			METRICS_MARK(phase);
+			metrics_serve(&input_set);
+#endif
 			(void) time(&now);
 			for (i = 0; i < numsocks; i++) {
 				if (FD_ISSET(sock[i], &input_set)) {
@@ -1489,6 +1573,16 @@ shovechars()
 			if (FD_ISSET(resolver_sock[1], &input_set)) {
 				resolve_hostnames();
 			}
+#endif
+#ifdef ASYNC_HOST_RESOLVER
+			if (resolver_wakeup_fd() >= 0 && FD_ISSET(resolver_wakeup_fd(), &input_set)) {
+				resolve_hostnames();
+			}
+#endif
+#ifdef MUF_WORKERS
+			if (muf_worker_wakeup_fd() >= 0 && FD_ISSET(muf_worker_wakeup_fd(), &input_set)) {
+				muf_worker_results();
+			}
 #endif
 			for (cnt = 0, d = descriptor_list; d; d = dnext) {
 				dnext = d->next;
@@ -1527,6 +1621,7 @@ shovechars()
 				con_players_max = cnt;
 			}
 			con_players_curr = cnt;
+			METRICS_PHASE(METRIC_IO, phase);
 		}
 	}
 
@@ -1538,6 +1633,57 @@ shovechars()
 }
 
 
+/*
+ * Does everything the main loop does each time around, apart from waiting
+ * for and reading input: runs due events and queued commands, and drops
+ * booted connections.  Returns the new last_slice for update_quotas().
+ */
+struct timeval
+process_slice(struct timeval last_slice, struct timeval current_time)
+{
+	struct descriptor_data *d, *dnext;
+#ifdef MAIN_LOOP_METRICS
+	struct timeval phase;
+#endif
+
+	last_slice = update_quotas(last_slice, current_time);
+
+	METRICS_MARK(phase);
+	next_muckevent();
+	METRICS_PHASE(METRIC_EVENTS, phase);
+	process_commands();
+	METRICS_PHASE(METRIC_COMMANDS, phase);
+	muf_event_process();
+	METRICS_PHASE(METRIC_MUFEVENTS, phase);
+
+	for (d = descriptor_list; d; d = dnext) {
+		dnext = d->next;
+		if (d->booted) {
+			process_output(d);
+			if (d->booted == 2) {
+				goodbye_user(d);
+			}
+			d->booted = 0;
+			process_output(d);
+			shutdownsock(d);
+		}
+	}
+	if (global_dumpdone != 0) {
+		if (tp_dumpdone_warning) {
+			wall_and_flush(tp_dumpdone_mesg);
+		}
+		global_dumpdone = 0;
+	}
+	purge_free_frames();
+	untouchprops_incremental(1);
+	objstats_sweep();
+#ifdef INCREMENTAL_SANITY
+	sanity_incremental();
+#endif
+	return last_slice;
+}
+
+
 void
 wall_and_flush(const char *msg)
 {
@@ -1618,8 +1764,17 @@ new_connection_v6(int port, int sock, int is_ssl)
 		fcntl(newsock, F_SETFD, 1);
 # endif
 		strcpyn(hostname, sizeof(hostname), addrout_v6(port, &(addr.sin6_addr), addr.sin6_port));
+# ifdef ASYNC_HOST_RESOLVER
+		if (tp_hostnames) {
+			const char *cached = resolver_lookup(newsock, (struct sockaddr *) &addr, port);
+
+			if (cached)
+				snprintf(hostname, sizeof(hostname), "%s(%u)", cached, ntohs(addr.sin6_port));
+		}
+# endif
 		log_status("ACCEPT: %s on descriptor %d", hostname, newsock);
 		log_status("CONCOUNT: There are now %d open connections.", ++ndescriptors);
+		METRICS_COUNT(METRIC_CONNECTS, 1);
 		return initializesock(newsock, hostname, is_ssl);
 	}
 }
@@ -1643,8 +1798,17 @@ new_connection(int port, int sock, int is_ssl)
 		fcntl(newsock, F_SETFD, 1);
 #endif
 		strcpyn(hostname, sizeof(hostname), addrout(port, addr.sin_addr.s_addr, addr.sin_port));
+#ifdef ASYNC_HOST_RESOLVER
+		if (tp_hostnames) {
+			const char *cached = resolver_lookup(newsock, (struct sockaddr *) &addr, port);
+
+			if (cached)
+				snprintf(hostname, sizeof(hostname), "%s(%u)", cached, ntohs(addr.sin_port));
+		}
+#endif
 		log_status("ACCEPT: %s on descriptor %d", hostname, newsock);
 		log_status("CONCOUNT: There are now %d open connections.", ++ndescriptors);
+		METRICS_COUNT(METRIC_CONNECTS, 1);
 		return initializesock(newsock, hostname, is_ssl);
 	}
 }
@@ -1774,6 +1938,32 @@ resolve_hostnames()
 
 #endif
 
+#ifdef ASYNC_HOST_RESOLVER
+/* Applies the hostname and ident lookups that the resolver threads have
+ * finished since the last time. */
+void
+resolve_hostnames()
+{
+	char hostname[128];
+	char username[128];
+	struct descriptor_data *d;
+	int descr;
+
+	while (resolver_result(&descr, hostname, username, sizeof(hostname))) {
+		if (!(d = lookup_descriptor(descr)))
+			continue;
+		if (*hostname) {
+			FREE(d->hostname);
+			d->hostname = string_dup(hostname);
+		}
+		if (*username) {
+			FREE(d->username);
+			d->username = string_dup(username);
+		}
+	}
+}
+#endif
+
 
 /*  addrout_v6 -- Translate IPV6 address 'a' from addr struct to text.		*/
 #ifdef USE_IPV6
@@ -1788,7 +1978,7 @@ addrout_v6(int lport, struct in6_addr *a, unsigned short prt)
 
 	prt = ntohs(prt);
 
-# ifndef SPAWN_HOST_RESOLVER
+# if !defined(SPAWN_HOST_RESOLVER) && !defined(ASYNC_HOST_RESOLVER)
 	if (tp_hostnames) {
 		/* One day the nameserver Qwest uses decided to start */
 		/* doing halfminute lags, locking up the entire muck  */
@@ -1854,7 +2044,7 @@ addrout(int lport, long a, unsigned short prt)
 
 	prt = ntohs(prt);
 
-#ifndef SPAWN_HOST_RESOLVER
+#if !defined(SPAWN_HOST_RESOLVER) && !defined(ASYNC_HOST_RESOLVER)
 	if (tp_hostnames) {
 		/* One day the nameserver Qwest uses decided to start */
 		/* doing halfminute lags, locking up the entire muck  */
@@ -1938,10 +2128,14 @@ shutdownsock(struct descriptor_data *d)
 		log_status("DISCONNECT: descriptor %d from %s(%s) never connected.",
 				   d->descriptor, d->hostname, d->username);
 	}
+	record_event(d, '-', NULL);
 	clearstrings(d);
 	shutdown(d->descriptor, 2);
 	close(d->descriptor);
     forget_descriptor(d);
+#ifdef ASYNC_HOST_RESOLVER
+	resolver_forget(d->descriptor);
+#endif
 	freeqs(d);
 	*d->prev = d->next;
 	if (d->next)
@@ -2036,6 +2230,7 @@ initializesock(int s, const char *hostname, int is_ssl)
 	d->prev = &descriptor_list;
 	descriptor_list = d;
 	remember_descriptor(d);
+	record_event(d, '+', NULL);
 
 #ifdef USE_SSL
 	if (!is_ssl && tp_starttls_allow) {
@@ -2320,6 +2515,7 @@ process_output(struct descriptor_data *d)
 		}
 #endif
 		d->output_size -= cnt;
+		METRICS_COUNT(METRIC_BYTES_OUT, cnt);
 		if (cnt == cur->nchars) {
 			d->output.lines--;
 			if (!cur->nxt) {
@@ -2406,6 +2602,40 @@ save_command(struct descriptor_data *d, const char *command)
 }
 
 
+/*
+ * -record writes a trace that fbmuck-bench can replay.  Each line is a
+ * descriptor number, then '+' when it connects, '-' when it disconnects,
+ * or '>' and a line of input.  Passwords go in as typed, so the file is
+ * only readable by the server's own user.
+ */
+int
+record_start(const char *filename)
+{
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+	if (fd < 0)
+		return 0;
+	if (!(record_file = fdopen(fd, "w"))) {
+		close(fd);
+		return 0;
+	}
+	setvbuf(record_file, NULL, _IOLBF, 0);
+	return 1;
+}
+
+
+static void
+record_event(struct descriptor_data *d, char event, const char *line)
+{
+	if (!record_file)
+		return;
+	if (line)
+		fprintf(record_file, "%d %c %s\n", d->descriptor, event, line);
+	else
+		fprintf(record_file, "%d %c\n", d->descriptor, event);
+}
+
+
 int
 process_input(struct descriptor_data *d)
 {
@@ -2444,6 +2674,9 @@ process_input(struct descriptor_data *d)
 # endif
 #endif
 
+	if (got > 0)
+		METRICS_COUNT(METRIC_BYTES_IN, got);
+
 	if (!d->raw_input) {
 		MALLOC(d->raw_input, char, MAX_COMMAND_LEN);
 		d->raw_input_at = d->raw_input;
@@ -2454,8 +2687,10 @@ process_input(struct descriptor_data *d)
 		if (*q == '\n') {
 			d->last_time = time(NULL);
 			*p = '\0';
-			if (p >= d->raw_input)
+			if (p >= d->raw_input) {
+				record_event(d, '>', d->raw_input);
 				save_command(d, d->raw_input);
+			}
 			p = d->raw_input;
 		} else if (d->telnet_state == TELNET_STATE_IAC) {
 			switch (*((unsigned char *)q)) {
@@ -2464,6 +2699,7 @@ process_input(struct descriptor_data *d)
 					break;
 				case TELNET_BRK: /* Break */
 				case TELNET_IP: /* Interrupt Process */
+					record_event(d, '>', BREAK_COMMAND);
 					save_command(d, BREAK_COMMAND);
 					d->telnet_state = TELNET_STATE_NORMAL;
 					break;
@@ -2666,6 +2902,7 @@ process_commands(void)
 						d->quota--;
 					}
 					nprocessed++;
+					METRICS_COUNT(METRIC_COMMANDS_RUN, 1);
 					if (!do_command(d, t->start)) {
 						d->booted = 2;
 						/* Disconnect player next pass through main event loop. */
@@ -2683,6 +2920,119 @@ process_commands(void)
 	} while (nprocessed > 0);
 }
 
+
+/*
+ * The replay_ functions let fbmuck-bench and fbmuck-mufbench drive the
+ * server without any sockets.  Their connections are descriptors open on
+ * /dev/null, so that output is queued and written out just as it is for
+ * real connections.
+ */
+static struct timeval replay_last_slice;
+
+void
+replay_init(void)
+{
+	init_descriptor_lookup();
+	init_descr_count_lookup();
+	mcp_initialize();
+	gui_initialize();
+	gettimeofday(&replay_last_slice, (struct timezone *) 0);
+}
+
+
+/* Opens a connection, and returns its descriptor, or -1 on failure. */
+int
+replay_connect(void)
+{
+	struct descriptor_data *d;
+	int s = open("/dev/null", O_RDWR);
+
+	if (s < 0)
+		return -1;
+	if (s >= FD_SETSIZE) {
+		close(s);
+		return -1;
+	}
+	ndescriptors++;
+	d = initializesock(s, "localhost(replay)", 0);
+	return d->descriptor;
+}
+
+
+/* Logs descr straight in as player, with no password and no announcing. */
+int
+replay_login(int descr, dbref player)
+{
+	struct descriptor_data *d = lookup_descriptor(descr);
+
+	if (!d || d->connected)
+		return 0;
+	d->connected = 1;
+	d->connected_at = time(NULL);
+	d->player = player;
+	update_desc_count_table();
+	remember_player_descr(player, d->descriptor);
+	PLAYER_SET_BLOCK(player, 0);
+	return 1;
+}
+
+
+/* Queues a line of input, as if it had just been read from descr. */
+int
+replay_input(int descr, const char *line)
+{
+	struct descriptor_data *d = lookup_descriptor(descr);
+
+	if (!d)
+		return 0;
+	d->last_time = time(NULL);
+	save_command(d, line);
+	return 1;
+}
+
+
+void
+replay_disconnect(int descr)
+{
+	struct descriptor_data *d = lookup_descriptor(descr);
+
+	if (d)
+		d->booted = 1;
+}
+
+
+/* Returns how many lines of input descr has waiting, or -1 if it's gone. */
+int
+replay_queued(int descr)
+{
+	struct descriptor_data *d = lookup_descriptor(descr);
+
+	return d ? d->input.lines : -1;
+}
+
+
+/*
+ * Runs one pass of the main loop, with every connection's command quota
+ * filled first, so that how many commands run doesn't depend on how long
+ * the last pass took.  Then writes out everyone's output.
+ */
+void
+replay_slice(void)
+{
+	struct descriptor_data *d, *dnext;
+	struct timeval now;
+
+	for (d = descriptor_list; d; d = d->next)
+		d->quota = tp_command_burst_size;
+	gettimeofday(&now, (struct timezone *) 0);
+	replay_last_slice = process_slice(replay_last_slice, now);
+	for (d = descriptor_list; d; d = dnext) {
+		dnext = d->next;
+		if (d->output.head && !process_output(d))
+			d->booted = 1;
+	}
+}
+
 int
 is_interface_command(const char* cmd)
 {
@@ -3020,6 +3370,9 @@ close_sockets(const char *msg)
 	}
 # endif
 #endif
+#ifdef MAIN_LOOP_METRICS
+	metrics_shutdown();
+#endif
 }
 
 
@@ -4078,12 +4431,20 @@ pdescrbufsize(int c)
 	return -1;
 }
 
+/*
+ * Finds the connected player whose name starts with name.  This looks
+ * through the player name index, unless more players match than there
+ * are connections to look through instead.
+ */
 dbref
 partial_pmatch(const char *name)
 {
 	struct descriptor_data *d;
 	dbref last = NOTHING;
 
+	if (count_player_prefix(name) <= ndescriptors)
+		return match_player_prefix(name, 1);
+
 	d = descriptor_list;
 	while (d) {
 		if (d->connected && (last != d->player) && string_prefix(NAME(d->player), name)) {
@@ -4365,6 +4726,8 @@ int ignore_prime_cache(dbref Player)
 	dbref* List = 0;
 	int Count = 0;
 	int i;
+	int Pos = 0;
+	struct refset* Set;
 
 	if (!tp_ignore_support)
 		return 0;
@@ -4372,6 +4735,22 @@ int ignore_prime_cache(dbref Player)
 	if ((Player < 0) || (Player >= db_top) || (Typeof(Player) != TYPE_PLAYER))
 		return 0;
 
+	if ((Set = get_property_refset(Player, IGNORE_PROP)) != NULL)
+	{
+		if ((List = (dbref*)malloc(sizeof(dbref) * Set->count)) == 0)
+			return 0;
+
+		while (refset_walk(Set, &Pos, &List[Count]))
+			Count++;
+
+		qsort(List, Count, sizeof(dbref), ignore_dbref_compare);
+
+		PLAYER_SET_IGNORE_CACHE(Player, List);
+		PLAYER_SET_IGNORE_COUNT(Player, Count);
+
+		return 1;
+	}
+
 	if ((Txt = get_property_class(Player, IGNORE_PROP)) == NULL)
 	{
 		PLAYER_SET_IGNORE_LAST(Player, AMBIGUOUS);
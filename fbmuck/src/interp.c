@@ -385,6 +385,7 @@ purge_free_frames(void)
 	while (ptr && ptr->next) {
 		ptr2 = ptr->next;
 		ptr->next = ptr->next->next;
+		frame_release_stacks(ptr2, 0);
 		free(ptr2);
 	}
 }
@@ -397,10 +398,106 @@ purge_all_free_frames(void)
 	while (free_frames_list) {
 		ptr = free_frames_list;
 		free_frames_list = ptr->next;
+		frame_release_stacks(ptr, 0);
 		free(ptr);
 	}
 }
 
+/*
+ * Makes sure the argument stack has room for need items, growing it
+ * if it has to.  Returns -1 if that would be more than STACK_SIZE.
+ * The caller must reload any copy it has of fr->argument.st.
+ */
+int
+argstack_reserve(struct frame *fr, int need)
+{
+	struct stack *stk = &fr->argument;
+	struct inst *st;
+	int size;
+
+	if (need <= stk->size)
+		return 0;
+	if (need > STACK_SIZE)
+		return -1;
+	for (size = stk->size ? stk->size * 2 : STACK_INITIAL; size < need; size *= 2) ;
+	if (size > STACK_SIZE)
+		size = STACK_SIZE;
+	st = (struct inst *) malloc(sizeof(struct inst) * size);
+	if (!st)
+		return -1;
+	if (stk->st) {
+		memcpy(st, stk->st, sizeof(struct inst) * stk->size);
+		assert(stk->nretired < STACK_RETIRED);
+		stk->retired[stk->nretired++] = stk->st;
+	}
+	stk->st = st;
+	stk->size = size;
+	return 0;
+}
+
+void
+argstack_free_retired(struct frame *fr)
+{
+	while (fr->argument.nretired > 0)
+		free(fr->argument.retired[--fr->argument.nretired]);
+}
+
+/*
+ * Makes sure the system stack has room for need return addresses.  The
+ * caller stack grows alongside it, with a spare slot, since it never
+ * holds more programs than the system stack has calls.
+ */
+int
+sysstack_reserve(struct frame *fr, int need)
+{
+	struct stack_addr *sys;
+	dbref *callers;
+	int size;
+
+	if (need <= fr->system.size)
+		return 0;
+	if (need > STACK_SIZE)
+		return -1;
+	for (size = fr->system.size ? fr->system.size * 2 : STACK_INITIAL; size < need; size *= 2) ;
+	if (size > STACK_SIZE)
+		size = STACK_SIZE;
+	sys = (struct stack_addr *) realloc(fr->system.st, sizeof(struct stack_addr) * size);
+	if (!sys)
+		return -1;
+	fr->system.st = sys;
+	fr->system.size = size;
+	callers = (dbref *) realloc(fr->caller.st, sizeof(dbref) * (size + 1));
+	if (!callers)
+		return -1;
+	fr->caller.st = callers;
+	fr->caller.size = size + 1;
+	return 0;
+}
+
+/*
+ * Frees a frame's stacks, except that stacks no bigger than keep items
+ * are left in place for the frame's next use.
+ */
+void
+frame_release_stacks(struct frame *fr, int keep)
+{
+	argstack_free_retired(fr);
+	if (fr->argument.size > keep) {
+		free(fr->argument.st);
+		fr->argument.st = NULL;
+		fr->argument.size = 0;
+	}
+	if (fr->system.size > keep) {
+		free(fr->system.st);
+		free(fr->caller.st);
+		fr->system.st = NULL;
+		fr->caller.st = NULL;
+		fr->system.size = 0;
+		fr->caller.size = 0;
+		fr->caller.top = 0;
+	}
+}
+
 void
 purge_for_pool(void)
 {
@@ -458,7 +555,16 @@ interp(int descr, dbref player, dbref location, dbref program,
 		free_frames_list = fr->next;
 	} else {
 		fr = (struct frame *) malloc(sizeof(struct frame));
-	}
+		fr->argument.st = NULL;
+		fr->argument.size = 0;
+		fr->argument.nretired = 0;
+		fr->system.st = NULL;
+		fr->system.size = 0;
+		fr->caller.st = NULL;
+		fr->caller.size = 0;
+	}
+	argstack_reserve(fr, STACK_INITIAL);
+	sysstack_reserve(fr, STACK_INITIAL);
 	fr->next = NULL;
 	fr->pid = forced_pid ? forced_pid : top_pid++;
 	fr->descr = descr;
@@ -837,6 +943,7 @@ prog_clean(struct frame *fr)
 	}
 
 	fr->argument.top = 0;
+	frame_release_stacks(fr, STACK_INITIAL);
 	fr->pc = 0;
 	if (fr->brkpt.lastcmd)
 		free(fr->brkpt.lastcmd);
@@ -851,6 +958,7 @@ prog_clean(struct frame *fr)
 	muf_dlog_purge(fr);
 
 	dequeue_timers(fr->pid, NULL);
+	muf_worker_forget(fr->pid);
 
 	muf_event_purge(fr);
 	fr->next = free_frames_list;
@@ -964,6 +1072,7 @@ calc_profile_timing(dbref prog, struct frame *fr)
 		fr->totaltime.tv_usec -= 1000000;
 		fr->totaltime.tv_sec += 1;
 	}
+	cpuacct_charge(OWNER(fr->caller.top > 0 ? fr->caller.st[1] : prog), &tv, 0);
 }
 
 
@@ -1019,8 +1128,119 @@ do_abort_loop(dbref player, dbref program, const char *msg,
 }
 
 
+/* Grows the argument stack to hold n more items, or aborts. */
+#define CHECK_ARGSTACK(n) \
+	if (atop + (n) > fr->argument.size) { \
+		if (argstack_reserve(fr, atop + (n)) < 0) \
+			abort_loop("Stack overflow.", NULL, NULL); \
+		arg = fr->argument.st; \
+	}
+
+/* Grows the system stack to hold another call, or aborts. */
+#define CHECK_SYSSTACK(C1, C2) \
+	if (stop >= fr->system.size) { \
+		if (sysstack_reserve(fr, stop + 1) < 0) \
+			abort_loop("System Stack Overflow", (C1), (C2)); \
+		sys = fr->system.st; \
+	}
+
+/*
+ * Primitives that can take far longer than most, and how many ordinary
+ * instructions each one counts as towards the next read of the slice
+ * clock.  The ones that sort, scan the database or run a regex count as a
+ * whole SLICE_CLOCK_INSTRS, so the clock is read right after them.
+ */
+static struct slice_cost_entry {
+	const char *name;
+	int cost;
+} slice_cost_list[] = {
+	{"ARRAY_SORT", SLICE_CLOCK_INSTRS},
+	{"ARRAY_SORT_INDEXED", SLICE_CLOCK_INSTRS},
+	{"ARRAY_FILTER_FLAGS", SLICE_CLOCK_INSTRS},
+	{"ARRAY_FILTER_PROP", SLICE_CLOCK_INSTRS},
+	{"FINDNEXT", SLICE_CLOCK_INSTRS},
+	{"NEXTENTRANCE", SLICE_CLOCK_INSTRS},
+	{"ENTRANCES_ARRAY", SLICE_CLOCK_INSTRS},
+	{"INSTANCES", SLICE_CLOCK_INSTRS},
+	{"COPYOBJ", SLICE_CLOCK_INSTRS},
+	{"TOADPLAYER", SLICE_CLOCK_INSTRS},
+	{"REGEXP", SLICE_CLOCK_INSTRS},
+	{"REGSUB", SLICE_CLOCK_INSTRS},
+	{"ARRAY_NUNION", SLICE_CLOCK_INSTRS / 4},
+	{"ARRAY_NINTERSECT", SLICE_CLOCK_INSTRS / 4},
+	{"ARRAY_NDIFF", SLICE_CLOCK_INSTRS / 4},
+	{"ARRAY_MATCHKEY", SLICE_CLOCK_INSTRS / 4},
+	{"ARRAY_MATCHVAL", SLICE_CLOCK_INSTRS / 4},
+	{"ARRAY_FINDVAL", SLICE_CLOCK_INSTRS / 4},
+	{"ARRAY_EXCLUDEVAL", SLICE_CLOCK_INSTRS / 4},
+	{"ARRAY_EXTRACT", SLICE_CLOCK_INSTRS / 4},
+	{"ARRAY_GET_PROPVALS", SLICE_CLOCK_INSTRS / 4},
+	{"ARRAY_PUT_PROPVALS", SLICE_CLOCK_INSTRS / 4},
+	{"ARRAY_JOIN", SLICE_CLOCK_INSTRS / 4},
+	{"ARRAY_EXPLODE", SLICE_CLOCK_INSTRS / 4},
+	{"EXPLODE", SLICE_CLOCK_INSTRS / 4},
+	{"EXPLODE_ARRAY", SLICE_CLOCK_INSTRS / 4},
+	{"CONTENTS_ARRAY", SLICE_CLOCK_INSTRS / 4},
+	{"STRENCRYPT", SLICE_CLOCK_INSTRS / 4},
+	{"STRDECRYPT", SLICE_CLOCK_INSTRS / 4},
+	{"SUBST", SLICE_CLOCK_INSTRS / 4},
+	{NULL, 0}
+};
+
+static int prim_slice_cost[BASE_MAX + 1];
+
+
+/* Looks up the primitive numbers for slice_cost_list. */
+void
+init_slice_costs(void)
+{
+	struct slice_cost_entry *ent;
+	int i;
+
+	for (i = 0; i <= BASE_MAX; i++)
+		prim_slice_cost[i] = 1;
+	for (ent = slice_cost_list; ent->name; ent++)
+		if ((i = get_primitive(ent->name)))
+			prim_slice_cost[i] = ent->cost;
+}
+
+
+/* Milliseconds on a clock that doesn't jump when the date is changed. */
+static long
+slice_clock(void)
+{
+	struct timeval tv;
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (!clock_gettime(CLOCK_MONOTONIC, &ts))
+		return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+#endif
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000L + tv.tv_usec / 1000L;
+}
+
+
+static struct inst *run_loop(dbref player, dbref program, struct frame *fr, int rettyp);
+
 struct inst *
 interp_loop(dbref player, dbref program, struct frame *fr, int rettyp)
+{
+#ifdef HEAP_SAMPLING
+	/* The heap sampler charges allocations to the running program. */
+	int sampled = CrT_sample_program;
+	struct inst *rv;
+
+	rv = run_loop(player, program, fr, rettyp);
+	CrT_sample_program = sampled;
+	return rv;
+#else
+	return run_loop(player, program, fr, rettyp);
+#endif
+}
+
+static struct inst *
+run_loop(dbref player, dbref program, struct frame *fr, int rettyp)
 {
 	register struct inst *pc;
 	register int atop;
@@ -1030,6 +1250,8 @@ interp_loop(dbref player, dbref program, struct frame *fr, int rettyp)
 	register struct stack_addr *sys;
 	register int instr_count;
 	register int stop;
+	int slice_cost, next_cost;
+	long slice_start, slice_msec;
 	int i = 0, tmp, writeonly, mlev;
 	static struct inst retval;
 	char dbuf[BUFFER_LEN];
@@ -1069,6 +1291,13 @@ interp_loop(dbref player, dbref program, struct frame *fr, int rettyp)
 	instr_count = 0;
 	mlev = ProgMLevel(program);
 	gettimeofday(&fr->proftime, NULL);
+	slice_start = slice_clock();
+	slice_msec = 0;
+	slice_cost = next_cost = 0;
+#ifdef MUF_PROFILER
+	if (muf_prof_pending)
+		muf_profile_discard();
+#endif
 
 	/* This is the 'natural' way to exit a function */
 	while (stop) {
@@ -1077,17 +1306,30 @@ interp_loop(dbref player, dbref program, struct frame *fr, int rettyp)
 		if ((player < 0) || (player >= db_top) || ((Typeof(player) != TYPE_PLAYER) && (Typeof(player) != TYPE_THING)))
 		{
 			reload(fr, atop, stop);
+			calc_profile_timing(program,fr);
 			prog_clean(fr);
 			interp_depth--;
-			calc_profile_timing(program,fr);
 
 			return NULL;
 		}
 
 		fr->instcnt++;
 		instr_count++;
+#ifdef HEAP_SAMPLING
+		CrT_sample_program = program;
+#endif
+
+		/* Check how long this slice has run for, every so often. */
+		slice_cost += next_cost;
+		if (slice_cost >= SLICE_CLOCK_INSTRS) {
+			slice_cost = 0;
+			slice_msec = slice_clock() - slice_start;
+		}
+		next_cost = (pc->type == PROG_PRIMITIVE) ? prim_slice_cost[pc->data.number] : 1;
 
 		if ((fr->multitask == PREEMPT) || (FLAGS(program) & BUILDER)) {
+			if (tp_max_preempt_msec && slice_msec >= tp_max_preempt_msec)
+				abort_loop_hard("Maximum preempt time exceeded", NULL, NULL);
 			if (mlev == 4) {
 				if (tp_max_ml4_preempt_count)
 				{
@@ -1103,7 +1345,8 @@ interp_loop(dbref player, dbref program, struct frame *fr, int rettyp)
 			}
 		} else {
 			/* if in FOREGROUND or BACKGROUND mode, '0 sleep' every so often. */
-			if ((fr->instcnt > tp_instr_slice * 4) && (instr_count >= tp_instr_slice)) {
+			if (((fr->instcnt > tp_instr_slice * 4) && (instr_count >= tp_instr_slice)) ||
+					(tp_slice_msec && slice_msec >= tp_slice_msec)) {
 				fr->pc = pc;
 				reload(fr, atop, stop);
 				PLAYER_SET_BLOCK(player, (!fr->been_background));
@@ -1231,8 +1474,7 @@ interp_loop(dbref player, dbref program, struct frame *fr, int rettyp)
 		case PROG_LOCK:
 		case PROG_MARK:
 		case PROG_ARRAY:
-			if (atop >= STACK_SIZE)
-				abort_loop("Stack overflow.", NULL, NULL);
+			CHECK_ARGSTACK(1);
 			copyinst(pc, arg + atop);
 			pc++;
 			atop++;
@@ -1244,8 +1486,7 @@ interp_loop(dbref player, dbref program, struct frame *fr, int rettyp)
 				struct inst *tmp;
 				struct localvars *lv;
 
-				if (atop >= STACK_SIZE)
-					abort_loop("Stack overflow.", NULL, NULL);
+				CHECK_ARGSTACK(1);
 
 				if (pc->data.number >= MAX_VAR || pc->data.number < 0)
 					abort_loop("Scoped variable number out of range.", NULL, NULL);
@@ -1293,8 +1534,7 @@ interp_loop(dbref player, dbref program, struct frame *fr, int rettyp)
 			{
 				struct inst *tmp;
 
-				if (atop >= STACK_SIZE)
-					abort_loop("Stack overflow.", NULL, NULL);
+				CHECK_ARGSTACK(1);
 
 				tmp = scopedvar_get(fr, 0, pc->data.number);
 				if (!tmp)
@@ -1373,8 +1613,7 @@ interp_loop(dbref player, dbref program, struct frame *fr, int rettyp)
 			break;
 
 		case PROG_EXEC:
-			if (stop >= STACK_SIZE)
-				abort_loop("System Stack Overflow", NULL, NULL);
+			CHECK_SYSSTACK(NULL, NULL);
 			sys[stop].progref = program;
 			sys[stop++].offset = pc + 1;
 			pc = pc->data.call;
@@ -1412,6 +1651,14 @@ interp_loop(dbref player, dbref program, struct frame *fr, int rettyp)
 			break;
 
 		case PROG_PRIMITIVE:
+			/*
+			 * Primitives that push a fixed handful of items don't
+			 * bother with CHECKOFLOW, so make sure they have room.
+			 */
+			if (atop + STACK_SLACK > fr->argument.size && fr->argument.size < STACK_SIZE) {
+				argstack_reserve(fr, Min(atop + STACK_SLACK, STACK_SIZE));
+				arg = fr->argument.st;
+			}
 			/*
 			 * All pc modifiers and stuff like that should stay here,
 			 * everything else call with an independent dispatcher.
@@ -1451,8 +1698,7 @@ interp_loop(dbref player, dbref program, struct frame *fr, int rettyp)
 					temp1->data.addr->progref < 0 ||
 					(Typeof(temp1->data.addr->progref) != TYPE_PROGRAM))
 							abort_loop_hard("Internal error.  Invalid address.", temp1, NULL);
-				if (stop >= STACK_SIZE)
-					abort_loop("System Stack Overflow", temp1, NULL);
+				CHECK_SYSSTACK(temp1, NULL);
 				sys[stop].progref = program;
 				sys[stop++].offset = pc + 1;
 				if (program != temp1->data.addr->progref) {
@@ -1506,8 +1752,7 @@ interp_loop(dbref player, dbref program, struct frame *fr, int rettyp)
 				if (mlev < 4 && OWNER(temp1->data.objref) != ProgUID
 					&& !Linkable(temp1->data.objref))
 							abort_loop("Permission denied", temp1, temp2);
-				if (stop >= STACK_SIZE)
-					abort_loop("System Stack Overflow", temp1, temp2);
+				CHECK_SYSSTACK(temp1, temp2);
 				sys[stop].progref = program;
 				sys[stop].offset = pc + 1;
 				if (!temp2) {
@@ -1716,6 +1961,25 @@ interp_loop(dbref player, dbref program, struct frame *fr, int rettyp)
 				tmp = atop;
 				prim_func[pc->data.number - 1] (player, program, mlev, pc, arg, &tmp, fr);
 				atop = tmp;
+				arg = fr->argument.st;
+				if (fr->argument.nretired)
+					argstack_free_retired(fr);
+#ifdef MUF_WORKERS
+				if (muf_worker_job_held) {
+					/* Sleep until the worker is done, then run this again. */
+					fr->pc = pc;
+					reload(fr, atop, stop);
+					PLAYER_SET_BLOCK(player, (!fr->been_background));
+					interp_depth--;
+					calc_profile_timing(program,fr);
+					muf_worker_submit(fr, player, program);
+					return NULL;
+				}
+#endif
+#ifdef MUF_PROFILER
+				if (muf_prof_pending)
+					muf_profile_sample(program, fr, pc, stop);
+#endif
 				pc++;
 				break;
 			}					/* switch */
@@ -1754,10 +2018,10 @@ interp_loop(dbref player, dbref program, struct frame *fr, int rettyp)
 				err = 0;
 			} else {
 				reload(fr, atop, stop);
+				calc_profile_timing(program,fr);
 				prog_clean(fr);
 				PLAYER_SET_BLOCK(player, 0);
 				interp_depth--;
-				calc_profile_timing(program,fr);
 				return NULL;
 			}
 		}
@@ -1778,15 +2042,15 @@ interp_loop(dbref player, dbref program, struct frame *fr, int rettyp)
 			}
 		}
 		reload(fr, atop, stop);
+		calc_profile_timing(program,fr);
 		prog_clean(fr);
 		interp_depth--;
-		calc_profile_timing(program,fr);
 		return rv;
 	}
 	reload(fr, atop, stop);
+	calc_profile_timing(program,fr);
 	prog_clean(fr);
 	interp_depth--;
-	calc_profile_timing(program,fr);
 	return NULL;
 }
 
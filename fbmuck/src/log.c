@@ -17,6 +17,456 @@
 #include "externs.h"
 #include "interface.h"
 
+#ifdef ASYNC_LOGGING
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+
+/*
+ * Asynchronous log writer.
+ *
+ * The log_*() routines used to fopen(), format and fclose() the logfile
+ * for every single line, on the main thread.  With ASYNC_LOGGING, they
+ * instead format the line into a ring buffer, and a background thread
+ * writes the buffered lines out to a set of logfiles that it keeps open.
+ * The writer wakes at least every LOG_FLUSH_MSECS, or as soon as the
+ * buffer is half full, so nothing sits in memory for long.
+ *
+ * SIGHUP makes the writer close and reopen all of its logfiles, so that
+ * logrotate and friends can move the old ones out of the way.
+ *
+ * If the buffer fills, the caller waits up to LOG_BACKPRESSURE_MSECS for
+ * the writer to make room, and then gives up and drops the line.  Drops
+ * are counted, and reported in the status log once the writer catches up.
+ *
+ * Signal handlers log too.  If one interrupts the main thread while it is
+ * in the middle of queueing a line, it falls back to writing its line
+ * synchronously, rather than deadlocking on the buffer lock.
+ */
+
+struct log_file {
+	const char *name;
+	FILE *fp;
+};
+
+struct log_record {
+	int file;
+	int len;
+};
+
+static struct log_file log_files[LOG_MAX_FILES];
+static int log_file_count = 0;
+
+static char log_ring[LOG_BUFFER_SIZE];
+static size_t log_head = 0;		/* Where the next record is queued. */
+static size_t log_tail = 0;		/* Where the writer will read next. */
+static size_t log_used = 0;
+
+static pthread_t log_thread;
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t log_space = PTHREAD_COND_INITIALIZER;
+
+static int log_async_active = 0;
+static int log_shutdown_requested = 0;
+static volatile sig_atomic_t log_reopen_requested = 0;
+/*
+ * Set while a thread is inside log_queue_line(), so a signal handler
+ * that logs doesn't deadlock on log_mutex.  Each thread has its own,
+ * since the parallel db loader threads log too.
+ */
+static __thread volatile sig_atomic_t log_in_queue = 0;
+
+static unsigned long log_lines_queued = 0;
+static unsigned long log_lines_dropped = 0;
+static unsigned long log_drops_unreported = 0;
+
+static void
+log_ring_put(const void *data, size_t len)
+{
+	size_t first = LOG_BUFFER_SIZE - log_head;
+
+	if (first > len)
+		first = len;
+	memcpy(log_ring + log_head, data, first);
+	memcpy(log_ring, (const char *) data + first, len - first);
+	log_head = (log_head + len) % LOG_BUFFER_SIZE;
+}
+
+static void
+log_ring_get(size_t pos, void *data, size_t len)
+{
+	size_t first = LOG_BUFFER_SIZE - pos;
+
+	if (first > len)
+		first = len;
+	memcpy(data, log_ring + pos, first);
+	memcpy((char *) data + first, log_ring, len - first);
+}
+
+/* Finds or adds the log_files[] slot for the given file.  Needs log_mutex. */
+static int
+log_file_index(const char *filename)
+{
+	int i;
+
+	for (i = 0; i < log_file_count; i++) {
+		if (log_files[i].name == filename || !strcmp(log_files[i].name, filename))
+			return i;
+	}
+	if (log_file_count >= LOG_MAX_FILES)
+		return -1;
+	log_files[log_file_count].name = strdup(filename);
+	log_files[log_file_count].fp = NULL;
+	return log_file_count++;
+}
+
+static void
+log_write_synchronous(const char *filename, const char *line, int len)
+{
+	FILE *fp;
+
+	if ((fp = fopen(filename, "ab")) == NULL) {
+		fprintf(stderr, "Unable to open %s!\n", filename);
+		fwrite(line, 1, len, stderr);
+	} else {
+		fwrite(line, 1, len, fp);
+		fclose(fp);
+	}
+}
+
+/* Only ever called from the writer thread. */
+static void
+log_reopen_all(void)
+{
+	int i, count;
+
+	pthread_mutex_lock(&log_mutex);
+	count = log_file_count;
+	pthread_mutex_unlock(&log_mutex);
+
+	for (i = 0; i < count; i++) {
+		if (log_files[i].fp) {
+			fclose(log_files[i].fp);
+			log_files[i].fp = NULL;
+		}
+	}
+}
+
+/* Only ever called from the writer thread. */
+static void
+log_write_record(int file, const char *line, int len)
+{
+	struct log_file *lf = &log_files[file];
+
+	if (!lf->fp && (lf->fp = fopen(lf->name, "ab")) == NULL) {
+		fprintf(stderr, "Unable to open %s!\n", lf->name);
+		fwrite(line, 1, len, stderr);
+		return;
+	}
+	fwrite(line, 1, len, lf->fp);
+}
+
+static void *
+log_writer_thread(void *arg)
+{
+	struct log_record rec;
+	struct timespec deadline;
+	struct timeval now;
+	char *line = NULL;
+	int linesize = 0;
+	size_t pos, avail, consumed;
+	unsigned long dropped;
+	int i, done;
+
+	for (;;) {
+		pthread_mutex_lock(&log_mutex);
+		if (!log_used && !log_shutdown_requested && !log_reopen_requested) {
+			gettimeofday(&now, NULL);
+			deadline.tv_sec = now.tv_sec + LOG_FLUSH_MSECS / 1000;
+			deadline.tv_nsec = (now.tv_usec + (LOG_FLUSH_MSECS % 1000) * 1000) * 1000;
+			if (deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&log_wakeup, &log_mutex, &deadline);
+		}
+		pos = log_tail;
+		avail = log_used;
+		done = log_shutdown_requested;
+		dropped = log_drops_unreported;
+		log_drops_unreported = 0;
+		pthread_mutex_unlock(&log_mutex);
+
+		if (log_reopen_requested) {
+			log_reopen_requested = 0;
+			log_reopen_all();
+		}
+
+		/*
+		 * Records between pos and pos+avail belong to us until we move
+		 * log_tail past them, so they can be written without the lock.
+		 */
+		consumed = 0;
+		while (consumed < avail) {
+			log_ring_get(pos, &rec, sizeof(rec));
+			pos = (pos + sizeof(rec)) % LOG_BUFFER_SIZE;
+			if (rec.len > linesize) {
+				linesize = rec.len;
+				line = (char *) realloc(line, linesize);
+			}
+			log_ring_get(pos, line, rec.len);
+			pos = (pos + rec.len) % LOG_BUFFER_SIZE;
+			consumed += sizeof(rec) + rec.len;
+			log_write_record(rec.file, line, rec.len);
+		}
+
+		if (dropped) {
+			char msg[128];
+			time_t lt = time(NULL);
+			char buf[40];
+
+			format_time(buf, 32, "%c", localtime(&lt));
+			snprintf(msg, sizeof(msg),
+					 "%.32s: LOG: Dropped %lu log lines while the log buffer was full.\n",
+					 buf, dropped);
+			log_write_synchronous(LOG_STATUS, msg, strlen(msg));
+		}
+
+		for (i = 0; i < LOG_MAX_FILES; i++) {
+			if (log_files[i].fp)
+				fflush(log_files[i].fp);
+		}
+
+		if (consumed) {
+			pthread_mutex_lock(&log_mutex);
+			log_tail = pos;
+			log_used -= consumed;
+			pthread_cond_broadcast(&log_space);
+			pthread_mutex_unlock(&log_mutex);
+		}
+
+		if (done && consumed == avail) {
+			pthread_mutex_lock(&log_mutex);
+			if (!log_used) {
+				pthread_mutex_unlock(&log_mutex);
+				break;
+			}
+			pthread_mutex_unlock(&log_mutex);
+		}
+	}
+
+	for (i = 0; i < LOG_MAX_FILES; i++) {
+		if (log_files[i].fp) {
+			fclose(log_files[i].fp);
+			log_files[i].fp = NULL;
+		}
+	}
+	free(line);
+	return NULL;
+}
+
+/*
+ * Queues one formatted line for the writer.  Returns 0 if the caller
+ * should write the line itself.
+ */
+static int
+log_queue_line(const char *filename, const char *line, int len)
+{
+	struct log_record rec;
+	struct timespec deadline;
+	struct timeval now;
+	size_t need = sizeof(rec) + len;
+	int waited = 0;
+
+	if (!log_async_active || log_in_queue || need > LOG_BUFFER_SIZE / 2)
+		return 0;
+
+	log_in_queue = 1;
+	pthread_mutex_lock(&log_mutex);
+	if (!log_async_active || (rec.file = log_file_index(filename)) < 0) {
+		pthread_mutex_unlock(&log_mutex);
+		log_in_queue = 0;
+		return 0;
+	}
+	while (LOG_BUFFER_SIZE - log_used < need) {
+		if (waited) {
+			log_lines_dropped++;
+			log_drops_unreported++;
+			pthread_mutex_unlock(&log_mutex);
+			log_in_queue = 0;
+			return 1;
+		}
+		waited = 1;
+		gettimeofday(&now, NULL);
+		deadline.tv_sec = now.tv_sec;
+		deadline.tv_nsec = (now.tv_usec + LOG_BACKPRESSURE_MSECS * 1000) * 1000L;
+		while (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		pthread_cond_signal(&log_wakeup);
+		while (LOG_BUFFER_SIZE - log_used < need) {
+			if (pthread_cond_timedwait(&log_space, &log_mutex, &deadline) == ETIMEDOUT)
+				break;
+		}
+	}
+	rec.len = len;
+	log_ring_put(&rec, sizeof(rec));
+	log_ring_put(line, len);
+	log_used += need;
+	log_lines_queued++;
+	if (log_used > LOG_BUFFER_SIZE / 2)
+		pthread_cond_signal(&log_wakeup);
+	pthread_mutex_unlock(&log_mutex);
+	log_in_queue = 0;
+	return 1;
+}
+
+/*
+ * In a forked child, the writer thread is gone and the lock may have been
+ * held at the time of the fork.  Just fall back to synchronous writes.
+ * The open logfile handles are abandoned, not closed, so that anything
+ * still in their stdio buffers doesn't get written out twice.
+ */
+static void
+log_atfork_prepare(void)
+{
+	pthread_mutex_lock(&log_mutex);
+}
+
+static void
+log_atfork_parent(void)
+{
+	pthread_mutex_unlock(&log_mutex);
+}
+
+static void
+log_atfork_child(void)
+{
+	int i;
+
+	for (i = 0; i < LOG_MAX_FILES; i++)
+		log_files[i].fp = NULL;
+	log_async_active = 0;
+	log_head = log_tail = log_used = 0;
+	pthread_mutex_init(&log_mutex, NULL);
+	pthread_cond_init(&log_wakeup, NULL);
+	pthread_cond_init(&log_space, NULL);
+}
+
+void
+start_log_writer(void)
+{
+	static int atfork_registered = 0;
+	sigset_t mask, oldmask;
+
+	if (log_async_active)
+		return;
+
+	if (!atfork_registered) {
+		pthread_atfork(log_atfork_prepare, log_atfork_parent, log_atfork_child);
+		atfork_registered = 1;
+	}
+
+	/* Signals should always be handled by the main thread. */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &oldmask);
+	log_shutdown_requested = 0;
+	if (pthread_create(&log_thread, NULL, log_writer_thread, NULL) == 0) {
+		log_async_active = 1;
+	} else {
+		fprintf(stderr, "Unable to start log writer thread.  Logging synchronously.\n");
+	}
+	pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+}
+
+void
+stop_log_writer(void)
+{
+	if (!log_async_active)
+		return;
+
+	/*
+	 * If we're in a signal handler that interrupted log_queue_line(), we
+	 * can't take the lock.  Just stop queueing, and let the rest go.
+	 */
+	if (log_in_queue) {
+		log_async_active = 0;
+		return;
+	}
+
+	pthread_mutex_lock(&log_mutex);
+	log_async_active = 0;
+	log_shutdown_requested = 1;
+	pthread_cond_signal(&log_wakeup);
+	pthread_mutex_unlock(&log_mutex);
+	pthread_join(log_thread, NULL);
+}
+
+void
+reopen_logs(void)
+{
+	/* Safe to call from a signal handler. The writer notices it shortly. */
+	log_reopen_requested = 1;
+}
+
+void
+log_writer_stats(unsigned long *queued, unsigned long *dropped, unsigned long *pending)
+{
+	pthread_mutex_lock(&log_mutex);
+	*queued = log_lines_queued;
+	*dropped = log_lines_dropped;
+	*pending = log_used;
+	pthread_mutex_unlock(&log_mutex);
+}
+
+/*
+ * Formats a log line, with a timestamp prefix.  This is called from more
+ * than one thread, so it keeps no state of its own.
+ */
+static int
+log_format_line(char *buf, int buflen, int prepend_time, char *format, va_list args)
+{
+	char timebuf[40];
+	struct tm tmbuf;
+	time_t lt;
+	int len = 0;
+	int res;
+
+	if (prepend_time) {
+		lt = time(NULL);
+		format_time(timebuf, 32, "%c", localtime_r(&lt, &tmbuf));
+		len = snprintf(buf, buflen, "%.32s: ", timebuf);
+	}
+	res = vsnprintf(buf + len, buflen - len - 1, format, args);
+	if (res < 0 || res >= buflen - len - 1)
+		res = buflen - len - 2;
+	len += res;
+	buf[len++] = '\n';
+	buf[len] = '\0';
+	return len;
+}
+
+static void
+vlog2file_async(char *filename, char *format, va_list args)
+{
+	char line[LOG_LINE_MAX];
+	int len;
+
+	len = log_format_line(line, sizeof(line), 1, format, args);
+	if (!log_queue_line(filename, line, len))
+		log_write_synchronous(filename, line, len);
+}
+
+#define vlog2file_timed(file, fmt, args) vlog2file_async(file, fmt, args)
+
+#else							/* ASYNC_LOGGING */
+
+#define vlog2file_timed(file, fmt, args) vlog2file(1, file, fmt, args)
+
+#endif							/* ASYNC_LOGGING */
+
 /* cks: these are varargs routines. We are assuming ANSI C. We could at least
    USE ANSI C varargs features, no? Sigh. */
 
@@ -64,7 +514,7 @@ log2file(char *filename, char *format, ...)
 { \
 	va_list args; \
 	va_start(args, format); \
-	vlog2file(1, FILENAME, format, args); \
+	vlog2file_timed(FILENAME, format, args); \
 	va_end(args); \
 }
 
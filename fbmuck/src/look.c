@@ -427,12 +427,12 @@ flag_description(dbref thing)
 int
 listprops_wildcard(dbref player, dbref thing, const char *dir, const char *wild)
 {
-	char propname[BUFFER_LEN];
 	char wld[BUFFER_LEN];
 	char buf[BUFFER_LEN];
 	char buf2[BUFFER_LEN];
 	char *ptr, *wldcrd = wld;
-	PropPtr propadr, pptr;
+	PropCursor cursor;
+	PropPtr propadr;
 	int i, cnt = 0;
 	int recurse = 0;
 
@@ -448,10 +448,10 @@ listprops_wildcard(dbref player, dbref thing, const char *dir, const char *wild)
 	if (*ptr)
 		*ptr++ = '\0';
 
-	propadr = first_prop(thing, (char *) dir, &pptr, propname, sizeof(propname));
+	propadr = propcursor_first(&cursor, thing, dir);
 	while (propadr) {
-		if (equalstr(wldcrd, propname)) {
-			snprintf(buf, sizeof(buf), "%s%c%s", dir, PROPDIR_DELIMITER, propname);
+		if (equalstr(wldcrd, cursor.name)) {
+			snprintf(buf, sizeof(buf), "%s%c%s", dir, PROPDIR_DELIMITER, cursor.name);
 			if (!Prop_System(buf) && ((!Prop_Hidden(buf) && !(PropFlags(propadr) & PROP_SYSPERMS))
 				|| Wizard(OWNER(player)))) {
 				if (!*ptr || recurse) {
@@ -464,7 +464,7 @@ listprops_wildcard(dbref player, dbref thing, const char *dir, const char *wild)
 				cnt += listprops_wildcard(player, thing, buf, ptr);
 			}
 		}
-		propadr = next_prop(pptr, propadr, propname, sizeof(propname));
+		propadr = propcursor_next(&cursor);
 	}
 	return cnt;
 }
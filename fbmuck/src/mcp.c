@@ -32,6 +32,7 @@ void FlushText(McpFrame * mfr);
 
 
 McpPkg *mcp_PackageList = NULL;
+static McpPkg *mcp_PackageHash[MCP_PKG_HASHSIZE];
 
 
 
@@ -87,6 +88,85 @@ msgarg_escape(char* buf, int bufsize, const char* in)
 
 
 int mcp_internal_parse(McpFrame * mfr, const char *in);
+static void *mcp_mesg_alloc(McpMesg * msg, size_t len);
+
+
+
+/*****************************************************************/
+/***                     *****************************************/
+/*** PACKAGE HASH TABLES *****************************************/
+/***                     *****************************************/
+/*****************************************************************/
+
+/*
+ * Both the global registry and each connection's negotiated package set
+ * are hashed on the case-folded package name, so that dispatching an
+ * incoming message costs one bucket probe per '-' in the message name,
+ * rather than a strcmp_nocase() against every package ever registered.
+ * The hashes take an explicit length so that a message name like
+ * "org-fuzzball-help-request" can be probed at each of its prefixes
+ * without copying them out first.
+ */
+
+static unsigned int
+mcp_pkghash_val(const char *name, int len)
+{
+	unsigned int hv = 0;
+
+	while (len-- > 0 && *name) {
+		hv = (hv << 5) + hv + (unsigned char) tolower(*name++);
+	}
+	return hv & (MCP_PKG_HASHSIZE - 1);
+}
+
+
+static McpPkg *
+mcp_pkghash_find(McpPkg ** table, const char *name, int len)
+{
+	McpPkg *ptr;
+
+	for (ptr = table[mcp_pkghash_val(name, len)]; ptr; ptr = ptr->hashnext) {
+		if (!strncmp_nocase(ptr->pkgname, name, len) && !ptr->pkgname[len]) {
+			return ptr;
+		}
+	}
+	return NULL;
+}
+
+
+static void
+mcp_pkghash_add(McpPkg ** table, McpPkg * pkg)
+{
+	unsigned int hv = mcp_pkghash_val(pkg->pkgname, strlen(pkg->pkgname));
+
+	pkg->hashnext = table[hv];
+	table[hv] = pkg;
+}
+
+
+static void
+mcp_pkghash_remove(McpPkg ** table, McpPkg * pkg)
+{
+	McpPkg **prev;
+
+	prev = &table[mcp_pkghash_val(pkg->pkgname, strlen(pkg->pkgname))];
+	while (*prev) {
+		if (*prev == pkg) {
+			*prev = pkg->hashnext;
+			break;
+		}
+		prev = &(*prev)->hashnext;
+	}
+}
+
+
+static McpPkg *
+mcp_package_find(const char *pkgname)
+{
+	return mcp_pkghash_find(mcp_PackageHash, pkgname, strlen(pkgname));
+}
+
+
 
 
 
@@ -128,6 +208,7 @@ mcp_package_register(const char *pkgname, McpVer minver, McpVer maxver, McpPkg_C
 	mcp_package_deregister(pkgname);
 	nu->next = mcp_PackageList;
 	mcp_PackageList = nu;
+	mcp_pkghash_add(mcp_PackageHash, nu);
 	mcp_frame_package_renegotiate(pkgname);
 }
 
@@ -148,35 +229,21 @@ mcp_package_register(const char *pkgname, McpVer minver, McpVer maxver, McpPkg_C
 void
 mcp_package_deregister(const char *pkgname)
 {
-	McpPkg *ptr = mcp_PackageList;
-	McpPkg *prev = NULL;
-
-	while (ptr && !strcmp_nocase(ptr->pkgname, pkgname)) {
-		mcp_PackageList = ptr->next;
-		if (ptr->cleanup)
-			ptr->cleanup(ptr->context);
-		if (ptr->pkgname)
-			free(ptr->pkgname);
-		free(ptr);
-		ptr = mcp_PackageList;
-	}
-
-	prev = mcp_PackageList;
-	if (ptr)
-		ptr = ptr->next;
+	McpPkg *ptr;
+	McpPkg **prev;
 
-	while (ptr) {
+	prev = &mcp_PackageList;
+	while ((ptr = *prev)) {
 		if (!strcmp_nocase(pkgname, ptr->pkgname)) {
-			prev->next = ptr->next;
+			*prev = ptr->next;
+			mcp_pkghash_remove(mcp_PackageHash, ptr);
 			if (ptr->cleanup)
 				ptr->cleanup(ptr->context);
 			if (ptr->pkgname)
 				free(ptr->pkgname);
 			free(ptr);
-			ptr = prev->next;
 		} else {
-			prev = ptr;
-			ptr = ptr->next;
+			prev = &ptr->next;
 		}
 	}
 	mcp_frame_package_renegotiate(pkgname);
@@ -289,6 +356,7 @@ mcp_frame_init(McpFrame * mfr, connection_t con)
 	mfr->version.vermajor = 0;
 	mfr->authkey = NULL;
 	mfr->packages = NULL;
+	memset(mfr->pkghash, 0, sizeof(mfr->pkghash));
 	mfr->messages = NULL;
 	mfr->enabled = 0;
 
@@ -330,6 +398,7 @@ mcp_frame_clear(McpFrame * mfr)
 		free(tmp);
 		tmp = mfr->packages;
 	}
+	memset(mfr->pkghash, 0, sizeof(mfr->pkghash));
 	while (tmp2) {
 		mfr->messages = tmp2->next;
 		mcp_mesg_clear(tmp2);
@@ -386,14 +455,7 @@ mcp_frame_package_renegotiate(const char* package)
 	char verbuf[32];
 	McpPkg *p;
 
-	p = mcp_PackageList;
-	while (p) {
-		if (!strcmp_nocase(p->pkgname, package)) {
-			break;
-		}
-		p = p->next;
-	}
-
+	p = mcp_package_find(package);
 	if (!p) {
 		mcp_mesg_init(&cando, MCP_NEGOTIATE_PKG, "can");
 		mcp_mesg_arg_append(&cando, "package", package);
@@ -459,11 +521,7 @@ mcp_frame_package_add(McpFrame * mfr, const char *package, McpVer minver, McpVer
 		return EMCP_NOMCP;
 	}
 
-	for (ptr = mcp_PackageList; ptr; ptr = ptr->next) {
-		if (!strcmp_nocase(ptr->pkgname, package)) {
-			break;
-		}
-	}
+	ptr = mcp_package_find(package);
 	if (!ptr) {
 		return EMCP_NOPACKAGE;
 	}
@@ -477,7 +535,9 @@ mcp_frame_package_add(McpFrame * mfr, const char *package, McpVer minver, McpVer
 	nu->maxver = selver;
 	nu->callback = ptr->callback;
 	nu->context = ptr->context;
+	nu->cleanup = NULL;
 	nu->next = NULL;
+	mcp_pkghash_add(mfr->pkghash, nu);
 
 	if (!mfr->packages) {
 		mfr->packages = nu;
@@ -511,26 +571,21 @@ void
 mcp_frame_package_remove(McpFrame * mfr, const char *package)
 {
 	McpPkg *tmp;
-	McpPkg *prev;
+	McpPkg **prev;
 
-	while (mfr->packages && !strcmp_nocase(mfr->packages->pkgname, package)) {
-		tmp = mfr->packages;
-		mfr->packages = tmp->next;
-		if (tmp->pkgname)
-			free(tmp->pkgname);
-		free(tmp);
+	if (!mcp_pkghash_find(mfr->pkghash, package, strlen(package))) {
+		return;
 	}
-
-	prev = mfr->packages;
-	while (prev && prev->next) {
-		if (!strcmp_nocase(prev->next->pkgname, package)) {
-			tmp = prev->next;
-			prev->next = tmp->next;
+	prev = &mfr->packages;
+	while ((tmp = *prev)) {
+		if (!strcmp_nocase(tmp->pkgname, package)) {
+			*prev = tmp->next;
+			mcp_pkghash_remove(mfr->pkghash, tmp);
 			if (tmp->pkgname)
 				free(tmp->pkgname);
 			free(tmp);
 		} else {
-			prev = prev->next;
+			prev = &tmp->next;
 		}
 	}
 }
@@ -561,11 +616,7 @@ mcp_frame_package_supported(McpFrame * mfr, const char *package)
 		return errver;
 	}
 
-	for (ptr = mfr->packages; ptr; ptr = ptr->next) {
-		if (!strcmp_nocase(ptr->pkgname, package)) {
-			break;
-		}
-	}
+	ptr = mcp_pkghash_find(mfr->pkghash, package, strlen(package));
 	if (!ptr) {
 		return errver;
 	}
@@ -603,11 +654,7 @@ mcp_frame_package_docallback(McpFrame * mfr, McpMesg * msg)
 			return EMCP_NOMCP;
 		}
 
-		for (ptr = mfr->packages; ptr; ptr = ptr->next) {
-			if (!strcmp_nocase(ptr->pkgname, msg->package)) {
-				break;
-			}
-		}
+		ptr = mcp_pkghash_find(mfr->pkghash, msg->package, strlen(msg->package));
 		if (!ptr) {
 			if (!strcmp_nocase(msg->package, MCP_NEGOTIATE_PKG)) {
 				McpVer twooh = { 2, 0 };
@@ -769,15 +816,17 @@ mcp_frame_output_mesg(McpFrame * mfr, McpMesg * msg)
 				p = ap->value;
 				while (*p) {
 					if (*p == '\n' || *p == '\r') {
-						McpArgPart *nu = (McpArgPart *) malloc(sizeof(McpArgPart));
+						McpArgPart *nu;
 
+						/* Split the line in place; the tail stays in the same buffer. */
+						nu = (McpArgPart *) mcp_mesg_alloc(msg, sizeof(McpArgPart));
 						nu->next = ap->next;
 						ap->next = nu;
+						if (anarg->last == ap)
+							anarg->last = nu;
 						*p++ = '\0';
-						nu->value = string_dup(p);
-						ap->value = (char *) realloc(ap->value, strlen(ap->value) + 1);
+						nu->value = p;
 						ap = nu;
-						p = nu->value;
 					} else {
 						p++;
 					}
@@ -900,6 +949,9 @@ mcp_mesg_init(McpMesg * msg, const char *package, const char *mesgname)
 	msg->mesgname = string_dup(mesgname);
 	msg->datatag = NULL;
 	msg->args = NULL;
+	msg->lastarg = NULL;
+	msg->chunks = NULL;
+	msg->argcount = 0;
 	msg->incomplete = 0;
 	msg->bytes = 0;
 	msg->next = NULL;
@@ -930,22 +982,15 @@ mcp_mesg_clear(McpMesg * msg)
 	if (msg->datatag)
 		free(msg->datatag);
 
-	while (msg->args) {
-		McpArg *tmp = msg->args;
+	while (msg->chunks) {
+		McpArgChunk *tmp = msg->chunks;
 
-		msg->args = tmp->next;
-		if (tmp->name)
-			free(tmp->name);
-		while (tmp->value) {
-			McpArgPart *ptr2 = tmp->value;
-
-			tmp->value = tmp->value->next;
-			if (ptr2->value)
-				free(ptr2->value);
-			free(ptr2);
-		}
+		msg->chunks = tmp->next;
 		free(tmp);
 	}
+	msg->args = NULL;
+	msg->lastarg = NULL;
+	msg->argcount = 0;
 	msg->bytes = 0;
 }
 
@@ -965,6 +1010,148 @@ mcp_mesg_clear(McpMesg * msg)
 
 
 
+/*
+ * A multi-line value can run to thousands of lines, and used to cost two
+ * mallocs per line, plus a walk of the arg list for each.  Instead, args
+ * and their lines are bump-allocated from chunks owned by the message.
+ * Anything too big for a normal chunk gets a chunk of its own.  Nothing
+ * is freed until mcp_mesg_clear(), so a removed arg just stops being
+ * linked in, and MAX_MCP_MESG_SIZE still bounds the whole thing.
+ */
+
+#define MCP_ARG_ALIGN(x) (((x) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+static void *
+mcp_mesg_alloc(McpMesg * msg, size_t len)
+{
+	McpArgChunk *chunk = msg->chunks;
+	size_t hdr = MCP_ARG_ALIGN(sizeof(McpArgChunk));
+	void *out;
+
+	len = MCP_ARG_ALIGN(len);
+	if (!chunk || chunk->used + len > chunk->size) {
+		size_t size = (len > MCP_ARG_CHUNK_SIZE - hdr) ? len : MCP_ARG_CHUNK_SIZE - hdr;
+
+		chunk = (McpArgChunk *) malloc(hdr + size);
+		chunk->size = size;
+		chunk->used = 0;
+		if (msg->chunks && size == len) {
+			/* Oversized; keep filling the current chunk afterwards. */
+			chunk->next = msg->chunks->next;
+			msg->chunks->next = chunk;
+		} else {
+			chunk->next = msg->chunks;
+			msg->chunks = chunk;
+		}
+	}
+	out = (char *) chunk + hdr + chunk->used;
+	chunk->used += len;
+	return out;
+}
+
+
+static McpArg *
+mcp_mesg_arg_find_n(McpMesg * msg, const char *name, int namelen)
+{
+	McpArg *ptr;
+
+	/* Continuation lines nearly always add to the same arg as last time. */
+	ptr = msg->lastarg;
+	if (ptr && !strncmp_nocase(ptr->name, name, namelen) && !ptr->name[namelen])
+		return ptr;
+	for (ptr = msg->args; ptr; ptr = ptr->next) {
+		if (!strncmp_nocase(ptr->name, name, namelen) && !ptr->name[namelen])
+			return ptr;
+	}
+	return NULL;
+}
+
+
+static McpArg *
+mcp_mesg_arg_find(McpMesg * msg, const char *name)
+{
+	return mcp_mesg_arg_find_n(msg, name, strlen(name));
+}
+
+
+static McpArgPart *
+mcp_mesg_part_new(McpMesg * msg, const char *val, int vallen)
+{
+	McpArgPart *nu;
+
+	nu = (McpArgPart *) mcp_mesg_alloc(msg, sizeof(McpArgPart) + vallen + 1);
+	nu->value = (char *) (nu + 1);
+	memcpy(nu->value, val, vallen);
+	nu->value[vallen] = '\0';
+	nu->next = NULL;
+	return nu;
+}
+
+
+
+/* As mcp_mesg_arg_append(), but with counted, unterminated strings. */
+static int
+mcp_mesg_arg_append_n(McpMesg * msg, const char *argname, int namelen,
+					  const char *argval, int vallen)
+{
+	McpArg *ptr;
+
+	if (!argval) {
+		vallen = 0;
+	}
+	if (namelen > MAX_MCP_ARGNAME_LEN) {
+		return EMCP_ARGNAMELEN;
+	}
+	if (vallen + msg->bytes > MAX_MCP_MESG_SIZE) {
+		return EMCP_MESGSIZE;
+	}
+	ptr = mcp_mesg_arg_find_n(msg, argname, namelen);
+	if (!ptr) {
+		if (namelen + vallen + msg->bytes > MAX_MCP_MESG_SIZE) {
+			return EMCP_MESGSIZE;
+		}
+		if (msg->argcount > MAX_MCP_MESG_ARGS + 1) {
+			return EMCP_ARGCOUNT;
+		}
+		ptr = (McpArg *) mcp_mesg_alloc(msg, sizeof(McpArg) + namelen + 1);
+		ptr->name = (char *) (ptr + 1);
+		memcpy(ptr->name, argname, namelen);
+		ptr->name[namelen] = '\0';
+		ptr->value = NULL;
+		ptr->last = NULL;
+		ptr->next = NULL;
+		if (!msg->args) {
+			msg->args = ptr;
+		} else {
+			McpArg *tail = msg->args;
+
+			while (tail->next)
+				tail = tail->next;
+			tail->next = ptr;
+		}
+		msg->argcount++;
+		msg->bytes += sizeof(McpArg) + namelen + 1;
+	}
+	msg->lastarg = ptr;
+
+	if (argval) {
+		McpArgPart *nu = mcp_mesg_part_new(msg, argval, vallen);
+
+		if (!ptr->last) {
+			ptr->value = ptr->last = nu;
+		} else {
+			ptr->last->next = nu;
+			ptr->last = nu;
+		}
+		msg->bytes += sizeof(McpArgPart) + vallen + 1;
+	}
+	ptr->was_shown = 0;
+	return EMCP_SUCCESS;
+}
+
+
+
+
 /*****************************************************************
  *
  * int mcp_mesg_arg_linecount(
@@ -980,12 +1167,9 @@ mcp_mesg_clear(McpMesg * msg)
 int
 mcp_mesg_arg_linecount(McpMesg * msg, const char *name)
 {
-	McpArg *ptr = msg->args;
+	McpArg *ptr = mcp_mesg_arg_find(msg, name);
 	int cnt = 0;
 
-	while (ptr && strcmp_nocase(ptr->name, name)) {
-		ptr = ptr->next;
-	}
 	if (ptr) {
 		McpArgPart *ptr2 = ptr->value;
 
@@ -1015,11 +1199,8 @@ mcp_mesg_arg_linecount(McpMesg * msg, const char *name)
 char *
 mcp_mesg_arg_getline(McpMesg * msg, const char *argname, int linenum)
 {
-	McpArg *ptr = msg->args;
+	McpArg *ptr = mcp_mesg_arg_find(msg, argname);
 
-	while (ptr && strcmp_nocase(ptr->name, argname)) {
-		ptr = ptr->next;
-	}
 	if (ptr) {
 		McpArgPart *ptr2 = ptr->value;
 
@@ -1059,65 +1240,8 @@ mcp_mesg_arg_getline(McpMesg * msg, const char *argname, int linenum)
 int
 mcp_mesg_arg_append(McpMesg * msg, const char *argname, const char *argval)
 {
-	McpArg *ptr = msg->args;
-	int namelen = strlen(argname);
-	int vallen = argval? strlen(argval) : 0;
-
-	if (namelen > MAX_MCP_ARGNAME_LEN) {
-		return EMCP_ARGNAMELEN;
-	}
-	if (vallen + msg->bytes > MAX_MCP_MESG_SIZE) {
-		return EMCP_MESGSIZE;
-	}
-	while (ptr && strcmp_nocase(ptr->name, argname)) {
-		ptr = ptr->next;
-	}
-	if (!ptr) {
-		if (namelen + vallen + msg->bytes > MAX_MCP_MESG_SIZE) {
-			return EMCP_MESGSIZE;
-		}
-		ptr = (McpArg *) malloc(sizeof(McpArg));
-		ptr->name = (char *) malloc(namelen + 1);
-		strcpyn(ptr->name, namelen+1, argname);
-		ptr->value = NULL;
-		ptr->last = NULL;
-		ptr->next = NULL;
-		if (!msg->args) {
-			msg->args = ptr;
-		} else {
-			int limit = MAX_MCP_MESG_ARGS;
-			McpArg *lastarg = msg->args;
-
-			while (lastarg->next) {
-				if (limit-- <= 0) {
-					free(ptr->name);
-					free(ptr);
-					return EMCP_ARGCOUNT;
-				}
-				lastarg = lastarg->next;
-			}
-			lastarg->next = ptr;
-		}
-		msg->bytes += sizeof(McpArg) + namelen + 1;
-	}
-
-	if (argval) {
-		McpArgPart *nu = (McpArgPart *) malloc(sizeof(McpArgPart));
-
-		nu->value = (char *) malloc(vallen + 1);
-		strcpyn(nu->value, vallen+1, argval);
-		nu->next = NULL;
-
-		if (!ptr->last) {
-			ptr->value = ptr->last = nu;
-		} else {
-			ptr->last->next = nu;
-			ptr->last = nu;
-		}
-		msg->bytes += sizeof(McpArgPart) + vallen + 1;
-	}
-	ptr->was_shown = 0;
-	return EMCP_SUCCESS;
+	return mcp_mesg_arg_append_n(msg, argname, strlen(argname),
+								 argval, argval ? strlen(argval) : 0);
 }
 
 
@@ -1137,61 +1261,24 @@ mcp_mesg_arg_append(McpMesg * msg, const char *argname, const char *argval)
 void
 mcp_mesg_arg_remove(McpMesg * msg, const char *argname)
 {
-	McpArg *ptr = msg->args;
-	McpArg *prev = NULL;
-
-	while (ptr && !strcmp_nocase(ptr->name, argname)) {
-		msg->args = ptr->next;
-		msg->bytes -= sizeof(McpArg);
-		if (ptr->name) {
-			free(ptr->name);
-			msg->bytes -= strlen(ptr->name) + 1;
-		}
-		while (ptr->value) {
-			McpArgPart *ptr2 = ptr->value;
-
-			ptr->value = ptr->value->next;
-			msg->bytes -= sizeof(McpArgPart);
-			if (ptr2->value) {
-				msg->bytes -= strlen(ptr2->value) + 1;
-				free(ptr2->value);
-			}
-			free(ptr2);
-		}
-		free(ptr);
-		ptr = msg->args;
-	}
+	McpArg *ptr;
+	McpArg **prev;
+	McpArgPart *ptr2;
 
-	prev = msg->args;
-	if (ptr)
-		ptr = ptr->next;
-
-	while (ptr) {
+	prev = &msg->args;
+	while ((ptr = *prev)) {
 		if (!strcmp_nocase(argname, ptr->name)) {
-			prev->next = ptr->next;
-			msg->bytes -= sizeof(McpArg);
-			if (ptr->name) {
-				free(ptr->name);
-				msg->bytes -= strlen(ptr->name) + 1;
-			}
-			while (ptr->value) {
-				McpArgPart *ptr2 = ptr->value;
-
-				ptr->value = ptr->value->next;
-				msg->bytes -= sizeof(McpArgPart);
-				if (ptr2->value) {
-					msg->bytes -= strlen(ptr2->value) + 1;
-					free(ptr2->value);
-				}
-				free(ptr2);
+			*prev = ptr->next;
+			msg->bytes -= sizeof(McpArg) + strlen(ptr->name) + 1;
+			for (ptr2 = ptr->value; ptr2; ptr2 = ptr2->next) {
+				msg->bytes -= sizeof(McpArgPart) + strlen(ptr2->value) + 1;
 			}
-			free(ptr);
-			ptr = prev->next;
+			msg->argcount--;
 		} else {
-			prev = ptr;
-			ptr = ptr->next;
+			prev = &ptr->next;
 		}
 	}
+	msg->lastarg = NULL;
 }
 
 
@@ -1418,26 +1505,18 @@ mcp_negotiate_handler(McpFrame * mfr, McpMesg * mesg, McpVer version, void *dumm
 /****************                *********************************/
 /*****************************************************************/
 
-int
-mcp_intern_is_ident(const char **in, char *buf, int buflen)
-{
-	int origbuflen = buflen;
-
-	if (!isalpha(**in) && **in != '_')
-		return 0;
-	while (isalpha(**in) || **in == '_' || isdigit(**in) || **in == '-') {
-		if (--buflen > 0) {
-			*buf++ = **in;
-		}
-		(*in)++;
-	}
-	if (origbuflen > 0)
-		*buf = '\0';
-	return 1;
-}
-
-
-int
+/*
+ * Incoming lines are tokenized in a single left-to-right pass.  The first
+ * character after the "#$#" prefix says what kind of line it is, so each
+ * line goes straight to the one parser that can accept it, and no parser
+ * ever backs up.  Names and values are handed on as pointer and length
+ * pairs into a private copy of the line; quoted values are unescaped in
+ * place there, so nothing is copied into scratch buffers along the way.
+ * Any syntax error rejects the whole line, which is then passed through
+ * as in-band text, just as before.
+ */
+
+static int
 mcp_intern_is_simplechar(char in)
 {
 	if (in == '*' || in == ':' || in == '\\' || in == '"')
@@ -1448,142 +1527,138 @@ mcp_intern_is_simplechar(char in)
 }
 
 
-int
-mcp_intern_is_unquoted(const char **in, char *buf, int buflen)
+/* Skips over an identifier, and returns its length, or 0 if none. */
+static int
+mcp_intern_ident(char **in)
 {
-	int origbuflen = buflen;
+	char *start = *in;
+	char *p = start;
 
-	if (!mcp_intern_is_simplechar(**in))
+	if (!isalpha(*p) && *p != '_')
 		return 0;
-	while (mcp_intern_is_simplechar(**in)) {
-		if (--buflen > 0) {
-			*buf++ = **in;
-		}
-		(*in)++;
-	}
-	if (origbuflen > 0)
-		*buf = '\0';
-	return 1;
+	while (isalpha(*p) || *p == '_' || isdigit(*p) || *p == '-')
+		p++;
+	*in = p;
+	return p - start;
 }
 
 
-int
-mcp_intern_is_quoted(const char **in, char *buf, int buflen)
+/* Skips over an unquoted value, and returns its length, or 0 if none. */
+static int
+mcp_intern_unquoted(char **in)
 {
-	int origbuflen = buflen;
-	const char *old = *in;
+	char *start = *in;
+	char *p = start;
 
-	if (**in != '"')
-		return 0;
-	(*in)++;
-	while (**in) {
-		if (**in == '\\') {
-			(*in)++;
-			if (**in && --buflen > 0) {
-				*buf++ = **in;
-			}
-		} else if (**in == '"') {
-			break;
-		} else {
-			if (--buflen > 0) {
-				*buf++ = **in;
-			}
-		}
-		(*in)++;
-	}
-	if (**in != '"') {
-		*in = old;
-		return 0;
-	}
-	(*in)++;
-	if (origbuflen > 0) {
-		*buf = '\0';
-	}
-	return 1;
+	while (mcp_intern_is_simplechar(*p))
+		p++;
+	*in = p;
+	return p - start;
 }
 
 
-int
-mcp_intern_is_keyval(McpMesg * msg, const char **in)
+/* Unescapes a quoted value in place.  Returns its length, or -1. */
+static int
+mcp_intern_quoted(char **in)
 {
-	char keyname[128];
-	char value[BUFFER_LEN];
-	const char *old = *in;
-	int deferred = 0;
+	char *p = *in + 1;
+	char *start = p;
+	char *out = p;
+
+	while (*p && *p != '"') {
+		if (*p == '\\' && p[1])
+			p++;
+		*out++ = *p++;
+	}
+	if (*p != '"')
+		return -1;
+	*in = p + 1;
+	return out - start;
+}
 
-	if (!isspace(**in))
-		return 0;
-	while (isspace(**in))
-		(*in)++;
-	if (!mcp_intern_is_ident(in, keyname, sizeof(keyname))) {
-		*in = old;
-		return 0;
-	}
-	if (**in == '*') {
-		msg->incomplete = 1;
-		deferred = 1;
-		(*in)++;
-	}
-	if (**in != ':') {
-		*in = old;
-		return 0;
-	}
-	(*in)++;
-	if (!isspace(**in)) {
-		*in = old;
-		return 0;
-	}
-	while (isspace(**in))
-		(*in)++;
-	if (!mcp_intern_is_unquoted(in, value, sizeof(value)) &&
-		!mcp_intern_is_quoted(in, value, sizeof(value))
-			) {
-		*in = old;
-		return 0;
-	}
 
-	if (deferred) {
-		mcp_mesg_arg_append(msg, keyname, NULL);
-	} else {
-		mcp_mesg_arg_append(msg, keyname, value);
+static int
+mcp_intern_keyvals(McpMesg * msg, char *in)
+{
+	char *key, *val;
+	int keylen, vallen;
+	int deferred;
+
+	while (*in) {
+		if (!isspace(*in))
+			return 0;
+		while (isspace(*in))
+			in++;
+		key = in;
+		if (!(keylen = mcp_intern_ident(&in)))
+			return 0;
+		deferred = 0;
+		if (*in == '*') {
+			msg->incomplete = 1;
+			deferred = 1;
+			in++;
+		}
+		if (*in != ':')
+			return 0;
+		in++;
+		if (!isspace(*in))
+			return 0;
+		while (isspace(*in))
+			in++;
+		if (*in == '"') {
+			val = in + 1;
+			if ((vallen = mcp_intern_quoted(&in)) < 0)
+				return 0;
+		} else {
+			val = in;
+			if (!(vallen = mcp_intern_unquoted(&in)))
+				return 0;
+		}
+		mcp_mesg_arg_append_n(msg, key, keylen, deferred ? NULL : val, vallen);
 	}
 	return 1;
 }
 
 
-
-int
-mcp_intern_is_mesg_start(McpFrame * mfr, const char *in)
+static int
+mcp_intern_mesg_start(McpFrame * mfr, char *in)
 {
 	char mesgname[128];
-	char authkey[128];
+	char *name = in;
+	char *authkey;
 	char *subname = NULL;
 	McpMesg *newmsg = NULL;
-	McpPkg *pkg = NULL;
+	int namelen, authlen;
 	int longlen = 0;
 
-	if (!mcp_intern_is_ident(&in, mesgname, sizeof(mesgname)))
+	if (!(namelen = mcp_intern_ident(&in)))
 		return 0;
+	if (namelen >= (int) sizeof(mesgname))
+		namelen = sizeof(mesgname) - 1;
+	memcpy(mesgname, name, namelen);
+	mesgname[namelen] = '\0';
+
 	if (strcmp_nocase(mesgname, MCP_INIT_PKG)) {
 		if (!isspace(*in))
 			return 0;
 		while (isspace(*in))
 			in++;
-		if (!mcp_intern_is_unquoted(&in, authkey, sizeof(authkey)))
+		authkey = in;
+		if (!(authlen = mcp_intern_unquoted(&in)))
 			return 0;
-		if (strcmp(authkey, mfr->authkey))
+		if (!mfr->authkey || strncmp(authkey, mfr->authkey, authlen) || mfr->authkey[authlen])
 			return 0;
 	}
 
 	if (strncmp_nocase(mesgname, MCP_INIT_PKG, 3)) {
-		for (pkg = mfr->packages; pkg; pkg = pkg->next) {
-			int pkgnamelen = strlen(pkg->pkgname);
-
-			if (!strncmp_nocase(pkg->pkgname, mesgname, pkgnamelen)) {
-				if (mesgname[pkgnamelen] == '\0' || mesgname[pkgnamelen] == '-') {
-					if (pkgnamelen > longlen) {
-						longlen = pkgnamelen;
-					}
+		int len;
+
+		/* Probe for the longest negotiated package that prefixes the name. */
+		for (len = namelen; len > 0; len--) {
+			if (len == namelen || mesgname[len] == '-') {
+				if (mcp_pkghash_find(mfr->pkghash, mesgname, len)) {
+					longlen = len;
+					break;
 				}
 			}
 		}
@@ -1594,7 +1669,7 @@ mcp_intern_is_mesg_start(McpFrame * mfr, const char *in)
 		if (!strncmp_nocase(mesgname, MCP_NEGOTIATE_PKG, neglen)) {
 			longlen = neglen;
 		} else if (!strcmp_nocase(mesgname, MCP_INIT_PKG)) {
-			longlen = strlen(mesgname);
+			longlen = namelen;
 		} else {
 			return 0;
 		}
@@ -1606,12 +1681,10 @@ mcp_intern_is_mesg_start(McpFrame * mfr, const char *in)
 
 	newmsg = (McpMesg *) malloc(sizeof(McpMesg));
 	mcp_mesg_init(newmsg, mesgname, subname);
-	while (*in) {
-		if (!mcp_intern_is_keyval(newmsg, &in)) {
-			mcp_mesg_clear(newmsg);
-			free(newmsg);
-			return 0;
-		}
+	if (!mcp_intern_keyvals(newmsg, in)) {
+		mcp_mesg_clear(newmsg);
+		free(newmsg);
+		return 0;
 	}
 
 	/* Okay, we've recieved a valid message. */
@@ -1619,6 +1692,11 @@ mcp_intern_is_mesg_start(McpFrame * mfr, const char *in)
 		/* It's incomplete.  Remember it to finish later. */
 		const char *msgdt = mcp_mesg_arg_getline(newmsg, MCP_DATATAG, 0);
 
+		if (!msgdt) {
+			mcp_mesg_clear(newmsg);
+			free(newmsg);
+			return 0;
+		}
 		newmsg->datatag = string_dup(msgdt);
 		mcp_mesg_arg_remove(newmsg, MCP_DATATAG);
 		newmsg->next = mfr->messages;
@@ -1633,28 +1711,42 @@ mcp_intern_is_mesg_start(McpFrame * mfr, const char *in)
 }
 
 
-int
-mcp_intern_is_mesg_cont(McpFrame * mfr, const char *in)
+static McpMesg **
+mcp_intern_find_partial(McpFrame * mfr, const char *datatag, int len)
 {
-	char datatag[128];
-	char keyname[128];
-	McpMesg *ptr;
+	McpMesg **prev;
 
-	if (*in != '*') {
-		return 0;
+	for (prev = &mfr->messages; *prev; prev = &(*prev)->next) {
+		if (!strncmp((*prev)->datatag, datatag, len) && !(*prev)->datatag[len]) {
+			return prev;
+		}
 	}
+	return NULL;
+}
+
+
+static int
+mcp_intern_mesg_cont(McpFrame * mfr, char *in)
+{
+	char *datatag;
+	char *keyname;
+	int taglen, keylen;
+	McpMesg **ptr;
+
 	in++;
 	if (!isspace(*in))
 		return 0;
 	while (isspace(*in))
 		in++;
-	if (!mcp_intern_is_unquoted(&in, datatag, sizeof(datatag)))
+	datatag = in;
+	if (!(taglen = mcp_intern_unquoted(&in)))
 		return 0;
 	if (!isspace(*in))
 		return 0;
 	while (isspace(*in))
 		in++;
-	if (!mcp_intern_is_ident(&in, keyname, sizeof(keyname)))
+	keyname = in;
+	if (!(keylen = mcp_intern_ident(&in)))
 		return 0;
 	if (*in != ':')
 		return 0;
@@ -1663,47 +1755,39 @@ mcp_intern_is_mesg_cont(McpFrame * mfr, const char *in)
 		return 0;
 	in++;
 
-	for (ptr = mfr->messages; ptr; ptr = ptr->next) {
-		if (!strcmp(datatag, ptr->datatag)) {
-			mcp_mesg_arg_append(ptr, keyname, in);
-			break;
-		}
-	}
+	ptr = mcp_intern_find_partial(mfr, datatag, taglen);
 	if (!ptr) {
 		return 0;
 	}
+	mcp_mesg_arg_append_n(*ptr, keyname, keylen, in, strlen(in));
 	return 1;
 }
 
 
-int
-mcp_intern_is_mesg_end(McpFrame * mfr, const char *in)
+static int
+mcp_intern_mesg_end(McpFrame * mfr, char *in)
 {
-	char datatag[128];
-	McpMesg *ptr, **prev;
+	char *datatag;
+	int taglen;
+	McpMesg **prev;
+	McpMesg *ptr;
 
-	if (*in != ':') {
-		return 0;
-	}
 	in++;
 	if (!isspace(*in))
 		return 0;
 	while (isspace(*in))
 		in++;
-	if (!mcp_intern_is_unquoted(&in, datatag, sizeof(datatag)))
+	datatag = in;
+	if (!(taglen = mcp_intern_unquoted(&in)))
 		return 0;
 	if (*in)
 		return 0;
-	prev = &mfr->messages;
-	for (ptr = mfr->messages; ptr; ptr = ptr->next, prev = &ptr->next) {
-		if (!strcmp(datatag, ptr->datatag)) {
-			*prev = ptr->next;
-			break;
-		}
-	}
-	if (!ptr) {
+	prev = mcp_intern_find_partial(mfr, datatag, taglen);
+	if (!prev) {
 		return 0;
 	}
+	ptr = *prev;
+	*prev = ptr->next;
 	ptr->incomplete = 0;
 	mcp_frame_package_docallback(mfr, ptr);
 	mcp_mesg_clear(ptr);
@@ -1716,11 +1800,15 @@ mcp_intern_is_mesg_end(McpFrame * mfr, const char *in)
 int
 mcp_internal_parse(McpFrame * mfr, const char *in)
 {
-	if (mcp_intern_is_mesg_cont(mfr, in))
-		return 1;
-	if (mcp_intern_is_mesg_end(mfr, in))
-		return 1;
-	if (mcp_intern_is_mesg_start(mfr, in))
-		return 1;
-	return 0;
+	char line[BUFFER_LEN];
+
+	strcpyn(line, sizeof(line), in);
+	switch (*line) {
+	case '*':
+		return mcp_intern_mesg_cont(mfr, line);
+	case ':':
+		return mcp_intern_mesg_end(mfr, line);
+	default:
+		return mcp_intern_mesg_start(mfr, line);
+	}
 }
@@ -10,8 +10,22 @@
 #include <malloc.h>
 #endif /* HAVE_MALLOC_H */
 
+/*
+ * Open dialogs are hashed twice: once by dlogid, for the value gets and
+ * sets and control events that name them, and once by descriptor, so a
+ * disconnect only visits the dialogs in its own bucket.  Each dialog also
+ * hashes its control values by id.  Both chains are doubly linked through
+ * pointer-to-pointer prevs, so a dialog can unlink itself from either one
+ * without a search.  The values list is kept, in its old newest-first
+ * order, for GuiValueFirst() and GuiValueNext().
+ */
+#define DLOG_HASH_SIZE       256	/* dialog buckets.  Power of 2. */
+#define DLOG_VALUE_HASH_SIZE  16	/* value buckets per dialog.  Power of 2. */
+#define DLOG_MAX_VALUES      256	/* max distinct control values per dialog. */
+
 typedef struct DlogValue_t {
 	struct DlogValue_t *next;
+	struct DlogValue_t *hashnext;
 	char *name;
 	int lines;
 	char **value;
@@ -20,16 +34,22 @@ typedef struct DlogValue_t {
 typedef struct DlogData_t {
 	struct DlogData_t *next;
 	struct DlogData_t **prev;
+	struct DlogData_t *descrnext;
+	struct DlogData_t **descrprev;
 	char *id;
 	int descr;
 	int dismissed;
+	int closed;				/* Already sent _closed on disconnect. */
+	int valuecount;
 	DlogValue *values;
+	DlogValue *valuehash[DLOG_VALUE_HASH_SIZE];
 	Gui_CB callback;
 	GuiErr_CB error_cb;
 	void *context;
 } DlogData;
 
-DlogData *dialog_list = NULL;
+DlogData *dialog_hash[DLOG_HASH_SIZE];
+DlogData *dialog_descr_hash[DLOG_HASH_SIZE];
 DlogData *dialog_last_accessed = NULL;
 
 
@@ -55,7 +75,7 @@ gui_dlog_find(const char *dlogid)
 	if (ptr && !strcmp(ptr->id, dlogid)) {
 		return ptr;
 	}
-	ptr = dialog_list;
+	ptr = dialog_hash[hash(dlogid, DLOG_HASH_SIZE)];
 	while (ptr) {
 		if (!strcmp(ptr->id, dlogid)) {
 			dialog_last_accessed = ptr;
@@ -67,6 +87,19 @@ gui_dlog_find(const char *dlogid)
 }
 
 
+static DlogValue *
+gui_value_find(DlogData * ddata, const char *id)
+{
+	DlogValue *ptr;
+
+	ptr = ddata->valuehash[hash(id, DLOG_VALUE_HASH_SIZE)];
+	while (ptr && strcmp(ptr->name, id)) {
+		ptr = ptr->hashnext;
+	}
+	return ptr;
+}
+
+
 void*
 gui_dlog_get_context(const char *dlogid)
 {
@@ -115,10 +148,7 @@ gui_value_linecount(const char *dlogid, const char *id)
 	if (!ddata) {
 		return EGUINODLOG;
 	}
-	ptr = ddata->values;
-	while (ptr && strcmp(ptr->name, id)) {
-		ptr = ptr->next;
-	}
+	ptr = gui_value_find(ddata, id);
 	if (!ptr) {
 		return 0;
 	}
@@ -148,10 +178,7 @@ GuiValueNext(const char *dlogid, const char *id)
 	if (!ddata) {
 		return NULL;
 	}
-	ptr = ddata->values;
-	while (ptr && strcmp(ptr->name, id)) {
-		ptr = ptr->next;
-	}
+	ptr = gui_value_find(ddata, id);
 	if (!ptr || !ptr->next) {
 		return NULL;
 	}
@@ -168,10 +195,7 @@ gui_value_get(const char *dlogid, const char *id, int line)
 	if (!ddata) {
 		return NULL;
 	}
-	ptr = ddata->values;
-	while (ptr && strcmp(ptr->name, id)) {
-		ptr = ptr->next;
-	}
+	ptr = gui_value_find(ddata, id);
 	if (!ptr || line < 0 || line >= ptr->lines) {
 		return NULL;
 	}
@@ -185,18 +209,11 @@ gui_value_set_local(const char *dlogid, const char *id, int lines, const char **
 	DlogValue *ptr;
 	DlogData *ddata = gui_dlog_find(dlogid);
 	int i;
-	int limit = 256;
 
 	if (!ddata) {
 		return;
 	}
-	ptr = ddata->values;
-	while (ptr && strcmp(ptr->name, id)) {
-		ptr = ptr->next;
-		if (!limit--) {
-			return;
-		}
-	}
+	ptr = gui_value_find(ddata, id);
 	if (ptr) {
 		for (i = 0; i < ptr->lines; i++) {
 			free(ptr->value[i]);
@@ -204,11 +221,19 @@ gui_value_set_local(const char *dlogid, const char *id, int lines, const char **
 		free(ptr->value);
 	} else {
 		int ilen = strlen(id)+1;
+		unsigned int hv = hash(id, DLOG_VALUE_HASH_SIZE);
+
+		if (ddata->valuecount >= DLOG_MAX_VALUES) {
+			return;
+		}
 		ptr = (DlogValue *) malloc(sizeof(DlogValue));
 		ptr->name = (char *) malloc(ilen);
 		strcpyn(ptr->name, ilen, id);
 		ptr->next = ddata->values;
 		ddata->values = ptr;
+		ptr->hashnext = ddata->valuehash[hv];
+		ddata->valuehash[hv] = ptr;
+		ddata->valuecount++;
 	}
 	ptr->lines = lines;
 	ptr->value = (char **) malloc(sizeof(char *) * lines);
@@ -231,6 +256,7 @@ gui_value_free(DlogValue * ptr)
 		free(ptr->value[i]);
 	}
 	free(ptr->value);
+	free(ptr);
 }
 
 
@@ -313,6 +339,7 @@ gui_dlog_alloc(int descr, Gui_CB callback, GuiErr_CB error_cb, void *context)
 {
 	char tmpid[32];
 	DlogData *ptr;
+	DlogData **head;
 	int tlen;
 
 	while (1) {
@@ -327,38 +354,49 @@ gui_dlog_alloc(int descr, Gui_CB callback, GuiErr_CB error_cb, void *context)
 	strcpyn(ptr->id, tlen, tmpid);
 	ptr->descr = descr;
 	ptr->dismissed = 0;
+	ptr->closed = 0;
 	ptr->callback = callback;
 	ptr->error_cb = error_cb;
 	ptr->context = context;
 	ptr->values = NULL;
+	ptr->valuecount = 0;
+	memset(ptr->valuehash, 0, sizeof(ptr->valuehash));
+
+	head = &dialog_hash[hash(ptr->id, DLOG_HASH_SIZE)];
+	ptr->prev = head;
+	ptr->next = *head;
+	if (*head)
+		(*head)->prev = &ptr->next;
+	*head = ptr;
+
+	head = &dialog_descr_hash[(unsigned int) descr & (DLOG_HASH_SIZE - 1)];
+	ptr->descrprev = head;
+	ptr->descrnext = *head;
+	if (*head)
+		(*head)->descrprev = &ptr->descrnext;
+	*head = ptr;
 
-	ptr->prev = &dialog_list;
-	ptr->next = dialog_list;
-	if (dialog_list)
-		dialog_list->prev = &ptr->next;
-	dialog_list = ptr;
 	dialog_last_accessed = ptr;
 	return ptr->id;
 }
 
 
-int
-GuiFree(const char *id)
+static void
+gui_dlog_unlink_free(DlogData * ptr)
 {
-	DlogData *ptr;
 	DlogValue *valptr;
 	DlogValue *nextval;
 
-	ptr = gui_dlog_find(id);
-	if (!ptr) {
-		return EGUINODLOG;
-	}
 	*ptr->prev = ptr->next;
 	if (ptr->next)
 		ptr->next->prev = ptr->prev;
+	*ptr->descrprev = ptr->descrnext;
+	if (ptr->descrnext)
+		ptr->descrnext->descrprev = ptr->descrprev;
 
-	ptr->next = NULL;
-	ptr->prev = NULL;
+	if (dialog_last_accessed == ptr) {
+		dialog_last_accessed = NULL;
+	}
 	free(ptr->id);
 
 	valptr = ptr->values;
@@ -367,12 +405,20 @@ GuiFree(const char *id)
 		gui_value_free(valptr);
 		valptr = nextval;
 	}
-	ptr->values = NULL;
-	ptr->descr = 0;
-	if (dialog_last_accessed == ptr) {
-		dialog_last_accessed = NULL;
-	}
 	free(ptr);
+}
+
+
+int
+GuiFree(const char *id)
+{
+	DlogData *ptr;
+
+	ptr = gui_dlog_find(id);
+	if (!ptr) {
+		return EGUINODLOG;
+	}
+	gui_dlog_unlink_free(ptr);
 	return 0;
 }
 
@@ -383,18 +429,15 @@ gui_dlog_closeall_descr(int descr)
 	DlogData *ptr;
 	McpMesg msg;
 
-	ptr = dialog_list;
+	/*
+	 * A callback can free any dialog on the chain, not just its own, so
+	 * start over from the head after each one.  The closed flag keeps
+	 * each dialog from being told twice.
+	 */
+	ptr = dialog_descr_hash[(unsigned int) descr & (DLOG_HASH_SIZE - 1)];
 	while (ptr) {
-		while (ptr) {
-			if (ptr->descr == descr) {
-				break;
-			}
-			ptr = ptr->next;
-		}
-		if (!ptr) {
-			return 0;
-		}
-		if (ptr->callback) {
+		if (ptr->descr == descr && ptr->callback && !ptr->closed) {
+			ptr->closed = 1;
 			mcp_mesg_init(&msg, GUI_PACKAGE, "ctrl-event");
 			mcp_mesg_arg_append(&msg, "dlogid", ptr->id);
 			mcp_mesg_arg_append(&msg, "id", "_closed");
@@ -402,8 +445,10 @@ gui_dlog_closeall_descr(int descr)
 			mcp_mesg_arg_append(&msg, "event", "buttonpress");
 			ptr->callback(ptr->descr, ptr->id, "_closed", "buttonpress", &msg, 1, ptr->context);
 			mcp_mesg_clear(&msg);
+			ptr = dialog_descr_hash[(unsigned int) descr & (DLOG_HASH_SIZE - 1)];
+		} else {
+			ptr = ptr->descrnext;
 		}
-		ptr = ptr->next;
 	}
 	return 0;
 }
@@ -414,40 +459,13 @@ gui_dlog_freeall_descr(int descr)
 {
 	DlogData *ptr;
 	DlogData *next;
-	DlogValue *valptr;
 
-	ptr = dialog_list;
+	ptr = dialog_descr_hash[(unsigned int) descr & (DLOG_HASH_SIZE - 1)];
 	while (ptr) {
-		while (ptr) {
-			if (ptr->descr == descr) {
-				break;
-			}
-			ptr = ptr->next;
-		}
-		if (!ptr) {
-			return 0;
-		}
-		next = ptr->next;
-		*ptr->prev = next;
-		if (next)
-			next->prev = ptr->prev;
-
-		ptr->next = NULL;
-		ptr->prev = NULL;
-		if (dialog_last_accessed == ptr) {
-			dialog_last_accessed = NULL;
-		}
-		free(ptr->id);
-
-		valptr = ptr->values;
-		while (valptr) {
-			ptr->values = valptr->next;
-			gui_value_free(valptr);
-			valptr = ptr->values;
+		next = ptr->descrnext;
+		if (ptr->descr == descr) {
+			gui_dlog_unlink_free(ptr);
 		}
-		ptr->values = NULL;
-		ptr->descr = 0;
-		free(ptr);
 		ptr = next;
 	}
 	return 0;
@@ -0,0 +1,607 @@
+/* Main loop metrics, served in the Prometheus text format */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <time.h>
+#include "db.h"
+#include "tune.h"
+#include "inst.h"
+#include "externs.h"
+#include "interface.h"
+#include "params.h"
+#include "array.h"
+
+#ifdef MAIN_LOOP_METRICS
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+
+/*
+ * Times are kept in HDR-style histograms of microseconds.  Values under
+ * 2 * METRICS_SUB microseconds get a bucket each.  Above that, each power
+ * of two is split into METRICS_SUB buckets of equal width, so that any
+ * value is known to within 1 part in METRICS_SUB, however large it is.
+ * Times of more than half an hour are counted as half an hour.
+ *
+ * Everything counts up from when the server started.  Prometheus works
+ * out rates from that by itself, and the quantiles given to MUF are over
+ * the whole run.
+ */
+
+#define METRICS_SUB_BITS 4
+#define METRICS_SUB (1 << METRICS_SUB_BITS)
+#define METRICS_MAX_BITS 31
+#define METRICS_MAX_VALUE ((1UL << METRICS_MAX_BITS) - 1)
+#define METRICS_BUCKETS ((METRICS_MAX_BITS - METRICS_SUB_BITS + 1) * METRICS_SUB)
+
+/* Prometheus gets buckets at the powers of two between these, in usecs. */
+#define METRICS_PROM_MIN_BITS 3
+#define METRICS_PROM_MAX_BITS 25
+
+#define METRICS_MAX_CLIENTS 4		/* Scrapes served at once */
+#define METRICS_CLIENT_TIMEOUT 10	/* Seconds to wait for a request */
+#define METRICS_REQUEST_LEN 2048	/* Longest request read */
+
+struct metrics_hist {
+	long count;
+	double sum;
+	unsigned long max;
+	long buckets[METRICS_BUCKETS];
+};
+
+static struct metrics_histinfo {
+	const char *key;			/* Key in the METRICS dictionary */
+	const char *name;			/* Prometheus metric name */
+	const char *phase;			/* Prometheus phase label, if any */
+	const char *help;
+} metrics_histinfo[METRIC_HISTS] = {
+	{"loop_time", "fbmuck_loop_seconds", NULL,
+	 "Time taken by each pass of the main loop, less the wait in select()."},
+	{"select_time", "fbmuck_select_wait_seconds", NULL,
+	 "Time spent waiting in select() for input, output or a timeout."},
+	{"events_time", "fbmuck_phase_seconds", "events", NULL},
+	{"commands_time", "fbmuck_phase_seconds", "commands", NULL},
+	{"mufevents_time", "fbmuck_phase_seconds", "mufevents", NULL},
+	{"io_time", "fbmuck_phase_seconds", "io", NULL}
+};
+
+static struct metrics_countinfo {
+	const char *key;
+	const char *name;
+	const char *help;
+} metrics_countinfo[METRIC_COUNTERS] = {
+	{"iterations", "fbmuck_loop_iterations_total", "Passes through the main loop."},
+	{"wakeups", "fbmuck_select_wakeups_total", "Times select() returned with descriptors ready."},
+	{"timeouts", "fbmuck_select_timeouts_total", "Times select() returned with nothing ready."},
+	{"bytes_in", "fbmuck_received_bytes_total", "Bytes read from player connections."},
+	{"bytes_out", "fbmuck_sent_bytes_total", "Bytes written to player connections."},
+	{"commands", "fbmuck_commands_total", "Commands taken from player input queues."},
+	{"connects", "fbmuck_connections_total", "Connections accepted."}
+};
+
+long metrics_counts[METRIC_COUNTERS];
+
+static struct metrics_hist metrics_hists[METRIC_HISTS];
+static struct timeval metrics_pass_start;
+static unsigned long metrics_last_wait;
+static time_t metrics_started = 0;
+
+static int metrics_descrs = 0;
+static int metrics_inlines = 0;
+static long metrics_outbytes = 0;
+
+static int metrics_sock = -1;
+static int metrics_port = 0;
+static time_t metrics_next_write = 0;
+
+static struct metrics_client {
+	int fd;
+	time_t opened;
+	int len;
+	char buf[METRICS_REQUEST_LEN];
+} metrics_clients[METRICS_MAX_CLIENTS];
+
+static char *metrics_buf = NULL;
+static int metrics_buflen = 0;
+static int metrics_bufsize = 0;
+
+extern int process_count;
+#ifdef DISKBASE
+extern long propcache_hits;
+extern long propcache_misses;
+#endif
+
+
+static int
+metrics_bucket(unsigned long us)
+{
+	int e = 0;
+
+	if (us > METRICS_MAX_VALUE)
+		us = METRICS_MAX_VALUE;
+	while ((us >> e) >= 2 * METRICS_SUB)
+		e++;
+	return e * METRICS_SUB + (int) (us >> e);
+}
+
+
+/* The highest value that lands in bucket i. */
+static unsigned long
+metrics_bucket_top(int i)
+{
+	int e = i / METRICS_SUB - 1;
+
+	if (e < 0)
+		e = 0;
+	return ((unsigned long) (i - e * METRICS_SUB) << e) + (1UL << e) - 1;
+}
+
+
+static void
+metrics_record(int which, unsigned long us)
+{
+	struct metrics_hist *h = &metrics_hists[which];
+
+	h->count++;
+	h->sum += us;
+	if (us > h->max)
+		h->max = us;
+	h->buckets[metrics_bucket(us)]++;
+}
+
+
+static unsigned long
+metrics_usecs(struct timeval *from, struct timeval *to)
+{
+	long us = (to->tv_sec - from->tv_sec) * 1000000L + (to->tv_usec - from->tv_usec);
+
+	/* The clock may have been stepped back. */
+	return us > 0 ? (unsigned long) us : 0;
+}
+
+
+/* The value that the given fraction of a histogram's times were under. */
+static unsigned long
+metrics_quantile(struct metrics_hist *h, double frac)
+{
+	long want = (long) (frac * h->count + 0.999999);
+	long seen = 0;
+	unsigned long top;
+	int i;
+
+	if (!h->count)
+		return 0;
+	if (want < 1)
+		want = 1;
+	for (i = 0; i < METRICS_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= want) {
+			top = metrics_bucket_top(i);
+			return top < h->max ? top : h->max;
+		}
+	}
+	return h->max;
+}
+
+
+void
+metrics_init(void)
+{
+	int i;
+
+	for (i = 0; i < METRICS_MAX_CLIENTS; i++)
+		metrics_clients[i].fd = -1;
+	metrics_started = time(NULL);
+}
+
+
+/*
+ * Called at the top of each pass of the main loop.  The pass before this
+ * one is timed from its start to now, less the time it spent in select().
+ */
+void
+metrics_pass(struct timeval *now)
+{
+	unsigned long us;
+
+	if (metrics_pass_start.tv_sec) {
+		us = metrics_usecs(&metrics_pass_start, now);
+		metrics_record(METRIC_LOOP, us > metrics_last_wait ? us - metrics_last_wait : 0);
+	}
+	metrics_pass_start = *now;
+	metrics_last_wait = 0;
+	metrics_counts[METRIC_ITERATIONS]++;
+}
+
+
+/* Records the time since *since against a phase, and moves *since on. */
+void
+metrics_phase(int which, struct timeval *since)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	metrics_record(which, metrics_usecs(since, &now));
+	*since = now;
+}
+
+
+void
+metrics_select(struct timeval *waited, int ready)
+{
+	metrics_last_wait = waited->tv_sec * 1000000UL + waited->tv_usec;
+	metrics_record(METRIC_SELECT, metrics_last_wait);
+	metrics_counts[ready > 0 ? METRIC_WAKEUPS : METRIC_TIMEOUTS]++;
+}
+
+
+void
+metrics_queues(int descrs, int inlines, long outbytes)
+{
+	metrics_descrs = descrs;
+	metrics_inlines = inlines;
+	metrics_outbytes = outbytes;
+}
+
+
+static void
+metrics_printf(const char *format, ...)
+{
+	va_list args;
+	int len;
+
+	for (;;) {
+		va_start(args, format);
+		len = vsnprintf(metrics_buf + metrics_buflen, metrics_bufsize - metrics_buflen,
+						format, args);
+		va_end(args);
+		if (len >= 0 && metrics_buflen + len < metrics_bufsize)
+			break;
+		metrics_bufsize = metrics_bufsize ? metrics_bufsize * 2 : 16384;
+		metrics_buf = (char *) realloc(metrics_buf, metrics_bufsize);
+		if (!metrics_buf)
+			abort();
+	}
+	metrics_buflen += len;
+}
+
+
+static void
+metrics_gauge(const char *name, const char *type, const char *help, long value)
+{
+	metrics_printf("# HELP %s %s\n# TYPE %s %s\n%s %ld\n", name, help, name, type, name, value);
+}
+
+
+static void
+metrics_prom_hist(int which)
+{
+	struct metrics_histinfo *info = &metrics_histinfo[which];
+	struct metrics_hist *h = &metrics_hists[which];
+	char label[64];
+	long below = 0;
+	int bits, i = 0;
+
+	if (!info->phase || which == METRIC_EVENTS) {
+		metrics_printf("# HELP %s %s\n", info->name, info->help ? info->help :
+					   "Time spent in each phase of the main loop.");
+		metrics_printf("# TYPE %s histogram\n", info->name);
+	}
+	if (info->phase)
+		snprintf(label, sizeof(label), "phase=\"%s\",", info->phase);
+	else
+		*label = '\0';
+
+	/* Values are whole usecs, so counting those under 2^bits gives le. */
+	for (bits = METRICS_PROM_MIN_BITS; bits <= METRICS_PROM_MAX_BITS; bits++) {
+		for (; i < metrics_bucket(1UL << bits); i++)
+			below += h->buckets[i];
+		metrics_printf("%s_bucket{%sle=\"%.6f\"} %ld\n", info->name, label,
+					   (1UL << bits) / 1e6, below);
+	}
+	metrics_printf("%s_bucket{%sle=\"+Inf\"} %ld\n", info->name, label, h->count);
+	if (info->phase)
+		snprintf(label, sizeof(label), "{phase=\"%s\"}", info->phase);
+	metrics_printf("%s_sum%s %.6f\n", info->name, label, h->sum / 1e6);
+	metrics_printf("%s_count%s %ld\n", info->name, label, h->count);
+}
+
+
+/* Builds the Prometheus text in metrics_buf. */
+static void
+metrics_text(void)
+{
+	int i;
+
+	metrics_buflen = 0;
+	metrics_gauge("fbmuck_uptime_seconds", "gauge", "Seconds since the server started.",
+				  metrics_started ? (long) (time(NULL) - metrics_started) : 0L);
+	for (i = 0; i < METRIC_COUNTERS; i++)
+		metrics_gauge(metrics_countinfo[i].name, "counter", metrics_countinfo[i].help,
+					  metrics_counts[i]);
+	metrics_gauge("fbmuck_descriptors", "gauge", "Open player connections.",
+				  (long) metrics_descrs);
+	metrics_gauge("fbmuck_input_queue_lines", "gauge",
+				  "Lines waiting in player input queues.", (long) metrics_inlines);
+	metrics_gauge("fbmuck_output_queue_bytes", "gauge",
+				  "Bytes waiting in player output queues.", metrics_outbytes);
+	metrics_gauge("fbmuck_timequeue_processes", "gauge",
+				  "Processes on the timequeue.", (long) process_count);
+#ifdef DISKBASE
+	metrics_gauge("fbmuck_propcache_hits_total", "counter",
+				  "Property loads found in memory.", propcache_hits);
+	metrics_gauge("fbmuck_propcache_misses_total", "counter",
+				  "Property loads read from disk.", propcache_misses);
+#endif
+	for (i = 0; i < METRIC_HISTS; i++)
+		metrics_prom_hist(i);
+}
+
+
+/* Rewrites the metrics file, by way of a temporary file. */
+static int
+metrics_write_file(const char *filename)
+{
+	char tmpname[BUFFER_LEN];
+	FILE *f;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+	if (!(f = fopen(tmpname, "wb")))
+		return -1;
+	metrics_text();
+	if (fwrite(metrics_buf, 1, metrics_buflen, f) != (size_t) metrics_buflen) {
+		fclose(f);
+		unlink(tmpname);
+		return -1;
+	}
+	if (fclose(f) || rename(tmpname, filename)) {
+		unlink(tmpname);
+		return -1;
+	}
+	return 0;
+}
+
+
+static int
+metrics_listen(int port)
+{
+	struct sockaddr_in addr;
+	int s, opt = 1;
+
+	if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		return -1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char *) &opt, sizeof(opt));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if (bind(s, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(s, 5) < 0) {
+		close(s);
+		return -1;
+	}
+	make_nonblocking(s);
+	return s;
+}
+
+
+static void
+metrics_close_client(struct metrics_client *c)
+{
+	close(c->fd);
+	c->fd = -1;
+	c->len = 0;
+}
+
+
+static void
+metrics_respond(struct metrics_client *c)
+{
+	char head[256];
+	const char *p;
+	int len, got;
+
+	if (strncmp(c->buf, "GET ", 4)) {
+		len = snprintf(head, sizeof(head),
+					   "HTTP/1.0 405 Method Not Allowed\r\nConnection: close\r\n\r\n");
+		p = NULL;
+	} else {
+		metrics_text();
+		len = snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\n"
+					   "Content-Type: text/plain; version=0.0.4\r\n"
+					   "Content-Length: %d\r\nConnection: close\r\n\r\n", metrics_buflen);
+		p = metrics_buf;
+	}
+
+	/*
+	 * The socket doesn't block, so that a scraper that stops reading
+	 * can't stall the server.  It's local, and the page fits in the
+	 * socket buffer, so if it's a short write, it's just dropped.
+	 */
+	if (write(c->fd, head, len) == len && p) {
+		do {
+			got = write(c->fd, p, metrics_buflen);
+		} while (got < 0 && errno == EINTR);
+	}
+	metrics_close_client(c);
+}
+
+
+/* Adds the metrics sockets to the set select() waits on. */
+void
+metrics_fdset(fd_set * input_set, int *maxd)
+{
+	int i, room = 0;
+
+	for (i = 0; i < METRICS_MAX_CLIENTS; i++) {
+		if (metrics_clients[i].fd >= 0) {
+			FD_SET(metrics_clients[i].fd, input_set);
+			if (metrics_clients[i].fd >= *maxd)
+				*maxd = metrics_clients[i].fd + 1;
+		} else {
+			room = 1;
+		}
+	}
+	if (metrics_sock >= 0 && room) {
+		FD_SET(metrics_sock, input_set);
+		if (metrics_sock >= *maxd)
+			*maxd = metrics_sock + 1;
+	}
+}
+
+
+/* Accepts scrapes, and answers them once the whole request is in. */
+void
+metrics_serve(fd_set * input_set)
+{
+	struct metrics_client *c;
+	int i, fd, got;
+
+	for (i = 0; i < METRICS_MAX_CLIENTS; i++) {
+		c = &metrics_clients[i];
+		if (c->fd < 0 || !FD_ISSET(c->fd, input_set))
+			continue;
+		got = read(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+		if (got <= 0) {
+			metrics_close_client(c);
+			continue;
+		}
+		c->len += got;
+		c->buf[c->len] = '\0';
+		if (strstr(c->buf, "\r\n\r\n") || strstr(c->buf, "\n\n") ||
+			c->len >= (int) sizeof(c->buf) - 1)
+			metrics_respond(c);
+	}
+
+	if (metrics_sock < 0 || !FD_ISSET(metrics_sock, input_set))
+		return;
+	if ((fd = accept(metrics_sock, NULL, NULL)) < 0)
+		return;
+	make_nonblocking(fd);
+	for (i = 0; i < METRICS_MAX_CLIENTS; i++) {
+		c = &metrics_clients[i];
+		if (c->fd < 0) {
+			c->fd = fd;
+			c->opened = time(NULL);
+			c->len = 0;
+			return;
+		}
+	}
+	close(fd);
+}
+
+
+/*
+ * Called once a pass from the main loop.  Opens or moves the metrics port
+ * when @tune metrics_port changes, drops scrapers that never sent a
+ * request, and rewrites the metrics file when it is due.
+ */
+void
+metrics_tick(void)
+{
+	time_t now = time(NULL);
+	int i;
+
+	if (tp_metrics_port != metrics_port) {
+		if (metrics_sock >= 0)
+			close(metrics_sock);
+		metrics_sock = -1;
+		metrics_port = tp_metrics_port;
+		if (metrics_port > 0 && metrics_port < 65536) {
+			if ((metrics_sock = metrics_listen(metrics_port)) < 0)
+				log_status("METRICS: Could not listen on localhost port %d.", metrics_port);
+			else
+				log_status("METRICS: Serving metrics on localhost port %d.", metrics_port);
+		}
+	}
+
+	for (i = 0; i < METRICS_MAX_CLIENTS; i++) {
+		if (metrics_clients[i].fd >= 0 &&
+			now - metrics_clients[i].opened > METRICS_CLIENT_TIMEOUT)
+			metrics_close_client(&metrics_clients[i]);
+	}
+
+	if (*tp_metrics_file && now >= metrics_next_write) {
+		if (metrics_write_file(tp_metrics_file) < 0 && metrics_next_write)
+			log_status("METRICS: Could not write %s.", tp_metrics_file);
+		metrics_next_write = now + (tp_metrics_interval > 0 ? tp_metrics_interval : 1);
+	}
+}
+
+
+void
+metrics_shutdown(void)
+{
+	int i;
+
+	for (i = 0; i < METRICS_MAX_CLIENTS; i++) {
+		if (metrics_clients[i].fd >= 0)
+			metrics_close_client(&metrics_clients[i]);
+	}
+	if (metrics_sock >= 0)
+		close(metrics_sock);
+	metrics_sock = -1;
+	metrics_port = 0;
+}
+
+
+static void
+metrics_set_count(stk_array ** arr, const char *key, long value)
+{
+	/* MUF integers are only 32 bits wide. */
+	if (value > INT_MAX)
+		array_set_strkey_fltval(arr, key, (double) value);
+	else
+		array_set_strkey_intval(arr, key, (int) value);
+}
+
+
+/* Makes the dictionary returned by the METRICS primitive. */
+stk_array *
+metrics_array(void)
+{
+	static const double fracs[] = { 0.5, 0.9, 0.99, 0.999 };
+	static const char *fracnames[] = { "p50", "p90", "p99", "p999" };
+	stk_array *nu, *sub;
+	struct metrics_hist *h;
+	int i, j;
+
+	nu = new_array_dictionary();
+	metrics_set_count(&nu, "uptime", metrics_started ? (long) (time(NULL) - metrics_started) : 0L);
+	for (i = 0; i < METRIC_COUNTERS; i++)
+		metrics_set_count(&nu, metrics_countinfo[i].key, metrics_counts[i]);
+	array_set_strkey_intval(&nu, "descriptors", metrics_descrs);
+	array_set_strkey_intval(&nu, "input_lines", metrics_inlines);
+	metrics_set_count(&nu, "output_bytes", metrics_outbytes);
+	array_set_strkey_intval(&nu, "processes", process_count);
+#ifdef DISKBASE
+	metrics_set_count(&nu, "propcache_hits", propcache_hits);
+	metrics_set_count(&nu, "propcache_misses", propcache_misses);
+#endif
+	for (i = 0; i < METRIC_HISTS; i++) {
+		h = &metrics_hists[i];
+		sub = new_array_dictionary();
+		metrics_set_count(&sub, "count", h->count);
+		array_set_strkey_fltval(&sub, "sum", h->sum / 1e6);
+		for (j = 0; j < (int) (sizeof(fracs) / sizeof(fracs[0])); j++)
+			metrics_set_count(&sub, fracnames[j], (long) metrics_quantile(h, fracs[j]));
+		metrics_set_count(&sub, "max", (long) h->max);
+		array_set_strkey_arrval(&nu, metrics_histinfo[i].key, sub);
+	}
+	return nu;
+}
+
+#else							/* MAIN_LOOP_METRICS */
+
+stk_array *
+metrics_array(void)
+{
+	return NULL;
+}
+
+#endif							/* MAIN_LOOP_METRICS */
@@ -720,16 +720,12 @@ msg_unparse_macro(dbref player, dbref what, dbref perms, char *name, int argc, a
 }
 
 
-#ifndef MSGHASHSIZE
-#define MSGHASHSIZE 256
-#endif
-
-static hash_tab msghash[MSGHASHSIZE];
+static hash_tab msghash;
 
 int
 find_mfn(const char *name)
 {
-	hash_data *exp = find_hash(name, msghash, MSGHASHSIZE);
+	hash_data *exp = find_hash(name, &msghash);
 
 	if (exp)
 		return (exp->ival);
@@ -742,16 +738,16 @@ insert_mfn(const char *name, int i)
 {
 	hash_data hd;
 
-	(void) free_hash(name, msghash, MSGHASHSIZE);
+	(void) free_hash(name, &msghash);
 	hd.ival = i;
-	(void) add_hash(name, hd, msghash, MSGHASHSIZE);
+	(void) add_hash(name, hd, &msghash);
 }
 
 
 void
 purge_mfns(void)
 {
-	kill_hash(msghash, MSGHASHSIZE, 0);
+	kill_hash(&msghash, 0);
 }
 
 
@@ -1342,6 +1338,7 @@ do_parse_mesg(int descr, dbref player, dbref what, const char *inbuf, const char
 				DBFETCH(what)->mpi_proftime.tv_sec += 1;
 			}
 			DBFETCH(what)->mpi_prof_use++;
+			cpuacct_charge(OWNER(what), &et, 1);
 		}
 		return(tmp);
 	} else {
@@ -0,0 +1,337 @@
+/*
+ * fbmuck-mufbench: times MUF primitives against a database, with no
+ * network connections, by running MUF code straight through interp_loop().
+ *
+ * Usage: fbmuck-mufbench [-gamedir PATH] [-sizes N,N,...] [-mintime SECS]
+ *                        [-baseline FILE] [-threshold PCT]
+ *                        dbfile benchfile...
+ *
+ * Each benchfile is a MUF program in the same form as the ones in
+ * fbmuf/Tests, and is fed to the server line by line as commands from
+ * God, just as if it had been quoted to a running server.  God is made
+ * a Mucker if need be, to use the editor.  The program text is written to
+ * the game's muf directory as usual, so use a scratch copy of a game
+ * directory.  The database file itself isn't changed.
+ *
+ * Every public word in a bench program is one case.  A case is called as
+ * ( int:size int:count -- ): it makes an input of the given size, then
+ * does its operation on that input count times.  Each case is run first
+ * with a count of 0, to see how long making the input takes, and then
+ * with doubling counts until the operations take at least -mintime
+ * seconds more than that.  Only that extra time is reported.
+ *
+ * Output is one tab-separated line per case and size:
+ *
+ *     name  size  count  ns/op  allocs/op
+ *
+ * where name is the program name, less any "bench-" prefix, then a dot
+ * and the public word's name.  allocs/op is "-" unless the server was
+ * built with MALLOC_PROFILING.  Lines starting with '#' are comments.
+ *
+ * Given -baseline, an earlier run's output, each line also gets that
+ * run's ns/op for the same case and size, and the change in percent.  The
+ * exit status is then 3 if any case is slower by more than -threshold
+ * percent.
+ */
+
+#include "config.h"
+#include "db.h"
+#include "interface.h"
+#include "params.h"
+#include "tune.h"
+#include "inst.h"
+#include "interp.h"
+#include "externs.h"
+
+extern void purge_free_frames(void);
+
+#define MUFBENCH_MAX_SIZES 16
+
+/* Don't run a case more than this many times, however quick it is. */
+#define MUFBENCH_MAX_COUNT (1 << 26)
+
+#define MUFBENCH_PREFIX "bench-"
+
+#define MUFBENCH_NAME_LEN 128
+
+struct baseline {
+	char name[MUFBENCH_NAME_LEN];
+	int size;
+	double nsop;
+	struct baseline *next;
+};
+
+static struct baseline *baselines = NULL;
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-gamedir PATH] [-sizes N,N,...] [-mintime SECS]\n", prog);
+	fprintf(stderr, "          [-baseline FILE] [-threshold PCT] dbfile benchfile...\n");
+	exit(1);
+}
+
+static void
+read_baseline(const char *filename)
+{
+	char line[BUFFER_LEN * 2];
+	struct baseline *b;
+	FILE *f;
+
+	if (!(f = fopen(filename, "rb"))) {
+		perror(filename);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (*line == '#')
+			continue;
+		b = (struct baseline *) malloc(sizeof(struct baseline));
+		if (sscanf(line, "%127s %d %*d %lf", b->name, &b->size, &b->nsop) != 3) {
+			free((void *) b);
+			continue;
+		}
+		b->next = baselines;
+		baselines = b;
+	}
+	fclose(f);
+}
+
+static struct baseline *
+find_baseline(const char *name, int size)
+{
+	struct baseline *b;
+
+	for (b = baselines; b; b = b->next)
+		if (b->size == size && !strcmp(b->name, name))
+			return b;
+	return NULL;
+}
+
+/*
+ * Feeds a bench file to the server as commands from God, and returns the
+ * program it made, or NOTHING.
+ */
+static dbref
+load_bench(const char *filename)
+{
+	char line[BUFFER_LEN];
+	char progname[BUFFER_LEN];
+	char *ptr;
+	FILE *f;
+	dbref i;
+
+	if (!(f = fopen(filename, "rb"))) {
+		perror(filename);
+		return NOTHING;
+	}
+	*progname = '\0';
+	while (fgets(line, sizeof(line), f)) {
+		if ((ptr = index(line, '\n')))
+			*ptr = '\0';
+		if ((ptr = index(line, '\r')))
+			*ptr = '\0';
+		if (!*progname && (!strncmp(line, "@prog ", 6) || !strncmp(line, "@program ", 9)))
+			strcpyn(progname, sizeof(progname), index(line, ' ') + 1);
+		process_command(-1, GOD, line);
+	}
+	fclose(f);
+	replay_slice();
+	if (FLAGS(GOD) & INTERACTIVE) {
+		fprintf(stderr, "fbmuck-mufbench: %s leaves the editor open.\n", filename);
+		return NOTHING;
+	}
+
+	for (i = db_top - 1; i >= 0; i--) {
+		if (Typeof(i) == TYPE_PROGRAM && OWNER(i) == GOD && !string_compare(NAME(i), progname)) {
+			if (!PROGRAM_CODE(i)) {
+				fprintf(stderr, "fbmuck-mufbench: %s didn't compile.\n", filename);
+				return NOTHING;
+			}
+			return i;
+		}
+	}
+	fprintf(stderr, "fbmuck-mufbench: %s didn't make a program.\n", filename);
+	return NOTHING;
+}
+
+/*
+ * Runs one case once.  The case's name is left on the stack under size
+ * and count, so that interp_loop() returns non-NULL if the case finishes
+ * and NULL if it aborts.  Returns 0 if it aborted.
+ */
+static int
+run_case(dbref program, struct publics *pub, int size, int count, double *secs, long *allocs)
+{
+	struct frame *fr;
+	struct timeval start, end;
+	struct inst *rv;
+	long allocs0 = 0;
+
+	strcpyn(match_args, BUFFER_LEN, pub->subname);
+	*match_cmdname = '\0';
+	fr = interp(-1, GOD, DBFETCH(GOD)->location, program, NOTHING, PREEMPT, STD_HARDUID, 0);
+	*match_args = '\0';
+	if (!fr)
+		return 0;
+	fr->pc = pub->addr.ptr;
+	push(fr->argument.st, &fr->argument.top, PROG_INTEGER, MIPSCAST & size);
+	push(fr->argument.st, &fr->argument.top, PROG_INTEGER, MIPSCAST & count);
+
+#ifdef MALLOC_PROFILING
+	allocs0 = CrT_total_allocs();
+#endif
+	gettimeofday(&start, NULL);
+	rv = interp_loop(GOD, program, fr, 0);
+	gettimeofday(&end, NULL);
+#ifdef MALLOC_PROFILING
+	*allocs = CrT_total_allocs() - allocs0;
+#else
+	*allocs = allocs0;
+#endif
+	purge_free_frames();
+
+	*secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+	return rv != NULL;
+}
+
+/*
+ * Times a case at one size, and prints its line.  Returns 1 if it was
+ * slower than the baseline by more than threshold percent.
+ */
+static int
+bench_case(const char *prefix, dbref program, struct publics *pub, int size,
+		   double mintime, double threshold)
+{
+	char name[MUFBENCH_NAME_LEN];
+	struct baseline *b;
+	double secs, basesecs, nsop, change;
+	long allocs, baseallocs;
+	int count, ok;
+
+	snprintf(name, sizeof(name), "%s.%s", prefix, pub->subname);
+	ok = run_case(program, pub, size, 0, &basesecs, &baseallocs);
+	for (count = 1; ok; count *= 2) {
+		ok = run_case(program, pub, size, count, &secs, &allocs);
+		if (ok && (secs - basesecs >= mintime || count >= MUFBENCH_MAX_COUNT))
+			break;
+	}
+	if (!ok) {
+		/* Pass the MUF error on to stderr. */
+		replay_slice();
+		fprintf(stderr, "fbmuck-mufbench: %s aborted at size %d.\n", name, size);
+		return 0;
+	}
+
+	nsop = (secs - basesecs) * 1e9 / count;
+	if (nsop < 0.0)
+		nsop = 0.0;
+	printf("%s\t%d\t%d\t%.1f", name, size, count, nsop);
+#ifdef MALLOC_PROFILING
+	printf("\t%.2f", allocs > baseallocs ? (double) (allocs - baseallocs) / count : 0.0);
+#else
+	printf("\t-");
+#endif
+	if (baselines) {
+		if ((b = find_baseline(name, size)) && b->nsop > 0.0) {
+			change = (nsop - b->nsop) * 100.0 / b->nsop;
+			printf("\t%.1f\t%+.1f%%\n", b->nsop, change);
+			fflush(stdout);
+			return change > threshold;
+		}
+		printf("\t-\t-");
+	}
+	printf("\n");
+	fflush(stdout);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	int sizes[MUFBENCH_MAX_SIZES] = { 10, 100, 1000 };
+	int nsizes = 3;
+	double mintime = 0.1, threshold = 10.0;
+	const char *dbfile = NULL, *basefile = NULL;
+	const char *prefix;
+	struct publics *pub;
+	int regressions = 0;
+	int i, j, first, descr;
+	char *ptr;
+	dbref program;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-gamedir") && i + 1 < argc) {
+			if (chdir(argv[++i])) {
+				perror("cd to gamedir");
+				exit(4);
+			}
+		} else if (!strcmp(argv[i], "-sizes") && i + 1 < argc) {
+			ptr = argv[++i];
+			for (nsizes = 0; *ptr && nsizes < MUFBENCH_MAX_SIZES; nsizes++) {
+				sizes[nsizes] = strtol(ptr, &ptr, 10);
+				if (sizes[nsizes] < 0 || (*ptr && *ptr++ != ','))
+					usage(argv[0]);
+			}
+		} else if (!strcmp(argv[i], "-mintime") && i + 1 < argc) {
+			mintime = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-baseline") && i + 1 < argc) {
+			basefile = argv[++i];
+		} else if (!strcmp(argv[i], "-threshold") && i + 1 < argc) {
+			threshold = atof(argv[++i]);
+		} else if (argv[i][0] == '-') {
+			usage(argv[0]);
+		} else {
+			break;
+		}
+	}
+	if (i + 1 >= argc || !nsizes)
+		usage(argv[0]);
+	dbfile = argv[i++];
+	first = i;
+	if (basefile)
+		read_baseline(basefile);
+
+	replay_init();
+	if (init_game(dbfile, "fbmuck-mufbench.db") < 0) {
+		fprintf(stderr, "Couldn't load %s!\n", dbfile);
+		exit(2);
+	}
+	SRANDOM(1);
+
+	/* God needs a MUCKER bit to use the editor.  The change isn't saved. */
+	if (!Mucker(GOD))
+		SetMLevel(GOD, 3);
+
+	/*
+	 * Log God in on a connection that writes to stderr, so that compile
+	 * errors and MUF errors can be seen.  The welcome screen goes to
+	 * /dev/null first.
+	 */
+	if ((descr = replay_connect()) < 0) {
+		fprintf(stderr, "fbmuck-mufbench: can't open a connection.\n");
+		exit(1);
+	}
+	replay_slice();
+	dup2(fileno(stderr), descr);
+	replay_login(descr, GOD);
+
+	printf("# name\tsize\tcount\tns/op\tallocs/op%s\n",
+		   basefile ? "\tbaseline\tchange" : "");
+	for (i = first; i < argc; i++) {
+		if ((program = load_bench(argv[i])) == NOTHING)
+			exit(1);
+		prefix = NAME(program);
+		if (!strncmp(prefix, MUFBENCH_PREFIX, strlen(MUFBENCH_PREFIX)))
+			prefix += strlen(MUFBENCH_PREFIX);
+		for (pub = PROGRAM_PUBS(program); pub; pub = pub->next)
+			for (j = 0; j < nsizes; j++)
+				regressions += bench_case(prefix, program, pub, sizes[j], mintime, threshold);
+	}
+
+	if (regressions) {
+		printf("# %d case%s slower than the baseline by more than %.1f%%\n",
+			   regressions, regressions == 1 ? "" : "s", threshold);
+		return 3;
+	}
+	return 0;
+}
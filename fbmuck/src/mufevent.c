@@ -20,14 +20,477 @@
 
 struct mufevent_process {
 	struct mufevent_process *prev, *next;
+	struct mufevent_process *ready_prev, *ready_next;
 	dbref player;
 	dbref prog;
 	short filtercount;
 	short deleted;
+	short ready;
 	char** filters;
 	struct frame *fr;
 } *mufevent_processes;
 
+/*
+ * New processes go on the end of mufevent_processes.  The ones that have
+ * an event they can take are also on the ready list, so that
+ * muf_event_process() doesn't have to look at the idle ones.  Processes
+ * marked deleted are freed by muf_event_process(), when there are any.
+ */
+static struct mufevent_process *mufevent_processes_tail = NULL;
+static struct mufevent_process *mufevent_ready = NULL;
+static struct mufevent_process *mufevent_ready_tail = NULL;
+static int mufevent_deleted = 0;
+
+/* The last process registered, so muf_event_process() can tell whether
+ * the program it ran went right back into EVENT_WAIT. */
+static struct mufevent_process *mufevent_registered = NULL;
+
+
+/* static void muf_event_ready(struct mufevent_process *proc)
+ * Puts a process on the end of the ready list, if it isn't already on it.
+ */
+static void
+muf_event_ready(struct mufevent_process *proc)
+{
+	if (proc->ready || proc->deleted)
+		return;
+	proc->ready = 1;
+	proc->ready_next = NULL;
+	proc->ready_prev = mufevent_ready_tail;
+	if (mufevent_ready_tail) {
+		mufevent_ready_tail->ready_next = proc;
+	} else {
+		mufevent_ready = proc;
+	}
+	mufevent_ready_tail = proc;
+}
+
+
+/* static void muf_event_unready(struct mufevent_process *proc)
+ * Takes a process off of the ready list.
+ */
+static void
+muf_event_unready(struct mufevent_process *proc)
+{
+	if (!proc->ready)
+		return;
+	if (proc->ready_next) {
+		proc->ready_next->ready_prev = proc->ready_prev;
+	} else {
+		mufevent_ready_tail = proc->ready_prev;
+	}
+	if (proc->ready_prev) {
+		proc->ready_prev->ready_next = proc->ready_next;
+	} else {
+		mufevent_ready = proc->ready_next;
+	}
+	proc->ready_prev = NULL;
+	proc->ready_next = NULL;
+	proc->ready = 0;
+}
+
+
+/* static void muf_event_process_delete(struct mufevent_process *proc)
+ * Marks a process as no longer waiting.  It gets freed on the next
+ * pass of muf_event_process().
+ */
+static void
+muf_event_process_delete(struct mufevent_process *proc)
+{
+	if (proc->deleted)
+		return;
+	muf_event_unready(proc);
+	if (proc->fr && proc->fr->events && proc->fr->events->waiter == proc)
+		proc->fr->events->waiter = NULL;
+	proc->deleted = 1;
+	mufevent_deleted++;
+}
+
+
+/* static struct mufevent_queue* muf_event_queue(struct frame* fr)
+ * Returns the event queue of the given program instance, making an
+ * empty one if it doesn't have one yet.
+ */
+static struct mufevent_queue *
+muf_event_queue(struct frame *fr)
+{
+	struct mufevent_queue *queue;
+	int i;
+
+	if (fr->events)
+		return fr->events;
+
+	queue = (struct mufevent_queue *) malloc(sizeof(struct mufevent_queue));
+	queue->head = NULL;
+	queue->tail = NULL;
+	queue->count = 0;
+	queue->seq = 0;
+	queue->waiter = NULL;
+	for (i = 0; i < MUFEVENT_HASH_SIZE; i++)
+		queue->names[i] = NULL;
+	fr->events = queue;
+	return queue;
+}
+
+
+/* static struct mufevent_name* muf_event_name(struct mufevent_queue* queue, const char* event)
+ * Finds the list of pending events with the given name, ignoring case.
+ * Returns NULL if there aren't any.
+ */
+static struct mufevent_name *
+muf_event_name(struct mufevent_queue *queue, const char *event)
+{
+	struct mufevent_name *node;
+
+	node = queue->names[hash(event, MUFEVENT_HASH_SIZE)];
+	while (node && string_compare(event, node->head->event))
+		node = node->next;
+	return node;
+}
+
+
+/* static int muf_event_literal(const char* pattern)
+ * Returns true if the given smatch pattern has no wildcards, so that
+ * the only event names it matches are the ones equal to it.
+ */
+static int
+muf_event_literal(const char *pattern)
+{
+	return !strpbrk(pattern, "\\?*[{");
+}
+
+
+/* static int muf_event_wants(struct mufevent_process* proc, const char* event)
+ * Returns true if the given waiting process will take the given event.
+ */
+static int
+muf_event_wants(struct mufevent_process *proc, const char *event)
+{
+	int i;
+
+	if (proc->filtercount == 0)
+		return 1;
+	for (i = 0; i < proc->filtercount; i++)
+		if (equalstr(proc->filters[i], (char *) event))
+			return 1;
+	return 0;
+}
+
+
+/* static void muf_event_free(struct mufevent* ptr)
+ * Frees up a MUF event once you are done with it.  This shouldn't be used
+ * outside this module.
+ */
+static void
+muf_event_free(struct mufevent *ptr)
+{
+	CLEAR(&ptr->data);
+	free(ptr->event);
+	ptr->event = NULL;
+	ptr->next = NULL;
+	free(ptr);
+}
+
+
+/* static void muf_event_unlink(struct mufevent_queue* queue, struct mufevent* ev)
+ * Takes an event out of the queue, without freeing it.  The event is
+ * usually the oldest one of its name, so this is almost always quick.
+ */
+static void
+muf_event_unlink(struct mufevent_queue *queue, struct mufevent *ev)
+{
+	struct mufevent_name *node = ev->name;
+	struct mufevent_name **link;
+	struct mufevent *ptr;
+
+	if (ev->next) {
+		ev->next->prev = ev->prev;
+	} else {
+		queue->tail = ev->prev;
+	}
+	if (ev->prev) {
+		ev->prev->next = ev->next;
+	} else {
+		queue->head = ev->next;
+	}
+	queue->count--;
+
+	if (node->head == ev) {
+		node->head = ev->samenext;
+		ptr = NULL;
+	} else {
+		for (ptr = node->head; ptr->samenext != ev; ptr = ptr->samenext) ;
+		ptr->samenext = ev->samenext;
+	}
+	if (node->tail == ev)
+		node->tail = ptr;
+
+	if (--node->count == 0) {
+		link = &queue->names[hash(ev->event, MUFEVENT_HASH_SIZE)];
+		while (*link != node)
+			link = &(*link)->next;
+		*link = node->next;
+		free(node);
+	}
+
+	ev->next = NULL;
+	ev->prev = NULL;
+	ev->samenext = NULL;
+	ev->name = NULL;
+}
+
+
+/* static struct mufevent* muf_event_find_specific(struct mufevent_queue* queue, int eventcount, char** events)
+ * Returns the oldest event in the queue that matches one of the given
+ * patterns, without removing it.  When none of the patterns have any
+ * wildcards, this only has to look at the oldest event of each name.
+ */
+static struct mufevent *
+muf_event_find_specific(struct mufevent_queue *queue, int eventcount, char **events)
+{
+	struct mufevent_name *node;
+	struct mufevent *ev = NULL;
+	struct mufevent *ptr;
+	int i;
+
+	for (i = 0; i < eventcount; i++)
+		if (!muf_event_literal(events[i]))
+			break;
+
+	if (i == eventcount) {
+		for (i = 0; i < eventcount; i++) {
+			node = muf_event_name(queue, events[i]);
+			if (node && (!ev || node->head->seq < ev->seq))
+				ev = node->head;
+		}
+		return ev;
+	}
+
+	for (ptr = queue->head; ptr; ptr = ptr->next)
+		for (i = 0; i < eventcount; i++)
+			if (equalstr(events[i], ptr->event))
+				return ptr;
+
+	return NULL;
+}
+
+
+/* int muf_event_count(struct frame* fr)
+ * Returns how many events are waiting to be processed.
+ */
+int
+muf_event_count(struct frame* fr)
+{
+	return fr->events ? fr->events->count : 0;
+}
+
+
+/* int muf_event_exists(struct frame* fr, const char* eventid)
+ * Returns how many events of the given event type are waiting to be processed.
+ * The eventid passed can be an smatch string.
+ */
+int
+muf_event_exists(struct frame* fr, const char* eventid)
+{
+	struct mufevent_name *node;
+	struct mufevent *ptr;
+	int count = 0;
+	char pattern[BUFFER_LEN];
+
+	if (!fr->events)
+		return 0;
+
+	if (muf_event_literal(eventid)) {
+		node = muf_event_name(fr->events, eventid);
+		return node ? node->count : 0;
+	}
+
+	strcpyn(pattern, sizeof(pattern), eventid);
+
+	for (ptr = fr->events->head; ptr; ptr = ptr->next)
+		if (equalstr(pattern, ptr->event))
+			count++;
+
+	return count;
+}
+
+
+/* void muf_event_add(struct frame* fr, char* event, struct inst* val, int exclusive)
+ * Adds a MUF event to the event queue for the given program instance.
+ * If the exclusive flag is true, and if an item of the same event type
+ * already exists in the queue, the new one will NOT be added.
+ */
+void
+muf_event_add(struct frame *fr, char *event, struct inst *val, int exclusive)
+{
+	struct mufevent_queue *queue = muf_event_queue(fr);
+	struct mufevent_name *node;
+	struct mufevent *newevent;
+	struct mufevent *ptr;
+	int slot;
+
+	node = muf_event_name(queue, event);
+	if (exclusive && node) {
+		for (ptr = node->head; ptr; ptr = ptr->samenext) {
+			if (!strcmp(event, ptr->event)) {
+				return;
+			}
+		}
+	}
+
+	newevent = (struct mufevent *) malloc(sizeof(struct mufevent));
+	newevent->event = string_dup(event);
+	copyinst(val, &newevent->data);
+	newevent->seq = queue->seq++;
+	newevent->next = NULL;
+	newevent->samenext = NULL;
+
+	newevent->prev = queue->tail;
+	if (queue->tail) {
+		queue->tail->next = newevent;
+	} else {
+		queue->head = newevent;
+	}
+	queue->tail = newevent;
+	queue->count++;
+
+	if (!node) {
+		slot = hash(event, MUFEVENT_HASH_SIZE);
+		node = (struct mufevent_name *) malloc(sizeof(struct mufevent_name));
+		node->head = NULL;
+		node->tail = NULL;
+		node->count = 0;
+		node->next = queue->names[slot];
+		queue->names[slot] = node;
+	}
+	if (node->tail) {
+		node->tail->samenext = newevent;
+	} else {
+		node->head = newevent;
+	}
+	node->tail = newevent;
+	node->count++;
+	newevent->name = node;
+
+	if (queue->waiter && !queue->waiter->ready && muf_event_wants(queue->waiter, event))
+		muf_event_ready(queue->waiter);
+}
+
+
+
+/* struct mufevent* muf_event_pop_specific(struct frame* fr, int eventcount, const char** events)
+ * Removes the first event of one of the specified types from the event queue
+ * of the given program instance.
+ * Returns a pointer to the removed event to the caller.
+ * Returns NULL if no matching events are found.
+ * You will need to call muf_event_free() on the returned data when you
+ * are done with it and wish to free it from memory.
+ */
+struct mufevent*
+muf_event_pop_specific(struct frame *fr, int eventcount, char **events)
+{
+	struct mufevent *ev;
+
+	if (!fr->events)
+		return NULL;
+
+	ev = muf_event_find_specific(fr->events, eventcount, events);
+	if (ev)
+		muf_event_unlink(fr->events, ev);
+	return ev;
+}
+
+
+
+/* void muf_event_remove(struct frame* fr, char* event, int doall)
+ * Removes a given MUF event type from the event queue of the given
+ * program instance.  If which is MUFEVENT_ALL, all instances are removed.
+ * If which is MUFEVENT_FIRST, only the first instance is removed.
+ * If which is MUFEVENT_LAST, only the last instance is removed.
+ */
+void
+muf_event_remove(struct frame *fr, char *event, int which)
+{
+	struct mufevent_name *node;
+	struct mufevent *ptr, *next;
+	struct mufevent *last = NULL;
+
+	if (!fr->events || !(node = muf_event_name(fr->events, event)))
+		return;
+
+	for (ptr = node->head; ptr; ptr = next) {
+		next = ptr->samenext;
+		if (strcmp(event, ptr->event))
+			continue;
+		if (which == MUFEVENT_LAST) {
+			last = ptr;
+		} else {
+			muf_event_unlink(fr->events, ptr);
+			muf_event_free(ptr);
+			if (which == MUFEVENT_FIRST) {
+				return;
+			}
+		}
+	}
+
+	if (last) {
+		muf_event_unlink(fr->events, last);
+		muf_event_free(last);
+	}
+}
+
+
+
+/* static struct mufevent* muf_event_pop(struct frame* fr)
+ * This pops the top muf event off of the given program instance's
+ * event queue, and returns it to the caller.  The caller should
+ * call muf_event_free() on the data when it is done with it.
+ */
+static struct mufevent *
+muf_event_pop(struct frame *fr)
+{
+	struct mufevent *ptr = NULL;
+
+	if (fr->events && fr->events->head) {
+		ptr = fr->events->head;
+		muf_event_unlink(fr->events, ptr);
+	}
+	return ptr;
+}
+
+
+
+/* void muf_event_purge(struct frame* fr)
+ * purges all muf events from the given program instance's event queue,
+ * and frees the queue.
+ */
+void
+muf_event_purge(struct frame *fr)
+{
+	struct mufevent_queue *queue = fr->events;
+	struct mufevent_name *node;
+	struct mufevent *ptr, *next;
+	int i;
+
+	if (!queue)
+		return;
+
+	for (ptr = queue->head; ptr; ptr = next) {
+		next = ptr->next;
+		muf_event_free(ptr);
+	}
+	for (i = 0; i < MUFEVENT_HASH_SIZE; i++) {
+		while ((node = queue->names[i])) {
+			queue->names[i] = node->next;
+			free(node);
+		}
+	}
+	if (queue->waiter)
+		muf_event_unready(queue->waiter);
+	free(queue);
+	fr->events = NULL;
+}
+
 /* static void muf_event_process_free(struct mufevent* ptr)
  * Frees up a mufevent_process once you are done with it.
  * This shouldn't be used outside this module.
@@ -37,8 +500,11 @@ muf_event_process_free(struct mufevent_process *ptr)
 {
 	int i;
 
+	muf_event_unready(ptr);
 	if (ptr->next) {
 		ptr->next->prev = ptr->prev;
+	} else {
+		mufevent_processes_tail = ptr->prev;
 	}
 	if (ptr->prev) {
 		ptr->prev->next = ptr->next;
@@ -82,7 +548,7 @@ void
 muf_event_register_specific(dbref player, dbref prog, struct frame *fr, int eventcount, char** eventids)
 {
 	struct mufevent_process *newproc;
-	struct mufevent_process *ptr;
+	struct mufevent_queue *queue;
 	int i;
 
 
@@ -90,6 +556,9 @@ muf_event_register_specific(dbref player, dbref prog, struct frame *fr, int even
 
 	newproc->prev = NULL;
 	newproc->next = NULL;
+	newproc->ready_prev = NULL;
+	newproc->ready_next = NULL;
+	newproc->ready = 0;
 	newproc->player = player;
 	newproc->prog = prog;
 	newproc->fr = fr;
@@ -104,15 +573,42 @@ muf_event_register_specific(dbref player, dbref prog, struct frame *fr, int even
 		newproc->filters = NULL;
 	}
 
-	ptr = mufevent_processes;
-	while ((ptr != NULL) && ptr->next) {
-		ptr = ptr->next;
-	}
-	if (!ptr) {
-		mufevent_processes = newproc;
+	newproc->prev = mufevent_processes_tail;
+	if (mufevent_processes_tail) {
+		mufevent_processes_tail->next = newproc;
 	} else {
-		ptr->next = newproc;
-		newproc->prev = ptr;
+		mufevent_processes = newproc;
+	}
+	mufevent_processes_tail = newproc;
+
+	queue = muf_event_queue(fr);
+	queue->waiter = newproc;
+	mufevent_registered = newproc;
+
+	if (fr->been_background) {
+		for (i = 0; i < eventcount; i++) {
+			if (!strcasecmp(eventids[i], "READ")) {
+				/* It's a backgrounded process, waiting for a READ...
+				 * should we throw an error?  Should we push a
+				 * null event onto the list?  At this point, I'm
+				 * pushing a READ event with descr = -1, so that
+				 * it will at least get out of its loop. -winged
+				 */
+				struct inst temp;
+
+				temp.type = PROG_INTEGER;
+				temp.data.number = -1;
+				muf_event_add(fr, "READ", &temp, 0);
+				break;
+			}
+		}
+	}
+
+	if (eventcount > 0) {
+		if (muf_event_find_specific(queue, newproc->filtercount, newproc->filters))
+			muf_event_ready(newproc);
+	} else if (queue->head) {
+		muf_event_ready(newproc);
 	}
 }
 
@@ -176,7 +672,7 @@ muf_event_dequeue_pid(int pid)
 				if (!proc->fr->been_background)
 					PLAYER_SET_BLOCK(proc->player, 0);
 				muf_event_purge(proc->fr);
-				proc->deleted = 1;
+				muf_event_process_delete(proc);
 				count++;
 			}
 		}
@@ -261,7 +757,7 @@ muf_event_dequeue(dbref prog, int killmode)
 			muf_event_purge(proc->fr);
 			prog_clean(proc->fr);
 		}
-		proc->deleted = 1;
+		muf_event_process_delete(proc);
 		count++;
 	}
 	return count;
@@ -522,338 +1018,113 @@ get_mufevent_pidinfo(stk_array* nw, int pid)
 }
 
 
-/* int muf_event_count(struct frame* fr)
- * Returns how many events are waiting to be processed.
- */
-int
-muf_event_count(struct frame* fr)
-{
-	struct mufevent *ptr;
-	int count = 0;
-
-	for (ptr = fr->events; ptr; ptr = ptr->next)
-		count++;
-
-	return count;
-}
-
-
-/* int muf_event_exists(struct frame* fr, const char* eventid)
- * Returns how many events of the given event type are waiting to be processed.
- * The eventid passed can be an smatch string.
- */
-int
-muf_event_exists(struct frame* fr, const char* eventid)
-{
-	struct mufevent *ptr;
-	int count = 0;
-	char pattern[BUFFER_LEN];
-	
-	strcpyn(pattern, sizeof(pattern), eventid);
-
-	for (ptr = fr->events; ptr; ptr = ptr->next)
-		if (equalstr(pattern, ptr->event))
-			count++;
-
-	return count;
-}
-
-
-/* static void muf_event_free(struct mufevent* ptr)
- * Frees up a MUF event once you are done with it.  This shouldn't be used
- * outside this module.
+/* static void muf_event_sweep()
+ * Frees the processes that have been marked deleted.
  */
 static void
-muf_event_free(struct mufevent *ptr)
+muf_event_sweep(void)
 {
-	CLEAR(&ptr->data);
-	free(ptr->event);
-	ptr->event = NULL;
-	ptr->next = NULL;
-	free(ptr);
-}
-
-
-/* void muf_event_add(struct frame* fr, char* event, struct inst* val, int exclusive)
- * Adds a MUF event to the event queue for the given program instance.
- * If the exclusive flag is true, and if an item of the same event type
- * already exists in the queue, the new one will NOT be added.
- */
-void
-muf_event_add(struct frame *fr, char *event, struct inst *val, int exclusive)
-{
-	struct mufevent *newevent;
-	struct mufevent *ptr;
-
-	ptr = fr->events;
-	while (ptr && ptr->next) {
-		if (exclusive && !strcmp(event, ptr->event)) {
-			return;
-		}
-		ptr = ptr->next;
-	}
+	struct mufevent_process *proc, *next;
 
-	if (exclusive && ptr && !strcmp(event, ptr->event)) {
+	if (!mufevent_deleted)
 		return;
-	}
-
-	newevent = (struct mufevent *) malloc(sizeof(struct mufevent));
-	newevent->event = string_dup(event);
-	copyinst(val, &newevent->data);
-	newevent->next = NULL;
-
-	if (!ptr) {
-		fr->events = newevent;
-	} else {
-		ptr->next = newevent;
-	}
-}
-
-
-
-/* struct mufevent* muf_event_pop_specific(struct frame* fr, int eventcount, const char** events)
- * Removes the first event of one of the specified types from the event queue
- * of the given program instance.
- * Returns a pointer to the removed event to the caller.
- * Returns NULL if no matching events are found.
- * You will need to call muf_event_free() on the returned data when you
- * are done with it and wish to free it from memory.
- */
-struct mufevent*
-muf_event_pop_specific(struct frame *fr, int eventcount, char **events)
-{
-	struct mufevent *tmp = NULL;
-	struct mufevent *ptr = NULL;
-	int i;
-
-	for (i = 0; i < eventcount; i++) {
-		if (fr->events && equalstr(events[i], fr->events->event)) {
-			tmp = fr->events;
-			fr->events = tmp->next;
-			return tmp;
-		}
-	}
-
-	ptr = fr->events;
-	while (ptr && ptr->next) {
-		for (i = 0; i < eventcount; i++) {
-			if (equalstr(events[i], ptr->next->event)) {
-				tmp = ptr->next;
-				ptr->next = tmp->next;
-				return tmp;
-			}
-		}
-		ptr = ptr->next;
-	}
-
-	return NULL;
-}
 
-
-
-/* void muf_event_remove(struct frame* fr, char* event, int doall)
- * Removes a given MUF event type from the event queue of the given
- * program instance.  If which is MUFEVENT_ALL, all instances are removed.
- * If which is MUFEVENT_FIRST, only the first instance is removed.
- * If which is MUFEVENT_LAST, only the last instance is removed.
- */
-void
-muf_event_remove(struct frame *fr, char *event, int which)
-{
-	struct mufevent *tmp = NULL;
-	struct mufevent *ptr = NULL;
-
-	while (fr->events && !strcmp(event, fr->events->event)) {
-		if (which == MUFEVENT_LAST) {
-			tmp = fr->events;
-			break;
-		} else {
-			tmp = fr->events;
-			fr->events = tmp->next;
-			muf_event_free(tmp);
-			if (which == MUFEVENT_FIRST) {
-				return;
-			}
-		}
-	}
-
-	ptr = fr->events;
-	while (ptr && ptr->next) {
-		if (!strcmp(event, ptr->next->event)) {
-			if (which == MUFEVENT_LAST) {
-				tmp = ptr;
-				ptr = ptr->next;
-			} else {
-				tmp = ptr->next;
-				ptr->next = tmp->next;
-				muf_event_free(tmp);
-				if (which == MUFEVENT_FIRST) {
-					return;
-				}
-			}
-		} else {
-			ptr = ptr->next;
+	proc = mufevent_processes;
+	while (proc != NULL) {
+		next = proc->next;
+		if (proc->deleted) {
+			muf_event_process_free(proc);
 		}
+		proc = next;
 	}
-}
-
-
-
-/* static struct mufevent* muf_event_peek(struct frame* fr)
- * This returns a pointer to the top muf event of the given
- * program instance's event queue.  The event is not removed
- * from the queue.
- */
-/*
- * Commented out by Winged for non-reference.  If you need it, de-comment.
- *
-static struct mufevent *
-muf_event_peek(struct frame *fr)
-{
-	return fr->events;
-}
- */
-
-
-/* static struct mufevent* muf_event_pop(struct frame* fr)
- * This pops the top muf event off of the given program instance's
- * event queue, and returns it to the caller.  The caller should
- * call muf_event_free() on the data when it is done with it.
- */
-static struct mufevent *
-muf_event_pop(struct frame *fr)
-{
-	struct mufevent *ptr = NULL;
-
-	if (fr->events) {
-		ptr = fr->events;
-		fr->events = fr->events->next;
-	}
-	return ptr;
-}
-
-
-
-/* void muf_event_purge(struct frame* fr)
- * purges all muf events from the given program instance's event queue.
- */
-void
-muf_event_purge(struct frame *fr)
-{
-	while (fr->events) {
-		muf_event_free(muf_event_pop(fr));
-	}
+	mufevent_deleted = 0;
 }
 
 
 
 /* void muf_event_process()
- * For all program instances who are in the EVENT_WAIT queue,
- * check to see if they have any items in their event queue.
- * If so, then process one each.  Up to ten programs can have
- * events processed at a time.
+ * For the program instances in the EVENT_WAIT queue that have an event
+ * they are waiting for, hand them their events.  Up to ten programs get
+ * woken at a time, and each one gets up to MUFEVENT_BATCH events, one
+ * after the other, if it goes straight back into an EVENT_WAIT that
+ * takes the next one.
  *
- * This also needs to make sure that background processes aren't
- * waiting for READ events.
+ * Only the processes on the ready list are looked at.  A process goes
+ * on it when it registers with a matching event already queued, or when
+ * a matching event arrives.
  */
 void
 muf_event_process(void)
 {
 	int limit = 10;
-	struct mufevent_process *proc, *next;
+	int batch;
+	struct mufevent_process *proc;
 	struct mufevent *ev;
-	dbref current_program;
-	int block, is_fg;
-
-	proc = mufevent_processes;
-	while (proc != NULL) {
-		next = proc->next;
-		if (proc->deleted) {
-			muf_event_process_free(proc);
-		}
-		proc = next;
-	}
-
-	proc = mufevent_processes;
-	while (proc != NULL && limit > 0) {
-		if (!proc->deleted && proc->fr) {
+	struct frame *fr;
+	dbref current_program, player, prog;
+	int block, is_fg, pid;
+
+	muf_event_sweep();
+
+	while (mufevent_ready != NULL && limit > 0) {
+		proc = mufevent_ready;
+		--limit;
+		for (batch = 0; batch < MUFEVENT_BATCH; batch++) {
+			fr = proc->fr;
+			pid = fr->pid;
+			player = proc->player;
+			prog = proc->prog;
+			muf_event_unready(proc);
 			if (proc->filtercount > 0) {
-				/* Make sure it's not waiting for a READ event, if it's
-				 * backgrounded */
-
-				if (proc->fr->been_background) {
-					int cnt = 0;
-					for(cnt = 0; cnt < proc->filtercount; cnt++) {
-						if(0==strcasecmp(proc->filters[cnt],"READ")) {
-					/* It's a backgrounded process, waiting for a READ...
-					 * should we throw an error?  Should we push a
-					 * null event onto the list?  At this point, I'm
-					 * pushing a READ event with descr = -1, so that
-					 * it will at least get out of its loop. -winged
-					 */
-							struct inst temp;
-							temp.type = PROG_INTEGER;
-							temp.data.number = -1;
-							muf_event_add(proc->fr,"READ",&temp,0);
-							CLEAR(&temp);
-							break;
-						}
-					}
-				}
+				ev = muf_event_pop_specific(fr, proc->filtercount, proc->filters);
+			} else {
+				/* Pop first event off of prog's event queue. */
+				ev = muf_event_pop(fr);
+			}
+			if (!ev)
+				break;
+
+			/* Events sent while it runs are for whatever it waits for next. */
+			fr->events->waiter = NULL;
 
-					
-				/* Search prog's event list for the apropriate event type. */
+			proc->fr = NULL;  /* We do NOT want to free this program after every EVENT_WAIT. */
+			muf_event_process_delete(proc);
+			mufevent_registered = NULL;
 
-				/* HACK:  This is probably inefficient to be walking this
-				 * queue over and over. Hopefully it's usually a short list.
-				 *
-				 * Would it be more efficient to use a hash table?  It'd
-				 * be more wasteful of memory, I think. -winged
+			if (argstack_reserve(fr, fr->argument.top + 2) < 0) {
+				/* Uh oh! That MUF program's stack is full!
+				 * Print an error, free the frame, and exit.
 				 */
-				ev = muf_event_pop_specific(proc->fr, proc->filtercount, proc->filters);
+				notify_nolisten(player, "Program stack overflow.", 1);
+				prog_clean(fr);
 			} else {
-				/* Pop first event off of prog's event queue. */
-				ev = muf_event_pop(proc->fr);
-			}
-			if (ev) {
-				--limit;
-				if (proc->fr->argument.top + 1 >= STACK_SIZE) {
-					/* Uh oh! That MUF program's stack is full!
-					 * Print an error, free the frame, and exit.
-					 */
-					notify_nolisten(proc->player, "Program stack overflow.", 1);
-					prog_clean(proc->fr);
-				} else {
-					current_program = PLAYER_CURR_PROG(proc->player);
-					block = PLAYER_BLOCK(proc->player);
-					is_fg = (proc->fr->multitask != BACKGROUND);
+				current_program = PLAYER_CURR_PROG(player);
+				block = PLAYER_BLOCK(player);
+				is_fg = (fr->multitask != BACKGROUND);
 
-					copyinst(&ev->data, &(proc->fr->argument.st[proc->fr->argument.top]));
-					proc->fr->argument.top++;
-					push(proc->fr->argument.st, &(proc->fr->argument.top),
-							PROG_STRING, MIPSCAST alloc_prog_string(ev->event));
+				copyinst(&ev->data, &(fr->argument.st[fr->argument.top]));
+				fr->argument.top++;
+				push(fr->argument.st, &(fr->argument.top),
+						PROG_STRING, MIPSCAST alloc_prog_string(ev->event));
 
-					interp_loop(proc->player, proc->prog, proc->fr, 0);
+				interp_loop(player, prog, fr, 0);
 
-					if (!is_fg) {
-						PLAYER_SET_BLOCK(proc->player, block);
-						PLAYER_SET_CURR_PROG(proc->player, current_program);
-					}
+				if (!is_fg) {
+					PLAYER_SET_BLOCK(player, block);
+					PLAYER_SET_CURR_PROG(player, current_program);
 				}
-				muf_event_free(ev);
-
-				proc->fr = NULL;  /* We do NOT want to free this program after every EVENT_WAIT. */
-				proc->deleted = 1;
 			}
+			muf_event_free(ev);
+
+			/* The frame is gone if the program finished or was cleaned
+			 * up, so don't look at it again.  If it went right back into
+			 * EVENT_WAIT, and already has something to take, keep going
+			 * with the process it registered. */
+			proc = mufevent_registered;
+			if (!proc || proc->deleted || !proc->ready || proc->fr->pid != pid)
+				break;
 		}
-		proc = proc->next;
-	}
-	proc = mufevent_processes;
-	while (proc != NULL) {
-		next = proc->next;
-		if (proc->deleted) {
-			muf_event_process_free(proc);
-		}
-		proc = next;
 	}
+
+	muf_event_sweep();
 }
@@ -0,0 +1,379 @@
+/* Sampling profiler for MUF programs */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <time.h>
+#include <ctype.h>
+#include "db.h"
+#include "tune.h"
+#include "inst.h"
+#include "externs.h"
+#include "interface.h"
+#include "params.h"
+#include "fbstrings.h"
+#include "interp.h"
+
+#ifdef MUF_PROFILER
+
+#include <signal.h>
+#include <sys/time.h>
+
+/*
+ * The profiler runs off of a SIGPROF interval timer, which only ticks
+ * while the server is using CPU.  The signal handler does nothing but
+ * count the tick and raise muf_prof_pending.  interp_loop() checks that
+ * flag after each primitive, and when it is set, calls
+ * muf_profile_sample() to charge all the ticks seen since the last
+ * sample to the primitive that just ran, its line, and the chain of
+ * functions on the system stack that led to it.  Ticks that land while
+ * no MUF is running get discarded when the interpreter is next entered.
+ *
+ * Two tables are kept.  The flat table is keyed on (program, line,
+ * primitive), and backs @mufprofile top.  The stack table is keyed on
+ * the folded call stack, in the "frame;frame;frame" format that the
+ * flamegraph tools read, and gets written out by @mufprofile dump.
+ */
+
+#define MUF_PROFILE_HASH_SIZE 1024	/* Initial slots in each sample table */
+#define MUF_PROFILE_MAX_KEYS 20000	/* Distinct entries kept per table */
+#define MUF_PROFILE_MAX_DEPTH 32	/* Innermost call frames folded */
+
+volatile sig_atomic_t muf_prof_pending = 0;
+static volatile sig_atomic_t muf_prof_ticks = 0;
+static sig_atomic_t muf_prof_seen = 0;
+
+static int muf_prof_hz = 0;
+static time_t muf_prof_started = 0;
+static long muf_prof_samples = 0;
+static long muf_prof_dropped = 0;
+static long muf_prof_discarded = 0;
+
+static hash_tab muf_prof_flat;
+static hash_tab muf_prof_stacks;
+static int muf_prof_flat_keys = 0;
+static int muf_prof_stack_keys = 0;
+
+
+static void
+muf_profile_tick(int sig)
+{
+	muf_prof_ticks++;
+	muf_prof_pending = 1;
+}
+
+
+static int
+muf_profile_timer(int hz)
+{
+	struct itimerval itv;
+
+	itv.it_interval.tv_sec = 0;
+	itv.it_interval.tv_usec = hz ? (1000000 / hz) : 0;
+	itv.it_value = itv.it_interval;
+	if (hz)
+		our_signal(SIGPROF, muf_profile_tick);
+	if (setitimer(ITIMER_PROF, &itv, NULL) < 0)
+		return -1;
+	if (!hz)
+		our_signal(SIGPROF, SIG_IGN);
+	return 0;
+}
+
+
+/*
+ * Adds weight to the count for key, unless the table is full and the
+ * key is a new one.  Returns 0 if the sample was dropped.
+ */
+static int
+muf_profile_count(hash_tab * table, int *keys, const char *key, int weight)
+{
+	hash_data *hd;
+	hash_data nd;
+
+	/* Keys hold program names, so compare them exactly. */
+	if (!table->minsize)
+		hash_init(table, MUF_PROFILE_HASH_SIZE, HASH_EXACT);
+	hd = find_hash(key, table);
+	if (hd) {
+		hd->ival += weight;
+		return 1;
+	}
+	if (*keys >= MUF_PROFILE_MAX_KEYS)
+		return 0;
+	nd.ival = weight;
+	add_hash(key, nd, table);
+	(*keys)++;
+	return 1;
+}
+
+
+/*
+ * Appends "name(#123):funcname" for the function holding pc to buf.
+ * Semicolons would split the frame when read back, so they get
+ * replaced.
+ */
+static int
+muf_profile_frame(char *buf, int buflen, dbref prog, struct inst *pc)
+{
+	struct inst *code = PROGRAM_CODE(prog);
+	const char *fname = "???";
+	char *p;
+	int len;
+
+	if (code) {
+		for (; pc > code && pc->type != PROG_FUNCTION; pc--) ;
+		if (pc->type == PROG_FUNCTION)
+			fname = pc->data.mufproc->procname;
+	}
+	len = snprintf(buf, buflen, "%.60s(#%d):%.60s", NAME(prog), prog, fname);
+	if (len < 0 || len >= buflen)
+		return -1;
+	for (p = buf; *p; p++) {
+		if (*p == ';')
+			*p = ':';
+	}
+	return len;
+}
+
+
+void
+muf_profile_discard(void)
+{
+	muf_prof_pending = 0;
+	if (muf_prof_ticks != muf_prof_seen) {
+		muf_prof_discarded += muf_prof_ticks - muf_prof_seen;
+		muf_prof_seen = muf_prof_ticks;
+	}
+}
+
+
+void
+muf_profile_sample(dbref program, struct frame *fr, struct inst *pc, int stop)
+{
+	char key[BUFFER_LEN];
+	char *ptr = key;
+	char *end = key + sizeof(key);
+	int weight, len, j;
+
+	muf_prof_pending = 0;
+	weight = muf_prof_ticks - muf_prof_seen;
+	muf_prof_seen += weight;
+	if (weight <= 0 || !muf_prof_hz)
+		return;
+	muf_prof_samples += weight;
+
+	snprintf(key, sizeof(key), "%d %d %d", program, pc->line, pc->data.number);
+	if (!muf_profile_count(&muf_prof_flat, &muf_prof_flat_keys, key, weight))
+		muf_prof_dropped += weight;
+
+	/*
+	 * System stack entries 1 through stop-1 hold the return addresses
+	 * of the callers, outermost first.  The running function is the
+	 * one holding pc.
+	 */
+	j = 1;
+	if (stop - j > MUF_PROFILE_MAX_DEPTH) {
+		j = stop - MUF_PROFILE_MAX_DEPTH;
+		ptr += snprintf(ptr, end - ptr, "...;");
+	}
+	for (; j < stop; j++) {
+		len = muf_profile_frame(ptr, end - ptr, fr->system.st[j].progref,
+								fr->system.st[j].offset - 1);
+		if (len < 0 || (ptr += len) >= end - 1) {
+			muf_prof_dropped += weight;
+			return;
+		}
+		*ptr++ = ';';
+	}
+	len = muf_profile_frame(ptr, end - ptr, program, pc);
+	if (len < 0 || (ptr += len) >= end - 1) {
+		muf_prof_dropped += weight;
+		return;
+	}
+	snprintf(ptr, end - ptr, ";%s", base_inst[pc->data.number - BASE_MIN]);
+	if (!muf_profile_count(&muf_prof_stacks, &muf_prof_stack_keys, key, weight))
+		muf_prof_dropped += weight;
+}
+
+
+static void
+muf_profile_reset(void)
+{
+	kill_hash(&muf_prof_flat, 0);
+	kill_hash(&muf_prof_stacks, 0);
+	muf_prof_flat_keys = 0;
+	muf_prof_stack_keys = 0;
+	muf_prof_samples = 0;
+	muf_prof_dropped = 0;
+	muf_prof_discarded = 0;
+	muf_prof_started = time(NULL);
+}
+
+
+/*
+ * Writes the folded stacks out to MUF_PROFILE_FILE, one per line,
+ * followed by the tick count.  Returns the number of lines written,
+ * or -1 if the file couldn't be opened.
+ */
+static int
+muf_profile_dump(void)
+{
+	FILE *f;
+	hash_entry *hp;
+	int count = 0;
+
+	if ((f = fopen(MUF_PROFILE_FILE, "wb")) == NULL)
+		return -1;
+	for (hp = next_hash(&muf_prof_stacks, NULL); hp; hp = next_hash(&muf_prof_stacks, hp)) {
+		fprintf(f, "%s %d\n", hp->name, hp->dat.ival);
+		count++;
+	}
+	fclose(f);
+	return count;
+}
+
+
+/*
+ * Carries out a profiler control command, which is one of "on [hz]",
+ * "off", "reset", "dump" or "status", and leaves a message for the
+ * user in buf.  Returns -1 if the command wasn't understood.
+ */
+int
+muf_profile_command(const char *arg, char *buf, int buflen)
+{
+	int hz, count;
+
+	while (isspace(*arg))
+		arg++;
+	if (string_prefix(arg, "on") && (!arg[2] || isspace(arg[2]))) {
+		hz = atoi(arg + 2);
+		if (hz <= 0)
+			hz = MUF_PROFILE_HZ;
+		if (hz > 1000)
+			hz = 1000;
+		if (!muf_prof_hz && !muf_prof_samples)
+			muf_prof_started = time(NULL);
+		if (muf_profile_timer(hz) < 0) {
+			snprintf(buf, buflen, "Could not start the profiling timer.");
+			return -1;
+		}
+		muf_prof_hz = hz;
+		snprintf(buf, buflen, "MUF profiler sampling at %d Hz.", hz);
+	} else if (!string_compare(arg, "off")) {
+		muf_profile_timer(0);
+		muf_prof_hz = 0;
+		snprintf(buf, buflen, "MUF profiler stopped.");
+	} else if (!string_compare(arg, "reset")) {
+		muf_profile_reset();
+		snprintf(buf, buflen, "MUF profile cleared.");
+	} else if (!string_compare(arg, "dump")) {
+		count = muf_profile_dump();
+		if (count < 0) {
+			snprintf(buf, buflen, "Could not write %s.", MUF_PROFILE_FILE);
+			return -1;
+		}
+		snprintf(buf, buflen, "Wrote %d stacks to %s.", count, MUF_PROFILE_FILE);
+	} else if (!*arg || !string_compare(arg, "status")) {
+		if (muf_prof_hz)
+			snprintf(buf, buflen, "MUF profiler is on at %d Hz.", muf_prof_hz);
+		else
+			snprintf(buf, buflen, "MUF profiler is off.");
+		count = strlen(buf);
+		snprintf(buf + count, buflen - count,
+				 "  %ld samples, %ld dropped, %ld outside MUF, %d stacks over %ld secs.",
+				 muf_prof_samples, muf_prof_dropped, muf_prof_discarded,
+				 muf_prof_stack_keys,
+				 (long) (muf_prof_started ? time(NULL) - muf_prof_started : 0));
+	} else {
+		snprintf(buf, buflen, "Unknown profiler command.  Use on [hz], off, reset, dump or status.");
+		return -1;
+	}
+	return 0;
+}
+
+
+struct muf_profile_line {
+	dbref prog;
+	int line;
+	int inst;
+	int count;
+};
+
+static int
+muf_profile_line_cmp(const void *a, const void *b)
+{
+	return ((const struct muf_profile_line *) b)->count -
+			((const struct muf_profile_line *) a)->count;
+}
+
+
+static void
+muf_profile_top(dbref player, int count)
+{
+	struct muf_profile_line *lines;
+	hash_entry *hp;
+	char buf[BUFFER_LEN];
+	int i, n = 0;
+
+	if (count <= 0)
+		count = 20;
+	lines = (struct muf_profile_line *) malloc(sizeof(*lines) * (muf_prof_flat_keys + 1));
+	for (hp = next_hash(&muf_prof_flat, NULL); hp && n < muf_prof_flat_keys;
+			hp = next_hash(&muf_prof_flat, hp)) {
+		if (sscanf(hp->name, "%d %d %d", &lines[n].prog, &lines[n].line, &lines[n].inst) == 3) {
+			lines[n].count = hp->dat.ival;
+			n++;
+		}
+	}
+	qsort(lines, n, sizeof(*lines), muf_profile_line_cmp);
+
+	notify(player, " Samples      %  Line  Primitive        Program");
+	for (i = 0; i < n && i < count; i++) {
+		snprintf(buf, sizeof(buf), "%8d %6.2f %5d  %-16s %s", lines[i].count,
+				 muf_prof_samples ? 100.0 * lines[i].count / muf_prof_samples : 0.0,
+				 lines[i].line, base_inst[lines[i].inst - BASE_MIN],
+				 (lines[i].prog >= 0 && lines[i].prog < db_top) ?
+						unparse_object(player, lines[i].prog) : "*RECYCLED*");
+		notify(player, buf);
+	}
+	free(lines);
+}
+
+
+void
+do_mufprofile(dbref player, const char *arg)
+{
+	char buf[BUFFER_LEN];
+
+	if (!Wizard(OWNER(player))) {
+		notify(player, "Permission denied. (MUF profiling is wiz-only)");
+		return;
+	}
+	if (string_prefix(arg, "top") && (!arg[3] || isspace(arg[3]))) {
+		muf_profile_top(player, atoi(arg + 3));
+		notify(player, "*Done*");
+		return;
+	}
+	muf_profile_command(arg, buf, sizeof(buf));
+	notify(player, buf);
+}
+
+#else							/* MUF_PROFILER */
+
+int
+muf_profile_command(const char *arg, char *buf, int buflen)
+{
+	snprintf(buf, buflen, "This server was compiled without MUF_PROFILER.");
+	return -1;
+}
+
+
+void
+do_mufprofile(dbref player, const char *arg)
+{
+	notify(player, "This server was compiled without MUF_PROFILER.");
+}
+
+#endif							/* MUF_PROFILER */
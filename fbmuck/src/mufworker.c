@@ -0,0 +1,410 @@
+/*
+ * Worker threads for slow MUF primitives.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "db.h"
+#include "inst.h"
+#include "interface.h"
+#include "externs.h"
+
+#ifdef MUF_WORKERS
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+
+/*
+ * A primitive that can be slow, but only works on the values it was
+ * given, can have the work done by one of MUF_WORKER_THREADS threads
+ * instead of in the main loop.  It checks muf_worker_can_offload(), makes
+ * copies of whatever the work needs, and calls muf_worker_hold() with a
+ * function to do the work.  It then returns leaving its arguments where
+ * they were on the stack, and the interpreter puts the process to sleep
+ * on that same instruction, with a WORKER entry in the timequeue.
+ *
+ * Finished jobs go on a completion queue, and a byte is written to a
+ * pipe so that the main loop's select() wakes up for them.  The process's
+ * timequeue entry is then made due, and when it runs, the primitive is
+ * run again.  This time muf_worker_answer() hands it the finished job,
+ * and it builds its result from that exactly as if it had done the work
+ * itself.  Errors come out of the primitive the same way, so CATCH and
+ * the error messages work as they always have.
+ *
+ * Only processes that would be time-sliced anyway, FOREGROUND and
+ * BACKGROUND ones, are handed off.  A PREEMPT program always does the
+ * work itself, since nothing else may run in the middle of it.  If a
+ * process is killed, muf_worker_forget() throws away its jobs, except
+ * one that a worker is already running, which is thrown away when it
+ * finishes.
+ */
+
+struct muf_job {
+	struct muf_job *next;
+	int pid;
+	void (*run) (void *data);
+	void (*release) (void *data);
+	void *data;
+};
+
+struct muf_job_queue {
+	struct muf_job *head;
+	struct muf_job *tail;
+	int count;
+};
+
+static struct muf_job_queue job_queue;
+static struct muf_job_queue done_queue;
+static pthread_mutex_t worker_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t worker_wakeup = PTHREAD_COND_INITIALIZER;
+
+/* Jobs whose process has been woken, waiting to be picked up.  Only
+ * the main thread touches these. */
+static struct muf_job *answers = NULL;
+static struct muf_job *held = NULL;
+static int jobs_out = 0;		/* Jobs on job_queue, done_queue, or running */
+
+static int worker_pipe[2] = { -1, -1 };
+static int worker_active = 0;
+static int worker_shutdown = 0;
+
+int muf_worker_job_held = 0;
+
+
+static void
+muf_job_enqueue(struct muf_job_queue *q, struct muf_job *job)
+{
+	job->next = NULL;
+	if (q->tail) {
+		q->tail->next = job;
+	} else {
+		q->head = job;
+	}
+	q->tail = job;
+	q->count++;
+}
+
+
+static struct muf_job *
+muf_job_dequeue(struct muf_job_queue *q)
+{
+	struct muf_job *job = q->head;
+
+	if (job) {
+		q->head = job->next;
+		if (!q->head)
+			q->tail = NULL;
+		q->count--;
+		job->next = NULL;
+	}
+	return job;
+}
+
+
+/* Moves the jobs for pid from q onto the list *dropped. */
+static void
+muf_job_unlink(struct muf_job_queue *q, int pid, struct muf_job **dropped)
+{
+	struct muf_job *job, *prev = NULL, *next;
+
+	for (job = q->head; job; job = next) {
+		next = job->next;
+		if (job->pid != pid) {
+			prev = job;
+			continue;
+		}
+		if (prev) {
+			prev->next = next;
+		} else {
+			q->head = next;
+		}
+		if (q->tail == job)
+			q->tail = prev;
+		q->count--;
+		job->next = *dropped;
+		*dropped = job;
+	}
+}
+
+
+/* Has to be done in the main thread, since it CLEARs MUF values. */
+static void
+muf_job_free(struct muf_job *job)
+{
+	job->release(job->data);
+	free(job);
+}
+
+
+static void *
+muf_worker_thread(void *arg)
+{
+	struct muf_job *job;
+	char c = 0;
+
+	pthread_mutex_lock(&worker_mutex);
+	for (;;) {
+		while (!job_queue.head && !worker_shutdown)
+			pthread_cond_wait(&worker_wakeup, &worker_mutex);
+		if (worker_shutdown)
+			break;
+		job = muf_job_dequeue(&job_queue);
+		pthread_mutex_unlock(&worker_mutex);
+
+		job->run(job->data);
+
+		pthread_mutex_lock(&worker_mutex);
+		muf_job_enqueue(&done_queue, job);
+		write(worker_pipe[1], &c, 1);
+	}
+	pthread_mutex_unlock(&worker_mutex);
+	return NULL;
+}
+
+
+void
+start_muf_workers(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	sigset_t mask, oldmask;
+	int i, started = 0;
+
+	if (worker_active)
+		return;
+
+	if (pipe(worker_pipe) < 0) {
+		log_status("Unable to start MUF workers: %s", strerror(errno));
+		return;
+	}
+	make_nonblocking(worker_pipe[0]);
+	make_nonblocking(worker_pipe[1]);
+#ifdef F_SETFD
+	fcntl(worker_pipe[0], F_SETFD, 1);
+	fcntl(worker_pipe[1], F_SETFD, 1);
+#endif
+
+	/* Signals should always be handled by the main thread. */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &oldmask);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	worker_shutdown = 0;
+	for (i = 0; i < MUF_WORKER_THREADS; i++)
+		if (!pthread_create(&thread, &attr, muf_worker_thread, NULL))
+			started++;
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+
+	if (started < MUF_WORKER_THREADS)
+		log_status("MUF workers: only started %d of %d threads.", started, MUF_WORKER_THREADS);
+	worker_active = (started > 0);
+}
+
+
+/*
+ * Any jobs still running are left to finish on their own.  Their
+ * processes are freed with the rest of the timequeue, and the jobs keep
+ * their own references to what they're working on.
+ */
+void
+stop_muf_workers(void)
+{
+	if (!worker_active)
+		return;
+	pthread_mutex_lock(&worker_mutex);
+	worker_shutdown = 1;
+	pthread_cond_broadcast(&worker_wakeup);
+	pthread_mutex_unlock(&worker_mutex);
+	worker_active = 0;
+}
+
+
+/* The descriptor the main loop should watch for finished jobs, or -1. */
+int
+muf_worker_wakeup_fd(void)
+{
+	return worker_active ? worker_pipe[0] : -1;
+}
+
+
+/* Whether a primitive running in fr may hand its work to a worker. */
+int
+muf_worker_can_offload(struct frame *fr, dbref program)
+{
+	return worker_active && !held && fr->multitask != PREEMPT &&
+			!(FLAGS(program) & BUILDER);
+}
+
+
+/*
+ * Called by a primitive, just before it returns with its arguments left
+ * on the stack, to have run(data) done by a worker.  release(data) is
+ * called in the main thread once the job's been picked up or dropped.
+ */
+void
+muf_worker_hold(struct frame *fr, void (*run) (void *), void (*release) (void *),
+				void *data)
+{
+	struct muf_job *job = (struct muf_job *) malloc(sizeof(struct muf_job));
+
+	job->next = NULL;
+	job->pid = fr->pid;
+	job->run = run;
+	job->release = release;
+	job->data = data;
+	held = job;
+	muf_worker_job_held = 1;
+}
+
+
+/*
+ * Called by the interpreter once the process that held a job has been
+ * stopped, to put the process in the timequeue and start the job.
+ */
+void
+muf_worker_submit(struct frame *fr, dbref player, dbref program)
+{
+	struct muf_job *job = held;
+
+	held = NULL;
+	muf_worker_job_held = 0;
+	if (!job)
+		return;
+	if (!add_muf_worker_event(fr->descr, player, program, fr)) {
+		muf_job_free(job);
+		return;
+	}
+	jobs_out++;
+	pthread_mutex_lock(&worker_mutex);
+	muf_job_enqueue(&job_queue, job);
+	pthread_cond_signal(&worker_wakeup);
+	pthread_mutex_unlock(&worker_mutex);
+}
+
+
+/*
+ * Called by a primitive to see whether a worker has already done its
+ * work for it.  Returns the data it held, or NULL.  The primitive has to
+ * release the data itself.
+ */
+void *
+muf_worker_answer(struct frame *fr, void (*run) (void *))
+{
+	struct muf_job **link, *job;
+	void *data;
+
+	for (link = &answers; (job = *link); link = &job->next) {
+		if (job->pid == fr->pid && job->run == run) {
+			*link = job->next;
+			data = job->data;
+			free(job);
+			return data;
+		}
+	}
+	return NULL;
+}
+
+
+/* Wakes the processes whose jobs have finished. */
+void
+muf_worker_results(void)
+{
+	struct muf_job *job;
+	char buf[64];
+
+	if (!worker_active && !jobs_out)
+		return;
+
+	if (worker_pipe[0] >= 0)
+		while (read(worker_pipe[0], buf, sizeof(buf)) > 0) ;
+
+	for (;;) {
+		pthread_mutex_lock(&worker_mutex);
+		job = muf_job_dequeue(&done_queue);
+		pthread_mutex_unlock(&worker_mutex);
+		if (!job)
+			break;
+		jobs_out--;
+		if (timequeue_wake_worker(job->pid)) {
+			job->next = answers;
+			answers = job;
+		} else {
+			muf_job_free(job);
+		}
+	}
+}
+
+
+/*
+ * Called when process pid is cleaned up, to drop its held job, the
+ * answers it never picked up, and any of its jobs that no worker has
+ * started on yet.
+ */
+void
+muf_worker_forget(int pid)
+{
+	struct muf_job **link, *job, *dropped = NULL;
+
+	if (held && held->pid == pid) {
+		muf_job_free(held);
+		held = NULL;
+		muf_worker_job_held = 0;
+	}
+	for (link = &answers; (job = *link); ) {
+		if (job->pid == pid) {
+			*link = job->next;
+			muf_job_free(job);
+		} else {
+			link = &job->next;
+		}
+	}
+	if (!jobs_out)
+		return;
+	pthread_mutex_lock(&worker_mutex);
+	muf_job_unlink(&job_queue, pid, &dropped);
+	muf_job_unlink(&done_queue, pid, &dropped);
+	pthread_mutex_unlock(&worker_mutex);
+	while ((job = dropped)) {
+		dropped = job->next;
+		jobs_out--;
+		muf_job_free(job);
+	}
+}
+
+
+#else							/* MUF_WORKERS */
+
+int
+muf_worker_can_offload(struct frame *fr, dbref program)
+{
+	return 0;
+}
+
+
+void
+muf_worker_hold(struct frame *fr, void (*run) (void *), void (*release) (void *),
+				void *data)
+{
+}
+
+
+void *
+muf_worker_answer(struct frame *fr, void (*run) (void *))
+{
+	return NULL;
+}
+
+
+void
+muf_worker_forget(int pid)
+{
+}
+
+#endif							/* MUF_WORKERS */
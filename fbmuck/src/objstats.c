@@ -0,0 +1,254 @@
+/* Object counts for @stats and STATS */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "db.h"
+#include "tune.h"
+#include "externs.h"
+
+/*
+ * Rather than walking the whole database each time someone asks how
+ * many objects there are, the counts are kept up to date as objects
+ * change.  Each object has an entry saying what it was last counted as:
+ * which owner, which type, and whether it was changed, propsloaded or
+ * old.  objstats_update() compares that against the object as it is
+ * now, and moves the object between the counts if anything's different.
+ *
+ * DBDIRTY() calls objstats_update(), which covers creating, recycling,
+ * chowning and retyping objects, since they all dirty the object after.
+ * The dumper calls it after clearing OBJECT_CHANGED.  Whether an object
+ * is old, meaning unused for longer than aging_time, changes just by time
+ * passing, so that is left to objstats_sweep(), which rechecks
+ * STATS_SWEEP_OBJECTS objects each pass through the main loop.  The sweep
+ * also fixes any count a change has slipped past without a DBDIRTY().
+ */
+
+#define OS_TYPE			0x07	/* Typeof() the object was counted as */
+#define OS_COUNTED		0x08	/* The entry is in the counts */
+#define OS_ALTERED		0x10	/* OBJECT_CHANGED was set */
+#define OS_LOADED		0x20	/* Its props were loaded (DISKBASE) */
+#define OS_DISKCHANGED	0x40	/* Its props were changed (DISKBASE) */
+#define OS_OLD			0x80	/* Unused for longer than aging_time */
+
+struct objstats_entry {
+	dbref owner;
+	unsigned short bits;
+};
+
+static struct objstats_entry *counted = NULL;
+static struct objstats **owned = NULL;
+static dbref counted_size = 0;
+static struct objstats totals;
+static int objstats_ready = 0;
+static dbref sweep_next = 0;
+
+
+static int
+objstats_grow(dbref size)
+{
+	struct objstats_entry *newcounted;
+	struct objstats **newowned;
+	dbref newsize = counted_size ? counted_size : 1024;
+
+	while (newsize < size)
+		newsize *= 2;
+	newcounted = (struct objstats_entry *) realloc(counted, newsize * sizeof(*counted));
+	if (!newcounted)
+		return 0;
+	counted = newcounted;
+	newowned = (struct objstats **) realloc(owned, newsize * sizeof(*owned));
+	if (!newowned)
+		return 0;
+	owned = newowned;
+	memset(counted + counted_size, 0, (newsize - counted_size) * sizeof(*counted));
+	memset(owned + counted_size, 0, (newsize - counted_size) * sizeof(*owned));
+	counted_size = newsize;
+	return 1;
+}
+
+
+static void
+objstats_add(struct objstats *s, unsigned short bits, int n)
+{
+	switch (bits & OS_TYPE) {
+	case TYPE_ROOM:
+		s->rooms += n;
+		break;
+	case TYPE_EXIT:
+		s->exits += n;
+		break;
+	case TYPE_THING:
+		s->things += n;
+		break;
+	case TYPE_PLAYER:
+		s->players += n;
+		break;
+	case TYPE_PROGRAM:
+		s->programs += n;
+		break;
+	case TYPE_GARBAGE:
+		s->garbage += n;
+		break;
+	}
+	if (bits & OS_ALTERED)
+		s->altered += n;
+	if (bits & OS_LOADED)
+		s->loaded += n;
+	if (bits & OS_DISKCHANGED)
+		s->changed += n;
+	if (bits & OS_OLD)
+		s->old += n;
+}
+
+
+static struct objstats *
+objstats_owner(dbref owner, int create)
+{
+	if (owner < 0 || owner >= counted_size)
+		return NULL;
+	if (!owned[owner] && create)
+		owned[owner] = (struct objstats *) calloc(1, sizeof(struct objstats));
+	return owned[owner];
+}
+
+
+/* What obj should be counted as now, leaving its age as it was. */
+static unsigned short
+objstats_bits(dbref obj, unsigned short was)
+{
+	unsigned short bits = OS_COUNTED | Typeof(obj) | (was & OS_OLD);
+
+	if (FLAGS(obj) & OBJECT_CHANGED)
+		bits |= OS_ALTERED;
+#ifdef DISKBASE
+	if (DBFETCH(obj)->propsmode != PROPS_UNLOADED)
+		bits |= OS_LOADED;
+	if (DBFETCH(obj)->propsmode == PROPS_CHANGED)
+		bits |= OS_DISKCHANGED;
+#endif
+	return bits;
+}
+
+
+static void
+objstats_set(dbref obj, dbref owner, unsigned short bits)
+{
+	struct objstats_entry *e = &counted[obj];
+	struct objstats *s;
+
+	if (e->owner == owner && e->bits == bits)
+		return;
+	if (e->bits & OS_COUNTED) {
+		objstats_add(&totals, e->bits, -1);
+		if ((s = objstats_owner(e->owner, 0)))
+			objstats_add(s, e->bits, -1);
+	}
+	objstats_add(&totals, bits, 1);
+	if ((s = objstats_owner(owner, 1)))
+		objstats_add(s, bits, 1);
+	e->owner = owner;
+	e->bits = bits;
+}
+
+
+/* Recounts obj, deciding afresh whether it's old. */
+static void
+objstats_age(dbref obj, time_t now)
+{
+	unsigned short bits = objstats_bits(obj, 0);
+
+	if ((now - DBFETCH(obj)->ts.lastused) > tp_aging_time)
+		bits |= OS_OLD;
+	objstats_set(obj, OWNER(obj), bits);
+}
+
+
+/* Brings the counts up to date with any change to obj. */
+void
+objstats_update(dbref obj)
+{
+	if (!objstats_ready || obj < 0 || obj >= db_top)
+		return;
+	if (obj >= counted_size && !objstats_grow(db_top))
+		return;
+	objstats_set(obj, OWNER(obj), objstats_bits(obj, counted[obj].bits));
+}
+
+
+/* Rechecks the next few objects, including how old they are. */
+void
+objstats_sweep(void)
+{
+	time_t now = time(NULL);
+	int n;
+
+	if (!objstats_ready || !db_top)
+		return;
+	if (db_top > counted_size && !objstats_grow(db_top))
+		return;
+	for (n = 0; n < STATS_SWEEP_OBJECTS && n < db_top; n++) {
+		if (sweep_next >= db_top)
+			sweep_next = 0;
+		objstats_age(sweep_next++, now);
+	}
+}
+
+
+void
+objstats_free(void)
+{
+	dbref i;
+
+	for (i = 0; i < counted_size; i++)
+		if (owned[i])
+			free(owned[i]);
+	free(counted);
+	free(owned);
+	counted = NULL;
+	owned = NULL;
+	counted_size = 0;
+	memset(&totals, 0, sizeof(totals));
+	objstats_ready = 0;
+	sweep_next = 0;
+}
+
+
+/*
+ * Counts every object from scratch.  Done once the database is loaded,
+ * and after anything that changes objects wholesale, like @sanfix.
+ */
+void
+objstats_rebuild(void)
+{
+	time_t now = time(NULL);
+	dbref i;
+
+	objstats_free();
+	if (db_top && !objstats_grow(db_top))
+		return;
+	for (i = 0; i < db_top; i++)
+		objstats_age(i, now);
+	objstats_ready = 1;
+}
+
+
+/*
+ * Fills in the counts for the objects owned by owner, or for the whole
+ * database if owner is NOTHING.
+ */
+void
+objstats_get(dbref owner, struct objstats *stats)
+{
+	struct objstats *s;
+
+	if (owner == NOTHING)
+		*stats = totals;
+	else if ((s = objstats_owner(owner, 0)))
+		*stats = *s;
+	else
+		memset(stats, 0, sizeof(*stats));
+}
@@ -6,6 +6,8 @@
 #include <stdio.h>
 #include <time.h>
 #include <ctype.h>
+#include <float.h>
+#include <limits.h>
 #include "db.h"
 #include "tune.h"
 #include "inst.h"
@@ -861,36 +863,161 @@ prim_array_reverse(PRIM_PROTOTYPE)
 }
 
 
-static int sortflag_caseinsens = 0;
-static int sortflag_descending = 0;
-static struct inst* sortflag_index = NULL;
-
-int
-sortcomp_generic(const void* x, const void* y)
+/*
+ * ARRAY_SORT and ARRAY_SORT_INDEXED sort a list of the positions of the
+ * items, comparing the key each one is sorted by, with a merge sort so
+ * that items that compare the same keep their order.  A big enough sort
+ * of plain values is done by a MUF worker instead.  The job holds a
+ * reference to the list, so the keys stay put even if the process is
+ * killed, and the list can't be changed in place since it's shared.
+ */
+struct sort_job {
+	struct inst list;			/* The list being sorted, while a worker has it */
+	int count;
+	int caseinsens;
+	int descending;
+	struct inst **keys;			/* What each item is sorted by, or NULL */
+	int *order;					/* Positions of the items, in sorted order */
+	int *scratch;
+};
+
+static int
+sort_compare(struct sort_job *job, int x, int y)
 {
-	struct inst* a;
-	struct inst* b;
+	struct inst *a;
+	struct inst *b;
 
-	if (!sortflag_descending) {
-		a = *(struct inst**)x;
-		b = *(struct inst**)y;
+	if (!job->descending) {
+		a = job->keys[x];
+		b = job->keys[y];
 	} else {
-		a = *(struct inst**)y;
-		b = *(struct inst**)x;
+		a = job->keys[y];
+		b = job->keys[x];
+	}
+	if (!a && !b) {
+		return 0;
+	} else if (!a) {
+		return -1;
+	} else if (!b) {
+		return 1;
+	}
+	return (array_idxcmp_case(a, b, (job->caseinsens? 0 : 1)));
+}
+
+/* Doesn't touch anything but the job, so it can be run by a worker. */
+static void
+sort_job_run(void *data)
+{
+	struct sort_job *job = (struct sort_job *) data;
+	int *from = job->order;
+	int *to = job->scratch;
+	int *swap;
+	int n = job->count;
+	int width, lo, mid, hi, i, j, k;
+
+	for (i = 0; i < n; i++)
+		from[i] = i;
+	for (width = 1; width < n; width *= 2) {
+		for (lo = 0; lo < n; lo += 2 * width) {
+			mid = (n - lo > width) ? lo + width : n;
+			hi = (n - mid > width) ? mid + width : n;
+			for (i = lo, j = mid, k = lo; k < hi; k++) {
+				if (i < mid && (j >= hi || sort_compare(job, from[i], from[j]) <= 0))
+					to[k] = from[i++];
+				else
+					to[k] = from[j++];
+			}
+		}
+		swap = from;
+		from = to;
+		to = swap;
 	}
-	if (sortflag_index) {
-		/* This should only be set if comparators are all arrays. */
-		a = array_getitem(a->data.array, sortflag_index);
-		b = array_getitem(b->data.array, sortflag_index);
-		if (!a && !b) {
-			return 0;
-		} else if (!a) {
-			return -1;
-		} else if (!b) {
-			return 1;
+	if (from != job->order)
+		memcpy(job->order, from, n * sizeof(int));
+}
+
+static void
+sort_job_release(void *data)
+{
+	struct sort_job *job = (struct sort_job *) data;
+
+	CLEAR(&job->list);
+	free(job->keys);
+	free(job->order);
+	free(job->scratch);
+	free(job);
+}
+
+/*
+ * Sorts list by the items themselves, or by their index entries if index
+ * isn't NULL.  Returns the sorted list, or NULL if a worker is doing the
+ * sort, and the primitive should leave its arguments for when it's run
+ * again.
+ */
+static stk_array *
+array_sort_list(struct frame *fr, dbref program, struct inst *list, int sorttype,
+				struct inst *index)
+{
+	stk_array *arr = list->data.array;
+	stk_array *nu;
+	struct sort_job *job;
+	struct inst *item;
+	struct inst idx;
+	int count = array_count(arr);
+	int offload, i;
+
+	job = (struct sort_job *) muf_worker_answer(fr, sort_job_run);
+	if (job && (job->list.data.array != arr || job->count != count)) {
+		sort_job_release(job);
+		job = NULL;
+	}
+
+	if (!job) {
+		offload = (count >= MUF_WORKER_MIN_ITEMS && !arr->pinned &&
+				   muf_worker_can_offload(fr, program));
+		job = (struct sort_job *) malloc(sizeof(struct sort_job));
+		job->list.type = PROG_INTEGER;
+		job->count = count;
+		job->caseinsens = (sorttype & SORTTYPE_CASEINSENS) ? 1 : 0;
+		job->descending = (sorttype & SORTTYPE_DESCENDING) ? 1 : 0;
+		job->keys = (struct inst **) malloc((count ? count : 1) * sizeof(struct inst *));
+		job->order = (int *) malloc((count ? count : 1) * sizeof(int));
+		job->scratch = (int *) malloc((count ? count : 1) * sizeof(int));
+
+		idx.type = PROG_INTEGER;
+		for (i = 0; i < count; i++) {
+			idx.data.number = i;
+			item = array_getitem(arr, &idx);
+			if (index) {
+				/* Pinned arrays are changed in place, even when shared. */
+				if (item->data.array && item->data.array->pinned)
+					offload = 0;
+				item = array_getitem(item->data.array, index);
+			}
+			job->keys[i] = item;
+			if (item && item->type != PROG_STRING && item->type != PROG_INTEGER &&
+					item->type != PROG_FLOAT && item->type != PROG_OBJECT)
+				offload = 0;
+		}
+
+		if (offload) {
+			copyinst(list, &job->list);
+			muf_worker_hold(fr, sort_job_run, sort_job_release, job);
+			return NULL;
 		}
+		sort_job_run(job);
 	}
-	return (array_idxcmp_case(a, b, (sortflag_caseinsens? 0 : 1)));
+
+	nu = new_array_packed(count);
+	idx.type = PROG_INTEGER;
+	for (i = 0; i < count; i++) {
+		idx.data.number = job->order[i];
+		item = array_getitem(arr, &idx);
+		idx.data.number = i;
+		array_setitem(&nu, &idx, item);
+	}
+	sort_job_release(job);
+	return nu;
 }
 
 int
@@ -899,6 +1026,34 @@ sortcomp_shuffle(const void* x, const void* y)
 	return (((RANDOM() >> 8) % 5) - 2);
 }
 
+static stk_array *
+array_shuffle_list(stk_array *arr)
+{
+	stk_array *nu;
+	struct inst **tmparr;
+	struct inst idx;
+	int count, i;
+
+	idx.type = PROG_INTEGER;
+	count = array_count(arr);
+	nu = new_array_packed(count);
+	tmparr = (struct inst**)malloc((count ? count : 1) * sizeof(struct inst*));
+
+	for (i = 0; i < count; i++) {
+		idx.data.number = i;
+		tmparr[i] = array_getitem(arr, &idx);
+	}
+
+	qsort(tmparr, count, sizeof(struct inst*), sortcomp_shuffle);
+
+	for (i = 0; i < count; i++) {
+		idx.data.number = i;
+		array_setitem(&nu, &idx, tmparr[i]);
+	}
+	free(tmparr);
+	return nu;
+}
+
 
 /* Sort types:
  * 1: case, ascending
@@ -912,9 +1067,6 @@ prim_array_sort(PRIM_PROTOTYPE)
 {
 	stk_array *arr;
 	stk_array *nu;
-	int count, i;
-	int (*comparator)(const void*, const void*);
-	struct inst** tmparr = NULL;
 
 	CHECKOP(2);
 	oper2 = POP();				/* int  sort_type   */
@@ -928,38 +1080,13 @@ prim_array_sort(PRIM_PROTOTYPE)
 	if (oper2->type != PROG_INTEGER)
 		abort_interp("Expected integer argument to specify sort type. (2)");
 
-	temp1.type = PROG_INTEGER;
-	count = array_count(arr);
-	nu = new_array_packed(count);
-	tmparr = (struct inst**)malloc(count * sizeof(struct inst*));
-
-	for (i = 0; i < count; i++) {
-		temp1.data.number = i;
-		tmparr[i] = array_getitem(arr, &temp1);
-	}
-
-	/* WORK: if we go multithreaded, we'll need to lock a mutex here. */
-	/*       Share this mutex with ARRAY_SORT_INDEXED. */
-	sortflag_caseinsens = (oper2->data.number & SORTTYPE_CASEINSENS) ? 1 : 0;
-	sortflag_descending = (oper2->data.number & SORTTYPE_DESCENDING) ? 1 : 0;
-	sortflag_index = NULL;
-
 	if ((oper2->data.number & SORTTYPE_SHUFFLE)) {
-		comparator = sortcomp_shuffle;
-	} else {
-		comparator = sortcomp_generic;
+		nu = array_shuffle_list(arr);
+	} else if (!(nu = array_sort_list(fr, program, oper1, oper2->data.number, NULL))) {
+		*top += 2;
+		return;
 	}
 
-	qsort(tmparr, count, sizeof(struct inst*), comparator);
-	/* WORK: if we go multithreaded, the mutex should be released here. */
-	/*       Share this mutex with ARRAY_SORT_INDEXED. */
-
-	for (i = 0; i < count; i++) {
-		temp1.data.number = i;
-		array_setitem(&nu, &temp1, tmparr[i]);
-	}
-	free(tmparr);
-
 	CLEAR(oper1);
 	CLEAR(oper2);
 	PushArrayRaw(nu);
@@ -978,9 +1105,6 @@ prim_array_sort_indexed(PRIM_PROTOTYPE)
 {
 	stk_array *arr;
 	stk_array *nu;
-	int count, i;
-	int (*comparator)(const void*, const void*);
-	struct inst** tmparr = NULL;
 
 	CHECKOP(3);
 	oper3 = POP();				/* idx  index_key   */
@@ -1000,38 +1124,13 @@ prim_array_sort_indexed(PRIM_PROTOTYPE)
 	if (oper3->type != PROG_INTEGER && oper3->type != PROG_STRING)
 		abort_interp("Index argument not an integer or string. (3)");
 
-	temp1.type = PROG_INTEGER;
-	count = array_count(arr);
-	nu = new_array_packed(count);
-	tmparr = (struct inst**)malloc(count * sizeof(struct inst*));
-
-	for (i = 0; i < count; i++) {
-		temp1.data.number = i;
-		tmparr[i] = array_getitem(arr, &temp1);
-	}
-
-	/* WORK: if we go multithreaded, we'll need to lock a mutex here. */
-	/*       Share this mutex with ARRAY_SORT. */
-	sortflag_caseinsens = (oper2->data.number & SORTTYPE_CASEINSENS) ? 1 : 0;
-	sortflag_descending = (oper2->data.number & SORTTYPE_DESCENDING) ? 1 : 0;
-	sortflag_index = oper3;
-
 	if ((oper2->data.number & SORTTYPE_SHUFFLE)) {
-		comparator = sortcomp_shuffle;
-	} else {
-		comparator = sortcomp_generic;
+		nu = array_shuffle_list(arr);
+	} else if (!(nu = array_sort_list(fr, program, oper1, oper2->data.number, oper3))) {
+		*top += 3;
+		return;
 	}
 
-	qsort(tmparr, count, sizeof(struct inst*), comparator);
-	/* WORK: if we go multithreaded, the mutex should be released here. */
-	/*       Share this mutex with ARRAY_SORT. */
-
-	for (i = 0; i < count; i++) {
-		temp1.data.number = i;
-		array_setitem(&nu, &temp1, tmparr[i]);
-	}
-	free(tmparr);
-
 	CLEAR(oper1);
 	CLEAR(oper2);
 	CLEAR(oper3);
@@ -1043,10 +1142,9 @@ void
 prim_array_get_propdirs(PRIM_PROTOTYPE)
 {
 	stk_array *nu;
-	char propname[BUFFER_LEN];
 	char dir[BUFFER_LEN];
-	PropPtr propadr, pptr;
-	PropPtr prptr;
+	PropCursor cursor;
+	PropPtr propadr;
 	int count = 0;
 	int len;
 
@@ -1072,26 +1170,23 @@ prim_array_get_propdirs(PRIM_PROTOTYPE)
 		dir[len] = '\0';
 
 	nu = new_array_packed(0);
-	propadr = first_prop(ref, dir, &pptr, propname, sizeof(propname));
+	propadr = propcursor_first(&cursor, ref, dir);
 	while (propadr) {
-		snprintf(buf, sizeof(buf), "%s%c%s", dir, PROPDIR_DELIMITER, propname);
+		snprintf(buf, sizeof(buf), "%s%c%s", dir, PROPDIR_DELIMITER, cursor.name);
 		if (prop_read_perms(ProgUID, ref, buf, mlev)) {
-			prptr = get_property(ref, buf);
-			if (prptr) {
 #ifdef DISKBASE
-				propfetch(ref, prptr);
+			propfetch(ref, propadr);
 #endif
-				if (PropDir(prptr)) {
-					if (count >= 511) {
-						array_free(nu);
-						abort_interp("Too many propdirs to put in an array!");
-					}
-
-					array_set_intkey_strval(&nu, count++, propname);
+			if (PropDir(propadr)) {
+				if (count >= 511) {
+					array_free(nu);
+					abort_interp("Too many propdirs to put in an array!");
 				}
+
+				array_set_intkey_strval(&nu, count++, cursor.name);
 			}
 		}
-		propadr = next_prop(pptr, propadr, propname, sizeof(propname));
+		propadr = propcursor_next(&cursor);
 	}
 
 	CLEAR(oper1);
@@ -1105,10 +1200,9 @@ void
 prim_array_get_propvals(PRIM_PROTOTYPE)
 {
 	stk_array *nu;
-	char propname[BUFFER_LEN];
 	char dir[BUFFER_LEN];
-	PropPtr propadr, pptr;
-	PropPtr prptr;
+	PropCursor cursor;
+	PropPtr propadr;
 	int count = 0;
 
 	/* dbref strPropDir -- array */
@@ -1130,64 +1224,65 @@ prim_array_get_propvals(PRIM_PROTOTYPE)
 		strcpyn(dir, sizeof(dir), "/");
 
 	nu = new_array_dictionary();
-	propadr = first_prop(ref, dir, &pptr, propname, sizeof(propname));
+	propadr = propcursor_first(&cursor, ref, dir);
 	while (propadr) {
-		snprintf(buf, sizeof(buf), "%s%c%s", dir, PROPDIR_DELIMITER, propname);
+		snprintf(buf, sizeof(buf), "%s%c%s", dir, PROPDIR_DELIMITER, cursor.name);
 		if (prop_read_perms(ProgUID, ref, buf, mlev)) {
-			prptr = get_property(ref, buf);
-			if (prptr) {
-				int goodflag = 1;
+			int goodflag = 1;
 
 #ifdef DISKBASE
-				propfetch(ref, prptr);
+			propfetch(ref, propadr);
 #endif
-				switch (PropType(prptr)) {
-				case PROP_STRTYP:
-					temp2.type = PROG_STRING;
-					temp2.data.string = alloc_prog_string(PropDataStr(prptr));
-					break;
-				case PROP_LOKTYP:
-					temp2.type = PROG_LOCK;
-					if (PropFlags(prptr) & PROP_ISUNLOADED) {
-						temp2.data.lock = TRUE_BOOLEXP;
-					} else {
-						temp2.data.lock = PropDataLok(prptr);
-						if (temp2.data.lock != TRUE_BOOLEXP) {
-							temp2.data.lock = copy_bool(temp2.data.lock);
-						}
+			switch (PropType(propadr)) {
+			case PROP_STRTYP:
+				temp2.type = PROG_STRING;
+				temp2.data.string = alloc_prog_string(PropDataStr(propadr));
+				break;
+			case PROP_SETTYP:
+				temp2.type = PROG_STRING;
+				temp2.data.string = alloc_prog_string(refset_text(PropDataSet(propadr)));
+				break;
+			case PROP_LOKTYP:
+				temp2.type = PROG_LOCK;
+				if (PropFlags(propadr) & PROP_ISUNLOADED) {
+					temp2.data.lock = TRUE_BOOLEXP;
+				} else {
+					temp2.data.lock = PropDataLok(propadr);
+					if (temp2.data.lock != TRUE_BOOLEXP) {
+						temp2.data.lock = copy_bool(temp2.data.lock);
 					}
-					break;
-				case PROP_REFTYP:
-					temp2.type = PROG_OBJECT;
-					temp2.data.number = PropDataRef(prptr);
-					break;
-				case PROP_INTTYP:
-					temp2.type = PROG_INTEGER;
-					temp2.data.number = PropDataVal(prptr);
-					break;
-				case PROP_FLTTYP:
-					temp2.type = PROG_FLOAT;
-					temp2.data.fnumber = PropDataFVal(prptr);
-					break;
-				default:
-					goodflag = 0;
-					break;
 				}
+				break;
+			case PROP_REFTYP:
+				temp2.type = PROG_OBJECT;
+				temp2.data.number = PropDataRef(propadr);
+				break;
+			case PROP_INTTYP:
+				temp2.type = PROG_INTEGER;
+				temp2.data.number = PropDataVal(propadr);
+				break;
+			case PROP_FLTTYP:
+				temp2.type = PROG_FLOAT;
+				temp2.data.fnumber = PropDataFVal(propadr);
+				break;
+			default:
+				goodflag = 0;
+				break;
+			}
 
-				if (goodflag) {
-					if (count++ >= 511) {
-						array_free(nu);
-						abort_interp("Too many properties to put in an array!");
-					}
-					temp1.type = PROG_STRING;
-					temp1.data.string = alloc_prog_string(propname);
-					array_setitem(&nu, &temp1, &temp2);
-					CLEAR(&temp1);
-					CLEAR(&temp2);
+			if (goodflag) {
+				if (count++ >= 511) {
+					array_free(nu);
+					abort_interp("Too many properties to put in an array!");
 				}
+				temp1.type = PROG_STRING;
+				temp1.data.string = alloc_prog_string(cursor.name);
+				array_setitem(&nu, &temp1, &temp2);
+				CLEAR(&temp1);
+				CLEAR(&temp2);
 			}
 		}
-		propadr = next_prop(pptr, propadr, propname, sizeof(propname));
+		propadr = propcursor_next(&cursor);
 	}
 
 	PushArrayRaw(nu);
@@ -1276,6 +1371,10 @@ prim_array_get_proplist(PRIM_PROTOTYPE)
 					temp2.type = PROG_STRING;
 					temp2.data.string = alloc_prog_string(PropDataStr(prptr));
 					break;
+				  case PROP_SETTYP:
+					temp2.type = PROG_STRING;
+					temp2.data.string = alloc_prog_string(refset_text(PropDataSet(prptr)));
+					break;
 				  case PROP_LOKTYP:
 					temp2.type = PROG_LOCK;
 					if (PropFlags(prptr) & PROP_ISUNLOADED) {
@@ -1562,6 +1661,9 @@ prim_array_get_reflist(PRIM_PROTOTYPE)
 	const char *rawstr;
 	char dir[BUFFER_LEN];
 	int count = 0;
+	struct refset *set;
+	dbref item;
+	int pos = 0;
 
 	/* dbref strPropDir -- array */
 	CHECKOP(2);
@@ -1583,9 +1685,16 @@ prim_array_get_reflist(PRIM_PROTOTYPE)
 		abort_interp("Permission denied.");
 
 	nu = new_array_packed(0);
-	rawstr = get_property_class(ref, dir);
-
-	if (rawstr) {
+	set = get_property_refset(ref, dir);
+	if (set) {
+		temp1.type = PROG_INTEGER;
+		temp2.type = PROG_OBJECT;
+		while (refset_walk(set, &pos, &item)) {
+			temp1.data.number = count++;
+			temp2.data.objref = item;
+			array_setitem(&nu, &temp1, &temp2);
+		}
+	} else if ((rawstr = get_property_class(ref, dir))) {
 		while (isspace(*rawstr))
 			rawstr++;
 		while (*rawstr) {
@@ -1624,6 +1733,7 @@ prim_array_put_reflist(PRIM_PROTOTYPE)
 	char buf2[BUFFER_LEN];
 	char dir[BUFFER_LEN];
 	char *out;
+	struct refset *set;
 	PData propdat;
 	int len;
 
@@ -1650,34 +1760,53 @@ prim_array_put_reflist(PRIM_PROTOTYPE)
 	ref = oper1->data.objref;
 	strcpyn(dir, sizeof(dir), DoNullInd(oper2->data.string));
 	arr = oper3->data.array;
-	buf[0] = '\0';
 
 	if (!prop_write_perms(ProgUID, ref, dir, mlev))
 		abort_interp("Permission denied.");
 
-	out = buf;
+	/*
+	 * A set can't hold a dbref twice, so a list that has one in it more
+	 * than once is stored as the string it always was, exactly as given.
+	 */
+	set = refset_new();
 	if (array_first(arr, &temp1)) {
 		do {
 			oper4 = array_getitem(arr, &temp1);
-			len = snprintf(buf2, sizeof(buf2), "#%d", oper4->data.objref);
-			if (len == -1) {
-				buf2[sizeof(buf2)-1] = '\0';
-				len = sizeof(buf2) - 1;
-			}
+			if (refset_find(set, oper4->data.objref))
+				break;
+			refset_add(set, oper4->data.objref);
+		} while (array_next(arr, &temp1));
+	}
+	if (set->count && set->count == array_count(arr)) {
+		propdat.flags = PROP_SETTYP;
+		propdat.data.set = set;
+	} else {
+		refset_free(set);
+		buf[0] = '\0';
+		out = buf;
+		if (array_first(arr, &temp1)) {
+			do {
+				oper4 = array_getitem(arr, &temp1);
+				len = snprintf(buf2, sizeof(buf2), "#%d", oper4->data.objref);
+				if (len == -1) {
+					buf2[sizeof(buf2)-1] = '\0';
+					len = sizeof(buf2) - 1;
+				}
 
-			if (out + len - buf >= BUFFER_LEN - 3)
-				abort_interp("Operation would result in string length overflow.");
+				if (out + len - buf >= BUFFER_LEN - 3)
+					abort_interp("Operation would result in string length overflow.");
 
-			if (*buf)
-				*out++ = ' ';
-			strcpyn(out, sizeof(buf)-(out-buf), buf2);
-			out += len;
-		} while (array_next(arr, &temp1));
+				if (*buf)
+					*out++ = ' ';
+				strcpyn(out, sizeof(buf)-(out-buf), buf2);
+				out += len;
+			} while (array_next(arr, &temp1));
+		}
+		propdat.flags = PROP_STRTYP;
+		propdat.data.str = buf;
 	}
 
 	remove_property(ref, dir);
-	propdat.flags = PROP_STRTYP;
-	propdat.data.str = buf;
 	set_property(ref, dir, &propdat);
 
 	CLEAR(oper1);
@@ -2131,6 +2260,9 @@ prim_array_get_ignorelist(PRIM_PROTOTYPE)
 	stk_array *nu;
 	const char *rawstr;
 	int count = 0;
+	struct refset *set;
+	dbref item;
+	int pos = 0;
 
 	CHECKOP(1);
 	oper1 = POP();
@@ -2148,7 +2280,17 @@ prim_array_get_ignorelist(PRIM_PROTOTYPE)
 
 	nu = new_array_packed(0);
 
-	if (tp_ignore_support)
+	if (tp_ignore_support && (set = get_property_refset(ref, IGNORE_PROP)))
+	{
+		temp1.type = PROG_INTEGER;
+		temp2.type = PROG_OBJECT;
+		while (refset_walk(set, &pos, &item)) {
+			temp1.data.number = count++;
+			temp2.data.objref = item;
+			array_setitem(&nu, &temp1, &temp2);
+		}
+	}
+	else if (tp_ignore_support)
 	{
 		rawstr = get_property_class(ref, IGNORE_PROP);
 
@@ -2417,3 +2559,499 @@ prim_array_filter_flags(PRIM_PROTOTYPE)
     CLEAR(oper2);
     PushArrayRaw(nw);
 }
+
+
+
+/*
+ * The vector prims below work on list arrays of numbers.  They copy the
+ * items into plain int or double buffers a run of ARRAY_VNODE_WIDTH at a
+ * time, straight from the array's leaves, and do the arithmetic in simple
+ * loops over those, which the compiler can vectorize.  The result is an
+ * integer if every number involved is an integer, and otherwise a float,
+ * with the same error flags set as the scalar math prims would set.
+ */
+
+#define VECTOR_ADD 0
+#define VECTOR_SUB 1
+#define VECTOR_MUL 2
+#define VECTOR_DIV 3
+
+/* Returns PROG_INTEGER if arr is a list of integers, PROG_FLOAT if it is a
+   list of integers and floats with at least one float, and 0 otherwise. */
+static int
+vector_type(stk_array * arr)
+{
+	array_data *vals;
+	int idx, cnt, i;
+	int typ = PROG_INTEGER;
+
+	if (!arr || arr->type != ARRAY_PACKED)
+		return 0;
+	if (array_is_homogenous(arr, PROG_INTEGER))
+		return PROG_INTEGER;
+	if (array_is_homogenous(arr, PROG_FLOAT))
+		return PROG_FLOAT;
+	for (idx = 0; (cnt = array_packed_run(arr, idx, &vals)); idx += cnt) {
+		for (i = 0; i < cnt; i++) {
+			if (vals[i].type == PROG_FLOAT)
+				typ = PROG_FLOAT;
+			else if (vals[i].type != PROG_INTEGER)
+				return 0;
+		}
+	}
+	return typ;
+}
+
+static int
+vector_load_ints(stk_array * arr, int idx, int *out)
+{
+	array_data *vals;
+	int cnt = array_packed_run(arr, idx, &vals);
+	int i;
+
+	for (i = 0; i < cnt; i++)
+		out[i] = vals[i].data.number;
+	return cnt;
+}
+
+/* Returns how many items were loaded.  Sets *bad if any is infinite. */
+static int
+vector_load_flts(stk_array * arr, int idx, double *out, int *bad)
+{
+	array_data *vals;
+	int cnt = array_packed_run(arr, idx, &vals);
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		out[i] = (vals[i].type == PROG_FLOAT) ? vals[i].data.fnumber : vals[i].data.number;
+		if (out[i] == INF || out[i] == NINF)
+			*bad = 1;
+	}
+	return cnt;
+}
+
+static int
+vector_int_ok(double val)
+{
+	return (val <= (double) INT_MAX && val >= (double) INT_MIN);
+}
+
+static void
+vector_append_int(stk_array ** arr, int val)
+{
+	struct inst item;
+
+	item.type = PROG_INTEGER;
+	item.line = 0;
+	item.data.number = val;
+	array_appenditem(arr, &item);
+}
+
+static void
+vector_append_flt(stk_array ** arr, double val)
+{
+	struct inst item;
+
+	item.type = PROG_FLOAT;
+	item.line = 0;
+	item.data.fnumber = val;
+	array_appenditem(arr, &item);
+}
+
+
+void
+prim_array_sum(PRIM_PROTOTYPE)
+{
+	int ibuf[ARRAY_VNODE_WIDTH];
+	double fbuf[ARRAY_VNODE_WIDTH];
+	stk_array *arr;
+	double fsum = 0.0;
+	unsigned int isum = 0;
+	int idx, cnt, i, typ;
+	int bad = 0;
+
+	CHECKOP(1);
+	oper1 = POP();				/* arr  Array */
+	if (oper1->type != PROG_ARRAY)
+		abort_interp("Argument not an array.");
+	arr = oper1->data.array;
+	if (!(typ = vector_type(arr)))
+		abort_interp("Argument must be a list array of numbers.");
+
+	if (typ == PROG_INTEGER) {
+		for (idx = 0; (cnt = vector_load_ints(arr, idx, ibuf)); idx += cnt) {
+			for (i = 0; i < cnt; i++) {
+				isum += (unsigned int) ibuf[i];
+				fsum += ibuf[i];
+			}
+		}
+		if (!vector_int_ok(fsum))
+			fr->error.error_flags.i_bounds = 1;
+		result = (int) isum;
+	} else {
+		for (idx = 0; (cnt = vector_load_flts(arr, idx, fbuf, &bad)); idx += cnt) {
+			for (i = 0; i < cnt; i++)
+				fsum += fbuf[i];
+		}
+		if (bad) {
+			fsum = 0.0;
+			fr->error.error_flags.f_bounds = 1;
+		}
+	}
+
+	CLEAR(oper1);
+	if (typ == PROG_INTEGER)
+		PushInt(result);
+	else
+		PushFloat(fsum);
+}
+
+
+/* Does the work of ARRAY_MIN and ARRAY_MAX. */
+static void
+vector_minmax(PRIM_PROTOTYPE, int wantmax)
+{
+	int ibuf[ARRAY_VNODE_WIDTH];
+	double fbuf[ARRAY_VNODE_WIDTH];
+	stk_array *arr;
+	double fbest;
+	int idx, cnt, i, typ;
+	int bad = 0;
+
+	CHECKOP(1);
+	oper1 = POP();				/* arr  Array */
+	if (oper1->type != PROG_ARRAY)
+		abort_interp("Argument not an array.");
+	arr = oper1->data.array;
+	if (!(typ = vector_type(arr)))
+		abort_interp("Argument must be a list array of numbers.");
+	if (!array_count(arr))
+		abort_interp("Argument must not be an empty array.");
+
+	if (typ == PROG_INTEGER) {
+		vector_load_ints(arr, 0, ibuf);
+		result = ibuf[0];
+		for (idx = 0; (cnt = vector_load_ints(arr, idx, ibuf)); idx += cnt) {
+			if (wantmax) {
+				for (i = 0; i < cnt; i++)
+					result = (ibuf[i] > result) ? ibuf[i] : result;
+			} else {
+				for (i = 0; i < cnt; i++)
+					result = (ibuf[i] < result) ? ibuf[i] : result;
+			}
+		}
+	} else {
+		vector_load_flts(arr, 0, fbuf, &bad);
+		fbest = fbuf[0];
+		for (idx = 0; (cnt = vector_load_flts(arr, idx, fbuf, &bad)); idx += cnt) {
+			if (wantmax) {
+				for (i = 0; i < cnt; i++)
+					fbest = (fbuf[i] > fbest) ? fbuf[i] : fbest;
+			} else {
+				for (i = 0; i < cnt; i++)
+					fbest = (fbuf[i] < fbest) ? fbuf[i] : fbest;
+			}
+		}
+		if (bad) {
+			fbest = 0.0;
+			fr->error.error_flags.f_bounds = 1;
+		}
+	}
+
+	CLEAR(oper1);
+	if (typ == PROG_INTEGER)
+		PushInt(result);
+	else
+		PushFloat(fbest);
+}
+
+
+void
+prim_array_min(PRIM_PROTOTYPE)
+{
+	vector_minmax(player, program, mlev, pc, arg, top, fr, 0);
+}
+
+
+void
+prim_array_max(PRIM_PROTOTYPE)
+{
+	vector_minmax(player, program, mlev, pc, arg, top, fr, 1);
+}
+
+
+void
+prim_array_dot(PRIM_PROTOTYPE)
+{
+	int ibuf1[ARRAY_VNODE_WIDTH], ibuf2[ARRAY_VNODE_WIDTH];
+	double fbuf1[ARRAY_VNODE_WIDTH], fbuf2[ARRAY_VNODE_WIDTH];
+	stk_array *arr1, *arr2;
+	double fsum = 0.0;
+	unsigned int isum = 0;
+	int idx, cnt, i, typ1, typ2;
+	int bad = 0;
+
+	CHECKOP(2);
+	oper2 = POP();				/* arr  Array */
+	oper1 = POP();				/* arr  Array */
+	if (oper1->type != PROG_ARRAY)
+		abort_interp("Argument not an array. (1)");
+	if (oper2->type != PROG_ARRAY)
+		abort_interp("Argument not an array. (2)");
+	arr1 = oper1->data.array;
+	arr2 = oper2->data.array;
+	if (!(typ1 = vector_type(arr1)))
+		abort_interp("Argument must be a list array of numbers. (1)");
+	if (!(typ2 = vector_type(arr2)))
+		abort_interp("Argument must be a list array of numbers. (2)");
+	if (array_count(arr1) != array_count(arr2))
+		abort_interp("Arrays must be the same length.");
+
+	if (typ1 == PROG_INTEGER && typ2 == PROG_INTEGER) {
+		for (idx = 0; (cnt = vector_load_ints(arr1, idx, ibuf1)); idx += cnt) {
+			vector_load_ints(arr2, idx, ibuf2);
+			for (i = 0; i < cnt; i++) {
+				isum += (unsigned int) ibuf1[i] * (unsigned int) ibuf2[i];
+				fsum += (double) ibuf1[i] * ibuf2[i];
+			}
+		}
+		if (!vector_int_ok(fsum))
+			fr->error.error_flags.i_bounds = 1;
+		result = (int) isum;
+	} else {
+		for (idx = 0; (cnt = vector_load_flts(arr1, idx, fbuf1, &bad)); idx += cnt) {
+			vector_load_flts(arr2, idx, fbuf2, &bad);
+			for (i = 0; i < cnt; i++)
+				fsum += fbuf1[i] * fbuf2[i];
+		}
+		if (bad) {
+			fsum = 0.0;
+			fr->error.error_flags.f_bounds = 1;
+		}
+	}
+
+	CLEAR(oper1);
+	CLEAR(oper2);
+	if (typ1 == PROG_INTEGER && typ2 == PROG_INTEGER)
+		PushInt(result);
+	else
+		PushFloat(fsum);
+}
+
+
+static void
+vector_arith_ints(int op, const int *a, const int *b, int *out, int cnt,
+				  struct frame *fr)
+{
+	int i, ok = 1;
+
+	switch (op) {
+	case VECTOR_ADD:
+		for (i = 0; i < cnt; i++) {
+			out[i] = (int) ((unsigned int) a[i] + (unsigned int) b[i]);
+			ok &= vector_int_ok((double) a[i] + b[i]);
+		}
+		break;
+	case VECTOR_SUB:
+		for (i = 0; i < cnt; i++) {
+			out[i] = (int) ((unsigned int) a[i] - (unsigned int) b[i]);
+			ok &= vector_int_ok((double) a[i] - b[i]);
+		}
+		break;
+	case VECTOR_MUL:
+		for (i = 0; i < cnt; i++) {
+			out[i] = (int) ((unsigned int) a[i] * (unsigned int) b[i]);
+			ok &= vector_int_ok((double) a[i] * b[i]);
+		}
+		break;
+	case VECTOR_DIV:
+		for (i = 0; i < cnt; i++) {
+			if (!b[i]) {
+				out[i] = 0;
+				fr->error.error_flags.div_zero = 1;
+			} else if (b[i] == -1) {
+				out[i] = (int) (0U - (unsigned int) a[i]);
+				ok &= (a[i] != INT_MIN);
+			} else {
+				out[i] = a[i] / b[i];
+			}
+		}
+		break;
+	}
+	if (!ok)
+		fr->error.error_flags.i_bounds = 1;
+}
+
+
+static void
+vector_arith_flts(int op, const double *a, const double *b, double *out, int cnt,
+				  struct frame *fr)
+{
+	int i;
+
+	switch (op) {
+	case VECTOR_ADD:
+		for (i = 0; i < cnt; i++)
+			out[i] = a[i] + b[i];
+		break;
+	case VECTOR_SUB:
+		for (i = 0; i < cnt; i++)
+			out[i] = a[i] - b[i];
+		break;
+	case VECTOR_MUL:
+		for (i = 0; i < cnt; i++)
+			out[i] = a[i] * b[i];
+		break;
+	case VECTOR_DIV:
+		for (i = 0; i < cnt; i++) {
+			if (fabs(b[i]) < DBL_EPSILON) {
+				out[i] = INF;
+				fr->error.error_flags.div_zero = 1;
+			} else {
+				out[i] = a[i] / b[i];
+			}
+		}
+		break;
+	}
+}
+
+
+/*
+ * Does the work of ARRAY_VADD, ARRAY_VSUB, ARRAY_VMUL and ARRAY_VDIV.  The
+ * second argument is either a list of numbers as long as the first, or a
+ * number to use with every item of it.
+ */
+static void
+vector_arith(PRIM_PROTOTYPE, int op)
+{
+	int ibuf1[ARRAY_VNODE_WIDTH], ibuf2[ARRAY_VNODE_WIDTH], iout[ARRAY_VNODE_WIDTH];
+	double fbuf1[ARRAY_VNODE_WIDTH], fbuf2[ARRAY_VNODE_WIDTH], fout[ARRAY_VNODE_WIDTH];
+	stk_array *arr1, *arr2 = NULL;
+	stk_array *nu;
+	int idx, cnt, i, typ1, typ2;
+	int bad = 0;
+
+	CHECKOP(2);
+	oper2 = POP();				/* arr or num  Operand */
+	oper1 = POP();				/* arr  Array */
+	if (oper1->type != PROG_ARRAY)
+		abort_interp("Argument not an array. (1)");
+	arr1 = oper1->data.array;
+	if (!(typ1 = vector_type(arr1)))
+		abort_interp("Argument must be a list array of numbers. (1)");
+	if (oper2->type == PROG_ARRAY) {
+		arr2 = oper2->data.array;
+		if (!(typ2 = vector_type(arr2)))
+			abort_interp("Argument must be a list array of numbers. (2)");
+		if (array_count(arr1) != array_count(arr2))
+			abort_interp("Arrays must be the same length.");
+	} else if (oper2->type == PROG_INTEGER || oper2->type == PROG_FLOAT) {
+		typ2 = oper2->type;
+		for (i = 0; i < ARRAY_VNODE_WIDTH; i++) {
+			ibuf2[i] = oper2->data.number;
+			fbuf2[i] = (typ2 == PROG_FLOAT) ? oper2->data.fnumber : oper2->data.number;
+		}
+		if (fbuf2[0] == INF || fbuf2[0] == NINF)
+			bad = 1;
+	} else {
+		abort_interp("Argument must be an array or a number. (2)");
+	}
+
+	nu = new_array_packed(0);
+	if (typ1 == PROG_INTEGER && typ2 == PROG_INTEGER) {
+		for (idx = 0; (cnt = vector_load_ints(arr1, idx, ibuf1)); idx += cnt) {
+			if (arr2)
+				vector_load_ints(arr2, idx, ibuf2);
+			vector_arith_ints(op, ibuf1, ibuf2, iout, cnt, fr);
+			for (i = 0; i < cnt; i++)
+				vector_append_int(&nu, iout[i]);
+		}
+	} else {
+		for (idx = 0; (cnt = vector_load_flts(arr1, idx, fbuf1, &bad)); idx += cnt) {
+			if (arr2)
+				vector_load_flts(arr2, idx, fbuf2, &bad);
+			vector_arith_flts(op, fbuf1, fbuf2, fout, cnt, fr);
+			for (i = 0; i < cnt; i++)
+				vector_append_flt(&nu, (fbuf1[i] == INF || fbuf1[i] == NINF ||
+										fbuf2[i] == INF || fbuf2[i] == NINF) ? 0.0 : fout[i]);
+		}
+		if (bad)
+			fr->error.error_flags.f_bounds = 1;
+	}
+
+	CLEAR(oper1);
+	CLEAR(oper2);
+	PushArrayRaw(nu);
+}
+
+
+void
+prim_array_vadd(PRIM_PROTOTYPE)
+{
+	vector_arith(player, program, mlev, pc, arg, top, fr, VECTOR_ADD);
+}
+
+
+void
+prim_array_vsub(PRIM_PROTOTYPE)
+{
+	vector_arith(player, program, mlev, pc, arg, top, fr, VECTOR_SUB);
+}
+
+
+void
+prim_array_vmul(PRIM_PROTOTYPE)
+{
+	vector_arith(player, program, mlev, pc, arg, top, fr, VECTOR_MUL);
+}
+
+
+void
+prim_array_vdiv(PRIM_PROTOTYPE)
+{
+	vector_arith(player, program, mlev, pc, arg, top, fr, VECTOR_DIV);
+}
+
+
+void
+prim_array_findrange(PRIM_PROTOTYPE)
+{
+	double fbuf[ARRAY_VNODE_WIDTH];
+	char hit[ARRAY_VNODE_WIDTH];
+	stk_array *arr;
+	stk_array *nu;
+	double lo, hi;
+	int idx, cnt, i;
+	int bad = 0;
+
+	CHECKOP(3);
+	oper3 = POP();				/* num  High */
+	oper2 = POP();				/* num  Low */
+	oper1 = POP();				/* arr  Array */
+	if (oper1->type != PROG_ARRAY)
+		abort_interp("Argument not an array. (1)");
+	arr = oper1->data.array;
+	if (!vector_type(arr))
+		abort_interp("Argument must be a list array of numbers. (1)");
+	if (oper2->type != PROG_INTEGER && oper2->type != PROG_FLOAT)
+		abort_interp("Argument not a number. (2)");
+	if (oper3->type != PROG_INTEGER && oper3->type != PROG_FLOAT)
+		abort_interp("Argument not a number. (3)");
+	lo = (oper2->type == PROG_FLOAT) ? oper2->data.fnumber : oper2->data.number;
+	hi = (oper3->type == PROG_FLOAT) ? oper3->data.fnumber : oper3->data.number;
+
+	nu = new_array_packed(0);
+	for (idx = 0; (cnt = vector_load_flts(arr, idx, fbuf, &bad)); idx += cnt) {
+		for (i = 0; i < cnt; i++)
+			hit[i] = (fbuf[i] >= lo) & (fbuf[i] <= hi);
+		for (i = 0; i < cnt; i++) {
+			if (hit[i])
+				vector_append_int(&nu, idx + i);
+		}
+	}
+
+	CLEAR(oper1);
+	CLEAR(oper2);
+	CLEAR(oper3);
+	PushArrayRaw(nu);
+}
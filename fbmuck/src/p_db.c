@@ -1037,6 +1037,7 @@ prim_getlinks(PRIM_PROTOTYPE)
 	switch (Typeof(my_obj)) {
 	case TYPE_EXIT:
 		count = DBFETCH(my_obj)->sp.exit.ndest;
+		CHECKOFLOW(count + 1);
 		for (i = 0; i < count; i++) {
 			PushObject((DBFETCH(my_obj)->sp.exit.dest)[i]);
 		}
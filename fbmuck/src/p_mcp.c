@@ -108,6 +108,13 @@ muf_mcp_callback(McpFrame * mfr, McpMesg * mesg, McpVer version, void *context)
 				CLEAR(&argname);
 				CLEAR(&argval);
 			}
+			if (argstack_reserve(tmpfr, tmpfr->argument.top + 2) < 0) {
+				/* No room to pass the message in, so drop it. */
+				array_free(argarr);
+				notify_nolisten(user, "Program stack overflow.", 1);
+				prog_clean(tmpfr);
+				return;
+			}
 			push(tmpfr->argument.st, &(tmpfr->argument.top), PROG_INTEGER, MIPSCAST & descr);
 			push(tmpfr->argument.st, &(tmpfr->argument.top), PROG_ARRAY, MIPSCAST argarr);
 			tmpfr->pc = ptr->addr;
@@ -348,9 +348,16 @@ prim_fork(PRIM_PROTOTYPE)
 	tmpfr = (struct frame *) calloc(1, sizeof(struct frame));
 	tmpfr->next = NULL;
 
+	/* The child's stacks only need to be as deep as the parent's are now. */
+	if (argstack_reserve(tmpfr, fr->argument.top + 1) < 0 ||
+			sysstack_reserve(tmpfr, fr->system.top) < 0) {
+		frame_release_stacks(tmpfr, -1);
+		free(tmpfr);
+		abort_interp("Out of memory.");
+	}
+
 	tmpfr->system.top = fr->system.top;
-	for (i = 0; i < fr->system.top; i++)
-		tmpfr->system.st[i] = fr->system.st[i];
+	memcpy(tmpfr->system.st, fr->system.st, sizeof(struct stack_addr) * fr->system.top);
 
 	tmpfr->argument.top = fr->argument.top;
 	for (i = 0; i < fr->argument.top; i++)
@@ -472,44 +479,18 @@ prim_stats(PRIM_PROTOTYPE)
 	ref = oper1->data.objref;
 	CLEAR(oper1);
 	{
-		dbref i;
-		int rooms, exits, things, players, programs, garbage;
-
-		/* tmp, ref */
-		rooms = exits = things = players = programs = garbage = 0;
-		for (i = 0; i < db_top; i++) {
-			if (ref == NOTHING || OWNER(i) == ref) {
-				switch (Typeof(i)) {
-				case TYPE_ROOM:
-					rooms++;
-					break;
-				case TYPE_EXIT:
-					exits++;
-					break;
-				case TYPE_THING:
-					things++;
-					break;
-				case TYPE_PLAYER:
-					players++;
-					break;
-				case TYPE_PROGRAM:
-					programs++;
-					break;
-				case TYPE_GARBAGE:
-					garbage++;
-					break;
-				}
-			}
-		}
-		ref = rooms + exits + things + players + programs + garbage;
+		struct objstats st;
+
+		objstats_get(ref, &st);
+		ref = st.rooms + st.exits + st.things + st.players + st.programs + st.garbage;
 		CHECKOFLOW(7);
 		PushInt(ref);
-		PushInt(rooms);
-		PushInt(exits);
-		PushInt(things);
-		PushInt(programs);
-		PushInt(players);
-		PushInt(garbage);
+		PushInt(st.rooms);
+		PushInt(st.exits);
+		PushInt(st.things);
+		PushInt(st.programs);
+		PushInt(st.players);
+		PushInt(st.garbage);
 		/* push results */
 	}
 }
@@ -1166,3 +1147,34 @@ prim_debug_line(PRIM_PROTOTYPE)
 		notify_nolisten(player, msg, 1);
 	}
 }
+
+void
+prim_muf_profile(PRIM_PROTOTYPE)
+{
+	/* s -- s */
+	CHECKOP(1);
+	oper1 = POP();
+	if (mlev < 4)
+		abort_interp("Wizbit only primitive.");
+	if (oper1->type != PROG_STRING)
+		abort_interp("Non-string argument. (1)");
+	if (muf_profile_command(DoNullInd(oper1->data.string), buf, sizeof(buf)) < 0)
+		abort_interp(buf);
+	CLEAR(oper1);
+	PushString(buf);
+}
+
+void
+prim_metrics(PRIM_PROTOTYPE)
+{
+	/* -- d */
+	stk_array *nu;
+
+	CHECKOP(0);
+	if (mlev < 3)
+		abort_interp("Requires Mucker Level 3 or better.");
+	CHECKOFLOW(1);
+	if (!(nu = metrics_array()))
+		abort_interp("This server was compiled without MAIN_LOOP_METRICS.");
+	PushArrayRaw(nu);
+}
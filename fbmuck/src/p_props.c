@@ -194,6 +194,9 @@ prim_getprop(PRIM_PROTOTYPE)
 				temp = PropDataStr(prptr);
 				PushString(temp);
 				break;
+			case PROP_SETTYP:
+				PushString(refset_text(PropDataSet(prptr)));
+				break;
 			case PROP_LOKTYP:
 				if (PropFlags(prptr) & PROP_ISUNLOADED) {
 					PushLock(TRUE_BOOLEXP);
@@ -265,6 +268,9 @@ prim_getpropstr(PRIM_PROTOTYPE)
 			case PROP_STRTYP:
 				temp = PropDataStr(ptr);
 				break;
+			case PROP_SETTYP:
+				temp = refset_text(PropDataSet(ptr));
+				break;
 				/*
 				 *case PROP_INTTYP:
 				 *    snprintf(buf, sizeof(buf), "%d", PropDataVal(ptr));
@@ -393,6 +399,9 @@ prim_envprop(PRIM_PROTOTYPE)
 			case PROP_STRTYP:
 				PushString(PropDataStr(ptr));
 				break;
+			case PROP_SETTYP:
+				PushString(refset_text(PropDataSet(ptr)));
+				break;
 			case PROP_INTTYP:
 				result = PropDataVal(ptr);
 				PushInt(result);
@@ -459,6 +468,9 @@ prim_envpropstr(PRIM_PROTOTYPE)
 			case PROP_STRTYP:
 				temp = PropDataStr(ptr);
 				break;
+			case PROP_SETTYP:
+				temp = refset_text(PropDataSet(ptr));
+				break;
 				/*
 				 *case PROP_INTTYP:
 				 *    snprintf(buf, sizeof(buf), "%d", PropDataVal(ptr));
@@ -961,6 +973,10 @@ prim_array_filter_prop(PRIM_PROTOTYPE)
 								strncpy(buf, PropDataStr(pptr), BUFFER_LEN);
 							break;
 
+							case PROP_SETTYP:
+								strcpyn(buf, BUFFER_LEN, refset_text(PropDataSet(pptr)));
+							break;
+
 							case PROP_LOKTYP:
 								if (PropFlags(pptr) & PROP_ISUNLOADED) {
 									strncpy(buf, "*UNLOCKED*", BUFFER_LEN);
@@ -96,6 +96,51 @@ const char* muf_re_error(int err)
 
 #define MATCH_ARR_SIZE 30
 
+/*
+ * A REGEXP on a long enough string is matched by a MUF worker.  The
+ * pattern has been compiled once already, so that a bad one gives the
+ * same error it always has, but the worker compiles its own copy, since
+ * the cache isn't safe to share.
+ */
+struct regexp_job {
+	struct inst text;
+	struct inst pattern;
+	int flags;
+	int matchcnt;
+	int matches[MATCH_ARR_SIZE];
+};
+
+/* Doesn't touch anything but the job, so it can be run by a worker. */
+static void
+regexp_job_run(void *data)
+{
+	struct regexp_job*	job		= (struct regexp_job *) data;
+	const char*			text	= DoNullInd(job->text.data.string);
+	const char*			errstr;
+	int					erroff;
+	pcre*				re;
+
+	re = pcre_compile(DoNullInd(job->pattern.data.string), job->flags, &errstr, &erroff, NULL);
+	if (re == NULL)
+	{
+		job->matchcnt = PCRE_ERROR_NOMEMORY;
+		return;
+	}
+
+	job->matchcnt = pcre_exec(re, NULL, text, strlen(text), 0, 0, job->matches, MATCH_ARR_SIZE);
+	pcre_free(re);
+}
+
+static void
+regexp_job_release(void *data)
+{
+	struct regexp_job*	job	= (struct regexp_job *) data;
+
+	CLEAR(&job->text);
+	CLEAR(&job->pattern);
+	free(job);
+}
+
 void
 prim_regexp(PRIM_PROTOTYPE)
 {
@@ -108,6 +153,7 @@ prim_regexp(PRIM_PROTOTYPE)
 	int			len, i;
 	int			matchcnt = 0;
 	const char*	errstr;
+	struct regexp_job*	job;
 
 	CHECKOP(3);
 
@@ -135,7 +181,34 @@ prim_regexp(PRIM_PROTOTYPE)
 	text	= DoNullInd(oper1->data.string);
 	len		= strlen(text);
 
-	if ((matchcnt = pcre_exec(re->re, NULL, text, len, 0, 0, matches, MATCH_ARR_SIZE)) < 0)
+	job = (struct regexp_job *) muf_worker_answer(fr, regexp_job_run);
+	if (job && (job->text.data.string != oper1->data.string ||
+				job->pattern.data.string != oper2->data.string || job->flags != flags))
+	{
+		regexp_job_release(job);
+		job = NULL;
+	}
+
+	if (job)
+	{
+		matchcnt = job->matchcnt;
+		memcpy(matches, job->matches, sizeof(matches));
+		regexp_job_release(job);
+	}
+	else if (len >= MUF_WORKER_MIN_TEXT && muf_worker_can_offload(fr, program))
+	{
+		job = (struct regexp_job *) malloc(sizeof(struct regexp_job));
+		copyinst(oper1, &job->text);
+		copyinst(oper2, &job->pattern);
+		job->flags = flags;
+		muf_worker_hold(fr, regexp_job_run, regexp_job_release, job);
+		*top += 3;
+		return;
+	}
+	else
+		matchcnt = pcre_exec(re->re, NULL, text, len, 0, 0, matches, MATCH_ARR_SIZE);
+
+	if (matchcnt < 0)
 	{
 		if (matchcnt != PCRE_ERROR_NOMATCH)
 		{
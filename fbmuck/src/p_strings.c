@@ -1349,10 +1349,11 @@ prim_strcat(PRIM_PROTOTYPE)
 	} else if (oper1->data.string->length + oper2->data.string->length > (BUFFER_LEN) - 1) {
 		abort_interp("Operation would result in overflow.");
 	} else {
-		bcopy(oper2->data.string->data, buf, oper2->data.string->length);
-		bcopy(oper1->data.string->data, buf + oper2->data.string->length,
-			  oper1->data.string->length + 1);
-		string = alloc_prog_string(buf);
+		/* Hand our link to the left string over, so it can grow in place. */
+		string = prog_string_append(oper2->data.string,
+									 oper1->data.string->data,
+									 oper1->data.string->length);
+		oper2->data.string = NULL;
 	}
 	CLEAR(oper1);
 	CLEAR(oper2);
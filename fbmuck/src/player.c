@@ -6,18 +6,215 @@
 #include "interface.h"
 #include "externs.h"
 
-static hash_tab player_list[PLAYER_HASH_SIZE];
+/*
+ * Player names are kept in a hash table, and in an index sorted by name,
+ * which lets partial names be matched with a binary search.  Both point
+ * at the same player_name records, which keep their own copy of the name,
+ * so they stay consistent even if a NAME() is changed without going
+ * through delete_player().  The index is only sorted when it's first
+ * needed, so loading the db just appends to it.
+ */
+struct player_name {
+	dbref player;
+	char name[1];
+};
+
+static hash_tab player_names;
+static int player_count = 0;
+
+static struct player_name **player_index = NULL;
+static int player_index_size = 0;
+static int player_index_sorted = 0;
+
+/* Like string_compare(), but only looks at the first len characters. */
+static int
+player_ncompare(const char *s1, const char *s2, int len)
+{
+	unsigned char c1 = 0, c2 = 0;
+
+	while (len-- > 0) {
+		c1 = tolower(*(const unsigned char *) s1++);
+		c2 = tolower(*(const unsigned char *) s2++);
+		if (!c1 || c1 != c2)
+			break;
+	}
+	return c1 - c2;
+}
+
+static int
+player_index_cmp(const void *a, const void *b)
+{
+	return string_compare((*(struct player_name * const *) a)->name,
+						  (*(struct player_name * const *) b)->name);
+}
+
+static void
+player_index_sort(void)
+{
+	if (!player_index_sorted) {
+		qsort(player_index, player_count, sizeof(struct player_name *), player_index_cmp);
+		player_index_sorted = 1;
+	}
+}
+
+/* First index entry not sorting before name, comparing at most len chars. */
+static int
+player_index_find(const char *name, int len)
+{
+	int lo = 0, hi = player_count;
+	int mid;
+
+	player_index_sort();
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (player_ncompare(player_index[mid]->name, name, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* First index entry past all of the names starting with prefix. */
+static int
+player_index_prefix_end(const char *prefix, int len)
+{
+	int lo = 0, hi = player_count;
+	int mid;
+
+	player_index_sort();
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (player_ncompare(player_index[mid]->name, prefix, len) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void
+player_index_add(struct player_name *p)
+{
+	int i;
+
+	if (player_count >= player_index_size) {
+		player_index_size = player_index_size ? player_index_size * 2 : PLAYER_HASH_SIZE;
+		player_index = (struct player_name **)
+				realloc(player_index, player_index_size * sizeof(struct player_name *));
+		if (!player_index) {
+			perror("player_index_add: out of memory!");
+			abort();
+		}
+	}
+	if (player_index_sorted) {
+		i = player_index_find(p->name, BUFFER_LEN);
+		memmove(&player_index[i + 1], &player_index[i],
+				(player_count - i) * sizeof(struct player_name *));
+		player_index[i] = p;
+	} else {
+		player_index[player_count] = p;
+	}
+}
+
+static void
+player_index_remove(struct player_name *p)
+{
+	int i = player_index_find(p->name, BUFFER_LEN);
+
+	if (i < player_count && player_index[i] == p) {
+		memmove(&player_index[i], &player_index[i + 1],
+				(player_count - i - 1) * sizeof(struct player_name *));
+	}
+}
+
+/* Adds name for who, or points an existing entry for name at who. */
+static void
+player_name_add(const char *name, dbref who)
+{
+	hash_data *hd;
+	hash_data nd;
+	struct player_name *p;
+	int len = strlen(name);
+
+	if (!player_names.minsize)
+		hash_init(&player_names, PLAYER_HASH_SIZE, 0);
+	if ((hd = find_hash(name, &player_names))) {
+		((struct player_name *) hd->pval)->player = who;
+		return;
+	}
+
+	p = (struct player_name *) malloc(sizeof(struct player_name) + len);
+	if (!p) {
+		perror("player_name_add: out of memory!");
+		abort();
+	}
+	p->player = who;
+	strcpyn(p->name, len + 1, name);
+
+	nd.pval = (void *) p;
+	add_hash(name, nd, &player_names);
+	player_index_add(p);
+	player_count++;
+}
+
+/* Returns nonzero if name wasn't there to remove. */
+static int
+player_name_remove(const char *name)
+{
+	hash_data *hd;
+	struct player_name *p;
+
+	if (!(hd = find_hash(name, &player_names)))
+		return 1;
+	p = (struct player_name *) hd->pval;
+	free_hash(name, &player_names);
+	player_index_remove(p);
+	player_count--;
+	free(p);
+	return 0;
+}
 
 dbref
 lookup_player(const char *name)
 {
 	hash_data *hd;
 
-	if ((hd = find_hash(name, player_list, PLAYER_HASH_SIZE)) == NULL) {
+	if (!(hd = find_hash(name, &player_names)))
 		return NOTHING;
-	} else {
-		return (hd->dbval);
+	return ((struct player_name *) hd->pval)->player;
+}
+
+/* How many players have names starting with prefix. */
+int
+count_player_prefix(const char *prefix)
+{
+	int len = strlen(prefix);
+
+	return player_index_prefix_end(prefix, len) - player_index_find(prefix, len);
+}
+
+/*
+ * Returns the player whose name starts with prefix, AMBIGUOUS if there's
+ * more than one, or NOTHING.  If connected is set, only players who are
+ * online are considered.
+ */
+dbref
+match_player_prefix(const char *prefix, int connected)
+{
+	int len = strlen(prefix);
+	int i = player_index_find(prefix, len);
+	int end = player_index_prefix_end(prefix, len);
+	dbref found = NOTHING;
+
+	for (; i < end; i++) {
+		if (connected && !online(player_index[i]->player))
+			continue;
+		if (found != NOTHING)
+			return AMBIGUOUS;
+		found = player_index[i]->player;
 	}
+	return found;
 }
 
 
@@ -153,21 +350,19 @@ do_password(dbref player, const char *old, const char *newobj)
 void
 clear_players(void)
 {
-	kill_hash(player_list, PLAYER_HASH_SIZE, 0);
+	kill_hash(&player_names, 1);
+	free(player_index);
+	player_index = NULL;
+	player_count = 0;
+	player_index_size = 0;
+	player_index_sorted = 0;
 	return;
 }
 
 void
 add_player(dbref who)
 {
-	hash_data hd;
-
-	hd.dbval = who;
-	if (add_hash(NAME(who), hd, player_list, PLAYER_HASH_SIZE) == NULL) {
-		panic("Out of memory");
-	} else {
-		return;
-	}
+	player_name_add(NAME(who), who);
 }
 
 
@@ -181,7 +376,7 @@ delete_player(dbref who)
 	dbref found, ren;
 
 
-	result = free_hash(NAME(who), player_list, PLAYER_HASH_SIZE);
+	result = player_name_remove(NAME(who));
 
 	if (result) {
 		wall_wizards
@@ -205,7 +400,7 @@ delete_player(dbref who)
 					log_status("SANITY NAME CHANGE: %s(#%d) to %s", NAME(ren), ren, namebuf);
 
 					if (ren == found) {
-						free_hash(NAME(ren), player_list, PLAYER_HASH_SIZE);
+						player_name_remove(NAME(ren));
 					}
 					if (NAME(ren)) {
 						free((void *) NAME(ren));
@@ -218,7 +413,7 @@ delete_player(dbref who)
 				}
 			}
 		}
-		result = free_hash(NAME(who), player_list, PLAYER_HASH_SIZE);
+		result = player_name_remove(NAME(who));
 		if (result) {
 			wall_wizards
 					("## WARNING: Playername hashtable still inconsistent.  Now you can panic.");
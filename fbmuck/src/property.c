@@ -18,8 +18,8 @@
 
 
 
-void
-set_property_nofetch(dbref player, const char *pname, PData * dat)
+static void
+store_property(dbref player, const char *pname, PData * dat)
 {
 	PropPtr p;
 	char buf[BUFFER_LEN];
@@ -99,6 +99,20 @@ set_property_nofetch(dbref player, const char *pname, PData * dat)
 	case PROP_LOKTYP:
 		SetPDataLok(p, dat->data.lok);
 		break;
+	case PROP_SETTYP:
+		/* The prop takes over the set, as with locks. */
+		if (!dat->data.set || !dat->data.set->count) {
+			if (dat->data.set)
+				refset_free(dat->data.set);
+			SetPType(p, PROP_DIRTYP);
+			SetPDataVal(p, 0);
+			if (!PropDir(p)) {
+				remove_property_nofetch(player, pname);
+			}
+		} else {
+			SetPDataSet(p, dat->data.set);
+		}
+		break;
 	case PROP_DIRTYP:
 		SetPDataVal(p, 0);
 		if (!PropDir(p)) {
@@ -108,6 +122,23 @@ set_property_nofetch(dbref player, const char *pname, PData * dat)
 	}
 }
 
+void
+set_property_nofetch(dbref player, const char *pname, PData * dat)
+{
+#ifdef HEAP_SAMPLING
+	struct CrT_prop_context ctx;
+
+	/* Let the heap sampler charge what this allocates to the prop tree. */
+	if (CrT_sample_rate) {
+		CrT_enter_prop_context(&ctx, player, pname);
+		store_property(player, pname, dat);
+		CrT_leave_prop_context(&ctx);
+		return;
+	}
+#endif
+	store_property(player, pname, dat);
+}
+
 
 void
 set_property(dbref player, const char *name, PData * dat)
@@ -341,6 +372,8 @@ has_property_strict(int descr, dbref player, dbref what, const char *pname, cons
 			return (value == PropDataVal(p));
 		    case PROP_FLTTYP:
 			return (value == (int) PropDataFVal(p));
+		    case PROP_SETTYP:
+			return (equalstr((char *) strval, (char *) refset_text(PropDataSet(p))));
 		    default:
 			/* assume other types don't match */
 			return 0;
@@ -360,6 +393,8 @@ get_property_class(dbref player, const char *pname)
 #ifdef DISKBASE
 		propfetch(player, p);
 #endif
+		if (PropType(p) == PROP_SETTYP)
+			return refset_text(PropDataSet(p));
 		if (PropType(p) != PROP_STRTYP)
 			return (char *) NULL;
 		return (PropDataStr(p));
@@ -425,6 +460,24 @@ get_property_dbref(dbref player, const char *pname)
 }
 
 
+/* return the dbref set of a reflist property, or NULL if it isn't one */
+struct refset *
+get_property_refset(dbref player, const char *pname)
+{
+	PropPtr p;
+
+	p = get_property(player, pname);
+	if (!p)
+		return NULL;
+#ifdef DISKBASE
+	propfetch(player, p);
+#endif
+	if (PropType(p) != PROP_SETTYP)
+		return NULL;
+	return PropDataSet(p);
+}
+
+
 /* return boolexp lock of property */
 struct boolexp *
 get_property_lock(dbref player, const char *pname)
@@ -609,6 +662,142 @@ next_prop(PropPtr list, PropPtr prop, char *name, int maxlen)
 
 
 
+/* Returns the root node of the given propdir's tree, or NULL. */
+static PropPtr
+propcursor_dir_root(dbref player, const char *dir)
+{
+	char buf[BUFFER_LEN];
+	PropPtr p;
+
+	while (*dir == PROPDIR_DELIMITER)
+		dir++;
+	if (!*dir)
+		return DBFETCH(player)->properties;
+	strcpyn(buf, sizeof(buf), dir);
+	p = propdir_get_elem(DBFETCH(player)->properties, buf);
+	return p ? PropDir(p) : NULL;
+}
+
+static PropPtr
+propcursor_found(PropCursor * cur, PropPtr p)
+{
+	cur->generation = prop_tree_generation;
+	if (p) {
+		strcpyn(cur->name, sizeof(cur->name), PropName(p));
+	} else {
+		cur->depth = 0;
+		*cur->name = '\0';
+	}
+	return p;
+}
+
+
+/* propcursor_first() points a cursor at the first property in a propdir.
+ * cur      the cursor to initialize.
+ * player   object the properties are on.
+ * dir      name of the propdir to iterate.
+ *
+ * Returns the first property node, or NULL if the propdir is empty or does
+ * not exist.  The name of the current property is kept in cur->name.
+ */
+PropPtr
+propcursor_first_nofetch(PropCursor * cur, dbref player, const char *dir)
+{
+	cur->obj = player;
+	strcpyn(cur->dir, sizeof(cur->dir), dir ? dir : "");
+	return propcursor_found(cur,
+			propcursor_seek_node(cur, propcursor_dir_root(player, cur->dir), NULL));
+}
+
+PropPtr
+propcursor_first(PropCursor * cur, dbref player, const char *dir)
+{
+#ifdef DISKBASE
+	fetchprops(player, dir);
+#endif
+
+	return propcursor_first_nofetch(cur, player, dir);
+}
+
+
+/* propcursor_seek() points a cursor at the first property in a propdir
+ * that sorts after the given name, whether or not that name exists.
+ */
+PropPtr
+propcursor_seek(PropCursor * cur, dbref player, const char *dir, const char *after)
+{
+	PropPtr p;
+
+#ifdef DISKBASE
+	fetchprops(player, dir);
+#endif
+
+	cur->obj = player;
+	strcpyn(cur->dir, sizeof(cur->dir), dir ? dir : "");
+	p = propcursor_seek_node(cur, propcursor_dir_root(player, cur->dir), after);
+	return propcursor_found(cur, p);
+}
+
+
+/* propcursor_next() steps a cursor to the next property in its propdir.
+ * Returns NULL once there are no more.  If properties have been added or
+ * removed anywhere since the cursor last moved, its saved path may be
+ * stale, so it looks its place back up by name.
+ */
+PropPtr
+propcursor_next(PropCursor * cur)
+{
+	if (!*cur->name)
+		return NULL;
+
+	if (cur->generation != prop_tree_generation) {
+#ifdef DISKBASE
+		fetchprops(cur->obj, cur->dir);
+#endif
+		return propcursor_found(cur,
+				propcursor_seek_node(cur, propcursor_dir_root(cur->obj, cur->dir),
+									 cur->name));
+	}
+	return propcursor_found(cur, propcursor_next_node(cur));
+}
+
+
+/*
+ * next_prop_name() is normally called in a loop, with the name it returned
+ * last time.  Keep the cursors for the last few such loops around, so that
+ * each step can pick up where the previous one left off.
+ */
+#define PROPNAME_CURSORS 8
+static PropCursor *propname_cursors[PROPNAME_CURSORS];
+static int propname_cursor_next = 0;
+
+static PropCursor *
+propname_cursor_find(dbref player, const char *dir, const char *name)
+{
+	int i;
+
+	for (i = 0; i < PROPNAME_CURSORS; i++) {
+		PropCursor *cur = propname_cursors[i];
+
+		if (cur && cur->obj == player && *cur->name &&
+			!strcmp(cur->name, name) && !strcmp(cur->dir, dir))
+			return cur;
+	}
+	return NULL;
+}
+
+static PropCursor *
+propname_cursor_alloc(void)
+{
+	PropCursor **slot = &propname_cursors[propname_cursor_next];
+
+	propname_cursor_next = (propname_cursor_next + 1) % PROPNAME_CURSORS;
+	if (!*slot)
+		*slot = (PropCursor *) malloc(sizeof(PropCursor));
+	return *slot;
+}
+
+
 /* next_prop_name() returns a ptr to the string name of the next property.
  * player   object the properties are on.
  * outbuf   pointer to buffer to return the next prop's name in.
@@ -621,18 +810,20 @@ next_prop(PropPtr list, PropPtr prop, char *name, int maxlen)
 char *
 next_prop_name(dbref player, char *outbuf, int outbuflen, char *name)
 {
-	char *ptr;
-	char buf[BUFFER_LEN];
-	PropPtr p, l;
-
-#ifdef DISKBASE
-	fetchprops(player, propdir_name(name));
-#endif
+	char dir[BUFFER_LEN];
+	char *leaf;
+	int len;
+	PropCursor *cur;
+	PropPtr p;
 
-	strcpyn(buf, sizeof(buf), name);
-	if (!*name || name[strlen(name) - 1] == PROPDIR_DELIMITER) {
-		l = DBFETCH(player)->properties;
-		p = propdir_first_elem(l, buf);
+	len = strlen(name);
+	if (!len || name[len - 1] == PROPDIR_DELIMITER) {
+		/* The names we return will be split at name's last delimiter. */
+		strcpyn(dir, sizeof(dir), name);
+		if (len)
+			dir[len - 1] = '\0';
+		cur = propname_cursor_alloc();
+		p = propcursor_first(cur, player, dir);
 		if (!p) {
 			*outbuf = '\0';
 			return NULL;
@@ -640,23 +831,29 @@ next_prop_name(dbref player, char *outbuf, int outbuflen, char *name)
 		strcpyn(outbuf, outbuflen, name);
 		strcatn(outbuf, outbuflen, PropName(p));
 	} else {
-		l = DBFETCH(player)->properties;
-		p = propdir_next_elem(l, buf);
+		strcpyn(dir, sizeof(dir), name);
+		leaf = rindex(dir, PROPDIR_DELIMITER);
+		if (leaf) {
+			*leaf++ = '\0';
+		} else {
+			leaf = name;
+			*dir = '\0';
+		}
+		if ((cur = propname_cursor_find(player, dir, leaf))) {
+			p = propcursor_next(cur);
+		} else {
+			cur = propname_cursor_alloc();
+			p = propcursor_seek(cur, player, dir, leaf);
+		}
 		if (!p) {
 			*outbuf = '\0';
 			return NULL;
 		}
-		strcpyn(outbuf, outbuflen, name);
-		ptr = rindex(outbuf, PROPDIR_DELIMITER);
-		if (!ptr)
-			ptr = outbuf;
-		*(ptr++) = PROPDIR_DELIMITER;
-		strcpyn(ptr, outbuflen - (ptr-outbuf), PropName(p));
+		snprintf(outbuf, outbuflen, "%s%c%s", dir, PROPDIR_DELIMITER, PropName(p));
 	}
 	return outbuf;
 }
 
-
 long
 size_properties(dbref player, int load)
 {
@@ -756,6 +953,10 @@ displayprop(dbref player, dbref obj, const char *name, char *buf, size_t bufsiz)
 	case PROP_REFTYP:
 		snprintf(buf, bufsiz, "%c ref %s:%s", blesschar, mybuf, unparse_object(player, PropDataRef(p)));
 		break;
+	case PROP_SETTYP:
+		snprintf(buf, bufsiz, "%c set %s:%.*s", blesschar, mybuf, (BUFFER_LEN / 2),
+				refset_text(PropDataSet(p)));
+		break;
 	case PROP_INTTYP:
 		snprintf(buf, bufsiz, "%c int %s:%d", blesschar, mybuf, PropDataVal(p));
 		break;
@@ -783,6 +984,74 @@ displayprop(dbref player, dbref obj, const char *name, char *buf, size_t bufsiz)
 
 extern short db_conversion_flag;
 
+/*
+ * Loads a reflist that db_putprop() wrote out from a PROP_SETTYP prop.
+ * The first line makes the set, and any PROP_SETTYP lines after it add
+ * the refs that didn't fit on it.  Lines can be longer than the line
+ * buffer; if this one was, partial is set, and the rest of the line is
+ * read in here.  Returns 0 if the list doesn't parse, so that the caller
+ * can load it as a string.
+ */
+static int
+db_get_reflist_prop(FILE * f, dbref obj, PropPtr pnode, const char *name,
+					int flg, const char *value, int partial)
+{
+	struct refset *set;
+	char buf[BUFFER_LEN];
+	char *line = NULL;
+	size_t len, size;
+	PropPtr p;
+	PData mydat;
+	dbref ref;
+	int pos = 0;
+
+	if (partial) {
+		len = strlen(value);
+		size = len + BUFFER_LEN * 4;
+		line = (char *) malloc(size);
+		memcpy(line, value, len + 1);
+		while (fgets(line + len, size - len, f)) {
+			len += strlen(line + len);
+			if (line[len - 1] == '\n') {
+				line[--len] = '\0';
+				break;
+			}
+			if (size - len < BUFFER_LEN) {
+				size *= 2;
+				line = (char *) realloc(line, size);
+			}
+		}
+		value = line;
+	}
+	set = refset_parse(value);
+	if (line)
+		free(line);
+	if (!set)
+		return 0;
+
+	if ((flg & PROP_TYPMASK) == PROP_SETTYP && !pnode) {
+		strcpyn(buf, sizeof(buf), name);
+		p = propdir_get_elem(DBFETCH(obj)->properties, buf);
+		if (p && PropType(p) == PROP_SETTYP) {
+			while (refset_walk(set, &pos, &ref))
+				refset_add(PropDataSet(p), ref);
+			refset_free(set);
+			return 1;
+		}
+	}
+
+	flg = (flg & ~(PROP_TYPMASK | PROP_REFLIST | PROP_ISUNLOADED)) | PROP_SETTYP;
+	if (pnode) {
+		SetPDataSet(pnode, set);
+		SetPFlagsRaw(pnode, flg);
+	} else {
+		mydat.flags = flg;
+		mydat.data.set = set;
+		set_property_nofetch(obj, name, &mydat);
+	}
+	return 1;
+}
+
 int
 db_get_single_prop(FILE * f, dbref obj, long pos, PropPtr pnode, const char *pdir)
 {
@@ -858,6 +1127,9 @@ db_get_single_prop(FILE * f, dbref obj, long pos, PropPtr pnode, const char *pdi
 
 	switch (flg & PROP_TYPMASK) {
 	case PROP_STRTYP:
+		if ((flg & PROP_REFLIST) && db_get_reflist_prop(f, obj, pnode, name, flg, value, !p))
+			break;
+		flg &= ~PROP_REFLIST;
 		if (!do_diskbase_propvals || pos) {
 			flg &= ~PROP_ISUNLOADED;
 			if (pnode) {
@@ -952,6 +1224,15 @@ db_get_single_prop(FILE * f, dbref obj, long pos, PropPtr pnode, const char *pdi
 		mydat.data.ref = atoi(value);
 		set_property_nofetch(obj, name, &mydat);
 		break;
+	case PROP_SETTYP:
+		if (!db_get_reflist_prop(f, obj, pnode, name, flg, value, !p)) {
+			wall_wizards("## WARNING! A corrupt property was found while trying to read it from disk.");
+			wall_wizards("##   This property has been skipped and will not be loaded.  See the sanity");
+			wall_wizards("##   logfile for technical details.");
+			log_sanity("Failed to read property from disk: Corrupt reflist value.  obj = #%d, pos = %ld, pdir = %s, data = %s:%s:%s", obj, pos, pdir, name, flags, value);
+			return -1;
+		}
+		break;
 	case PROP_DIRTYP:
 		break;
 	}
@@ -971,6 +1252,7 @@ db_putprop(FILE * f, const char *dir, PropPtr p)
 	char buf[BUFFER_LEN * 2];
 	const char *ptr2;
 	char tbuf[50];
+	int setpos, more;
 	int outflags = (PropFlagsRaw(p) & ~(PROP_TOUCHED | PROP_ISUNLOADED | PROP_DIRUNLOADED));
 
 	if (PropType(p) == PROP_DIRTYP)
@@ -1006,6 +1288,22 @@ db_putprop(FILE * f, const char *dir, PropPtr p)
 			return;
 		ptr2 = unparse_boolexp((dbref) 1, PropDataLok(p), 0);
 		break;
+	case PROP_SETTYP:
+		/* The first line is a reflist string that older servers can read.
+		   Whatever doesn't fit on it goes on lines of set type after it. */
+		outflags = (outflags & ~PROP_TYPMASK) | PROP_STRTYP | PROP_REFLIST;
+		setpos = 0;
+		do {
+			if (fprintf(f, "%s%s%c%d%c", dir+1, PropName(p), PROP_DELIMITER,
+						outflags, PROP_DELIMITER) < 0 ||
+				(more = refset_write(f, PropDataSet(p), &setpos)) == EOF ||
+				putc('\n', f) == EOF) {
+				log_sanity("Failed to write out property db_putprop(dir = %s)", dir);
+				abort();
+			}
+			outflags = (outflags & ~(PROP_TYPMASK | PROP_REFLIST)) | PROP_SETTYP;
+		} while (more);
+		return;
 	}
 
 	snprintf(buf, sizeof(buf), "%s%s%c%d%c%s\n",
@@ -1121,6 +1419,51 @@ untouchprops_incremental(int limit)
 }
 
 
+/*
+ * Reflists are kept in PROP_SETTYP props.  A reflist that is still a
+ * "#1 #2 #3" string is turned into a set when it is first changed, as
+ * long as it's in exactly the form the set would give back, so that
+ * nothing reading it can tell.  Finding a ref in it leaves it alone.  Any other string is left alone, and
+ * searched and edited as a string, as before.
+ */
+static struct refset *
+reflist_set(PropPtr ptr)
+{
+	struct refset *set;
+
+	if (PropType(ptr) == PROP_SETTYP)
+		return PropDataSet(ptr);
+	if (PropType(ptr) != PROP_STRTYP || !(set = refset_parse(PropDataStr(ptr))))
+		return NULL;
+	clear_propnode(ptr);
+	SetPType(ptr, PROP_SETTYP);
+	SetPDataSet(ptr, set);
+	return set;
+}
+
+static void
+reflist_changed(dbref obj)
+{
+#ifdef DISKBASE
+	dirtyprops(obj);
+#endif
+	DBDIRTY(obj);
+}
+
+static void
+reflist_new(dbref obj, const char *propname, dbref first, dbref second)
+{
+	PData mydat;
+
+	mydat.flags = PROP_SETTYP;
+	mydat.data.set = refset_new();
+	if (first != second)
+		refset_add(mydat.data.set, first);
+	refset_add(mydat.data.set, second);
+	set_property(obj, propname, &mydat);
+}
+
+
 void
 reflist_add(dbref obj, const char* propname, dbref toadd)
 {
@@ -1131,6 +1474,7 @@ reflist_add(dbref obj, const char* propname, dbref toadd)
 	int charcount = 0;
 	char buf[BUFFER_LEN];
 	char outbuf[BUFFER_LEN];
+	struct refset *set;
 
 	ptr = get_property(obj, propname);
 	if (ptr) {
@@ -1139,6 +1483,11 @@ reflist_add(dbref obj, const char* propname, dbref toadd)
 #ifdef DISKBASE
 		propfetch(obj, ptr);
 #endif
+		if ((set = reflist_set(ptr))) {
+			refset_add(set, toadd);
+			reflist_changed(obj);
+			return;
+		}
 		switch (PropType(ptr)) {
 		case PROP_STRTYP:
 			*outbuf = '\0';
@@ -1179,19 +1528,15 @@ reflist_add(dbref obj, const char* propname, dbref toadd)
 			}
 			break;
 		case PROP_REFTYP:
-			if (PropDataRef(ptr) != toadd) {
-				snprintf(outbuf, sizeof(outbuf), "#%d #%d", PropDataRef(ptr), toadd);
-				add_property(obj, propname, outbuf, 0);
-			}
+			if (PropDataRef(ptr) != toadd)
+				reflist_new(obj, propname, PropDataRef(ptr), toadd);
 			break;
 		default:
-			snprintf(outbuf, sizeof(outbuf), "#%d", toadd);
-			add_property(obj, propname, outbuf, 0);
+			reflist_new(obj, propname, toadd, toadd);
 			break;
 		}
 	} else {
-		snprintf(outbuf, sizeof(outbuf), "#%d", toadd);
-		add_property(obj, propname, outbuf, 0);
+		reflist_new(obj, propname, toadd, toadd);
 	}
 }
 
@@ -1206,6 +1551,7 @@ reflist_del(dbref obj, const char* propname, dbref todel)
 	int charcount = 0;
 	char buf[BUFFER_LEN];
 	char outbuf[BUFFER_LEN];
+	struct refset *set;
 
 	ptr = get_property(obj, propname);
 	if (ptr) {
@@ -1214,6 +1560,15 @@ reflist_del(dbref obj, const char* propname, dbref todel)
 #ifdef DISKBASE
 		propfetch(obj, ptr);
 #endif
+		if ((set = reflist_set(ptr))) {
+			if (refset_del(set, todel)) {
+				if (set->count)
+					reflist_changed(obj);
+				else
+					add_property(obj, propname, "", 0);
+			}
+			return;
+		}
 		switch (PropType(ptr)) {
 		case PROP_STRTYP:
 			*outbuf = '\0';
@@ -1275,6 +1630,8 @@ reflist_find(dbref obj, const char* propname, dbref tofind)
 #ifdef DISKBASE
 		propfetch(obj, ptr);
 #endif
+		if (PropType(ptr) == PROP_SETTYP)
+			return refset_find(PropDataSet(ptr), tofind);
 		switch (PropType(ptr)) {
 		case PROP_STRTYP:
 			temp = PropDataStr(ptr);
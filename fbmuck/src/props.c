@@ -17,6 +17,22 @@
 
 #define Comparator(x,y) string_compare(x,y)
 
+/*
+ * Bumped whenever a node is added to or removed from any property tree,
+ * which is what invalidates the paths saved in PropCursors.  It is left
+ * alone while prop_tree_frozen is set, which the database loader does
+ * while it has several threads building trees, and bumps it afterwards.
+ */
+unsigned long prop_tree_generation = 0;
+int prop_tree_frozen = 0;
+
+static void
+prop_tree_changed(void)
+{
+	if (!prop_tree_frozen)
+		prop_tree_generation++;
+}
+
 static PropPtr
 find(char *key, PropPtr avl)
 {
@@ -179,6 +195,8 @@ free_propnode(PropPtr p)
 			free((void *) PropDataStr(p));
 		if (PropType(p) == PROP_LOKTYP)
 			free_boolexp(PropDataLok(p));
+		if (PropType(p) == PROP_SETTYP)
+			refset_free(PropDataSet(p));
 	}
 	free(p);
 }
@@ -193,6 +211,8 @@ clear_propnode(PropPtr p)
 	        }
 		if (PropType(p) == PROP_LOKTYP)
 			free_boolexp(PropDataLok(p));
+		if (PropType(p) == PROP_SETTYP)
+			refset_free(PropDataSet(p));
 	}
 	SetPDataVal(p, 0);
 	SetPFlags(p, (PropFlags(p) & ~PROP_ISUNLOADED));
@@ -200,35 +220,47 @@ clear_propnode(PropPtr p)
 }
 
 
+/*
+ * The rebalance flag is passed down rather than kept in a static, so that
+ * the parallel database loader can build several trees at once.
+ */
 static PropPtr
-insert(char *key, PropPtr * avl)
+insert_node(char *key, PropPtr * avl, short *balancep)
 {
 	PropPtr ret;
 	register PropPtr p = *avl;
 	register int cmp;
-	static short balancep;
 
 	if (p) {
 		cmp = Comparator(key, PropName(p));
 		if (cmp > 0) {
-			ret = insert(key, &(AVL_RT(p)));
+			ret = insert_node(key, &(AVL_RT(p)), balancep);
 		} else if (cmp < 0) {
-			ret = insert(key, &(AVL_LF(p)));
+			ret = insert_node(key, &(AVL_LF(p)), balancep);
 		} else {
-			balancep = 0;
+			*balancep = 0;
 			return (p);
 		}
-		if (balancep) {
+		if (*balancep) {
 			*avl = balance_node(p);
 		}
 		return ret;
 	} else {
 		p = *avl = alloc_propnode(key);
-		balancep = 1;
+		prop_tree_changed();
+		*balancep = 1;
 		return (p);
 	}
 }
 
+static PropPtr
+insert(char *key, PropPtr * avl)
+{
+	short balancep = 0;
+
+	return insert_node(key, avl, &balancep);
+}
+
 static PropPtr
 getmax(PropPtr avl)
 {
@@ -281,8 +313,10 @@ delnode(char *key, PropPtr avl)
 	PropPtr save;
 
 	save = remove_propnode(key, &avl);
-	if (save)
+	if (save) {
 		free_propnode(save);
+		prop_tree_changed();
+	}
 	return avl;
 }
 
@@ -296,6 +330,7 @@ delete_proplist(PropPtr p)
 	delete_proplist(PropDir(p));
 	delete_proplist(AVL_RT(p));
 	free_propnode(p);
+	prop_tree_changed();
 }
 
 PropPtr
@@ -359,6 +394,70 @@ next_node(PropPtr ptr, char *name)
 }
 
 
+/* Pushes the path from p down to the leftmost node beneath it. */
+static void
+propcursor_push_left(PropCursor * cur, PropPtr p)
+{
+	while (p && cur->depth < PROPCURSOR_MAXDEPTH) {
+		cur->stack[cur->depth++] = p;
+		p = AVL_LF(p);
+	}
+}
+
+
+/*
+ * Points the cursor at the first node in the tree at root that sorts after
+ * the given name, or at the very first node if name is NULL.  Returns that
+ * node, or NULL if there isn't one.
+ */
+PropPtr
+propcursor_seek_node(PropCursor * cur, PropPtr root, const char *name)
+{
+	int cmpval;
+	int keep = 0;
+
+	cur->depth = 0;
+	if (!name) {
+		propcursor_push_left(cur, root);
+		return cur->depth ? cur->stack[cur->depth - 1] : NULL;
+	}
+	while (root && cur->depth < PROPCURSOR_MAXDEPTH) {
+		cur->stack[cur->depth++] = root;
+		cmpval = Comparator(name, PropName(root));
+		if (cmpval < 0) {
+			keep = cur->depth;
+			root = AVL_LF(root);
+		} else if (cmpval > 0) {
+			root = AVL_RT(root);
+		} else {
+			return propcursor_next_node(cur);
+		}
+	}
+	cur->depth = keep;
+	return keep ? cur->stack[keep - 1] : NULL;
+}
+
+
+/* Steps the cursor to the in-order successor of its current node. */
+PropPtr
+propcursor_next_node(PropCursor * cur)
+{
+	PropPtr p;
+
+	if (!cur->depth)
+		return NULL;
+	p = cur->stack[cur->depth - 1];
+	if (AVL_RT(p)) {
+		propcursor_push_left(cur, AVL_RT(p));
+	} else {
+		do {
+			p = cur->stack[--cur->depth];
+		} while (cur->depth && AVL_RT(cur->stack[cur->depth - 1]) == p);
+	}
+	return cur->depth ? cur->stack[cur->depth - 1] : NULL;
+}
+
+
 /* copies properties */
 void
 copy_proplist(dbref obj, PropPtr * nu, PropPtr old)
@@ -389,6 +488,9 @@ copy_proplist(dbref obj, PropPtr * nu, PropPtr old)
 		case PROP_FLTTYP:
 			SetPDataFVal(p, PropDataFVal(old));
 			break;
+		case PROP_SETTYP:
+			SetPDataSet(p, refset_copy(PropDataSet(old)));
+			break;
 		default:
 			SetPDataVal(p, PropDataVal(old));
 			break;
@@ -423,6 +525,9 @@ size_proplist(PropPtr avl)
 		case PROP_LOKTYP:
 			bytes += size_boolexp(PropDataLok(avl));
 			break;
+		case PROP_SETTYP:
+			bytes += refset_size(PropDataSet(avl));
+			break;
 		default:
 			break;
 		}
@@ -0,0 +1,339 @@
+#include "config.h"
+#include "params.h"
+
+#include "db.h"
+#include "props.h"
+#include "externs.h"
+#include <limits.h>
+
+/* refset.c -- sets of dbrefs, kept in the order they were added.
+ *
+ * These hold the value of reflist props, so that REFLIST_FIND, _ADD and
+ * _DEL don't have to rescan and rebuild a "#1 #2 #3" string every time,
+ * and so that reflists aren't limited to BUFFER_LEN characters.  Code
+ * that reads a reflist as a string still only sees as much of it as will
+ * fit in BUFFER_LEN, as before.
+ *
+ * The refs are kept in order[], in the order they were added.  A ref
+ * that is taken out leaves a gap there, and the gaps are squeezed out
+ * whenever the array fills up.  slots[] is a hash table, with linear
+ * probing, that finds a ref's place in order[].  tree[] is a Fenwick
+ * tree over order[], counting the refs that are still there, so that a
+ * ref's position in the list can be worked out without walking it.
+ */
+
+#define REFSET_MIN_SIZE 8
+
+/* A gap in order[], where a ref used to be. */
+#define REFSET_GONE ((dbref) INT_MIN)
+
+static unsigned int
+refset_hashval(dbref ref)
+{
+	unsigned int hashval = (unsigned int) ref * 2654435761U;
+
+	return hashval ^ (hashval >> 15);
+}
+
+/* Returns the slot in slots[] holding ref, or the empty slot where it
+   would go. */
+static unsigned int
+refset_probe(const struct refset *set, dbref ref)
+{
+	unsigned int i = refset_hashval(ref) & set->mask;
+
+	while (set->slots[i] && set->order[set->slots[i] - 1] != ref)
+		i = (i + 1) & set->mask;
+	return i;
+}
+
+static void
+refset_tree_add(struct refset *set, int pos, int delta)
+{
+	for (pos++; pos <= set->size; pos += pos & -pos)
+		set->tree[pos] += delta;
+}
+
+/* Returns how many refs are in order[0] through order[pos]. */
+static int
+refset_tree_count(const struct refset *set, int pos)
+{
+	int count = 0;
+
+	for (pos++; pos > 0; pos -= pos & -pos)
+		count += set->tree[pos];
+	return count;
+}
+
+static void *
+refset_alloc(size_t count, size_t size)
+{
+	void *ptr = calloc(count, size);
+
+	if (!ptr) {
+		fprintf(stderr, "PANIC: Out of memory in refset_alloc()\n");
+		abort();
+	}
+	return ptr;
+}
+
+/*
+ * Moves the refs into fresh arrays with room for size of them, closing
+ * up any gaps, and rebuilds the hash table and the Fenwick tree.
+ */
+static void
+refset_rebuild(struct refset *set, int size)
+{
+	dbref *order = (dbref *) refset_alloc(size, sizeof(dbref));
+	unsigned int hashsize = 16;
+	int i, j, count = 0;
+
+	while (hashsize < (unsigned int) size * 2)
+		hashsize *= 2;
+	for (i = 0; i < set->used; i++) {
+		if (set->order[i] != REFSET_GONE)
+			order[count++] = set->order[i];
+	}
+
+	free((void *) set->order);
+	free((void *) set->tree);
+	free((void *) set->slots);
+	set->order = order;
+	set->tree = (int *) refset_alloc(size + 1, sizeof(int));
+	set->slots = (unsigned int *) refset_alloc(hashsize, sizeof(unsigned int));
+	set->mask = hashsize - 1;
+	set->size = size;
+	set->used = set->count = count;
+
+	for (i = 1; i <= count; i++) {
+		set->tree[i] = 1;
+		set->slots[refset_probe(set, order[i - 1])] = i;
+	}
+	/* Every node passes its count up, even the empty ones past count,
+	   since the refs added later will go under them. */
+	for (i = 1; i <= size; i++) {
+		j = i + (i & -i);
+		if (j <= size)
+			set->tree[j] += set->tree[i];
+	}
+}
+
+static void
+refset_changed(struct refset *set)
+{
+	if (set->text) {
+		free((void *) set->text);
+		set->text = NULL;
+	}
+}
+
+struct refset *
+refset_new(void)
+{
+	struct refset *set = (struct refset *) refset_alloc(1, sizeof(struct refset));
+
+	refset_rebuild(set, REFSET_MIN_SIZE);
+	return set;
+}
+
+void
+refset_free(struct refset *set)
+{
+	free((void *) set->order);
+	free((void *) set->tree);
+	free((void *) set->slots);
+	free((void *) set->text);
+	free((void *) set);
+}
+
+/* refset_find:  returns ref's position in the set, counting from 1,
+   or 0 if it isn't there. */
+int
+refset_find(const struct refset *set, dbref ref)
+{
+	unsigned int i = refset_probe(set, ref);
+
+	if (!set->slots[i])
+		return 0;
+	return refset_tree_count(set, set->slots[i] - 1);
+}
+
+/* refset_del:  takes ref out of the set.  Returns 1 if it was there. */
+int
+refset_del(struct refset *set, dbref ref)
+{
+	unsigned int i = refset_probe(set, ref);
+	unsigned int j, home;
+	int pos;
+
+	if (!set->slots[i])
+		return 0;
+	pos = set->slots[i] - 1;
+	set->order[pos] = REFSET_GONE;
+	refset_tree_add(set, pos, -1);
+	set->count--;
+
+	/* Shift back any entries that probed past the freed slot. */
+	for (j = (i + 1) & set->mask; set->slots[j]; j = (j + 1) & set->mask) {
+		home = refset_hashval(set->order[set->slots[j] - 1]) & set->mask;
+		if (((j - home) & set->mask) >= ((j - i) & set->mask)) {
+			set->slots[i] = set->slots[j];
+			i = j;
+		}
+	}
+	set->slots[i] = 0;
+
+	if (set->size > REFSET_MIN_SIZE && set->count * 4 < set->size)
+		refset_rebuild(set, set->size / 2);
+	refset_changed(set);
+	return 1;
+}
+
+/* refset_add:  puts ref at the end of the set, moving it there if it
+   was already in the set. */
+void
+refset_add(struct refset *set, dbref ref)
+{
+	if (ref == REFSET_GONE)
+		return;
+	if (set->count && set->order[set->used - 1] == ref)
+		return;
+	refset_del(set, ref);
+	if (set->used == set->size)
+		refset_rebuild(set, set->count * 2 < set->size ? set->size : set->size * 2);
+
+	set->order[set->used] = ref;
+	refset_tree_add(set, set->used, 1);
+	set->slots[refset_probe(set, ref)] = ++set->used;
+	set->count++;
+	refset_changed(set);
+}
+
+/* refset_walk:  steps through the refs in a set, in order.  Start with
+   *pos set to 0.  Returns 0 once there are no more. */
+int
+refset_walk(const struct refset *set, int *pos, dbref * ref)
+{
+	dbref item;
+
+	while (*pos < set->used) {
+		item = set->order[(*pos)++];
+		if (item != REFSET_GONE) {
+			*ref = item;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+struct refset *
+refset_copy(const struct refset *set)
+{
+	struct refset *nu = refset_new();
+	dbref ref;
+	int pos = 0;
+
+	while (refset_walk(set, &pos, &ref))
+		refset_add(nu, ref);
+	return nu;
+}
+
+/* refset_text:  returns the set as a reflist string, "#1 #2 #3", cut
+   off after as many refs as fit in BUFFER_LEN.  The string is kept until
+   the set next changes. */
+const char *
+refset_text(struct refset *set)
+{
+	char refbuf[16];
+	char *out;
+	dbref ref;
+	int pos = 0;
+	int len;
+
+	if (set->text)
+		return set->text;
+	len = set->count * 13 + 1;
+	out = set->text = (char *) refset_alloc(len < BUFFER_LEN ? len : BUFFER_LEN, 1);
+	while (refset_walk(set, &pos, &ref)) {
+		len = sprintf(refbuf, out == set->text ? "#%d" : " #%d", ref);
+		if (out + len >= set->text + BUFFER_LEN)
+			break;
+		strcpy(out, refbuf);
+		out += len;
+	}
+	*out = '\0';
+	return set->text;
+}
+
+/* refset_write:  writes the set out as a reflist string, starting at the
+   ref *pos is on and stopping before the line would reach BUFFER_LEN, as
+   refset_text() does.  Leaves *pos on the first ref it didn't write.
+   Returns 1 if there are more refs to write, 0 if there aren't, and EOF
+   if the write failed. */
+int
+refset_write(FILE * f, const struct refset *set, int *pos)
+{
+	char refbuf[16];
+	dbref ref;
+	int next = *pos;
+	int len = 0;
+	int reflen;
+
+	while (refset_walk(set, pos, &ref)) {
+		reflen = sprintf(refbuf, len ? " #%d" : "#%d", ref);
+		if (len && len + reflen >= BUFFER_LEN) {
+			*pos = next;
+			return 1;
+		}
+		if (fputs(refbuf, f) == EOF)
+			return EOF;
+		len += reflen;
+		next = *pos;
+	}
+	return 0;
+}
+
+/* refset_parse:  makes a set from a reflist string.  Returns NULL
+   unless the string is exactly what refset_write() would give for the
+   set, so that it reads back the same once it's been turned into one. */
+struct refset *
+refset_parse(const char *text)
+{
+	char refbuf[16];
+	struct refset *set;
+	const char *ptr = text;
+	dbref ref;
+	int len;
+
+	if (*ptr != NUMBER_TOKEN)
+		return NULL;
+	set = refset_new();
+	for (;;) {
+		ref = (dbref) atoi(ptr + 1);
+		len = sprintf(refbuf, "#%d", ref);
+		if (strncmp(ptr, refbuf, len) || refset_find(set, ref))
+			break;
+		refset_add(set, ref);
+		ptr += len;
+		if (*ptr != ' ' || ptr[1] != NUMBER_TOKEN)
+			break;
+		ptr++;
+	}
+	if (*ptr) {
+		refset_free(set);
+		return NULL;
+	}
+	return set;
+}
+
+long
+refset_size(const struct refset *set)
+{
+	long bytes = sizeof(struct refset);
+
+	bytes += set->size * (sizeof(dbref) + sizeof(int)) + sizeof(int);
+	bytes += (set->mask + 1) * sizeof(unsigned int);
+	if (set->text)
+		bytes += strlen(set->text) + 1;
+	return bytes;
+}
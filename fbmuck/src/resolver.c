@@ -28,7 +28,9 @@
 
 
 /* number of hostnames cached in an LRU queue */
+#ifndef HOST_CACHE_SIZE
 #define HOST_CACHE_SIZE 8192
+#endif
 
 /* Time before retrying to resolve a previously unresolved IP address. */
 /* 1800 seconds == 30 minutes */
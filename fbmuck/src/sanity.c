@@ -141,10 +141,39 @@ sane_dump_object(dbref player, const char *arg)
 }
 
 
+#ifdef INCREMENTAL_SANITY
+/*
+ * A wizard's @sanity runs as a scan that checks SANITY_SLICE_OBJECTS
+ * objects each time the main loop calls sanity_incremental().  Objects
+ * created after the scan started are left for the next one.  The
+ * orphan search at the end marks references with SANEBIT, so it must see
+ * the whole database at once.  It is done in a single slice, which is
+ * fine, since it only makes three passes over the db array.
+ */
+struct sanity_scan {
+	dbref player;				/* who started it */
+	dbref next;					/* next object to check */
+	dbref top;					/* db_top when it started */
+	int violations;				/* found so far */
+	time_t started;
+	time_t took;				/* how long it took, once done */
+};
+
+static struct sanity_scan *san_scan = NULL;
+static struct sanity_scan san_last;	/* last completed scan, for status */
+#endif /* INCREMENTAL_SANITY */
+
+
 void
 violate(dbref player, dbref i, const char *s)
 {
 	SanPrint(player, "Object \"%s\" %s!", unparse(i), s);
+#ifdef INCREMENTAL_SANITY
+	if (san_scan) {
+		log_sanity("Object \"%s\" %s!", unparse(i), s);
+		san_scan->violations++;
+	}
+#endif
 	sanity_violated = 1;
 }
 
@@ -537,6 +566,140 @@ sanity(dbref player)
 	SanPrint(player, "Done.");
 }
 
+
+#ifdef INCREMENTAL_SANITY
+
+int
+sanity_running(void)
+{
+	return san_scan != NULL;
+}
+
+
+static void
+sanity_finish(const char *how)
+{
+	san_last = *san_scan;
+	san_last.took = time(NULL) - san_scan->started;
+	log_sanity("Sanity check %s after %d of %d objects, with %d violation%s found.",
+			   how, san_scan->next, san_scan->top,
+			   san_scan->violations, (san_scan->violations == 1) ? "" : "s");
+	free(san_scan);
+	san_scan = NULL;
+}
+
+
+void
+sanity_incremental(void)
+{
+	int limit = SANITY_SLICE_OBJECTS;
+	dbref player;
+
+	if (!san_scan) {
+		return;
+	}
+	player = san_scan->player;
+	if (!valid_obj(player) || TYPEOF(player) != TYPE_PLAYER) {
+		sanity_finish("abandoned, as its player is gone,");
+		return;
+	}
+	if (san_scan->top > db_top) {
+		san_scan->top = db_top;
+	}
+
+	while (san_scan->next < san_scan->top && limit-- > 0) {
+		check_object(player, san_scan->next++);
+	}
+
+	if (san_scan->next >= san_scan->top) {
+		find_orphan_objects(player);
+		SanPrint(player, "Done.  %d violation%s found.  See logs/sanity for the list.",
+				 san_scan->violations, (san_scan->violations == 1) ? "" : "s");
+		sanity_finish("completed");
+	}
+}
+
+
+static void
+sanity_status(dbref player)
+{
+	time_t elapsed;
+	int pct;
+
+	if (!san_scan) {
+		if (!san_last.top) {
+			notify(player, "No sanity check is running.");
+		} else {
+			notify_fmt(player,
+					   "No sanity check is running.  The last one checked %d of %d objects in %ld seconds, and found %d violation%s.",
+					   san_last.next, san_last.top, (long) san_last.took, san_last.violations,
+					   (san_last.violations == 1) ? "" : "s");
+		}
+		return;
+	}
+
+	elapsed = time(NULL) - san_scan->started;
+	pct = san_scan->top ? (int) ((100.0 * san_scan->next) / san_scan->top) : 100;
+	notify_fmt(player, "Sanity check started by %s, %ld seconds ago.",
+			   unparse_object(player, san_scan->player), (long) elapsed);
+	notify_fmt(player, "  %d of %d objects checked (%d%%), %d violation%s so far.",
+			   san_scan->next, san_scan->top, pct,
+			   san_scan->violations, (san_scan->violations == 1) ? "" : "s");
+	if (san_scan->next > 0 && elapsed > 0) {
+		double eta = (double) elapsed * (san_scan->top - san_scan->next) / san_scan->next;
+
+		notify_fmt(player, "  About %.0f seconds to go.", eta);
+	} else {
+		notify(player, "  Too early to estimate how long it will take.");
+	}
+}
+#endif /* INCREMENTAL_SANITY */
+
+
+void
+do_sanity(dbref player, const char *arg)
+{
+#ifdef INCREMENTAL_SANITY
+#ifdef GOD_PRIV
+	if (!God(player)) {
+#else
+	if (!Wizard(player)) {
+#endif
+		notify(player, "Permission Denied.");
+		return;
+	}
+
+	if (!string_compare(arg, "status")) {
+		sanity_status(player);
+	} else if (!string_compare(arg, "stop")) {
+		if (!san_scan) {
+			notify(player, "No sanity check is running.");
+			return;
+		}
+		sanity_finish("stopped");
+		notify(player, "Sanity check stopped.");
+	} else if (*arg) {
+		notify(player, "Usage: @sanity [status|stop]");
+	} else if (san_scan) {
+		notify(player, "A sanity check is already running.  Use '@sanity status' to check on it.");
+	} else {
+		san_scan = (struct sanity_scan *) malloc(sizeof(struct sanity_scan));
+		san_scan->player = player;
+		san_scan->next = 0;
+		san_scan->top = db_top;
+		san_scan->violations = 0;
+		san_scan->started = time(NULL);
+		san_scan->took = 0;
+		sanity_violated = 0;
+		log_sanity("Sanity check of %d objects started by %s.", db_top, unparse(player));
+		notify_fmt(player, "Checking %d objects in the background.  Use '@sanity status' to check on it.",
+				   db_top);
+	}
+#else
+	sanity(player);
+#endif
+}
+
 #define SanFixed(ref, fixed) san_fixed_log((fixed), 1, (ref), -1)
 #define SanFixed2(ref, ref2, fixed) san_fixed_log((fixed), 1, (ref), (ref2))
 #define SanFixedRef(ref, fixed) san_fixed_log((fixed), 0, (ref), -1)
@@ -1008,6 +1171,15 @@ clean_global_environment(void)
 	}
 }
 
+static void
+sanfix_flush(dbref player)
+{
+	if (player > NOTHING) {
+		flush_user_output(player);
+	}
+}
+
+
 void
 sanfix(dbref player)
 {
@@ -1024,6 +1196,14 @@ sanfix(dbref player)
 		return;
 	}
 
+#ifdef INCREMENTAL_SANITY
+	if (san_scan) {
+		/* Its results are about to be out of date. */
+		sanity_finish("interrupted by @sanfix");
+		SanPrint(player, "Stopped the running sanity check.");
+	}
+#endif
+
 	sanity_violated = 0;
 
 	for (loop = 0; loop < db_top; loop++) {
@@ -1036,14 +1216,23 @@ sanfix(dbref player)
 		tp_player_start = GLOBAL_ENVIRONMENT;
 	}
 
+	SanPrint(player, "Cutting bad contents, exits and recyclable chains...");
+	sanfix_flush(player);
 	hacksaw_bad_chains();
+	SanPrint(player, "Checking %d objects for misplaced links...", db_top);
+	sanfix_flush(player);
 	find_misplaced_objects();
+	SanPrint(player, "Adopting orphan objects...");
+	sanfix_flush(player);
 	adopt_orphans();
+	SanPrint(player, "Cleaning up the global environment...");
+	sanfix_flush(player);
 	clean_global_environment();
 
 	for (loop = 0; loop < db_top; loop++) {
 		FLAGS(loop) &= ~SANEBIT;
 	}
+	objstats_rebuild();
 
 	if (player > NOTHING) {
 		if (!sanity_violated) {
@@ -1196,6 +1385,11 @@ extract_prop(FILE * f, const char *dir, PropPtr p)
 
 	if (PropType(p) == PROP_DIRTYP)
 		return;
+	if (PropType(p) == PROP_SETTYP) {
+		/* Sets can take up more than one line. */
+		db_putprop(f, dir, p);
+		return;
+	}
 
 	for (ptr = buf, ptr2 = dir + 1; *ptr2;)
 		*ptr++ = *ptr2++;
@@ -42,6 +42,9 @@ void set_signals(void);
 RETSIGTYPE bailout(int);
 RETSIGTYPE sig_dump_status(int i);
 RETSIGTYPE sig_shutdown(int i);
+#ifdef ASYNC_LOGGING
+RETSIGTYPE sig_reopen_logs(int i);
+#endif
 #ifdef SIGEMERG
 RETSIGTYPE sig_emerg(int i);
 #endif
@@ -144,8 +147,13 @@ set_sigs_intern(int bail)
 	/* we don't care about SIGPIPE, we notice it in select() and write() */
 	our_signal(SIGPIPE, SET_IGN);
 
+#ifdef ASYNC_LOGGING
+	/* reopen logfiles, so they can be rotated out from under us */
+	our_signal(SIGHUP, bail ? SIG_DFL : sig_reopen_logs);
+#else
 	/* didn't manage to lose that control tty, did we? Ignore it anyway. */
 	our_signal(SIGHUP, SET_IGN);
+#endif
 
 #ifdef SPAWN_HOST_RESOLVER
 	/* resolver's exited. Better clean up the mess our child leaves */
@@ -249,6 +257,19 @@ RETSIGTYPE sig_emerg(int i)
 }
 #endif
 
+#ifdef ASYNC_LOGGING
+/*
+ * Reopen the logfiles, after logrotate has moved them.
+ */
+RETSIGTYPE sig_reopen_logs(int i)
+{
+	reopen_logs();
+#if !defined(SYSV) && !defined(_POSIX_VERSION) && !defined(ULTRIX)
+	return 0;
+#endif
+}
+#endif
+
 /*
  * Gracefully shut the server down.
  */
@@ -132,10 +132,16 @@ do_page(dbref player, const char *arg1, const char *arg2)
 		notify_fmt(player, "You don't have enough %s.", tp_pennies);
 		return;
 	}
-	if ((target = lookup_player(arg1)) == NOTHING) {
+	if ((target = lookup_player(arg1)) == NOTHING && *arg1)
+		target = partial_pmatch(arg1);
+	if (target == NOTHING) {
 		notify(player, "I don't recognize that name.");
 		return;
 	}
+	if (target == AMBIGUOUS) {
+		notify(player, "I don't know which one you mean!");
+		return;
+	}
 	if (FLAGS(target) & HAVEN) {
 		notify(player, "That player does not wish to be disturbed.");
 		return;
@@ -372,7 +372,7 @@ pronoun_substitute(int descr, dbref player, const char *str)
 	return buf;
 }
 
-#ifndef MALLOC_PROFILING
+#ifndef CRT_MALLOC_WRAPPERS
 
 char *
 alloc_string(const char *string)
@@ -390,38 +390,190 @@ alloc_string(const char *string)
 	return s;
 }
 
+static void *
+prog_string_malloc(size_t size, const char *file, int line)
+{
+	return malloc(size);
+}
+
 struct shared_string *
 alloc_prog_string(const char *s)
+{
+	return new_prog_string(s, prog_string_malloc, __FILE__, __LINE__);
+}
+
+char *
+string_dup(const char *s)
+{
+	char *p;
+
+	p = (char *) malloc(1 + strlen(s));
+	if (p)
+		(void) strcpy(p, s);  /* Guaranteed enough space. */
+	return (p);
+}
+#endif
+
+#ifdef HEAP_SAMPLING
+
+/*
+ * With the heap sampler, strings are charged to the line that asked for
+ * them rather than to this file, and are tagged as strings.
+ */
+char *
+CrT_alloc_string(const char *string, const char *file, int line)
+{
+	char *s;
+
+	/* NULL, "" -> NULL */
+	if (!string || !*string)
+		return 0;
+
+	if ((s = (char *) CrT_malloc_tagged(strlen(string) + 1, file, line,
+										 CRT_TAG_STRINGS)) == 0) {
+		abort();
+	}
+	strcpy(s, string);  /* Guaranteed enough space. */
+	return s;
+}
+
+static void *
+prog_string_malloc_tagged(size_t size, const char *file, int line)
+{
+	return CrT_malloc_tagged(size, file, line, CRT_TAG_STRINGS);
+}
+
+struct shared_string *
+CrT_alloc_prog_string(const char *s, const char *file, int line)
+{
+	return new_prog_string(s, prog_string_malloc_tagged, file, line);
+}
+
+char *
+CrT_string_dup(const char *s, const char *file, int line)
+{
+	char *p;
+
+	p = (char *) CrT_malloc_tagged(1 + strlen(s), file, line, CRT_TAG_STRINGS);
+	if (p)
+		(void) strcpy(p, s);  /* Guaranteed enough space. */
+	return (p);
+}
+#endif							/* HEAP_SAMPLING */
+
+
+/*
+ * One character strings are handed out from a table rather than being
+ * allocated every time, since programs that walk a string a character
+ * at a time make a lot of them.  The table holds a link to each one, so
+ * they are never freed and never get grown in place by a strcat.
+ */
+static struct shared_string *prog_char_strings[256];
+
+struct shared_string *
+alloc_prog_char(int c)
+{
+	struct shared_string *ss;
+
+	c &= 0xff;
+	if (!c)
+		return NULL;
+	ss = prog_char_strings[c];
+	if (!ss) {
+		if ((ss = (struct shared_string *)
+			 malloc(sizeof(struct shared_string) + 1)) == NULL)
+			abort();
+		ss->links = 1;
+		ss->length = 1;
+		ss->capacity = 2;
+		ss->data[0] = (char) c;
+		ss->data[1] = '\0';
+		prog_char_strings[c] = ss;
+	}
+	ss->links++;
+	return ss;
+}
+
+
+/*
+ * Makes a prog string holding a copy of s, in memory from allocfn.
+ * file and line are handed on to allocfn, for the malloc wrappers to
+ * charge the string to.  Returns NULL for an empty string.
+ */
+struct shared_string *
+new_prog_string(const char *s, void *(*allocfn) (size_t, const char *, int),
+				const char *file, int line)
 {
 	struct shared_string *ss;
 	int length;
 
 	if (s == NULL || *s == '\0')
 		return (NULL);
+	if (s[1] == '\0')
+		return alloc_prog_char(*s);
 
 	length = strlen(s);
 	if ((ss = (struct shared_string *)
-		 malloc(sizeof(struct shared_string) + length)) == NULL)
+		 allocfn(sizeof(struct shared_string) + length, file, line)) == NULL)
 		abort();
 
 	ss->links = 1;
 	ss->length = length;
+	ss->capacity = length + 1;
 	bcopy(s, ss->data, ss->length + 1);
 	return (ss);
 }
 
 
-char *
-string_dup(const char *s)
+/*
+ * Appends len bytes of s to the prog string ss, taking over the caller's
+ * link to ss.  If nothing else links to ss, it is grown in place with
+ * room to spare, so building a string with repeated appends takes
+ * amortized constant time per append instead of copying the whole string
+ * each time.  A shared ss is copied first.  Returns the new string.
+ */
+struct shared_string *
+prog_string_append(struct shared_string *ss, const char *s, int len)
 {
-	char *p;
+	struct shared_string *nu;
+	int oldlen, length, capacity;
+
+	if (len <= 0)
+		return ss;
+	oldlen = ss ? ss->length : 0;
+	length = oldlen + len;
+	if (ss && ss->links == 1 && ss->capacity > length) {
+		bcopy(s, ss->data + oldlen, len);
+		ss->length = length;
+		ss->data[length] = '\0';
+		return ss;
+	}
 
-	p = (char *) malloc(1 + strlen(s));
-	if (p)
-		(void) strcpy(p, s);  /* Guaranteed enough space. */
-	return (p);
+	capacity = 2 * oldlen + 1;
+	if (capacity > BUFFER_LEN)
+		capacity = BUFFER_LEN;
+	if (capacity < length + 1)
+		capacity = length + 1;
+	if (ss && ss->links == 1) {
+		if ((nu = (struct shared_string *)
+			 realloc(ss, sizeof(struct shared_string) + capacity - 1)) == NULL)
+			abort();
+	} else {
+		if ((nu = (struct shared_string *)
+			 malloc(sizeof(struct shared_string) + capacity - 1)) == NULL)
+			abort();
+		nu->links = 1;
+		if (ss) {
+			bcopy(ss->data, nu->data, oldlen);
+			ss->links--;
+		}
+	}
+	nu->capacity = capacity;
+	bcopy(s, nu->data + oldlen, len);
+	nu->length = length;
+	nu->data[length] = '\0';
+	return nu;
 }
-#endif
 
 
 
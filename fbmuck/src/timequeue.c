@@ -28,6 +28,7 @@
 #define TQ_MUF_READ     0x3
 #define TQ_MUF_TREAD    0x4
 #define TQ_MUF_TIMER    0x5
+#define TQ_MUF_WORKER   0x6
 
 #define TQ_MPI_QUEUE    0x0
 #define TQ_MPI_DELAY    0x1
@@ -358,6 +359,22 @@ add_muf_timer_event(int descr, dbref player, dbref prog, struct frame *fr, int d
 					 prog, fr, buf, NULL, NULL);
 }
 
+/*
+ * A process waiting for a MUF worker isn't due until the worker is done,
+ * when timequeue_wake_worker() makes it due.  Until then, it's kept a day
+ * off, well out of the way.
+ */
+int
+add_muf_worker_event(int descr, dbref player, dbref prog, struct frame *fr)
+{
+	if (!fr) {
+		panic("add_muf_worker_event(): NULL frame passed !");
+	}
+
+	return add_event(TQ_MUF_TYP, TQ_MUF_WORKER, TIME_DAY(1), descr, player, -1, fr->trig,
+					 prog, fr, "WORKER", NULL, NULL);
+}
+
 int
 add_muf_delay_event(int delay, int descr, dbref player, dbref loc, dbref trig, dbref prog,
 					struct frame *fr, const char *mode)
@@ -492,8 +509,7 @@ handle_read_event(int descr, dbref player, const char *command)
 				return;
 			}
 
-			if ((fr->argument.top >= STACK_SIZE) ||
-				(nothing_flag && fr->argument.top >= STACK_SIZE - 1)) {
+			if (argstack_reserve(fr, fr->argument.top + ((typ == TQ_MUF_TREAD) ? 2 : 1)) < 0) {
 
 				/*
 				 * Uh oh! That MUF program's stack is full!
@@ -552,6 +568,92 @@ handle_read_event(int descr, dbref player, const char *command)
 }
 
 
+/* Who a timequeue entry's CPU time is charged to, or NOTHING if no one. */
+static dbref
+timenode_owner(timequeue ptr)
+{
+	if (ptr->typ == TQ_MPI_TYP)
+		return valid_objref(ptr->trig) ? OWNER(ptr->trig) : NOTHING;
+	if (ptr->subtyp == TQ_MUF_READ || ptr->subtyp == TQ_MUF_TREAD ||
+			ptr->subtyp == TQ_MUF_TIMER)
+		return NOTHING;
+	if (!valid_objref(ptr->called_prog) || Typeof(ptr->called_prog) != TYPE_PROGRAM)
+		return NOTHING;
+	return OWNER(ptr->called_prog);
+}
+
+
+/* Moves the entry at the head of the timequeue back down it, to run at when. */
+static void
+requeue_timenode(time_t when)
+{
+	timequeue event = tqhead;
+	timequeue ptr;
+
+	tqhead = event->next;
+	event->when = when;
+	if (!tqhead || event->when < tqhead->when ||
+			(tqhead->typ == TQ_MUF_TYP && tqhead->subtyp == TQ_MUF_READ)) {
+		event->next = tqhead;
+		tqhead = event;
+		return;
+	}
+	ptr = tqhead;
+	while (ptr->next && event->when >= ptr->next->when &&
+		   !(ptr->next->typ == TQ_MUF_TYP &&
+			 ptr->next->subtyp == TQ_MUF_READ)) {
+		ptr = ptr->next;
+	}
+	event->next = ptr->next;
+	ptr->next = event;
+}
+
+
+/*
+ * If the owner of the entry at the head of the timequeue is over their
+ * CPU budget, moves the entry back down the queue to run later, and
+ * returns true.
+ */
+static int
+defer_timenode(time_t rtime)
+{
+	dbref owner = timenode_owner(tqhead);
+	int delay;
+
+	if (owner == NOTHING || !(delay = cpuacct_throttle_delay(owner)))
+		return 0;
+	requeue_timenode(rtime + delay);
+	return 1;
+}
+
+
+/*
+ * Makes the process pid, which was waiting for a MUF worker, due to run
+ * now.  Returns its frame, or NULL if it's no longer waiting.
+ */
+struct frame *
+timequeue_wake_worker(int pid)
+{
+	timequeue ptr, prev = NULL;
+
+	for (ptr = tqhead; ptr; prev = ptr, ptr = ptr->next) {
+		if (ptr->eventnum == pid && ptr->typ == TQ_MUF_TYP &&
+				ptr->subtyp == TQ_MUF_WORKER)
+			break;
+	}
+	if (!ptr)
+		return NULL;
+	if (prev) {
+		prev->next = ptr->next;
+		ptr->next = tqhead;
+		tqhead = ptr;
+	}
+	ptr->subtyp = TQ_MUF_DELAY;
+	requeue_timenode(time(NULL));
+	return ptr->fr;
+}
+
+
 void
 next_timequeue_event(void)
 {
@@ -570,10 +672,17 @@ next_timequeue_event(void)
 		maxruns++;
 	}
 
-	while (tqhead && (tqhead != lastevent) && (maxruns--)) {
+	while (tqhead && (tqhead != lastevent) && rtime >= tqhead->when && (maxruns--)) {
 		if (tqhead->typ == TQ_MUF_TYP && tqhead->subtyp == TQ_MUF_READ) {
 			break;
 		}
+		if (tqhead->typ == TQ_MUF_TYP && tqhead->subtyp == TQ_MUF_WORKER) {
+			requeue_timenode(rtime + TIME_DAY(1));
+			continue;
+		}
+		if (defer_timenode(rtime)) {
+			continue;
+		}
 		event = tqhead;
 		tqhead = tqhead->next;
 		process_count--;
@@ -813,7 +922,8 @@ list_events(dbref player)
 		}
 
 		/* Now, the next due is based on if it's waiting on a READ */
-		if (ptr->typ == TQ_MUF_TYP && ptr->subtyp == TQ_MUF_READ) {
+		if (ptr->typ == TQ_MUF_TYP && (ptr->subtyp == TQ_MUF_READ ||
+									   ptr->subtyp == TQ_MUF_WORKER)) {
 			strcpyn(duestr, sizeof(duestr), "--");
 		} else if (ptr->typ == TQ_MUF_TYP && ptr->subtyp == TQ_MUF_TIMER) {
 			/* if it's a timer event, it gives the eventnum */
@@ -990,6 +1100,7 @@ get_pidinfo(int pid)
 							(ptr->subtyp == TQ_MUF_LISTEN) ? alloc_prog_string("LISTEN") :
 							(ptr->subtyp == TQ_MUF_TIMER) ? alloc_prog_string("TIMER") :
 							(ptr->subtyp == TQ_MUF_DELAY) ? alloc_prog_string("DELAY") :
+							(ptr->subtyp == TQ_MUF_WORKER) ? alloc_prog_string("WORKER") :
 							alloc_prog_string("");
 		} else if (ptr->typ == TQ_MPI_TYP) {
 			int subtyp = (ptr->subtyp & TQ_MPI_SUBMASK);
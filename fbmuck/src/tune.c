@@ -39,6 +39,7 @@ const char *tp_ssl_cipher_preference_list = SSL_CIPHER_PREFERENCE_LIST;
 const char *tp_pcreate_flags = PCREATE_FLAGS;
 const char *tp_reserved_names = RESERVED_NAMES;
 const char *tp_reserved_player_names = RESERVED_PLAYER_NAMES;
+const char *tp_metrics_file = METRICS_FILE;
 
 struct tune_str_entry {
 	const char *group;
@@ -66,6 +67,7 @@ struct tune_str_entry tune_str_list[] = {
 	{"Properties", "proplist_counter_fmt", &tp_proplist_counter_fmt, 0, 1, "Proplist counter name format"},
 	{"Properties", "proplist_entry_fmt", &tp_proplist_entry_fmt, 0, 1, "Proplist entry name format"},
 	{"Registration", "register_mesg", &tp_register_mesg, 0, 1, "Login registration mesg"},
+	{"Metrics",    "metrics_file", &tp_metrics_file, MLEV_GOD, 1, "File to rewrite with main loop metrics"},
 	{"Misc",       "muckname", &tp_muckname, 0, 1, "Muck name"},
 	{"Misc",       "leave_mesg", &tp_leave_mesg, 0, 1, "Logoff message"},
 	{"Misc",       "huh_mesg", &tp_huh_mesg, 0, 1, "Command unrecognized warning"},
@@ -89,6 +91,8 @@ int tp_clean_interval = CLEAN_INTERVAL;
 int tp_aging_time = AGING_TIME;
 int tp_maxidle = MAXIDLE;
 int tp_idle_ping_time = IDLE_PING_TIME;
+int tp_metrics_interval = METRICS_INTERVAL;
+int tp_cpu_window = CPU_WINDOW;
 
 
 struct tune_time_entry {
@@ -106,6 +110,8 @@ struct tune_time_entry tune_time_list[] = {
 	{"DB Dumps",  "monolithic_interval", &tp_monolithic_interval, 0, "Interval between full dumps"},
 	{"Idle Boot", "maxidle", &tp_maxidle, 0, "Maximum idle time before booting"},
 	{"Idle Boot", "idle_ping_time", &tp_idle_ping_time, 0, "Server side keepalive time in seconds"},
+	{"Metrics",   "metrics_interval", &tp_metrics_interval, 0, "Interval between metrics file rewrites"},
+	{"MUF",       "cpu_window", &tp_cpu_window, 0, "Span of time an owner's CPU budget covers"},
 	{"Tuning",    "clean_interval", &tp_clean_interval, 0, "Interval between memory cleanups."},
 
 	{NULL, NULL, NULL, 0}
@@ -141,6 +147,8 @@ int tp_max_plyr_processes = MAX_PLYR_PROCESSES;
 int tp_max_instr_count = MAX_INSTR_COUNT;
 int tp_max_ml4_preempt_count = MAX_ML4_PREEMPT_COUNT;
 int tp_instr_slice = INSTR_SLICE;
+int tp_slice_msec = SLICE_MSEC;
+int tp_max_preempt_msec = MAX_PREEMPT_MSEC;
 int tp_mpi_max_commands = MPI_MAX_COMMANDS;
 int tp_pause_min = PAUSE_MIN;
 int tp_free_frames_pool = FREE_FRAMES_POOL;
@@ -149,6 +157,9 @@ int tp_playermax_limit = PLAYERMAX_LIMIT;
 int tp_process_timer_limit = PROCESS_TIMER_LIMIT;
 int tp_cmd_log_threshold_msec = CMD_LOG_THRESHOLD_MSEC;
 int tp_userlog_mlev = USERLOG_MLEV;
+int tp_metrics_port = METRICS_PORT;
+int tp_heap_sample_bytes = HEAP_SAMPLE_BYTES;
+int tp_cpu_budget_percent = CPU_BUDGET_PERCENT;
 
 int tp_mcp_muf_mlev = MCP_MUF_MLEV;
 
@@ -179,13 +190,18 @@ struct tune_val_entry tune_val_list[] = {
 	{"Killing",     "kill_bonus", &tp_kill_bonus, 0, "Bonus to killed player"},
 	{"Listeners",   "listen_mlev", &tp_listen_mlev, 0, "Mucker Level required for Listener progs"},
 	{"Logging",     "cmd_log_threshold_msec", &tp_cmd_log_threshold_msec, 0, "Log commands that take longer than X millisecs"},
+	{"Metrics",     "metrics_port", &tp_metrics_port, MLEV_GOD, "Localhost port to serve metrics on (0 = none)"},
+	{"Metrics",     "heap_sample_bytes", &tp_heap_sample_bytes, MLEV_GOD, "Mean bytes allocated between heap samples (0 = off)"},
 	{"Misc",        "max_force_level", &tp_max_force_level, MLEV_GOD, "Maximum number of forces processed within a command"},
 	{"MUF",         "max_process_limit", &tp_max_process_limit, 0, "Max concurrent processes on system"},
 	{"MUF",         "max_plyr_processes", &tp_max_plyr_processes, 0, "Max concurrent processes per player"},
 	{"MUF",         "max_instr_count", &tp_max_instr_count, 0, "Max MUF instruction run length for ML1"},
 	{"MUF",         "max_ml4_preempt_count", &tp_max_ml4_preempt_count, 0, "Max MUF preempt instruction run length for ML4, (0 = no limit)"},
 	{"MUF",         "instr_slice", &tp_instr_slice, 0, "Instructions run per timeslice"},
+	{"MUF",         "slice_msec", &tp_slice_msec, 0, "Max millisecs run per timeslice (0 = no limit)"},
+	{"MUF",         "max_preempt_msec", &tp_max_preempt_msec, 0, "Max millisecs a preempt program may run (0 = no limit)"},
 	{"MUF",         "process_timer_limit", &tp_process_timer_limit, 0, "Max timers per process"},
+	{"MUF",         "cpu_budget_percent", &tp_cpu_budget_percent, 0, "Percent of cpu_window an owner's programs may use (0 = no limit)"},
 	{"MUF",         "mcp_muf_mlev", &tp_mcp_muf_mlev, 0, "Mucker Level required to use MCP"},
 	{"MUF",		"userlog_mlev", &tp_userlog_mlev, 0, "Mucker Level required to write to userlog"},
 	{"MUF",         "movepennies_muf_mlev", &tp_movepennies_muf_mlev, 0, "Mucker Level required to move pennies non-destructively"},
@@ -194,12 +194,12 @@ do_teleport(int descr, dbref player, const char *arg1, const char *arg2)
 int
 blessprops_wildcard(dbref player, dbref thing, const char *dir, const char *wild, int blessp)
 {
-	char propname[BUFFER_LEN];
 	char wld[BUFFER_LEN];
 	char buf[BUFFER_LEN];
 	char buf2[BUFFER_LEN];
 	char *ptr, *wldcrd = wld;
-	PropPtr propadr, pptr;
+	PropCursor cursor;
+	PropPtr propadr;
 	int i, cnt = 0;
 	int recurse = 0;
 
@@ -222,10 +222,10 @@ blessprops_wildcard(dbref player, dbref thing, const char *dir, const char *wild
 	if (*ptr)
 		*ptr++ = '\0';
 
-	propadr = first_prop(thing, (char *) dir, &pptr, propname, sizeof(propname));
+	propadr = propcursor_first(&cursor, thing, dir);
 	while (propadr) {
-		if (equalstr(wldcrd, propname)) {
-			snprintf(buf, sizeof(buf), "%s%c%s", dir, PROPDIR_DELIMITER, propname);
+		if (equalstr(wldcrd, cursor.name)) {
+			snprintf(buf, sizeof(buf), "%s%c%s", dir, PROPDIR_DELIMITER, cursor.name);
 			if (!Prop_System(buf) && ((!Prop_Hidden(buf) && !(PropFlags(propadr) & PROP_SYSPERMS))
 				|| Wizard(OWNER(player)))) {
 				if (!*ptr || recurse) {
@@ -244,7 +244,7 @@ blessprops_wildcard(dbref player, dbref thing, const char *dir, const char *wild
 				cnt += blessprops_wildcard(player, thing, buf, ptr, blessp);
 			}
 		}
-		propadr = next_prop(pptr, propadr, propname, sizeof(propname));
+		propadr = propcursor_next(&cursor);
 	}
 	return cnt;
 }
@@ -442,29 +442,15 @@ do_force(int descr, dbref player, const char *what, char *command)
 void
 do_stats(dbref player, const char *name)
 {
-	int rooms;
-	int exits;
-	int things;
-	int players;
-	int programs;
-	int garbage = 0;
+	struct objstats st;
 	int total;
-	int altered = 0;
-	int oldobjs = 0;
-#ifdef DISKBASE
-	int loaded = 0;
-	int changed = 0;
-#endif
-	time_t currtime = time(NULL);
-	dbref i;
-	dbref owner=NOTHING;
+	dbref owner = NOTHING;
 	char buf[BUFFER_LEN];
 
 	if (!Wizard(OWNER(player)) && (!name || !*name)) {
 		snprintf(buf, sizeof(buf), "The universe contains %d objects.", db_top);
 		notify(player, buf);
 	} else {
-		total = rooms = exits = things = players = programs = 0;
 		if (name != NULL && *name != '\0') {
 			owner = lookup_player(name);
 			if (owner == NOTHING) {
@@ -475,115 +461,29 @@ do_stats(dbref player, const char *name)
 				notify(player, "Permission denied. (you must be a wizard to get someone else's stats)");
 				return;
 			}
-			for (i = 0; i < db_top; i++) {
-
-#ifdef DISKBASE
-				if ((OWNER(i) == owner) && DBFETCH(i)->propsmode != PROPS_UNLOADED)
-					loaded++;
-				if ((OWNER(i) == owner) && DBFETCH(i)->propsmode == PROPS_CHANGED)
-					changed++;
-#endif
-
-				/* count objects marked as changed. */
-				if ((OWNER(i) == owner) && (FLAGS(i) & OBJECT_CHANGED))
-					altered++;
-
-				/* if unused for 90 days, inc oldobj count */
-				if ((OWNER(i) == owner) &&
-					(currtime - DBFETCH(i)->ts.lastused) > tp_aging_time) oldobjs++;
-
-				switch (Typeof(i)) {
-				case TYPE_ROOM:
-					if (OWNER(i) == owner)
-						total++, rooms++;
-					break;
-
-				case TYPE_EXIT:
-					if (OWNER(i) == owner)
-						total++, exits++;
-					break;
-
-				case TYPE_THING:
-					if (OWNER(i) == owner)
-						total++, things++;
-					break;
-
-				case TYPE_PLAYER:
-					if (i == owner)
-						total++, players++;
-					break;
-
-				case TYPE_PROGRAM:
-					if (OWNER(i) == owner)
-						total++, programs++;
-					break;
-
-				}
-			}
-		} else {
-			for (i = 0; i < db_top; i++) {
-
-#ifdef DISKBASE
-				if (DBFETCH(i)->propsmode != PROPS_UNLOADED)
-					loaded++;
-				if (DBFETCH(i)->propsmode == PROPS_CHANGED)
-					changed++;
-#endif
-
-				/* count objects marked as changed. */
-				if (FLAGS(i) & OBJECT_CHANGED)
-					altered++;
-
-				/* if unused for 90 days, inc oldobj count */
-				if ((currtime - DBFETCH(i)->ts.lastused) > tp_aging_time)
-					oldobjs++;
-
-				switch (Typeof(i)) {
-				case TYPE_ROOM:
-					total++;
-					rooms++;
-					break;
-				case TYPE_EXIT:
-					total++;
-					exits++;
-					break;
-				case TYPE_THING:
-					total++;
-					things++;
-					break;
-				case TYPE_PLAYER:
-					total++;
-					players++;
-					break;
-				case TYPE_PROGRAM:
-					total++;
-					programs++;
-					break;
-				case TYPE_GARBAGE:
-					total++;
-					garbage++;
-					break;
-				}
-			}
 		}
+		objstats_get(owner, &st);
+		if (owner != NOTHING)
+			st.garbage = 0;		/* No one owns garbage. */
+		total = st.rooms + st.exits + st.things + st.players + st.programs + st.garbage;
 
 		notify_fmt(player, "%7d room%s        %7d exit%s        %7d thing%s",
-				   rooms, (rooms == 1) ? " " : "s",
-				   exits, (exits == 1) ? " " : "s", things, (things == 1) ? " " : "s");
+				   st.rooms, (st.rooms == 1) ? " " : "s",
+				   st.exits, (st.exits == 1) ? " " : "s", st.things, (st.things == 1) ? " " : "s");
 
 		notify_fmt(player, "%7d program%s     %7d player%s      %7d garbage",
-				   programs, (programs == 1) ? " " : "s",
-				   players, (players == 1) ? " " : "s", garbage);
+				   st.programs, (st.programs == 1) ? " " : "s",
+				   st.players, (st.players == 1) ? " " : "s", st.garbage);
 
 		notify_fmt(player,
 				   "%7d total object%s                     %7d old & unused",
-				   total, (total == 1) ? " " : "s", oldobjs);
+				   total, (total == 1) ? " " : "s", st.old);
 
 #ifdef DISKBASE
 		if (Wizard(OWNER(player))) {
 			notify_fmt(player,
 					   "%7d proploaded object%s                %7d propchanged object%s",
-					   loaded, (loaded == 1) ? " " : "s", changed, (changed == 1) ? "" : "s");
+					   st.loaded, (st.loaded == 1) ? " " : "s", st.changed, (st.changed == 1) ? "" : "s");
 
 		}
 #endif
@@ -601,7 +501,7 @@ do_stats(dbref player, const char *name)
 #endif
 			(void) format_time(buf, 40, "%a %b %e %T %Z", time_tm);
 			notify_fmt(player, "%7d unsaved object%s     Last dump: %s",
-					   altered, (altered == 1) ? "" : "s", buf);
+					   st.altered, (st.altered == 1) ? "" : "s", buf);
 		}
 #endif
 
@@ -879,6 +779,25 @@ do_usage(dbref player)
 	notify_fmt(player, "Compiled on: %s", UNAME_VALUE);
 	notify_fmt(player, "Process ID: %d", pid);
 	notify_fmt(player, "Max descriptors/process: %ld", max_open_files());
+#ifdef ASYNC_LOGGING
+	{
+		unsigned long queued, dropped, pending;
+
+		log_writer_stats(&queued, &dropped, &pending);
+		notify_fmt(player, "Log lines queued: %lu, dropped: %lu (%lu bytes pending)",
+				   queued, dropped, pending);
+	}
+#endif
+#ifdef ASYNC_HOST_RESOLVER
+	{
+		int dns_pending, ident_pending, cached;
+		unsigned long hits, misses;
+
+		resolver_stats(&dns_pending, &ident_pending, &cached, &hits, &misses);
+		notify_fmt(player, "Host lookups pending: %d DNS, %d ident.  Cache: %d hosts, %lu hits, %lu misses.",
+				   dns_pending, ident_pending, cached, hits, misses);
+	}
+#endif
 #ifdef HAVE_GETRUSAGE
 	notify_fmt(player, "Performed %d input servicings.", usage.ru_inblock);
 	notify_fmt(player, "Performed %d output servicings.", usage.ru_oublock);
@@ -1302,12 +1221,16 @@ do_all_topprofs(dbref player, char *arg1)
 
 
 void
-do_memory(dbref who)
+do_memory(dbref who, const char *arg)
 {
 	if (!Wizard(OWNER(who))) {
 		notify(who, "Permission denied. (You don't need to know the memory stats)");
 		return;
 	}
+	if (string_prefix(arg, "profile") && (!arg[7] || isspace(arg[7]))) {
+		do_heap_profile(who, arg + 7);
+		return;
+	}
 #ifndef NO_MEMORY_COMMAND
 # ifdef HAVE_MALLINFO
 	{
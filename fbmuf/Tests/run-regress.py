@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+#
+# Runs the MUF regression tests against a scratch copy of the base db.
+#
+# Usage: run-regress.py path/to/fbmuck [port]
+#
+# The tests in this directory are loaded as programs and run with the
+# regress command from cmd-regress.muf.  The server is then shut down,
+# which dumps the db, and started again on the dump, and the tests are
+# run a second time, so that tests like test-reflist_dump can check what
+# they left behind after a dump and reload.  Exits 1 if any test failed
+# on either pass.
+#
+
+import glob
+import os
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+TESTS = os.path.dirname(os.path.abspath(__file__))
+FBMUCK = os.path.join(TESTS, '..', '..', 'fbmuck')
+WIZARD = 'connect One potrzebie'
+
+
+class Connection:
+    def __init__(self, port):
+        for tries in range(50):
+            try:
+                self.sock = socket.create_connection(('127.0.0.1', port))
+                break
+            except OSError:
+                time.sleep(0.2)
+        else:
+            sys.exit('Could not connect to the server on port %d.' % port)
+        self.text = ''
+
+    def send(self, text):
+        self.sock.sendall(text.replace('\n', '\r\n').encode('latin1'))
+
+    def wait_for(self, marker, timeout=120):
+        """Reads until marker turns up, and returns what came before it."""
+        deadline = time.time() + timeout
+        while marker not in self.text:
+            self.sock.settimeout(max(deadline - time.time(), 0.01))
+            try:
+                data = self.sock.recv(65536)
+            except socket.timeout:
+                sys.exit('Timed out waiting for %r.' % marker)
+            if not data:
+                sys.exit('Server closed the connection.')
+            self.text += data.decode('latin1')
+        before, self.text = self.text.split(marker, 1)
+        return before
+
+
+def start_server(fbmuck, gamedir, dbin, port):
+    subprocess.check_call([fbmuck, '-gamedir', gamedir, dbin, 'data/out.db', str(port)])
+    conn = Connection(port)
+    conn.send(WIZARD + '\n')
+    conn.send('@tune command_burst_size=100000\n')
+    conn.send('@tune commands_per_time=100000\n')
+    conn.send('@tune command_time_msec=1\n')
+    return conn
+
+
+def run_regress(conn):
+    conn.send('regress\n')
+    output = conn.wait_for('Regression tests complete.')
+    lines = [line for line in output.splitlines()
+             if line.startswith('Success - ') or line.startswith('FAILURE - ')]
+    lines.append('Regression tests complete.' + conn.wait_for('\n').rstrip())
+    return '\n'.join(lines)
+
+
+def stop_server(conn, gamedir):
+    pidfile = os.path.join(gamedir, 'netmuck.pid')
+    pid = int(open(pidfile).read().split()[0])
+    conn.send('@shutdown\n')
+    for tries in range(300):
+        try:
+            os.kill(pid, 0)
+        except OSError:
+            return
+        time.sleep(0.2)
+    sys.exit('Server did not shut down.')
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit('Usage: %s path/to/fbmuck [port]' % sys.argv[0])
+    fbmuck = os.path.abspath(sys.argv[1])
+    port = int(sys.argv[2]) if len(sys.argv) > 2 else 4466
+
+    gamedir = tempfile.mkdtemp(prefix='fbregress.')
+    shutil.rmtree(gamedir)
+    shutil.copytree(os.path.join(FBMUCK, 'game'), gamedir)
+    shutil.rmtree(os.path.join(gamedir, 'muf'))
+    shutil.copytree(os.path.join(FBMUCK, 'dbs', 'basedb', 'muf'), os.path.join(gamedir, 'muf'))
+    shutil.copy(os.path.join(FBMUCK, 'dbs', 'basedb', 'data', 'base.db'),
+                os.path.join(gamedir, 'data', 'in.db'))
+
+    conn = start_server(fbmuck, gamedir, 'data/in.db', port)
+    conn.send('@set me=M3\n')
+    programs = [os.path.join(TESTS, 'cmd-regress.muf')]
+    programs += sorted(glob.glob(os.path.join(TESTS, 'test-*.muf')))
+    for path in programs:
+        name = os.path.basename(path)[:-4]
+        conn.send(open(path, encoding='latin1').read() + '\n')
+        conn.wait_for('Editor exited.')
+        conn.send('@set %s=W\n' % name)
+    conn.send('@action regress=me\n@link regress=cmd-regress\n')
+
+    results = run_regress(conn)
+    stop_server(conn, gamedir)
+    shutil.copy(os.path.join(gamedir, 'data', 'out.db'), os.path.join(gamedir, 'data', 'dumped.db'))
+    conn = start_server(fbmuck, gamedir, 'data/dumped.db', port)
+    reloaded = run_regress(conn)
+    stop_server(conn, gamedir)
+
+    print(results)
+    print('After a dump and reload:')
+    print(reloaded)
+    if 'FAILURE' in results or 'FAILURE' in reloaded:
+        print('Logs and dumps are in %s.' % gamedir)
+        sys.exit(1)
+    shutil.rmtree(gamedir)
+
+
+if __name__ == '__main__':
+    main()